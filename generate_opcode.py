@@ -4,6 +4,7 @@
 # SPDX-License-Identifier: MIT
 #
 
+import re
 import sys
 
 
@@ -23,6 +24,43 @@ class Opcode:
                 name += '_' + arg
         return name
 
+    def get_operands(self):
+        operands = [parse_operand(arg) for arg in self.args if len(arg) > 0]
+        if None in operands:
+            return None
+
+        # MOV direct, direct: The source address is encoded first
+        direct = [o for o in operands if isinstance(o, Direct)]
+        if len(direct) == 2:
+            direct[0].var = 'direct_dst'
+            direct[1].var = 'direct_src'
+
+        return operands
+
+    def get_template_implementation(self):
+        template = instruction_templates.get(self.mnemonic)
+        operands = self.get_operands()
+        if template is None or operands is None:
+            return None
+
+        fetch = [o.fetch() for o in operands if o.fetch() is not None]
+        if len(fetch) == 2 and 'direct_src' in fetch[1]:
+            fetch.reverse()
+
+        try:
+            body = template(*operands)
+        except (NotImplementedError, TypeError):
+            return None
+
+        impl = 'IMPL(%s)\n{\n' % self.get_actor_function_name()
+        for line in fetch:
+            impl += '    %s\n' % line
+        if len(fetch) > 0:
+            impl += '\n'
+        for line in body:
+            impl += '    %s\n' % line
+        return impl + '}'
+
     def get_actor_signature(self):
         return 'void %s(mcs51_t*);' % self.get_actor_function_name()
 
@@ -49,6 +87,163 @@ class Opcode:
         return initializer
 
 
+class Operand:
+    """
+    Operand class of an instruction template (A, Rn, @Ri, direct, #immed, bit, /bit, C, offset).
+    An operand knows how to pop itself from the code memory, and how to read and write its value.
+    """
+
+    def __init__(self, var=''):
+        self.var = var
+
+    def fetch(self):
+        return None
+
+    def read(self):
+        raise NotImplementedError()
+
+    def write(self, value):
+        raise NotImplementedError()
+
+
+class Accumulator(Operand):
+    def read(self):
+        return 'ACC'
+
+    def write(self, value):
+        return 'ACC = %s;' % value
+
+
+class Register(Operand):
+    def __init__(self, n):
+        super().__init__()
+        self.n = n
+
+    def read(self):
+        return 'R%d' % self.n
+
+    def write(self, value):
+        return 'R%d = %s;' % (self.n, value)
+
+
+class Indirect(Operand):
+    def __init__(self, n):
+        super().__init__()
+        self.n = n
+
+    def read(self):
+        return 'read_indirect(p, R%d)' % self.n
+
+    def write(self, value):
+        return 'write_indirect(p, R%d, %s);' % (self.n, value)
+
+
+class Direct(Operand):
+    def fetch(self):
+        return 'uint8_t %s = pop_pc_u8(p);' % self.var
+
+    def read(self):
+        return 'read_direct(p, %s)' % self.var
+
+    def write(self, value):
+        return 'write_direct(p, %s, %s);' % (self.var, value)
+
+
+class Immediate(Operand):
+    def fetch(self):
+        return 'uint8_t %s = pop_pc_u8(p);' % self.var
+
+    def read(self):
+        return self.var
+
+
+class Carry(Operand):
+    def read(self):
+        return 'GET_C()'
+
+    def write(self, value):
+        return 'PUT_C(%s);' % value
+
+
+class Bit(Operand):
+    def __init__(self, var, negated=False):
+        super().__init__(var)
+        self.negated = negated
+
+    def fetch(self):
+        return 'uint8_t %s = pop_pc_u8(p);' % self.var
+
+    def read(self):
+        return '%sread_bit(p, %s)' % ('!' if self.negated else '', self.var)
+
+    def write(self, value):
+        return 'write_bit(p, %s, %s);' % (self.var, value)
+
+
+class Offset(Operand):
+    def fetch(self):
+        return 'int8_t %s = pop_pc_s8(p);' % self.var
+
+
+def parse_operand(arg):
+    if arg == 'A':
+        return Accumulator()
+    if re.fullmatch(r'R[0-7]', arg):
+        return Register(int(arg[1]))
+    if re.fullmatch(r'@R[01]', arg):
+        return Indirect(int(arg[2]))
+    if arg == 'direct':
+        return Direct('direct')
+    if arg == '#immed':
+        return Immediate('immed')
+    if arg == 'C':
+        return Carry()
+    if arg == 'bit':
+        return Bit('bit')
+    if arg == '/bit':
+        return Bit('bit', negated=True)
+    if arg == 'offset':
+        return Offset('offset')
+    return None
+
+
+def jump_if(condition):
+    return ['jump_relative_if(p, %s, offset);' % condition]
+
+
+def logic(operator):
+    return lambda d, s: [d.write('%s %s %s' % (d.read(), operator, s.read()))]
+
+
+def complement(d):
+    if isinstance(d, Accumulator):
+        return [d.write('~%s' % d.read())]
+    return [d.write('!%s' % d.read())]
+
+
+# Semantics of the instruction families, composed from the operand classes
+instruction_templates = {
+    'ADD': lambda d, s: [d.write('alu_add(p, %s, %s, 0)' % (d.read(), s.read()))],
+    'ADDC': lambda d, s: [d.write('alu_add(p, %s, %s, GET_C())' % (d.read(), s.read()))],
+    'SUBB': lambda d, s: [d.write('alu_sub(p, %s, %s, GET_C())' % (d.read(), s.read()))],
+    'ANL': logic('&'),
+    'ORL': logic('|'),
+    'XRL': logic('^'),
+    'MOV': lambda d, s: [d.write(s.read())],
+    'INC': lambda d: [d.write('%s + 1' % d.read())],
+    'DEC': lambda d: [d.write('%s - 1' % d.read())],
+    'XCH': lambda d, s: ['uint8_t tmp = %s;' % s.read(), s.write(d.read()), d.write('tmp')],
+    'CJNE': lambda d, s, o: ['uint8_t a = %s;' % d.read(), 'uint8_t b = %s;' % s.read()] + jump_if('a != b') + ['PUT_C(a < b);'],
+    'DJNZ': lambda d, o: ['uint8_t value = %s - 1;' % d.read(), d.write('value')] + jump_if('value != 0'),
+    'SETB': lambda d: [d.write('1')],
+    'CLR': lambda d: [d.write('0')],
+    'CPL': complement,
+    'JB': lambda b, o: jump_if(b.read()),
+    'JNB': lambda b, o: jump_if('!%s' % b.read()),
+    'JBC': lambda b, o: ['bool set = %s;' % b.read(), 'if (set)', '    ' + b.write('0')] + jump_if('set'),
+}
+
+
 opcode_dict = {}
 with open(sys.argv[1], 'r') as file:
     line_no = 0
@@ -144,6 +339,30 @@ with open('opcode_impl_gen.h', 'w') as out:
     for k, opcode in signature_opcode_map.items():
         print(opcode.get_actor_signature(), file=out)
 
+# Hand-written actors (IMPL(name) in opcode_impl.c)
+handwritten_actors = set()
+with open(sys.argv[2], 'r') as file:
+    handwritten_actors = set(re.findall(r'^IMPL\((\w+)\)', file.read(), re.MULTILINE))
+
+# Actors generated from the instruction templates, unless implemented by hand
+template_actors = {}
+for k, opcode in signature_opcode_map.items():
+    name = opcode.get_actor_function_name()
+    if name in handwritten_actors:
+        continue
+    impl = opcode.get_template_implementation()
+    if impl is not None:
+        template_actors[name] = impl
+
+with open('opcode_impl_template_gen.h', 'w') as out:
+    print(file_header, file=out)
+    print('// Included by opcode_impl.c, which defines IMPL(name) and the operand helpers', file=out)
+    print('', file=out)
+
+    for name, impl in template_actors.items():
+        print(impl, file=out)
+        print('', file=out)
+
 with open('opcode_impl_weak_gen.c', 'w') as out:
     print(file_header, file=out)
     print('#include <stdlib.h>', file=out)
@@ -152,5 +371,137 @@ with open('opcode_impl_weak_gen.c', 'w') as out:
     print('', file=out)
 
     for k, opcode in signature_opcode_map.items():
+        name = opcode.get_actor_function_name()
+        if name in handwritten_actors or name in template_actors:
+            continue
         print(opcode.get_actor_weak_implementation(), file=out)
         print('', file=out)
+
+# Superinstructions (optional argument): opcode sequences, one per line, '#' starts a comment
+superinstructions = {}
+if len(sys.argv) > 3:
+    with open(sys.argv[3], 'r') as file:
+        for line_no, line in enumerate(file, 1):
+            codes = line.split('#')[0].split()
+            if len(codes) == 0:
+                continue
+
+            try:
+                codes = ['0x%02X' % int(code, 16) for code in codes]
+            except ValueError:
+                print('Bad superinstruction in line %d' % line_no, file=sys.stderr)
+                sys.exit(1)
+
+            names = [opcode_dict[code].get_actor_function_name() for code in codes if code in opcode_dict]
+            if len(codes) < 2 or len(names) != len(codes):
+                print('Bad superinstruction in line %d' % line_no, file=sys.stderr)
+                sys.exit(1)
+
+            # Only actors inlined into the switch can be fused
+            if any(name not in handwritten_actors and name not in template_actors for name in names):
+                print('Skipping superinstruction in line %d: unimplemented opcode' % line_no, file=sys.stderr)
+                continue
+
+            # Prefix tree of the following opcodes
+            node = superinstructions.setdefault(codes[0], {})
+            for code in codes[1:]:
+                node = node.setdefault(code, {})
+
+
+# The previous instruction is completed first: Its scheduler events may move the PC (e.g. a watchdog
+# reset), so the next opcode is compared afterwards. Without a match the next loop iteration fetches
+# it, the instruction boundary (S1P2) is done already (fused).
+def superinstruction_arms(node, indent):
+    lines = []
+    lines.append('%sif (mcs51_core_fuse(p, &cycles, osc_periods))' % indent)
+    lines.append('%s{' % indent)
+    keyword = 'if'
+    for code, children in node.items():
+        opcode = opcode_dict[code]
+        lines.append('%s    %s (p->C[p->PC] == %s)' % (indent, keyword, code))
+        lines.append('%s    {' % indent)
+        lines.append('%s        p->PC++;' % indent)
+        lines.append('%s        ir->opcode.code = %s;' % (indent, code))
+        lines.append('%s        %s(p);' % (indent, opcode.get_actor_function_name()))
+        lines.append('%s        cycles = %s;' % (indent, opcode.cycles))
+        if children:
+            lines += superinstruction_arms(children, indent + '        ')
+        lines.append('%s    }' % indent)
+        keyword = 'else if'
+    lines.append('%s    else' % indent)
+    lines.append('%s    {' % indent)
+    lines.append('%s        fused = true;' % indent)
+    lines.append('%s    }' % indent)
+    lines.append('%s}' % indent)
+    return lines
+
+
+# Dispatch switch of the interpreter cores (mcs51_core.h), the actors are inlined into the case arms
+with open('opcode_switch_gen.h', 'w') as out:
+    print(file_header, file=out)
+    print('// Included by mcs51_core.h inside the interpreter loop, requires p, ir, opcode, cycles, osc_periods and fused', file=out)
+    print('', file=out)
+    print('switch (opcode)', file=out)
+    print('{', file=out)
+    for k, opcode in opcode_dict.items():
+        name = opcode.get_actor_function_name()
+        if name not in handwritten_actors and name not in template_actors:
+            continue
+
+        if opcode.code not in superinstructions:
+            print('    case %s: %s(p); cycles = %s; break;' % (opcode.code, name, opcode.cycles), file=out)
+            continue
+
+        print('    case %s:' % opcode.code, file=out)
+        print('        %s(p);' % name, file=out)
+        print('        cycles = %s;' % opcode.cycles, file=out)
+        print('#if MCS51_CORE_SUPERINSTRUCTIONS', file=out)
+        for line in superinstruction_arms(superinstructions[opcode.code], '        '):
+            print(line, file=out)
+        print('#endif', file=out)
+        print('        break;', file=out)
+    print('    // Reserved and unimplemented opcodes are dispatched through the opcode map', file=out)
+    print('    default: p->opcode_map[opcode].actor(p); cycles = 1; break;', file=out)
+    print('}', file=out)
+
+# PSW flag lookup tables
+#
+# For an addition r = a + b + c (or subtraction r = a - b - c) the carry (borrow) vector a ^ b ^ r
+# holds the carry into every bit position. Bits 8..4 of the carry vector select:
+# - Bit 4 (carry out of bit 3): AC
+# - Bit 7 (carry into bit 7) XOR bit 8 (carry out of bit 7): OV
+# - Bit 8: C
+with open('alu_flags_gen.h', 'w') as out:
+    print(file_header, file=out)
+    print('#pragma once', file=out)
+    print('', file=out)
+    print('#include <stdint.h>', file=out)
+    print('', file=out)
+    print('/// PSW flags (C, AC, OV) indexed by bits 8..4 of the carry vector a ^ b ^ result', file=out)
+    print('extern const uint8_t alu_flags_table[0x20];', file=out)
+    print('', file=out)
+    print('/// Parity (0 or 1) of a byte', file=out)
+    print('extern const uint8_t parity_table[0x100];', file=out)
+
+with open('alu_flags_gen.c', 'w') as out:
+    print(file_header, file=out)
+    print('#include "alu_flags_gen.h"', file=out)
+    print('#include "sfr_definitions_gen.h"', file=out)
+    print('', file=out)
+    print('const uint8_t alu_flags_table[0x20] = {', file=out)
+    for i in range(0x20):
+        flags = []
+        if i & 0b10000:
+            flags.append('SFR_PSW_C_Msk')
+        if i & 0b00001:
+            flags.append('SFR_PSW_AC_Msk')
+        if ((i >> 3) ^ (i >> 4)) & 1:
+            flags.append('SFR_PSW_OV_Msk')
+        print('    [0x%02x] = %s,' % (i, ' | '.join(flags) if flags else '0'), file=out)
+    print('};', file=out)
+    print('', file=out)
+    print('const uint8_t parity_table[0x100] = {', file=out)
+    for i in range(0, 0x100, 16):
+        row = ', '.join(str(bin(v).count('1') & 1) for v in range(i, i + 16))
+        print('    %s,' % row, file=out)
+    print('};', file=out)
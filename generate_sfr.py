@@ -160,25 +160,132 @@ with open('sfr_definitions_gen.h', 'w') as out:
         sfr.print_macro_definitions(file=out)
         print('', file=out)
 
+# Variant profiles: SFR subsets of sfrs.md and the IDATA size (variants.md)
+variants = []
+with open(sys.argv[2], 'r') as file:
+    table_line_no = 0
+    for line_no, line in enumerate(file, start=1):
+        if not line.lstrip().startswith("|"):
+            continue
+
+        table_line_no += 1
+        if table_line_no < 3:
+            continue
+
+        cells = [s.strip() for s in line.strip().strip('|').split('|')]
+        if len(cells) != 4:
+            print('Bad variant entry in line %d: 4 cells expected, got %d' % (line_no, len(cells)), file=sys.stderr)
+            sys.exit(1)
+
+        names = cells[3].split()
+
+        # A leading variant name includes the SFRs of that variant
+        included = [v for v in variants if names and v['variant'] == names[0]]
+        sfrs = list(included[0]['sfrs']) + names[1:] if included else names
+
+        unknown = [name for name in sfrs if name not in [sfr.name for sfr in sfr_dict.values()]]
+        if unknown:
+            print('Unknown SFRs of variant %s in line %d: %s' % (cells[0], line_no, ' '.join(unknown)), file=sys.stderr)
+            sys.exit(1)
+
+        variants.append({'variant': cells[0], 'name': cells[1], 'idata': int(cells[2]), 'sfrs': sfrs})
+
+
+def variant_id(variant):
+    return variant['variant'].lower()
+
+
 with open('sfr_map_gen.h', 'w') as out:
     print(file_header, file=out)
     print('#pragma once', file=out)
     print('', file=out)
     print('#include "sfr.h"', file=out)
+    print('#include "variant.h"', file=out)
     print('', file=out)
     print('#define SFR_MAP_SIZE (0x100)', file=out)
-    print('extern const sfr_t sfr_map[SFR_MAP_SIZE];', file=out)
+    print('', file=out)
+    for variant in variants:
+        print('extern const sfr_t sfr_map_%s[SFR_MAP_SIZE];' % variant_id(variant), file=out)
+    print('', file=out)
+    print('extern const mcs51_variant_profile_t mcs51_variant_profiles[MCS51_VARIANT_COUNT];', file=out)
 
 with open('sfr_map_gen.c', 'w') as out:
     print(file_header, file=out)
+    print('#include "sfr_address_map_gen.h"', file=out)
     print('#include "sfr_definitions_gen.h"', file=out)
     print('#include "sfr_map_gen.h"', file=out)
+
+    for variant in variants:
+        print('', file=out)
+        print('const sfr_t sfr_map_%s[SFR_MAP_SIZE] = {' % variant_id(variant), file=out)
+        for k, sfr in sfr_dict.items():
+            if sfr.name not in variant['sfrs']:
+                continue
+            c_boolean = 'false'
+            if sfr.bit_addressable:
+                c_boolean = 'true'
+            print('    [SFR_%s] = {.name = "%s", .bit_addressable = %s},' % (sfr.name, sfr.name, c_boolean), file=out)
+        print('};', file=out)
+
     print('', file=out)
+    print('const mcs51_variant_profile_t mcs51_variant_profiles[MCS51_VARIANT_COUNT] = {', file=out)
+    for variant in variants:
+        print('    [MCS51_VARIANT_%s] = {.name = "%s", .idata_size = %d, .sfr_map = sfr_map_%s, .indirect_address_map = sfr_indirect_address_map_%d},'
+              % (variant['variant'].upper(), variant['name'], variant['idata'], variant_id(variant), variant['idata']), file=out)
+    print('};', file=out)
 
-    print('const sfr_t sfr_map[SFR_MAP_SIZE] = {', file=out)
-    for k, sfr in sfr_dict.items():
-        c_boolean = 'false'
-        if sfr.bit_addressable:
-            c_boolean = 'true'
-        print('    [SFR_%s] = {.name = "%s", .bit_addressable = %s},' % (sfr.name, sfr.name, c_boolean), file=out)
+# Constant address translation tables of the bit and @Ri handlers (see mcs51_helpers.h)
+with open('sfr_address_map_gen.h', 'w') as out:
+    print(file_header, file=out)
+    print('#pragma once', file=out)
+    print('', file=out)
+    print('#include <stdint.h>', file=out)
+    print('', file=out)
+    print('/// Containing directly addressable byte and mask of a bit address', file=out)
+    print('typedef struct sfr_bit_address_t {', file=out)
+    print('    uint8_t byte;', file=out)
+    print('    uint8_t mask;', file=out)
+    print('} sfr_bit_address_t;', file=out)
+    print('', file=out)
+    print('extern const sfr_bit_address_t sfr_bit_address_map[0x100];', file=out)
+    print('', file=out)
+    print('/**', file=out)
+    print(' * "Physical" DATA index of an indirect (@Ri) address per IDATA size. 0x80-0xFF are mapped to the', file=out)
+    print(' * upper IDATA region, or to the unused region 0x180-0x1FF without upper IDATA (128 bytes).', file=out)
+    print(' */', file=out)
+    for idata in sorted({variant['idata'] for variant in variants}):
+        print('extern const uint16_t sfr_indirect_address_map_%d[0x100];' % idata, file=out)
+
+bit_addressable_sfrs = {int(sfr.address, 16): sfr for sfr in sfr_dict.values() if sfr.bit_addressable}
+
+with open('sfr_address_map_gen.c', 'w') as out:
+    print(file_header, file=out)
+    print('#include "sfr_address_map_gen.h"', file=out)
+    print('', file=out)
+
+    print('const sfr_bit_address_t sfr_bit_address_map[0x100] = {', file=out)
+    for bit in range(0x100):
+        if bit < 0x80:
+            # Bit-addressable RAM D:20 - D:2F
+            byte = 0x20 + bit // 8
+            comment = 'D:%02X.%d' % (byte, bit % 8)
+        else:
+            # Bit-addressable SFRs at addresses divisible by 8
+            byte = bit & 0xF8
+            sfr = bit_addressable_sfrs.get(byte)
+            if sfr is None:
+                comment = 'Unlisted SFR %02X.%d' % (byte, bit % 8)
+            else:
+                comment = '%s.%s' % (sfr.name, sfr.bits[bit % 8].name if sfr.bits[bit % 8].valid() else bit % 8)
+        print('    [0x%02X] = {.byte = 0x%02X, .mask = 0x%02X}, // %s' % (bit, byte, 1 << (bit % 8), comment), file=out)
     print('};', file=out)
+    print('', file=out)
+
+    for idata in sorted({variant['idata'] for variant in variants}):
+        upper = 0x100 if idata == 256 else 0x180
+        print('', file=out)
+        print('const uint16_t sfr_indirect_address_map_%d[0x100] = {' % idata, file=out)
+        for address in range(0, 0x100, 8):
+            indices = [a if a < 0x80 else upper + (a - 0x80) for a in range(address, address + 8)]
+            print('    %s,' % ', '.join('0x%03X' % i for i in indices), file=out)
+        print('};', file=out)
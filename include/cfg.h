@@ -0,0 +1,130 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct mcs51_t mcs51_t;
+
+/// How control leaves a basic block
+typedef enum cfg_exit_t
+{
+    CFG_EXIT_FALLTHROUGH,   /// Into the next block (the next instruction is a branch target)
+    CFG_EXIT_JUMP,          /// AJMP, LJMP, SJMP
+    CFG_EXIT_BRANCH,        /// Conditional branch (JZ, JNZ, JC, JNC, JB, JNB, JBC, CJNE, DJNZ)
+    CFG_EXIT_CALL,          /// ACALL, LCALL, the callee is assumed to return
+    CFG_EXIT_RET,           /// RET
+    CFG_EXIT_RETI,          /// RETI
+    CFG_EXIT_TABLE,         /// JMP @A+DPTR into a resolved jump table
+    CFG_EXIT_INDIRECT,      /// JMP @A+DPTR with unknown targets
+    CFG_EXIT_UNIMPLEMENTED, /// Opcode without an implementation (e.g. the reserved opcode 0xA5)
+} cfg_exit_t;
+
+typedef enum cfg_edge_kind_t
+{
+    CFG_EDGE_FALLTHROUGH, /// Next block in CODE order, also the not taken conditional branch
+    CFG_EDGE_JUMP,
+    CFG_EDGE_TAKEN, /// Taken conditional branch
+    CFG_EDGE_CALL,  /// Call site to the entry block of the callee
+    CFG_EDGE_RETURN, /// Call site to the block of the return address
+    CFG_EDGE_TABLE, /// JMP @A+DPTR to a jump table entry
+} cfg_edge_kind_t;
+
+typedef struct cfg_edge_t {
+    uint32_t from; /// Block index
+    uint32_t to;   /// Block index
+    cfg_edge_kind_t kind;
+} cfg_edge_t;
+
+typedef struct cfg_block_t {
+    uint16_t start;
+    uint16_t last;         /// Address of the last instruction
+    uint16_t end;          /// Address behind the last instruction
+    uint16_t instructions;
+    uint32_t cycles;       /// Machine cycles of all instructions (opcodes.md)
+    cfg_exit_t exit;
+    uint16_t target;       /// CFG_EXIT_JUMP, CFG_EXIT_BRANCH and CFG_EXIT_CALL: Address of the target
+
+    uint32_t function;   /// Index of the first function that reaches the block
+    uint32_t first_edge; /// Successors: edges[first_edge] ... edges[first_edge + edge_count - 1]
+    uint32_t edge_count;
+} cfg_block_t;
+
+typedef enum cfg_function_kind_t
+{
+    CFG_FUNCTION_RESET,
+    CFG_FUNCTION_INTERRUPT, /// Interrupt vector of nvic_t.map
+    CFG_FUNCTION_ROOT,      /// Additional root of cfg_build()
+    CFG_FUNCTION_CALL,      /// Target of ACALL or LCALL
+} cfg_function_kind_t;
+
+typedef struct cfg_function_t {
+    uint16_t entry;
+    cfg_function_kind_t kind;
+    uint8_t interrupt; /// CFG_FUNCTION_INTERRUPT: Index into nvic_t.map
+
+    uint32_t entry_block;
+    uint32_t block_count; /// Blocks reachable from the entry without following calls
+} cfg_function_t;
+
+/**
+ * Control-flow graph of a firmware image, found by a recursive-descent disassembly.
+ *
+ * The disassembly starts at the reset vector, the interrupt vectors of the variant (nvic_t.map) and
+ * optional roots, follows jumps, branches and calls, and stops at returns and unimplemented
+ * opcodes. A JMP @A+DPTR is resolved when DPTR is loaded with an immediate earlier on the same path
+ * (not changed since by INC DPTR, a call, or a write of DPL, DPH or AUXR1) and points to a run of
+ * AJMP or LJMP instructions (a jump table); otherwise it is reported in unresolved. Bytes that are never reached are treated as data.
+ *
+ * Blocks are ordered by address and end at every control transfer, calls included. A function is
+ * the set of blocks reachable from its entry without following CFG_EDGE_CALL.
+ */
+typedef struct cfg_t {
+    cfg_block_t* blocks;
+    size_t block_count;
+
+    cfg_edge_t* edges; /// Grouped by the source block
+    size_t edge_count;
+
+    cfg_function_t* functions; /// Reset, interrupts, roots, then the call targets by address
+    size_t function_count;
+
+    uint16_t* unimplemented; /// Addresses of reachable unimplemented opcodes
+    size_t unimplemented_count;
+
+    uint16_t* unresolved; /// Addresses of JMP @A+DPTR without a resolved jump table
+    size_t unresolved_count;
+
+    uint8_t instruction[0x10000 / 8]; /// Bitmap of the decoded instruction addresses
+
+    int32_t* _block_of; /// Block index of every CODE address, -1 if not decoded
+} cfg_t;
+
+/**
+ * Disassemble the CODE memory of an initialized MCU (opcode_map and interrupt vectors of its variant).
+ * @return false if out of memory
+ */
+bool cfg_build(cfg_t* cfg, const mcs51_t* p, const uint16_t* roots, size_t root_count);
+
+void cfg_free(cfg_t* cfg);
+
+/// Index of the block containing the instruction at address, -1 if none
+int32_t cfg_block_at(const cfg_t* cfg, uint16_t address);
+
+/// Index of the function with the entry address, -1 if none
+int32_t cfg_function_at(const cfg_t* cfg, uint16_t entry);
+
+/// Disassemble one instruction with resolved operands, e.g. "DJNZ R7, 0x0045"
+int cfg_format_instruction(const mcs51_t* p, uint16_t address, char* buffer, size_t size);
+
+/// Print the disassembly listing by blocks, with function labels and successors
+void cfg_print(const cfg_t* cfg, const mcs51_t* p, FILE* file);
+
+/// Write the CFG as a graphviz digraph
+void cfg_write_dot(const cfg_t* cfg, FILE* file);
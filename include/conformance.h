@@ -0,0 +1,82 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "mcs51.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Randomized ISA conformance tests.
+ *
+ * Every case is a random initial CPU state and a random sequence of valid instructions, drawn from
+ * the opcode table (opcodes.md) with operands the reference model supports. The case is executed by
+ * an independent reference model of the instruction semantics (src/conformance_model.c) and by each
+ * selected engine; PC, DATA, IDATA, SFRs, PSW flags, XDATA and the cycle count have to match.
+ *
+ * Cases are derived from (seed, index) only, so a failure is reproducible from its index. Cases are
+ * sharded across worker threads and failing cases are shrunk to a minimal instruction sequence.
+ */
+
+#define CONFORMANCE_MAX_INSTRUCTIONS (32)
+#define CONFORMANCE_ENGINE_PHASE     (MCS51_ENGINE_COUNT) /// Bit of the phase-accurate msc51_do_osc_period()
+
+/// Engines the conformance tests support (MCS51_ENGINE_FUZZ requires a fuzz_t)
+#define CONFORMANCE_ENGINES_ALL ((1U << CONFORMANCE_ENGINE_PHASE) | (1U << MCS51_ENGINE_PLAIN) | (1U << MCS51_ENGINE_TRACE) \
+                                 | (1U << MCS51_ENGINE_PROFILE) | (1U << MCS51_ENGINE_COVERAGE) | (1U << MCS51_ENGINE_MEMORY))
+
+typedef struct conformance_instruction_t {
+    uint8_t bytes[3];
+    uint8_t length;
+} conformance_instruction_t;
+
+typedef struct conformance_case_t {
+    uint64_t index;
+    uint16_t origin; /// CODE address of the first instruction
+    uint8_t count;   /// Instructions, also the number of executed instructions
+    conformance_instruction_t instructions[CONFORMANCE_MAX_INSTRUCTIONS];
+
+    uint8_t iram[0x100];
+    uint8_t acc;
+    uint8_t b;
+    uint8_t psw;
+    uint8_t sp;
+    uint8_t dpl;
+    uint8_t dph;
+    uint8_t p2;
+} conformance_case_t;
+
+typedef struct conformance_config_t {
+    uint64_t seed;
+    uint64_t cases;
+    uint8_t max_instructions; /// Instructions per case, at most CONFORMANCE_MAX_INSTRUCTIONS
+    uint32_t engines;         /// Bit mask of mcs51_engine_t and CONFORMANCE_ENGINE_PHASE
+    unsigned int workers;     /// Threads, 0 runs in the calling thread
+    FILE* report;             /// Shrunk failing cases are printed here (optional)
+} conformance_config_t;
+
+typedef struct conformance_result_t {
+    uint64_t cases;
+    uint64_t instructions; /// Instructions executed by the reference model
+    uint64_t failures;
+
+    conformance_case_t first_failure; /// Shrunk failing case with the lowest index
+    uint32_t first_failure_engines;   /// Engines that fail first_failure
+
+    bool error; /// The workers could not be allocated, no case was run
+} conformance_result_t;
+
+/// Generate the case index of a seed
+void conformance_generate(uint64_t seed, uint64_t index, uint8_t max_instructions, conformance_case_t* c);
+
+/// Run, check and shrink the cases of a configuration
+conformance_result_t conformance_run(const conformance_config_t* config);
+
+/// Print the disassembled instructions and the initial state of a case
+void conformance_print_case(const conformance_case_t* c, FILE* file);
+
+const char* conformance_engine_name(unsigned int engine);
@@ -0,0 +1,93 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * CODE coverage, collected by the MCS51_ENGINE_COVERAGE interpreter core.
+ *
+ * Conditional branches (JZ, JNZ, JC, JNC, JB, JNB, JBC, CJNE, DJNZ) record both outcomes at the
+ * address of the branch instruction. The bitmaps are plain arrays, so coverage of several runs is
+ * merged with a bitwise OR (coverage_merge(), coverage_save() and coverage_merge_file()).
+ */
+typedef struct coverage_t {
+    uint8_t executed[0x10000 / 8];         /// One bit per CODE address (first byte of an executed instruction)
+    uint8_t branch_taken[0x10000 / 8];     /// Conditional branch taken
+    uint8_t branch_not_taken[0x10000 / 8]; /// Conditional branch not taken (fall through)
+} coverage_t;
+
+/// Instruction size of the conditional branches by opcode, 0 for other opcodes
+extern const uint8_t coverage_branch_bytes[0x100];
+
+static inline bool coverage_test(const uint8_t* bitmap, uint16_t address)
+{
+    return bitmap[address >> 3] & (1 << (address & 0b111));
+}
+
+/**
+ * Record the outcome of the conditional branch at pc (called by the interpreter core). The outcome
+ * is the evaluated condition, a taken branch to the next instruction (offset 0) counts as taken.
+ */
+static inline void coverage_record_branch(coverage_t* coverage, uint16_t pc, bool taken)
+{
+    uint8_t* bitmap = taken ? coverage->branch_taken : coverage->branch_not_taken;
+    bitmap[pc >> 3] |= 1 << (pc & 0b111);
+}
+
+void coverage_reset(coverage_t* coverage);
+
+/// Number of executed instructions (CODE addresses)
+uint32_t coverage_count_executed(const coverage_t* coverage);
+
+/// Number of covered branch outcomes (taken and not taken count separately)
+uint32_t coverage_count_branch_outcomes(const coverage_t* coverage);
+
+/// dst |= src
+void coverage_merge(coverage_t* dst, const coverage_t* src);
+
+bool coverage_save(const coverage_t* coverage, FILE* file);
+
+/// Merge a coverage written by coverage_save()
+bool coverage_merge_file(coverage_t* coverage, FILE* file);
+
+typedef struct coverage_line_t {
+    uint16_t address; /// First byte of an instruction
+    uint32_t file;    /// Index into coverage_map_t.files
+    uint32_t line;
+} coverage_line_t;
+
+typedef struct coverage_symbol_t {
+    uint16_t address;
+    char* name;
+} coverage_symbol_t;
+
+/**
+ * Symbol and line information of a firmware image, loaded from a text file:
+ *   L <hex address> <source file> <line>   Instruction of a source line
+ *   F <hex address> <name>                 Function entry point
+ * Empty lines and lines starting with '#' are ignored.
+ */
+typedef struct coverage_map_t {
+    char** files;
+    size_t file_count;
+
+    coverage_line_t* lines; /// Sorted by file, line and address
+    size_t line_count;
+
+    coverage_symbol_t* symbols;
+    size_t symbol_count;
+} coverage_map_t;
+
+bool coverage_map_load(coverage_map_t* map, FILE* file);
+
+void coverage_map_free(coverage_map_t* map);
+
+/// Write an lcov tracefile (line, function and branch coverage). code is the CODE memory of the firmware.
+void coverage_write_lcov(const coverage_t* coverage, const coverage_map_t* map, const uint8_t* code, FILE* file);
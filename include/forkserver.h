@@ -0,0 +1,40 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct mcs51_t mcs51_t;
+
+/**
+ * Fork server (POSIX): The firmware reset code (RAM clearing, C runtime init) runs once, then every
+ * test request is served by a fork()ed child, which starts with a copy-on-write image of mcs51_t.
+ *
+ * Protocol over pipes, in host byte order:
+ *   Request   uint32_t length, length bytes of payload
+ *   Response  int32_t status of the child (exit code, or 128 + signal number)
+ */
+
+#define FORKSERVER_MAX_REQUEST (0x10000)
+
+/**
+ * Test handler, called in the child with the request payload.
+ * @return Exit code of the child, reported to the client
+ */
+typedef int (*forkserver_fn_t)(mcs51_t* p, const uint8_t* request, size_t length, void* ctx);
+
+/**
+ * Run the firmware until the PC reaches pc (at most max_cycles machine cycles), then serve requests
+ * until request_fd is closed.
+ *
+ * @return Number of served requests, or -1 if pc is not reached or on an I/O error
+ */
+long forkserver_run(mcs51_t* p, uint16_t pc, uint64_t max_cycles, int request_fd, int response_fd, forkserver_fn_t fn, void* ctx);
+
+/// Client side: send a request and wait for the status
+bool forkserver_request(int request_fd, int response_fd, const uint8_t* request, size_t length, int* status);
@@ -0,0 +1,136 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "mcs51.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * In-process coverage-guided fuzzing of firmware input handlers.
+ *
+ * The firmware is run from reset to the entry point once and snapshotted. For every input the
+ * snapshot is restored (a copy of mcs51_t), the input is injected into XDATA or the UART RX stream,
+ * and the MCS51_ENGINE_FUZZ interpreter core runs until the stop address, a crash or the cycle budget.
+ * The core records control flow edges (jumps, calls, returns, interrupts and conditional branches)
+ * into an AFL-style hashed edge map.
+ *
+ * Workers (processes or threads) share a corpus directory: inputs with new coverage are written to
+ * it and inputs of other workers are imported periodically.
+ */
+
+#define FUZZ_MAP_SIZE (0x10000)
+#define FUZZ_MAX_INPUT (0x1000)
+#define FUZZ_MAX_CORPUS (0x1000)
+#define FUZZ_SYNC_INTERVAL (0x1000) /// Executions between corpus directory scans
+#define FUZZ_MAX_SYNCED (0x4000)    /// Hash set of imported inputs without new coverage, a power of two
+
+typedef enum fuzz_result_t
+{
+    FUZZ_RUNNING,
+    FUZZ_OK,                         /// Stop address or semihosting exit with code 0
+    FUZZ_TIMEOUT,                    /// Cycle budget exhausted
+    FUZZ_CRASH_PC_OUT_OF_ROM,        /// PC beyond the firmware image
+    FUZZ_CRASH_UNIMPLEMENTED_OPCODE, /// Reserved opcode
+    FUZZ_CRASH_STACK_OVERFLOW,       /// Push above sp_max (or below the stack guard floor, see stack.h)
+    FUZZ_CRASH_ASSERT,               /// Assert address or semihosting exit with a non-zero code
+} fuzz_result_t;
+
+typedef enum fuzz_input_t
+{
+    FUZZ_INPUT_XDATA, /// Input copied to xdata_address, length (big endian u16) to xdata_length_address
+    FUZZ_INPUT_UART,  /// Input received byte by byte through SBUF/RI while REN is set and RI is clear
+} fuzz_input_t;
+
+typedef struct fuzz_config_t {
+    uint16_t entry;    /// The snapshot is taken when the PC reaches the entry point after reset
+    uint16_t stop;     /// The run ends (FUZZ_OK) when the PC reaches the stop address
+    uint32_t rom_size; /// Size of the firmware image, PC >= rom_size is a crash
+    uint8_t sp_max;    /// Highest valid stack pointer after a push, 0 for the top of IDATA of the variant
+
+    bool assert_enabled;
+    uint16_t assert_address; /// Entry of the firmware's assertion handler
+    bool semihosting;        /// Enable semihost_t, SEMIHOST_EXIT reports pass or fail
+
+    uint64_t init_cycles;   /// Machine cycles to reach the entry point
+    uint64_t budget_cycles; /// Machine cycles per input
+
+    fuzz_input_t input;
+    uint16_t xdata_address;
+    uint16_t xdata_length_address;
+    uint16_t max_input; /// Maximum input length, at most FUZZ_MAX_INPUT
+} fuzz_config_t;
+
+typedef struct fuzz_entry_t {
+    uint8_t* data;
+    uint16_t length;
+    uint64_t hash;
+} fuzz_entry_t;
+
+/// Fuzzer (worker) state, allocate it on the heap (it holds two mcs51_t)
+typedef struct fuzz_t {
+    fuzz_config_t config;
+
+    mcs51_t proc;     /// Running instance
+    mcs51_t snapshot; /// State at the entry point
+
+    uint8_t edges[FUZZ_MAP_SIZE]; /// Edge hit counts of the last run
+    uint8_t seen[FUZZ_MAP_SIZE];  /// Hit count buckets of all runs
+
+    semihost_t semihost;
+
+    const uint8_t* _uart_input;
+    size_t _uart_length;
+    size_t _uart_position;
+    uint16_t _next_pc; /// PC after the previous instruction
+    fuzz_result_t _result;
+
+    fuzz_entry_t corpus[FUZZ_MAX_CORPUS];
+    size_t corpus_count;
+
+    uint64_t _synced[FUZZ_MAX_SYNCED]; /// Open addressing, 0 is a free slot
+    size_t _synced_count;
+
+    uint64_t executions;
+    uint64_t crashes;
+    uint64_t _random;
+} fuzz_t;
+
+/**
+ * Load the firmware and run it from reset to the entry point.
+ * @return false if the entry point is not reached within init_cycles
+ */
+bool fuzz_init(fuzz_t* fuzz, const fuzz_config_t* config, const uint8_t* code, size_t code_size);
+
+/// Restore the snapshot and run one input, the edges of the run are in fuzz->edges
+fuzz_result_t fuzz_run(fuzz_t* fuzz, const uint8_t* input, size_t length);
+
+/// Merge the edges of the last run into the seen buckets, true if any bucket is new
+bool fuzz_has_new_coverage(fuzz_t* fuzz);
+
+/// Add an input to the in-memory corpus (copied)
+bool fuzz_add_input(fuzz_t* fuzz, const uint8_t* input, size_t length);
+
+/**
+ * Fuzz for a number of executions. Inputs with new coverage are written to corpus_dir, crashing
+ * inputs to crash_dir (both created if missing). Inputs of other workers in corpus_dir are imported
+ * every FUZZ_SYNC_INTERVAL executions, each of them is run once (also over several calls).
+ *
+ * @return Number of unique crashes (crashing inputs with new edges among the crashing inputs)
+ */
+uint64_t fuzz_loop(fuzz_t* fuzz, const char* corpus_dir, const char* crash_dir, uint64_t executions, uint64_t seed);
+
+/// Run fuzz_loop() in worker threads sharing the directories
+uint64_t fuzz_parallel(const fuzz_config_t* config, const uint8_t* code, size_t code_size, const char* corpus_dir,
+                       const char* crash_dir, unsigned int workers, uint64_t executions);
+
+void fuzz_free(fuzz_t* fuzz);
+
+const char* fuzz_result_name(fuzz_result_t result);
+
+/// Called by the MCS51_ENGINE_FUZZ core after every instruction, true to end the run
+bool fuzz_step(fuzz_t* fuzz, mcs51_t* p, uint16_t pc, uint8_t opcode);
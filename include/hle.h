@@ -0,0 +1,52 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct mcs51_t mcs51_t;
+
+/**
+ * High-level emulation (HLE) of a firmware routine in host code.
+ * The handler performs the register and memory effects of the routine (e.g. R6/R7 = R6/R7 * R4/R5),
+ * the emulator returns to the caller afterwards (RET). Use mcs51_read_direct()/mcs51_write_direct()
+ * or call mcs51_sync_psw() before accessing the PSW through D[].
+ */
+typedef void (*hle_fn_t)(mcs51_t* p, void* ctx);
+
+typedef struct hle_t {
+    hle_fn_t fn; /// NULL for unused slots
+    void* ctx;
+
+    uint16_t address; /// Entry point of the routine
+    uint32_t cycles;  /// Machine cycles charged per call
+} hle_t;
+
+#define HLE_MAX (16)
+
+/**
+ * Replace the firmware routine at a CODE address. The handler runs when the PC reaches the address
+ * at an instruction boundary (fetch), i.e. after the LCALL/ACALL. The charged machine cycles pass
+ * like the cycles of an instruction: The timers count them, scheduled events (watchdog, serial port,
+ * host events) run and the interrupt flags are latched.
+ *
+ * @return HLE handle or -1 if all HLE_MAX slots are in use
+ */
+int hle_add(mcs51_t* p, uint16_t address, uint32_t cycles, hle_fn_t fn, void* ctx);
+
+/**
+ * Replace the firmware routine starting with a byte signature (first match in CODE).
+ * Bytes with a zero mask bit are ignored, e.g. relocated absolute addresses. mask may be NULL.
+ *
+ * @return HLE handle or -1 if the signature is not found or all slots are in use
+ */
+int hle_add_signature(mcs51_t* p, const uint8_t* signature, const uint8_t* mask, size_t length, uint32_t cycles, hle_fn_t fn, void* ctx);
+
+void hle_remove(mcs51_t* p, int handle);
+
+/// Run the routine at the PC and return to the caller (called from the fetch)
+void hle_enter(mcs51_t* p);
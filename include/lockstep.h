@@ -0,0 +1,54 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct mcs51_t mcs51_t;
+
+/**
+ * Differential lockstep checker: Runs the phase-accurate engine (msc51_do_osc_period()) and an
+ * interpreter core (candidate->_engine) side by side on two instances of the same firmware.
+ *
+ * Every interval instructions the architectural state (PC, DATA/SFR/IDATA with the timer counts,
+ * XDATA, oscillator periods, interrupt controller) is compared by hash. On a mismatch both instances are restored from the last
+ * matching checkpoint and the first diverging instruction is located by bisection.
+ *
+ * Host callbacks (serial TX, watchers, HLE) run on both instances, the instances must not share state.
+ */
+typedef struct lockstep_t {
+    mcs51_t* reference; /// Phase-accurate engine
+    mcs51_t* candidate; /// Interpreter core selected by _engine
+    uint64_t interval;  /// Instructions between state comparisons, 1 for every instruction boundary
+
+    uint64_t instructions; /// Instructions executed in lockstep
+
+    bool diverged;
+    uint64_t divergence_instruction; /// Index of the first diverging instruction
+    uint16_t divergence_pc;          /// Reference PC before the first diverging instruction
+
+    mcs51_t* _reference_checkpoint;
+    mcs51_t* _candidate_checkpoint;
+} lockstep_t;
+
+/// The instances have to be identical and at an instruction boundary
+bool lockstep_init(lockstep_t* lockstep, mcs51_t* reference, mcs51_t* candidate, uint64_t interval);
+
+void lockstep_free(lockstep_t* lockstep);
+
+/**
+ * Run a number of instructions in lockstep.
+ * @return false on a divergence, both instances are left in the state after the diverging instruction
+ */
+bool lockstep_run(lockstep_t* lockstep, uint64_t instructions);
+
+/// Hash of the architectural state
+uint64_t lockstep_hash(mcs51_t* p);
+
+/// Print the diverging instruction and the state differences
+void lockstep_print_divergence(lockstep_t* lockstep, FILE* file);
@@ -9,9 +9,42 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "coverage.h"
+#include "hle.h"
 #include "instruction_register.h"
+#include "memprofile.h"
 #include "nvic.h"
+#include "profile.h"
+#include "scheduler.h"
+#include "semihost.h"
 #include "sfr.h"
+#include "stack.h"
+#include "timebase.h"
+#include "timer.h"
+#include "variant.h"
+#include "vcd.h"
+#include "watch.h"
+#include "watchdog.h"
+
+typedef struct fuzz_t fuzz_t;
+
+/**
+ * Interpreter cores of msc51_run(). All cores execute complete instructions with inlined actors
+ * and are cycle-accurate at machine cycle granularity (interrupt latency, timers, serial port), the
+ * scheduled events (scheduler.h) are only checked once per instruction.
+ * Unlike msc51_do_osc_period(), they do not drive ALE and ignore opcode_map overrides of
+ * implemented opcodes.
+ */
+typedef enum mcs51_engine_t
+{
+    MCS51_ENGINE_PLAIN,    /// Fastest, no instrumentation
+    MCS51_ENGINE_TRACE,    /// Loads the instruction register and calls _on_trace before each instruction, samples _vcd after it
+    MCS51_ENGINE_PROFILE,  /// Counts executed instructions per opcode and CODE address into _profile
+    MCS51_ENGINE_COVERAGE, /// Marks executed CODE addresses in _coverage
+    MCS51_ENGINE_FUZZ,     /// Records control flow edges and checks crash conditions of _fuzz (see fuzz.h)
+    MCS51_ENGINE_MEMORY,   /// Counts DATA, IDATA and XDATA accesses per byte and instruction into _memprofile
+    MCS51_ENGINE_COUNT,
+} mcs51_engine_t;
 
 /**
  * Intel MCS-51 MCU (aka. 8051).
@@ -28,7 +61,7 @@
  *
  * Facts:
  * - Oscillator 11.0592 MHz when C/T bit of TMOD is 0
- * - 1 machine cycle = 12 clock cycles
+ * - 1 machine cycle = 12 clock cycles (6 in X2 mode)
  * - UART circuit clock divider = 32
  *
  * https://ww1.microchip.com/downloads/en/DeviceDoc/doc4316.pdf
@@ -49,10 +82,25 @@ typedef struct mcs51_t {
     uint8_t C[0x10000]; /// CODE
 
     sfr_t sfr_map[0x100]; /// Describes and handles directly addressable memory (such as R0, R1, ..., SFRs)
+
+    /**
+     * Bitmaps of directly addressable bytes with an SFR hook or a watcher (see mcs51_update_sfr_hooks()).
+     * Accesses to other addresses do not call into sfr_map.
+     */
+    uint32_t _sfr_hooked_read[0x100 / 32];
+    uint32_t _sfr_hooked_write[0x100 / 32];
+    watch_t _watches[WATCH_MAX];
+
+    uint32_t _hle_entries[0x10000 / 32]; /// Bitmap of CODE addresses with a high-level emulated routine
+    hle_t _hle[HLE_MAX];
     opcode_t opcode_map[0x100];
 
-    uint64_t _osc_frequency_hertz;
+    /**
+     * State phases since init, 12 per machine cycle: Oscillator periods, or half oscillator periods
+     * in X2 mode (CKCON0.X2). Mapped to emulated time by _timebase, see timebase.h.
+     */
     uint64_t _osc_periods;
+    timebase_t _timebase; /// Oscillator frequency (mcs51_set_osc_frequency()) and clock mode
 
     instruction_register_t _instruction_register;
 
@@ -73,22 +121,113 @@ typedef struct mcs51_t {
 
     nvic_t _nvic;
 
+    scheduler_t _scheduler; /// Peripheral events, run in S6P2
+
+    /**
+     * Timer 0, 1 and 2, counted lazily (see timer.h).
+     * The host has to call mcs51_sync_timers() before reading D[SFR_TLx/THx] directly and has to
+     * write TLx, THx, TMOD, TCON.TRx and T2CON through mcs51_write_direct().
+     */
+    mcs51_timer_t _timers[3];
+    int _brg_event;                        /// Overflow of the internal baud rate generator (AT89C51RD2)
+    mcs51_serial_clock_t _serial_tx_clock; /// Selected by T2CON.TCLK and BDRCON.TBCK
+
+    mcs51_variant_t _variant;              /// Selected by mcs51_init_variant()
+    const uint16_t* _indirect_address_map; /// Of the variant, see variant.h
+    uint8_t _dptr_inactive[2];             /// AT89C51RD2: DPL, DPH of the DPTR not selected by AUXR1.DPS
+    uint8_t _dps;                          /// AUXR1.DPS of the DPTR in DPL, DPH
+
+    watchdog_t _watchdog; /// Host configuration and expiry statistics (see watchdog.h)
+    stack_guard_t _stack; /// Stack watermark and overflow detection (see stack.h)
+
     bool _sfr_dirty_sbuf;
+    uint8_t _sbuf_tx; /// Transmit buffer, D[SFR_SBUF] holds the receive buffer after mcs51_serial_rx()
+
+    /**
+     * PSW flags P, AC and OV are evaluated lazily, when the PSW is read.
+     * The host has to call mcs51_sync_psw() before accessing D[SFR_PSW] directly.
+     */
+    bool _psw_dirty;           /// AC and OV have to be derived from _psw_carry_vector
+    uint8_t _psw_carry_vector; /// Bits 8..4 of a ^ b ^ result of the last ADD, ADDC or SUBB
+
+    /**
+     * DATA address of R0 in the selected register bank, updated on every PSW write.
+     * This is an offset rather than a pointer, so mcs51_t stays trivially copyable.
+     */
+    uint8_t _register_bank;
 
     void (*_on_serial_tx)(char c);
     bool _abort_on_unimplemented_opcode;
+
+    vcd_t* _vcd; /// Optional waveform recorder, sampled after every oscillator period
+
+    mcs51_engine_t _engine;          /// Interpreter core of msc51_run()
+    void (*_on_trace)(mcs51_t* p);   /// MCS51_ENGINE_TRACE: Called after the fetch, before the execution
+    profile_t* _profile;             /// MCS51_ENGINE_PROFILE
+    coverage_t* _coverage;           /// MCS51_ENGINE_COVERAGE
+    memprofile_t* _memprofile;       /// MCS51_ENGINE_MEMORY
+
+    semihost_t* _semihost; /// Set by semihost_enable()
+    fuzz_t* _fuzz;         /// MCS51_ENGINE_FUZZ, set by fuzz_init()
+
 } mcs51_t;
 
+/// Initialize an AT89C51RD2
 void mcs51_init(mcs51_t* p);
 
+/// Initialize the given MCU variant (see variant.h)
+void mcs51_init_variant(mcs51_t* p, mcs51_variant_t variant);
+
 void mcs51_reset(mcs51_t* p);
 
 void mcs51_print_state(mcs51_t* p);
 
+/// Materialize the lazily evaluated PSW flags (P, AC and OV) in D[SFR_PSW]
+void mcs51_sync_psw(mcs51_t* p);
+
+/// Materialize the lazily counted timer registers (TL0, TH0, TL1, TH1, TL2 and TH2) in D[]
+void mcs51_sync_timers(mcs51_t* p);
+
+/**
+ * Receive a byte on the serial port (mode 1 with SCON.REN): Loads SBUF and sets RI. The host is
+ * responsible for the frame timing, e.g. with a scheduled event (scheduler.h).
+ * @return false if the receiver is not enabled or RI is still set (the byte is lost)
+ */
+bool mcs51_serial_rx(mcs51_t* p, uint8_t byte);
+
+/// Rebuild the SFR hook bitmaps, required after modifying the on_read/on_write hooks of sfr_map
+void mcs51_update_sfr_hooks(mcs51_t* p);
+
+/// Read a directly addressable byte (DATA or SFR) including the SFR read hooks
+uint8_t mcs51_read_direct(mcs51_t* p, uint8_t address);
+
+/// Write a directly addressable byte (DATA or SFR) including the SFR write hooks, e.g. to switch register banks
+void mcs51_write_direct(mcs51_t* p, uint8_t address, uint8_t value);
+
 void mcs51_print_current_instruction(mcs51_t* p);
 
+/// Change the oscillator frequency from the current state phase on, the emulated time so far is kept
+void mcs51_set_osc_frequency(mcs51_t* p, uint64_t hertz);
+
 double msc51_execution_time_ms(mcs51_t* p);
 
+uint64_t msc51_execution_time_ns(mcs51_t* p);
+
 void msc51_do_machine_cycle(mcs51_t* p);
 
 void msc51_do_osc_period(mcs51_t* p);
+
+/**
+ * Run whole instructions with the selected interpreter core (_engine) for at least osc_periods
+ * oscillator periods. An instruction in progress is completed with msc51_do_osc_period() first.
+ */
+void msc51_run(mcs51_t* p, uint64_t osc_periods);
+
+/**
+ * Run whole instructions until the emulated time reaches ns (see msc51_run()), e.g. to pace the
+ * emulation against a wall clock. Clock changes of the firmware during the run are followed.
+ */
+void msc51_run_until_ns(mcs51_t* p, uint64_t ns);
+
+/// Execute the next instruction (or complete the current one) with the selected interpreter core
+void msc51_do_instruction(mcs51_t* p);
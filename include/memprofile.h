@@ -0,0 +1,80 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct mcs51_t mcs51_t;
+
+/// Accesses of one byte, the counters saturate
+typedef struct memprofile_cell_t {
+    uint32_t reads;
+    uint32_t writes;
+
+    /**
+     * Instruction with the most accesses (approximate): An access by another instruction decrements
+     * the weight and takes the cell over at zero, so the dominant instruction survives.
+     */
+    uint16_t pc;
+    uint16_t pc_weight;
+} memprofile_cell_t;
+
+/**
+ * Memory access profile, collected by the MCS51_ENGINE_MEMORY interpreter core.
+ * The structure is large, allocate it on the heap or statically; the other cores do not touch it.
+ *
+ * Counted are the directly addressed bytes (DATA and SFRs, bit accesses on the containing byte,
+ * read-modify-write instructions as a read and a write), indirect accesses (@R0, @R1, the stack) and
+ * MOVX. The registers R0-R7 and the accumulator of an instruction's own encoding are not memory
+ * accesses. The calls inserted by the interrupt controller are attributed to the interrupt vector.
+ */
+typedef struct memprofile_t {
+    memprofile_cell_t data[0x200]; /// By index of mcs51_t.D: DATA, SFRs, upper IDATA (0x100 + address - 0x80)
+    memprofile_cell_t xdata[0x10000];
+    uint32_t pc_accesses[0x10000]; /// Accesses per instruction address
+
+    uint16_t _pc; /// Instruction being executed
+} memprofile_t;
+
+static inline uint32_t memprofile_saturating_increment(uint32_t count)
+{
+    return count + (count != UINT32_MAX);
+}
+
+/// Count an access of the executing instruction (called by the interpreter core)
+static inline void memprofile_record(memprofile_t* m, memprofile_cell_t* cell, bool write)
+{
+    if (write)
+        cell->writes = memprofile_saturating_increment(cell->writes);
+    else
+        cell->reads = memprofile_saturating_increment(cell->reads);
+
+    if (cell->pc == m->_pc)
+        cell->pc_weight += cell->pc_weight != UINT16_MAX;
+    else if (cell->pc_weight == 0)
+        *cell = (memprofile_cell_t){.reads = cell->reads, .writes = cell->writes, .pc = m->_pc, .pc_weight = 1};
+    else
+        cell->pc_weight--;
+
+    m->pc_accesses[m->_pc] = memprofile_saturating_increment(m->pc_accesses[m->_pc]);
+}
+
+void memprofile_reset(memprofile_t* m);
+
+/**
+ * Print the top_n DATA/IDATA bytes, the hardest polled SFRs (by reads), the XDATA bytes worth
+ * moving into DATA (MOVX through DPTR or @Ri costs 2 cycles and pointer setup) and the instructions
+ * with the most accesses.
+ */
+void memprofile_print(const memprofile_t* m, const mcs51_t* p, FILE* file, unsigned int top_n);
+
+/**
+ * Print a heatmap of the accesses, 16 bytes per line, from ' ' (none) to '@' (most) in a
+ * logarithmic scale: DATA, SFRs and upper IDATA, and the XDATA lines with accesses.
+ */
+void memprofile_print_heatmap(const memprofile_t* m, FILE* file);
@@ -0,0 +1,114 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct mcs51_t mcs51_t;
+typedef struct network_t network_t;
+
+#define NETWORK_MAX_NODES (16)
+#define NETWORK_MAX_LINKS (32)
+
+typedef enum network_link_kind_t
+{
+    NETWORK_LINK_SERIAL, /// Serial TX of one MCU to the serial RX of another
+    NETWORK_LINK_PINS,   /// Writes to a port of one MCU drive (masked) pins of a port of another
+} network_link_kind_t;
+
+typedef struct network_link_t {
+    network_link_kind_t kind;
+    uint8_t from;
+    uint8_t to;
+    uint8_t from_port; /// NETWORK_LINK_PINS: SFR_P0 - SFR_P3
+    uint8_t to_port;
+    uint8_t mask;
+    uint64_t latency_ns; /// From the send to the arrival, e.g. one UART character time
+} network_link_t;
+
+/// A serial byte or port write on its way, in the time of the receiver
+typedef struct network_message_t {
+    uint64_t arrival_ns;
+    uint64_t due;   /// Oscillator period of the receiver
+    uint32_t order; /// Generation order, breaks ties of arrival_ns deterministically
+    network_link_kind_t kind;
+    uint8_t port;
+    uint8_t mask;
+    uint8_t value;
+} network_message_t;
+
+typedef struct network_queue_t {
+    network_message_t* items;
+    size_t head;
+    size_t count;
+    size_t capacity;
+} network_queue_t;
+
+typedef struct network_node_t {
+    mcs51_t* mcu;
+    network_t* network;
+    unsigned int index;
+
+    uint64_t rx_bytes;   /// Serial bytes received
+    uint64_t rx_dropped; /// Serial bytes that arrived while the receiver was disabled or RI was set
+
+    int _event;             /// Delivery of the inbox head (scheduler handle)
+    uint8_t _watched_ports; /// Bit mask of P0 - P3 with a write watcher
+    network_queue_t _outbox; /// Sent during the current window (arrival_ns holds the send time)
+    network_queue_t _inbox;  /// Sorted by arrival
+} network_node_t;
+
+/**
+ * Network of MCUs connected by serial and pin links, co-simulated in parallel.
+ *
+ * The synchronization is conservative: All MCUs run independently through windows of emulated time
+ * as long as the shortest link latency (the lookahead). A message sent in a window arrives in a
+ * later one, so it is exchanged at the barrier between the windows and delivered by a scheduled
+ * event (scheduler.h) of the receiver. The exchange is ordered by arrival time and generation
+ * order, so the result does not depend on the number of worker threads.
+ *
+ * An MCU completes its last instruction of a window, so it overshoots the window end by up to one
+ * instruction (at most 4 machine cycles). A message arriving during that overshoot is delivered at
+ * the receiver's next instruction boundary, i.e. up to one instruction late. The delay is
+ * deterministic as well.
+ *
+ * The network owns _on_serial_tx of its MCUs and registers a scheduler event and port watchers.
+ */
+struct network_t {
+    network_node_t nodes[NETWORK_MAX_NODES];
+    unsigned int node_count;
+
+    network_link_t links[NETWORK_MAX_LINKS];
+    unsigned int link_count;
+
+    uint64_t time_ns; /// Emulated time all MCUs have reached
+    uint64_t windows; /// Synchronization windows so far
+
+    /// Optional, called at the barriers for every transmitted byte in a deterministic order
+    void (*on_serial_tx)(network_t* network, unsigned int node, uint8_t byte, uint64_t ns);
+    void* ctx;
+};
+
+void network_init(network_t* network);
+
+void network_free(network_t* network);
+
+/**
+ * Add an initialized MCU, its emulated time has to be time_ns of the network.
+ * @return Node index or -1 if all NETWORK_MAX_NODES are in use
+ */
+int network_add_mcu(network_t* network, mcs51_t* p);
+
+/// @return Link index or -1 if all NETWORK_MAX_LINKS are in use
+int network_connect_serial(network_t* network, unsigned int from, unsigned int to, uint64_t latency_ns);
+
+/// @return Link index or -1 if all NETWORK_MAX_LINKS are in use
+int network_connect_pins(network_t* network, unsigned int from, uint8_t from_port, unsigned int to, uint8_t to_port, uint8_t mask, uint64_t latency_ns);
+
+/// Run all MCUs until the emulated time ns, on workers threads (0 runs in the calling thread)
+void network_run(network_t* network, uint64_t ns, unsigned int workers);
@@ -30,17 +30,24 @@ typedef struct interrupt_t {
  * | INT1    | IE1   | 0x0013
  * | Timer 1 | TF1   | 0x001B
  * | Serial  | TI/RI | 0x0023
+ * | Timer 2 | TF2/EXF2 | 0x002B (8052)
+ *
+ * Priority levels: IP, and IPH on the AT89C51RD2 (level 3 with IPH and IP set, down to level 0).
  */
 typedef struct nvic_t {
     // SFR_IE map
-    interrupt_t map[5];
+    interrupt_t map[6];
 
     /**
      * Pending ISRs (bitmask). Compatible to SFR_IE and SFR_IP.
-     * MSB [ RI/TI | TF1 | IE1 | TF0 | IE0 ] LSB
+     * MSB [ TF2/EXF2 | RI/TI | TF1 | IE1 | TF0 | IE0 ] LSB
      */
     uint8_t _isr_pending;
 
+    uint8_t _sources;  /// Interrupt sources of the variant (bitmask of _isr_pending)
+    uint8_t _wake_up;  /// Sources ending power-down (the external interrupts of the variant, the oscillator is stopped)
+    uint8_t _iph_mask; /// 0xFF if the variant has IPH, otherwise 0 (2 priority levels)
+
     uint8_t _isr_active_msk;  /// Active ISRs (bitmask)
     uint8_t _isr_running_msk; /// Currently active and running ISR (bit mask)
 
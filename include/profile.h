@@ -0,0 +1,84 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct mcs51_t mcs51_t;
+
+#define PROFILE_TRIPLE_SLOTS (0x1000)
+
+/// Approximate count of an opcode triple (first opcode in bits 23..16)
+typedef struct profile_triple_t {
+    uint32_t opcodes;
+    uint64_t count;
+} profile_triple_t;
+
+/**
+ * Execution profile, collected by the MCS51_ENGINE_PROFILE interpreter core.
+ * The structure is large, allocate it on the heap or statically.
+ *
+ * Opcode pairs are counted exactly. Opcode triples are counted in a direct-mapped table: a colliding
+ * triple decrements the count of the slot and takes it over at zero, so frequent triples survive.
+ * Sequences are interrupted by interrupts.
+ */
+typedef struct profile_t {
+    uint64_t opcode_count[0x100]; /// Executed instructions per opcode
+    uint64_t pc_count[0x10000];   /// Executed instructions per CODE address
+    uint64_t pair_count[0x10000]; /// Executed opcode pairs (first opcode in the high byte)
+    profile_triple_t triples[PROFILE_TRIPLE_SLOTS];
+    uint64_t instructions; /// Executed instructions in total
+
+    uint16_t _history;       /// Previous two opcodes (latest in the low byte)
+    uint8_t _history_length; /// Number of valid opcodes in _history
+} profile_t;
+
+static inline void profile_record_triple(profile_t* profile, uint32_t opcodes)
+{
+    profile_triple_t* slot = &profile->triples[(opcodes ^ (opcodes >> 12)) % PROFILE_TRIPLE_SLOTS];
+
+    if (slot->opcodes == opcodes)
+        slot->count++;
+    else if (slot->count == 0)
+        *slot = (profile_triple_t){.opcodes = opcodes, .count = 1};
+    else
+        slot->count--;
+}
+
+/// Count an executed instruction (called by the interpreter core)
+static inline void profile_record(profile_t* profile, uint16_t pc, uint8_t opcode)
+{
+    profile->opcode_count[opcode]++;
+    profile->pc_count[pc]++;
+    profile->instructions++;
+
+    if (profile->_history_length >= 1)
+        profile->pair_count[(uint16_t) (profile->_history << 8) | opcode]++;
+    if (profile->_history_length >= 2)
+        profile_record_triple(profile, ((uint32_t) profile->_history << 8) | opcode);
+
+    profile->_history = (profile->_history << 8) | opcode;
+    if (profile->_history_length < 2)
+        profile->_history_length++;
+}
+
+/// An interrupt breaks the opcode sequence
+static inline void profile_record_interrupt(profile_t* profile)
+{
+    profile->_history_length = 0;
+}
+
+void profile_reset(profile_t* profile);
+
+/// Print the top_n most executed opcodes, CODE addresses, opcode pairs and opcode triples
+void profile_print(const profile_t* profile, const mcs51_t* p, FILE* file, unsigned int top_n);
+
+/**
+ * Write the top_n opcode pairs and triples as superinstruction list (see superinstructions.txt),
+ * to be passed to the build with -DMCS51_SUPERINSTRUCTIONS=<file>.
+ */
+void profile_write_superinstructions(const profile_t* profile, const mcs51_t* p, FILE* file, unsigned int top_n);
@@ -0,0 +1,72 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct mcs51_t mcs51_t;
+
+/**
+ * Discrete-event scheduler of the peripherals (timers, watchdog, host-scheduled pin changes and
+ * device models of the host).
+ *
+ * Instead of clocking every peripheral in every machine cycle, a peripheral arms an event for the
+ * oscillator period of its next state change (e.g. a timer overflow) and derives everything in
+ * between on demand, typically from an SFR read hook. The engines only compare the current period
+ * with the earliest armed event and run due events in S6P2 of the machine cycle that contains their
+ * due period. Use due = 12 * n + 11 to run an event in machine cycle n.
+ *
+ * Device models of the host attach to SFRs through the sfr_map hooks (mcs51_update_sfr_hooks()) and
+ * keep their timing here. The scheduler is part of mcs51_t and copied with it, so ctx must not point
+ * into the mcs51_t.
+ */
+typedef void (*scheduler_fn_t)(mcs51_t* p, uint64_t due, void* ctx);
+
+#define SCHEDULER_MAX       (16)
+#define SCHEDULER_NOT_ARMED (0xFF)
+
+typedef struct scheduler_event_t {
+    scheduler_fn_t fn; /// NULL for unused slots
+    void* ctx;
+
+    uint64_t due;       /// Oscillator period
+    uint8_t heap_index; /// Position in scheduler_t.heap or SCHEDULER_NOT_ARMED
+} scheduler_event_t;
+
+typedef struct scheduler_t {
+    scheduler_event_t events[SCHEDULER_MAX];
+
+    uint8_t heap[SCHEDULER_MAX]; /// Min-heap of the armed events by due, ties by handle
+    uint8_t heap_size;
+
+    uint64_t next_due; /// Due of the earliest armed event, UINT64_MAX if none
+} scheduler_t;
+
+void scheduler_init(scheduler_t* s);
+
+/**
+ * Register an event handler. The event is not armed.
+ *
+ * @return Event handle or -1 if all SCHEDULER_MAX slots are in use
+ */
+int scheduler_add(mcs51_t* p, scheduler_fn_t fn, void* ctx);
+
+void scheduler_remove(mcs51_t* p, int handle);
+
+/**
+ * Arm (or re-arm) an event. An event due in the past runs in the next S6P2. Events run once,
+ * the handler may arm its event again.
+ */
+void scheduler_arm(mcs51_t* p, int handle, uint64_t due);
+
+void scheduler_cancel(mcs51_t* p, int handle);
+
+/// Due oscillator period of an armed event, UINT64_MAX if it is not armed
+uint64_t scheduler_due(const mcs51_t* p, int handle);
+
+/// S6P2: Run the events due at or before osc_period in the order of their due (called by the engines)
+void scheduler_run(mcs51_t* p, uint64_t osc_period);
@@ -0,0 +1,47 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct mcs51_t mcs51_t;
+
+/**
+ * Semihosting: The reserved opcode 0xA5 calls into the host. The call number is passed in A,
+ * arguments in R7 (file), DPTR (XDATA buffer) and R4/R5 (length, high byte in R4).
+ * A returns 0 on success and 0xFF on failure, unless noted otherwise.
+ *
+ * SEMIHOST_WRITE   Write R4/R5 bytes of XDATA at DPTR to file R7, R4/R5 = bytes written
+ * SEMIHOST_READ    Read up to R4/R5 bytes of file R7 into XDATA at DPTR (test vectors), R4/R5 = bytes read
+ * SEMIHOST_EXIT    Report pass (R7 = 0) or fail (R7 = error code), the CPU halts at the instruction (no return)
+ * SEMIHOST_CLOCK   Host monotonic clock in milliseconds, R4 (MSB) - R7 (LSB)
+ * SEMIHOST_CYCLES  Emulated machine cycles, R4 (MSB) - R7 (LSB)
+ */
+typedef enum semihost_call_t
+{
+    SEMIHOST_WRITE = 0x01,
+    SEMIHOST_READ = 0x02,
+    SEMIHOST_EXIT = 0x03,
+    SEMIHOST_CLOCK = 0x04,
+    SEMIHOST_CYCLES = 0x05,
+} semihost_call_t;
+
+#define SEMIHOST_OPCODE (0xA5)
+#define SEMIHOST_MAX_FILES (8)
+
+typedef struct semihost_t {
+    FILE* files[SEMIHOST_MAX_FILES]; /// Host files by number, 0-2 are stdin, stdout and stderr by default
+
+    bool exited;
+    uint8_t exit_code; /// R7 of SEMIHOST_EXIT, 0 for pass
+} semihost_t;
+
+void semihost_init(semihost_t* semihost);
+
+/// Install the semihosting handler as opcode 0xA5 (1 byte, 1 cycle)
+void semihost_enable(mcs51_t* p, semihost_t* semihost);
@@ -0,0 +1,64 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct mcs51_t mcs51_t;
+
+#define STACK_CHAIN_MAX (16)
+
+/// A push outside the guarded stack region
+typedef struct stack_overflow_t {
+    uint64_t osc_period; /// State phase of the push
+    uint8_t sp;          /// SP after the push
+
+    /**
+     * chain[0] is the PC at the push (behind the pushing instruction, or the interrupted address for
+     * an interrupt), followed by the return addresses found on the stack, innermost first.
+     */
+    uint16_t chain[STACK_CHAIN_MAX];
+    uint8_t chain_length;
+} stack_overflow_t;
+
+/**
+ * Stack watermark and overflow detection.
+ *
+ * Every push (PUSH, ACALL, LCALL and the calls inserted by the interrupt controller) compares the
+ * new SP against a single threshold: Pushes below the high-water mark take no further action. A
+ * push above it raises the mark, or is an overflow if SP left [floor, ceiling]: Beyond the top of
+ * IDATA, wrapped past 0xFF, or below floor (into the register banks or the bit-addressable area in
+ * use, see stack_set_guard()). The overflow is recorded and execution continues like the hardware.
+ *
+ * The return addresses of the call chain are recovered from the stack: A pair of bytes is taken as
+ * a return address if it follows an ACALL or LCALL in CODE. Return addresses of interrupts are not
+ * recognized, and pushed data may look like a return address.
+ */
+typedef struct stack_guard_t {
+    uint8_t floor;   /// Lowest valid SP after a push, 0x08 after init (above register bank 0)
+    uint8_t ceiling; /// Highest valid SP after a push, the top of IDATA after init
+
+    void (*on_overflow)(mcs51_t* p, const stack_overflow_t* overflow); /// Optional, called on every overflow
+
+    uint8_t high_water;             /// Highest valid SP after a push since mcs51_init(), 0x07 without a push
+    uint64_t overflows;             /// Number of overflowing pushes since mcs51_init()
+    stack_overflow_t last_overflow;
+
+    uint16_t _check; /// Offset of SP from floor that takes the slow path, high_water - floor + 1
+} stack_guard_t;
+
+/**
+ * Guard the stack region [floor, ceiling], e.g. floor 0x30 if the firmware uses all register banks
+ * and the bit-addressable area. The high-water mark is kept.
+ */
+void stack_set_guard(mcs51_t* p, uint8_t floor, uint8_t ceiling);
+
+/// Return addresses on the stack from SP down to the floor, innermost first, see stack_guard_t
+uint8_t stack_unwind(const mcs51_t* p, uint16_t* chain, uint8_t max);
+
+void stack_print_overflow(const stack_overflow_t* overflow, FILE* file);
@@ -0,0 +1,37 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Piecewise linear mapping of the state phase count (mcs51_t._osc_periods) to emulated time.
+ *
+ * A state phase is one oscillator period in the standard (12-clock) mode and half an oscillator
+ * period in X2 (6-clock) mode, so the machine cycle stays 12 state phases and the engines and the
+ * scheduler are not aware of the clock mode. Every change of the oscillator frequency or of the
+ * clock mode starts a new segment. The time within a segment is computed from its start, the start
+ * keeps a fraction of 2^-32 ns, so no rounding error accumulates over the segments.
+ */
+typedef struct timebase_t {
+    uint64_t hertz;          /// Oscillator frequency of the current segment
+    uint8_t periods_per_osc; /// State phases per oscillator period: 1, or 2 in X2 mode
+
+    uint64_t start_periods;  /// State phase count at the start of the current segment
+    uint64_t start_ns;       /// Emulated time at start_periods
+    uint32_t start_fraction; /// In 2^-32 ns
+} timebase_t;
+
+void timebase_init(timebase_t* tb, uint64_t hertz);
+
+/// Start a new segment at periods (not before the start of the current segment)
+void timebase_change(timebase_t* tb, uint64_t periods, uint64_t hertz, uint8_t periods_per_osc);
+
+/// Emulated time in nanoseconds (rounded down) of a state phase count of the current segment
+uint64_t timebase_ns(const timebase_t* tb, uint64_t periods);
+
+/// First state phase count of the current segment at or after ns
+uint64_t timebase_periods(const timebase_t* tb, uint64_t ns);
@@ -0,0 +1,37 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Timer 0, 1 and 2 (8052) as scheduler clients (scheduler.h).
+ *
+ * A running timer is counted lazily: It increments in the last of every period oscillator periods,
+ * its count is start_count plus the increments since start_osc, written to TLx/THx when they are
+ * read (SFR read hook or mcs51_sync_timers()). Writes to TLx/THx, TMOD, TCON, T2CON and PCON
+ * restart the count. The overflow is a scheduled event, which sets TFx, reloads (mode 2, timer 2)
+ * and clocks the serial port.
+ */
+typedef struct mcs51_timer_t {
+    bool running;   /// TRx set and not in power-down mode
+    uint8_t mode;   /// TMOD mode the timer was started with, timer 2: 4 auto-reload, 5 baud rate generator
+    uint8_t period; /// State phases per increment (12, timer 2 baud rate generator 2, doubled by CKCON0 TxX2 in X2 mode)
+
+    uint32_t start_count; /// 13-bit, 16-bit or 8-bit count (mode 0, 1, 2) at start_osc
+    uint64_t start_osc;   /// Oscillator period of the (re)start, the start of a machine cycle
+
+    int event; /// Overflow event (scheduler handle)
+} mcs51_timer_t;
+
+/// Overflows that clock the serial port transmitter (T2CON.TCLK, BDRCON.TBCK)
+typedef enum mcs51_serial_clock_t
+{
+    MCS51_SERIAL_CLOCK_TIMER_1,
+    MCS51_SERIAL_CLOCK_TIMER_2,
+    MCS51_SERIAL_CLOCK_BRG, /// Internal baud rate generator of the AT89C51RD2
+} mcs51_serial_clock_t;
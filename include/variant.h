@@ -0,0 +1,35 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "sfr.h"
+#include <stdint.h>
+
+/**
+ * MCU variants (variants.md), selected by mcs51_init_variant():
+ * - 8051: Timer 0 and 1, serial port, 128 bytes IDATA
+ * - 8052: Adds Timer 2 (16-bit auto-reload and baud rate generator) and 256 bytes IDATA
+ * - AT89C51RD2: Adds the dual DPTR (AUXR1), 4 interrupt priority levels (IPH), the internal baud
+ *   rate generator (BRL, BDRCON), the watchdog (WDTRST, WDTPRG) and CKCON0
+ *
+ * The SFR maps and the indirect address maps are generated constant tables. The peripherals of a
+ * variant install their SFR hooks at init (mcs51_register_sfrs()), nothing is decided per instruction.
+ */
+typedef enum mcs51_variant_t
+{
+    MCS51_VARIANT_8051,
+    MCS51_VARIANT_8052,
+    MCS51_VARIANT_AT89C51RD2,
+    MCS51_VARIANT_COUNT,
+} mcs51_variant_t;
+
+typedef struct mcs51_variant_profile_t {
+    const char* name;
+    uint16_t idata_size; /// Bytes of IDATA including the DATA region (128 or 256)
+
+    const sfr_t* sfr_map;                  /// SFRs of the variant, unnamed entries are not implemented
+    const uint16_t* indirect_address_map; /// "Physical" DATA index of an indirect (@Ri) address
+} mcs51_variant_profile_t;
@@ -0,0 +1,88 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct mcs51_t mcs51_t;
+typedef struct vcd_signal_t vcd_signal_t;
+
+typedef uint32_t (*vcd_sampler_t)(mcs51_t* p, const vcd_signal_t* signal);
+
+typedef struct vcd_signal_t {
+    const char* name;
+    uint8_t width; /// Width in bits (1 - 32)
+
+    vcd_sampler_t sample;
+    uint8_t address; /// Sampler argument, e.g. the SFR address
+    uint8_t bit;     /// Sampler argument, e.g. the bit position
+
+    uint32_t value; /// Last value written to the dump
+    char id;        /// VCD identifier code
+} vcd_signal_t;
+
+#define VCD_MAX_SIGNALS (64)
+#define VCD_BUFFER_SIZE (0x10000)
+
+/**
+ * Value Change Dump (IEEE 1364) recorder.
+ *
+ * Signals are sampled after every oscillator period, but only changes are written.
+ * Timestamps are in nanoseconds of emulated time (see msc51_execution_time_ns()).
+ * The output is collected in an internal buffer and written to the file in large blocks.
+ *
+ * Usage:
+ *   vcd_init(&vcd, fopen("trace.vcd", "w"));
+ *   vcd_add_ale(&vcd);
+ *   vcd_add_sfr(&vcd, "P1", SFR_P1);
+ *   proc._vcd = &vcd;
+ *   ...
+ *   vcd_close(&vcd);
+ */
+typedef struct vcd_t {
+    FILE* file;
+
+    vcd_signal_t signals[VCD_MAX_SIGNALS];
+    uint8_t signal_count;
+
+    bool _header_written;
+    uint64_t _timestamp; /// Timestamp of the last value change block
+
+    char _buffer[VCD_BUFFER_SIZE];
+    size_t _buffer_used;
+} vcd_t;
+
+void vcd_init(vcd_t* vcd, FILE* file);
+
+bool vcd_add_signal(vcd_t* vcd, const char* name, uint8_t width, vcd_sampler_t sample, uint8_t address, uint8_t bit);
+
+/// Record a complete SFR or DATA byte, e.g. a port
+bool vcd_add_sfr(vcd_t* vcd, const char* name, uint8_t address);
+
+/// Record a single SFR bit, e.g. a port pin or TF0
+bool vcd_add_sfr_bit(vcd_t* vcd, const char* name, uint8_t address, uint8_t bit);
+
+/// Record the Address Latch Enable signal
+bool vcd_add_ale(vcd_t* vcd);
+
+/// Record the active ISR mask of the NVIC (6 bits, bit 5 is Timer 2)
+bool vcd_add_isr_active(vcd_t* vcd);
+
+/**
+ * Record the serial transmitter. The UART is modelled on character level, thus
+ * the transmitted byte (SBUF) and the transmit interrupt flag (TI) are recorded.
+ */
+bool vcd_add_serial_tx(vcd_t* vcd);
+
+void vcd_sample(vcd_t* vcd, mcs51_t* p);
+
+void vcd_flush(vcd_t* vcd);
+
+/// Flush and close the underlying file
+void vcd_close(vcd_t* vcd);
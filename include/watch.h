@@ -0,0 +1,49 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct mcs51_t mcs51_t;
+
+typedef enum watch_kind_t
+{
+    WATCH_READ = 0b01,
+    WATCH_WRITE = 0b10,
+    WATCH_READ_WRITE = WATCH_READ | WATCH_WRITE,
+} watch_kind_t;
+
+/**
+ * Watch callback. For reads old_value and new_value are the same.
+ */
+typedef void (*watch_fn_t)(mcs51_t* p, uint8_t address, watch_kind_t kind, uint8_t old_value, uint8_t new_value, void* ctx);
+
+typedef struct watch_t {
+    watch_fn_t fn; /// NULL for unused slots
+    void* ctx;
+
+    uint8_t address;
+    watch_kind_t kind;
+} watch_t;
+
+#define WATCH_MAX (16)
+
+/**
+ * Register a host watcher (memory watchpoint) for a directly addressable byte (DATA or SFR).
+ * Several watchers may be registered for the same address. Accesses by instructions are reported:
+ * Direct and bit addressing, and for DATA (0x00-0x7F) @R0/@R1 and the stack (PUSH, POP, calls,
+ * returns and interrupts). Not reported are the registers R0-R7 encoded in the opcode (e.g.
+ * MOV A, R7, INC R0, DJNZ R7 and the pointer read of @Ri), the accumulator of the encoding, and
+ * accesses of the host through D[].
+ *
+ * @return Watch handle or -1 if all WATCH_MAX slots are in use
+ */
+int watch_add(mcs51_t* p, uint8_t address, watch_kind_t kind, watch_fn_t fn, void* ctx);
+
+void watch_remove(mcs51_t* p, int handle);
+
+void watch_notify(mcs51_t* p, uint8_t address, watch_kind_t kind, uint8_t old_value, uint8_t new_value);
@@ -0,0 +1,42 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct mcs51_t mcs51_t;
+
+/**
+ * Hardware watchdog of the AT89C51RD2 family.
+ *
+ * Writing 0x1E and 0xE1 in sequence to WDTRST starts the watchdog, the same sequence services it.
+ * It expires (2^(14 + WTO) - 1) watchdog cycles after the last service, WTO is WDTPRG[2:0] at
+ * service time. Only a reset stops it; it keeps counting in IDLE and stops with the oscillator in
+ * power-down mode. Its clock (X2 mode and CKCON0.WDX2) is taken at service time.
+ *
+ * The expiry is a single scheduled event (scheduler.h), re-armed by every service.
+ */
+typedef struct watchdog_t {
+    uint64_t timeout_cycles; /// Overrides the WDTPRG time-out if not 0
+    bool reset_on_expiry;    /// Reset the MCU (PC = 0, SFRs) on expiry (default), otherwise the watchdog restarts
+    void (*on_expiry)(mcs51_t* p); /// Optional, called on every expiry before the reset
+
+    uint64_t expiries;    /// Number of expiries since mcs51_init()
+    uint64_t last_expiry; /// Oscillator period of the last expiry
+
+    bool _running;
+    bool _sequence;           /// 0x1E was written to WDTRST
+    uint64_t _frozen_cycles;  /// Power-down: Watchdog cycles left until the expiry, 0 if not frozen
+    uint64_t _period;         /// State phases per watchdog cycle
+    int _event;
+} watchdog_t;
+
+/// Watchdog cycles (machine cycles unless CKCON0.WDX2 in X2 mode) from a service to the expiry
+uint64_t watchdog_timeout_cycles(const mcs51_t* p);
+
+/// Watchdog cycles left until the expiry, UINT64_MAX if the watchdog is not running
+uint64_t watchdog_remaining_cycles(const mcs51_t* p);
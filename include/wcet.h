@@ -0,0 +1,75 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct mcs51_t mcs51_t;
+typedef struct cfg_t cfg_t;
+
+#define WCET_UNBOUNDED (UINT64_MAX)
+#define WCET_STACK_UNBOUNDED (UINT32_MAX)
+
+/// User-supplied bound of a loop
+typedef struct wcet_loop_bound_t {
+    uint16_t header;     /// Address of the loop header, the block the back edges jump to (e.g. a DJNZ to itself)
+    uint32_t iterations; /// Maximum number of taken back edges per entry of the loop
+} wcet_loop_bound_t;
+
+typedef struct wcet_function_t {
+    /**
+     * Worst-case machine cycles from the entry to the return, callees included, or WCET_UNBOUNDED
+     * (loop without bound, recursion, unresolved indirect jump, or no return at all). Interrupts add
+     * the 2 cycles of the call inserted by the interrupt controller.
+     */
+    uint64_t cycles;
+
+    /// Bytes pushed on top of the return address (PUSH, calls of callees), or WCET_STACK_UNBOUNDED
+    uint32_t stack;
+
+    uint8_t level; /// Interrupts: Priority level from IP (and IPH), 0 is the lowest
+} wcet_function_t;
+
+/**
+ * Static worst-case execution time and stack depth of a firmware image, from its CFG (cfg.h) and the
+ * cycle counts of opcodes.md.
+ *
+ * The WCET of a function is the longest path from its entry to a return. Natural loops are collapsed
+ * from the innermost: A loop costs iterations times its longest iteration, plus the longest path to
+ * an exit. Loops without a bound make the function unbounded and are listed in missing_bounds.
+ *
+ * The stack depth follows PUSH, POP and the calls along the paths of a function. Writes to SP (e.g.
+ * MOV SP, #immed) are not tracked. The program depth is the depth of the reset function plus the
+ * deepest interrupt of every priority level, as an interrupt is only preempted by a higher level.
+ * The levels are taken from IP and IPH of the MCU at the time of the analysis.
+ */
+typedef struct wcet_t {
+    wcet_function_t* functions; /// Parallel to cfg_t.functions
+    size_t function_count;
+
+    uint16_t* missing_bounds; /// Loop headers without a bound, by address
+    size_t missing_bound_count;
+
+    uint8_t levels;          /// Priority levels of the variant, 2 or 4 (IPH)
+    uint32_t level_stack[4]; /// Deepest interrupt of each level, return address included
+    uint32_t max_stack;      /// Reset function and one interrupt per level
+    uint8_t initial_sp;      /// SP after reset
+    uint16_t idata_size;
+} wcet_t;
+
+/**
+ * Analyze a CFG built from the MCU.
+ * @return false if out of memory
+ */
+bool wcet_analyze(wcet_t* wcet, const cfg_t* cfg, const mcs51_t* p, const wcet_loop_bound_t* bounds, size_t bound_count);
+
+void wcet_free(wcet_t* wcet);
+
+/// Write the analysis as a JSON object
+void wcet_write_json(const wcet_t* wcet, const cfg_t* cfg, const mcs51_t* p, FILE* file);
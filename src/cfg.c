@@ -0,0 +1,707 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "cfg.h"
+#include "coverage.h"
+#include "mcs51.h"
+#include "sfr_definitions_gen.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CFG_NO_FUNCTION (UINT32_MAX)
+
+/// Growable list of CODE addresses
+typedef struct cfg_addresses_t {
+    uint16_t* items;
+    size_t count;
+    size_t capacity;
+} cfg_addresses_t;
+
+/// Jump table entry of a resolved JMP @A+DPTR
+typedef struct cfg_table_entry_t {
+    uint16_t jump;
+    uint16_t entry;
+} cfg_table_entry_t;
+
+typedef struct cfg_decoded_t {
+    cfg_exit_t exit; /// CFG_EXIT_FALLTHROUGH for instructions without a control transfer
+    uint8_t bytes;
+    uint8_t cycles;
+    uint16_t target;
+} cfg_decoded_t;
+
+static bool cfg_test(const uint8_t* bitmap, uint16_t address)
+{
+    return bitmap[address >> 3] & (1 << (address & 0b111));
+}
+
+static void cfg_set(uint8_t* bitmap, uint16_t address)
+{
+    bitmap[address >> 3] |= 1 << (address & 0b111);
+}
+
+static bool cfg_addresses_push(cfg_addresses_t* list, uint16_t address)
+{
+    if (list->count == list->capacity)
+    {
+        size_t capacity = list->capacity ? 2 * list->capacity : 64;
+        uint16_t* items = realloc(list->items, capacity * sizeof(uint16_t));
+        if (!items)
+            return false;
+
+        list->items = items;
+        list->capacity = capacity;
+    }
+
+    list->items[list->count++] = address;
+    return true;
+}
+
+static int cfg_compare_addresses(const void* a, const void* b)
+{
+    return (int) *(const uint16_t*) a - (int) *(const uint16_t*) b;
+}
+
+static int cfg_compare_table_entries(const void* a, const void* b)
+{
+    const cfg_table_entry_t* x = a;
+    const cfg_table_entry_t* y = b;
+
+    if (x->jump != y->jump)
+        return (int) x->jump - (int) y->jump;
+
+    return (int) x->entry - (int) y->entry;
+}
+
+static cfg_decoded_t cfg_decode(const mcs51_t* p, uint16_t address)
+{
+    const uint8_t op = p->C[address];
+    const opcode_t* opcode = &p->opcode_map[op];
+
+    if (opcode->cycles == 0)
+        return (cfg_decoded_t){.exit = CFG_EXIT_UNIMPLEMENTED, .bytes = 1};
+
+    cfg_decoded_t d = {.exit = CFG_EXIT_FALLTHROUGH, .bytes = opcode->bytes, .cycles = opcode->cycles};
+    const uint16_t next = address + opcode->bytes;
+    const uint8_t arg1 = p->C[(uint16_t) (address + 1)];
+    const uint8_t arg2 = p->C[(uint16_t) (address + 2)];
+
+    // AJMP and ACALL: The 11-bit address lies in the 2K page of the next instruction
+    if ((op & 0x1F) == 0x01 || (op & 0x1F) == 0x11)
+    {
+        d.exit = (op & 0x1F) == 0x01 ? CFG_EXIT_JUMP : CFG_EXIT_CALL;
+        d.target = (next & 0xF800) | (op >> 5) << 8 | arg1;
+        return d;
+    }
+
+    switch (op)
+    {
+        case 0x02: // LJMP addr16
+        case 0x12: // LCALL addr16
+            d.exit = op == 0x02 ? CFG_EXIT_JUMP : CFG_EXIT_CALL;
+            d.target = arg1 << 8 | arg2;
+            break;
+        case 0x80: // SJMP offset
+            d.exit = CFG_EXIT_JUMP;
+            d.target = next + (int8_t) arg1;
+            break;
+        case 0x73: // JMP @A+DPTR
+            d.exit = CFG_EXIT_INDIRECT;
+            break;
+        case 0x22:
+            d.exit = CFG_EXIT_RET;
+            break;
+        case 0x32:
+            d.exit = CFG_EXIT_RETI;
+            break;
+        default:
+            if (coverage_branch_bytes[op] != 0)
+            {
+                // The offset is the last byte of the conditional branches
+                d.exit = CFG_EXIT_BRANCH;
+                d.target = next + (int8_t) p->C[(uint16_t) (address + coverage_branch_bytes[op] - 1)];
+            }
+            break;
+    }
+
+    return d;
+}
+
+/// Direct address written by the instruction, -1 if it writes none
+static int cfg_direct_destination(const mcs51_t* p, uint16_t address)
+{
+    const uint8_t op = p->C[address];
+
+    switch (op)
+    {
+        case 0x05: // INC direct
+        case 0x15: // DEC direct
+        case 0x42: // ORL direct, A
+        case 0x43: // ORL direct, #immed
+        case 0x52: // ANL direct, A
+        case 0x53: // ANL direct, #immed
+        case 0x62: // XRL direct, A
+        case 0x63: // XRL direct, #immed
+        case 0x75: // MOV direct, #immed
+        case 0xC5: // XCH A, direct
+        case 0xD0: // POP direct
+        case 0xD5: // DJNZ direct, offset
+        case 0xF5: // MOV direct, A
+            return p->C[(uint16_t) (address + 1)];
+        case 0x85: // MOV direct, direct (source first)
+            return p->C[(uint16_t) (address + 2)];
+        default:
+            break;
+    }
+
+    // MOV direct, @Ri and MOV direct, Rn
+    if (op >= 0x86 && op <= 0x8F)
+        return p->C[(uint16_t) (address + 1)];
+
+    return -1;
+}
+
+/// Entries of a jump table at base: A run of AJMP (2 bytes) or LJMP (3 bytes) reachable with an 8-bit A
+static size_t cfg_table_size(const mcs51_t* p, uint16_t base, uint8_t* entry_bytes)
+{
+    const uint8_t op = p->C[base];
+    *entry_bytes = (op & 0x1F) == 0x01 ? 2 : op == 0x02 ? 3 : 0;
+    if (*entry_bytes == 0)
+        return 0;
+
+    size_t entries = 0;
+    while (entries * *entry_bytes <= 0xFF)
+    {
+        const uint8_t entry_op = p->C[(uint16_t) (base + entries * *entry_bytes)];
+        if (*entry_bytes == 2 ? (entry_op & 0x1F) != 0x01 : entry_op != 0x02)
+            break;
+        entries++;
+    }
+
+    return entries;
+}
+
+/// Recursive descent from the roots: Marks the instructions, block leaders and call targets
+static bool cfg_disassemble(cfg_t* cfg, const mcs51_t* p, cfg_addresses_t* worklist, uint8_t* leader, uint8_t* callee, uint8_t* table_jump,
+                            cfg_table_entry_t** table, size_t* table_count)
+{
+    cfg_addresses_t unimplemented = {0};
+    cfg_addresses_t unresolved = {0};
+    size_t table_capacity = 0;
+    bool ok = true;
+
+    while (ok && worklist->count > 0)
+    {
+        uint16_t address = worklist->items[--worklist->count];
+        bool dptr_known = false;
+        uint16_t dptr = 0;
+
+        while (ok && !cfg_test(cfg->instruction, address))
+        {
+            cfg_set(cfg->instruction, address);
+
+            const cfg_decoded_t d = cfg_decode(p, address);
+            const uint16_t next = address + d.bytes;
+            bool stop = true;
+
+            // DPL, DPH or the DPTR selection (AUXR1.DPS) written
+            const int destination = cfg_direct_destination(p, address);
+            if (destination == SFR_DPL || destination == SFR_DPH || destination == SFR_AUXR1)
+                dptr_known = false;
+
+            switch (d.exit)
+            {
+                case CFG_EXIT_FALLTHROUGH:
+                    if (p->C[address] == 0x90) // MOV DPTR, #immed
+                    {
+                        dptr_known = true;
+                        dptr = p->C[(uint16_t) (address + 1)] << 8 | p->C[(uint16_t) (address + 2)];
+                    } else if (p->C[address] == 0xA3) // INC DPTR
+                    {
+                        dptr_known = false;
+                    }
+                    stop = false;
+                    break;
+                case CFG_EXIT_BRANCH:
+                    cfg_set(leader, d.target);
+                    cfg_set(leader, next);
+                    ok = cfg_addresses_push(worklist, d.target);
+                    stop = false;
+                    break;
+                case CFG_EXIT_CALL:
+                    cfg_set(leader, d.target);
+                    cfg_set(callee, d.target);
+                    cfg_set(leader, next);
+                    ok = cfg_addresses_push(worklist, d.target);
+                    dptr_known = false; // The callee may change DPTR
+                    stop = false;
+                    break;
+                case CFG_EXIT_JUMP:
+                    cfg_set(leader, d.target);
+                    ok = cfg_addresses_push(worklist, d.target);
+                    break;
+                case CFG_EXIT_INDIRECT: {
+                    uint8_t entry_bytes = 0;
+                    const size_t entries = dptr_known ? cfg_table_size(p, dptr, &entry_bytes) : 0;
+
+                    if (entries == 0)
+                    {
+                        ok = cfg_addresses_push(&unresolved, address);
+                        break;
+                    }
+
+                    cfg_set(table_jump, address);
+                    for (size_t i = 0; ok && i < entries; i++)
+                    {
+                        const uint16_t entry = dptr + i * entry_bytes;
+
+                        if (*table_count == table_capacity)
+                        {
+                            table_capacity = table_capacity ? 2 * table_capacity : 64;
+                            cfg_table_entry_t* items = realloc(*table, table_capacity * sizeof(cfg_table_entry_t));
+                            if (!items)
+                            {
+                                ok = false;
+                                break;
+                            }
+                            *table = items;
+                        }
+
+                        (*table)[(*table_count)++] = (cfg_table_entry_t){.jump = address, .entry = entry};
+                        cfg_set(leader, entry);
+                        ok = cfg_addresses_push(worklist, entry);
+                    }
+                    break;
+                }
+                case CFG_EXIT_UNIMPLEMENTED:
+                    ok = cfg_addresses_push(&unimplemented, address);
+                    break;
+                default:
+                    break;
+            }
+
+            if (stop)
+                break;
+
+            address = next;
+        }
+    }
+
+    qsort(unimplemented.items, unimplemented.count, sizeof(uint16_t), &cfg_compare_addresses);
+    qsort(unresolved.items, unresolved.count, sizeof(uint16_t), &cfg_compare_addresses);
+    qsort(*table, *table_count, sizeof(cfg_table_entry_t), &cfg_compare_table_entries);
+
+    cfg->unimplemented = unimplemented.items;
+    cfg->unimplemented_count = unimplemented.count;
+    cfg->unresolved = unresolved.items;
+    cfg->unresolved_count = unresolved.count;
+
+    return ok;
+}
+
+/// Split the decoded instructions into blocks, ordered by address
+static bool cfg_build_blocks(cfg_t* cfg, const mcs51_t* p, const uint8_t* leader, const uint8_t* table_jump)
+{
+    size_t capacity = 0;
+    cfg_block_t* current = 0;
+
+    for (uint32_t address = 0; address < 0x10000; address++)
+    {
+        if (!cfg_test(cfg->instruction, address))
+            continue;
+
+        if (!current || cfg_test(leader, address) || current->end != address || current->exit != CFG_EXIT_FALLTHROUGH)
+        {
+            if (cfg->block_count == capacity)
+            {
+                capacity = capacity ? 2 * capacity : 256;
+                cfg_block_t* blocks = realloc(cfg->blocks, capacity * sizeof(cfg_block_t));
+                if (!blocks)
+                    return false;
+                cfg->blocks = blocks;
+            }
+
+            current = &cfg->blocks[cfg->block_count++];
+            *current = (cfg_block_t){.start = address, .function = CFG_NO_FUNCTION};
+        }
+
+        const cfg_decoded_t d = cfg_decode(p, address);
+
+        current->last = address;
+        current->end = address + d.bytes;
+        current->instructions++;
+        current->cycles += d.cycles;
+        current->exit = d.exit == CFG_EXIT_INDIRECT && cfg_test(table_jump, address) ? CFG_EXIT_TABLE : d.exit;
+        current->target = d.target;
+
+        for (uint8_t i = 0; i < d.bytes; i++)
+            cfg->_block_of[(uint16_t) (address + i)] = (int32_t) (cfg->block_count - 1);
+    }
+
+    return true;
+}
+
+static bool cfg_add_edge(cfg_t* cfg, size_t* capacity, uint32_t from, uint16_t to_address, cfg_edge_kind_t kind)
+{
+    const int32_t to = cfg_block_at(cfg, to_address);
+
+    // A target inside another instruction (overlapping code) has no block of its own
+    if (to < 0 || cfg->blocks[to].start != to_address)
+        return true;
+
+    if (cfg->edge_count == *capacity)
+    {
+        *capacity = *capacity ? 2 * *capacity : 256;
+        cfg_edge_t* edges = realloc(cfg->edges, *capacity * sizeof(cfg_edge_t));
+        if (!edges)
+            return false;
+        cfg->edges = edges;
+    }
+
+    cfg->edges[cfg->edge_count++] = (cfg_edge_t){.from = from, .to = (uint32_t) to, .kind = kind};
+    cfg->blocks[from].edge_count++;
+    return true;
+}
+
+static bool cfg_build_edges(cfg_t* cfg, const cfg_table_entry_t* table, size_t table_count)
+{
+    size_t capacity = 0;
+    size_t t = 0;
+    bool ok = true;
+
+    for (uint32_t b = 0; ok && b < cfg->block_count; b++)
+    {
+        cfg_block_t* block = &cfg->blocks[b];
+        block->first_edge = cfg->edge_count;
+
+        switch (block->exit)
+        {
+            case CFG_EXIT_FALLTHROUGH:
+                ok = cfg_add_edge(cfg, &capacity, b, block->end, CFG_EDGE_FALLTHROUGH);
+                break;
+            case CFG_EXIT_JUMP:
+                ok = cfg_add_edge(cfg, &capacity, b, block->target, CFG_EDGE_JUMP);
+                break;
+            case CFG_EXIT_BRANCH:
+                ok = cfg_add_edge(cfg, &capacity, b, block->target, CFG_EDGE_TAKEN) && cfg_add_edge(cfg, &capacity, b, block->end, CFG_EDGE_FALLTHROUGH);
+                break;
+            case CFG_EXIT_CALL:
+                ok = cfg_add_edge(cfg, &capacity, b, block->target, CFG_EDGE_CALL) && cfg_add_edge(cfg, &capacity, b, block->end, CFG_EDGE_RETURN);
+                break;
+            case CFG_EXIT_TABLE:
+                // The table entries are sorted by the address of the jump, like the blocks
+                while (t < table_count && table[t].jump < block->last)
+                    t++;
+                for (; ok && t < table_count && table[t].jump == block->last; t++)
+                    ok = cfg_add_edge(cfg, &capacity, b, table[t].entry, CFG_EDGE_TABLE);
+                break;
+            default:
+                break;
+        }
+    }
+
+    return ok;
+}
+
+static bool cfg_add_function(cfg_t* cfg, size_t* capacity, uint8_t* entries, uint16_t entry, cfg_function_kind_t kind, uint8_t interrupt)
+{
+    const int32_t block = cfg_block_at(cfg, entry);
+    if (cfg_test(entries, entry) || block < 0 || cfg->blocks[block].start != entry)
+        return true;
+
+    if (cfg->function_count == *capacity)
+    {
+        *capacity = *capacity ? 2 * *capacity : 64;
+        cfg_function_t* functions = realloc(cfg->functions, *capacity * sizeof(cfg_function_t));
+        if (!functions)
+            return false;
+        cfg->functions = functions;
+    }
+
+    cfg_set(entries, entry);
+    cfg->functions[cfg->function_count++] = (cfg_function_t){.entry = entry, .kind = kind, .interrupt = interrupt, .entry_block = (uint32_t) block};
+    return true;
+}
+
+/// Blocks of every function: Reachable from the entry without following calls
+static bool cfg_build_functions(cfg_t* cfg)
+{
+    uint8_t* visited = calloc(cfg->block_count, 1);
+    uint32_t* stack = malloc((cfg->edge_count + 1) * sizeof(uint32_t));
+    if (!visited || !stack)
+    {
+        free(visited);
+        free(stack);
+        return false;
+    }
+
+    for (uint32_t f = 0; f < cfg->function_count; f++)
+    {
+        cfg_function_t* function = &cfg->functions[f];
+        size_t depth = 0;
+
+        memset(visited, 0, cfg->block_count);
+        stack[depth++] = function->entry_block;
+
+        while (depth > 0)
+        {
+            const uint32_t b = stack[--depth];
+            if (visited[b])
+                continue;
+
+            visited[b] = 1;
+            function->block_count++;
+
+            cfg_block_t* block = &cfg->blocks[b];
+            if (block->function == CFG_NO_FUNCTION)
+                block->function = f;
+
+            for (uint32_t e = block->first_edge; e < block->first_edge + block->edge_count; e++)
+            {
+                if (cfg->edges[e].kind != CFG_EDGE_CALL && !visited[cfg->edges[e].to])
+                    stack[depth++] = cfg->edges[e].to;
+            }
+        }
+    }
+
+    free(visited);
+    free(stack);
+    return true;
+}
+
+bool cfg_build(cfg_t* cfg, const mcs51_t* p, const uint16_t* roots, size_t root_count)
+{
+    memset(cfg, 0, sizeof(*cfg));
+
+    static const size_t bitmap_size = 0x10000 / 8;
+    uint8_t* leader = calloc(bitmap_size, 1);
+    uint8_t* callee = calloc(bitmap_size, 1);
+    uint8_t* table_jump = calloc(bitmap_size, 1);
+    uint8_t* entries = calloc(bitmap_size, 1);
+    cfg->_block_of = malloc(0x10000 * sizeof(int32_t));
+
+    cfg_addresses_t worklist = {0};
+    cfg_table_entry_t* table = 0;
+    size_t table_count = 0;
+    bool ok = leader && callee && table_jump && entries && cfg->_block_of;
+
+    if (ok)
+    {
+        for (uint32_t i = 0; i < 0x10000; i++)
+            cfg->_block_of[i] = -1;
+
+        // Roots: Reset, the interrupt vectors of the variant and the host roots
+        ok &= cfg_addresses_push(&worklist, 0x0000);
+        for (unsigned int i = 0; i < sizeof(p->_nvic.map) / sizeof(p->_nvic.map[0]); i++)
+        {
+            if (p->_nvic.map[i].bit_mask & p->_nvic._sources)
+                ok &= cfg_addresses_push(&worklist, p->_nvic.map[i].vector);
+        }
+        for (size_t i = 0; i < root_count; i++)
+            ok &= cfg_addresses_push(&worklist, roots[i]);
+
+        for (size_t i = 0; i < worklist.count; i++)
+            cfg_set(leader, worklist.items[i]);
+    }
+
+    ok = ok && cfg_disassemble(cfg, p, &worklist, leader, callee, table_jump, &table, &table_count);
+    ok = ok && cfg_build_blocks(cfg, p, leader, table_jump);
+    ok = ok && cfg_build_edges(cfg, table, table_count);
+
+    if (ok)
+    {
+        size_t capacity = 0;
+
+        ok &= cfg_add_function(cfg, &capacity, entries, 0x0000, CFG_FUNCTION_RESET, 0);
+        for (unsigned int i = 0; i < sizeof(p->_nvic.map) / sizeof(p->_nvic.map[0]); i++)
+        {
+            if (p->_nvic.map[i].bit_mask & p->_nvic._sources)
+                ok &= cfg_add_function(cfg, &capacity, entries, p->_nvic.map[i].vector, CFG_FUNCTION_INTERRUPT, i);
+        }
+        for (size_t i = 0; i < root_count; i++)
+            ok &= cfg_add_function(cfg, &capacity, entries, roots[i], CFG_FUNCTION_ROOT, 0);
+        for (uint32_t address = 0; address < 0x10000; address++)
+        {
+            if (cfg_test(callee, address))
+                ok &= cfg_add_function(cfg, &capacity, entries, address, CFG_FUNCTION_CALL, 0);
+        }
+    }
+
+    ok = ok && cfg_build_functions(cfg);
+
+    free(leader);
+    free(callee);
+    free(table_jump);
+    free(entries);
+    free(worklist.items);
+    free(table);
+
+    if (!ok)
+        cfg_free(cfg);
+
+    return ok;
+}
+
+void cfg_free(cfg_t* cfg)
+{
+    free(cfg->blocks);
+    free(cfg->edges);
+    free(cfg->functions);
+    free(cfg->unimplemented);
+    free(cfg->unresolved);
+    free(cfg->_block_of);
+    memset(cfg, 0, sizeof(*cfg));
+}
+
+int32_t cfg_block_at(const cfg_t* cfg, uint16_t address)
+{
+    return cfg->_block_of ? cfg->_block_of[address] : -1;
+}
+
+int32_t cfg_function_at(const cfg_t* cfg, uint16_t entry)
+{
+    for (size_t i = 0; i < cfg->function_count; i++)
+    {
+        if (cfg->functions[i].entry == entry)
+            return (int32_t) i;
+    }
+
+    return -1;
+}
+
+int cfg_format_instruction(const mcs51_t* p, uint16_t address, char* buffer, size_t size)
+{
+    const uint8_t op = p->C[address];
+    const opcode_t* opcode = &p->opcode_map[op];
+    const uint16_t next = address + (opcode->bytes ? opcode->bytes : 1);
+    const char* args[3] = {opcode->arg1, opcode->arg2, opcode->arg3};
+
+    // Operand bytes in the order of the arguments, MOV direct, direct encodes the source first
+    uint8_t operand[3] = {1, 2, 3};
+    if (op == 0x85)
+    {
+        operand[0] = 2;
+        operand[1] = 1;
+    }
+
+    int length = snprintf(buffer, size, "%s", opcode->mnemonic);
+    uint8_t o = 0;
+
+    for (unsigned int i = 0; i < 3 && args[i] && args[i][0] != '\0'; i++)
+    {
+        const uint8_t byte = p->C[(uint16_t) (address + operand[o])];
+        char text[32];
+
+        if (strcmp(args[i], "addr11") == 0)
+            snprintf(text, sizeof(text), "0x%04X", (next & 0xF800) | (op >> 5) << 8 | byte), o++;
+        else if (strcmp(args[i], "addr16") == 0 || (strcmp(args[i], "#immed") == 0 && op == 0x90))
+            snprintf(text, sizeof(text), "%s0x%04X", args[i][0] == '#' ? "#" : "", byte << 8 | p->C[(uint16_t) (address + operand[o] + 1)]), o += 2;
+        else if (strcmp(args[i], "#immed") == 0)
+            snprintf(text, sizeof(text), "#0x%02X", byte), o++;
+        else if (strcmp(args[i], "offset") == 0)
+            snprintf(text, sizeof(text), "0x%04X", (uint16_t) (next + (int8_t) byte)), o++;
+        else if (strcmp(args[i], "direct") == 0 && byte >= 0x80 && p->sfr_map[byte].name)
+            snprintf(text, sizeof(text), "%s", p->sfr_map[byte].name), o++;
+        else if (strcmp(args[i], "direct") == 0 || strcmp(args[i], "bit") == 0)
+            snprintf(text, sizeof(text), "0x%02X", byte), o++;
+        else if (strcmp(args[i], "/bit") == 0)
+            snprintf(text, sizeof(text), "/0x%02X", byte), o++;
+        else
+            snprintf(text, sizeof(text), "%s", args[i]);
+
+        if (length >= 0 && (size_t) length < size)
+            length += snprintf(buffer + length, size - length, "%s%s", i == 0 ? " " : ", ", text);
+    }
+
+    return length;
+}
+
+static const char* cfg_edge_kind_name(cfg_edge_kind_t kind)
+{
+    switch (kind)
+    {
+        case CFG_EDGE_FALLTHROUGH: return "fallthrough";
+        case CFG_EDGE_JUMP: return "jump";
+        case CFG_EDGE_TAKEN: return "taken";
+        case CFG_EDGE_CALL: return "call";
+        case CFG_EDGE_RETURN: return "return";
+        case CFG_EDGE_TABLE: return "table";
+    }
+
+    return "?";
+}
+
+static const char* cfg_function_kind_name(cfg_function_kind_t kind)
+{
+    switch (kind)
+    {
+        case CFG_FUNCTION_RESET: return "reset";
+        case CFG_FUNCTION_INTERRUPT: return "interrupt";
+        case CFG_FUNCTION_ROOT: return "root";
+        case CFG_FUNCTION_CALL: return "function";
+    }
+
+    return "?";
+}
+
+void cfg_print(const cfg_t* cfg, const mcs51_t* p, FILE* file)
+{
+    for (size_t b = 0; b < cfg->block_count; b++)
+    {
+        const cfg_block_t* block = &cfg->blocks[b];
+
+        const int32_t f = cfg_function_at(cfg, block->start);
+        if (f >= 0)
+        {
+            const cfg_function_t* function = &cfg->functions[f];
+            fprintf(file, "\n; %s %04X", cfg_function_kind_name(function->kind), function->entry);
+            if (function->kind == CFG_FUNCTION_INTERRUPT)
+                fprintf(file, " %s", p->_nvic.map[function->interrupt].name);
+            fprintf(file, ", %u blocks\n", function->block_count);
+        }
+
+        fprintf(file, "L_%04X:\n", block->start);
+
+        uint16_t address = block->start;
+        for (uint16_t i = 0; i < block->instructions; i++)
+        {
+            char text[64];
+            cfg_format_instruction(p, address, text, sizeof(text));
+            fprintf(file, "    %04X  %s\n", address, text);
+
+            const uint8_t bytes = p->opcode_map[p->C[address]].bytes;
+            address += bytes ? bytes : 1;
+        }
+
+        if (block->exit == CFG_EXIT_UNIMPLEMENTED)
+            fprintf(file, "    ; unimplemented opcode\n");
+        else if (block->exit == CFG_EXIT_INDIRECT)
+            fprintf(file, "    ; unresolved indirect jump\n");
+
+        for (uint32_t e = block->first_edge; e < block->first_edge + block->edge_count; e++)
+            fprintf(file, "    ; -> L_%04X (%s)\n", cfg->blocks[cfg->edges[e].to].start, cfg_edge_kind_name(cfg->edges[e].kind));
+    }
+}
+
+void cfg_write_dot(const cfg_t* cfg, FILE* file)
+{
+    fprintf(file, "digraph cfg {\n    node [shape=box, fontname=monospace];\n");
+
+    for (size_t b = 0; b < cfg->block_count; b++)
+    {
+        const cfg_block_t* block = &cfg->blocks[b];
+        fprintf(file, "    L_%04X [label=\"%04X-%04X\\n%u instructions, %u cycles\"];\n", block->start, block->start, block->last,
+                block->instructions, block->cycles);
+    }
+
+    for (size_t e = 0; e < cfg->edge_count; e++)
+    {
+        const cfg_edge_t* edge = &cfg->edges[e];
+        fprintf(file, "    L_%04X -> L_%04X [label=\"%s\"%s];\n", cfg->blocks[edge->from].start, cfg->blocks[edge->to].start,
+                cfg_edge_kind_name(edge->kind), edge->kind == CFG_EDGE_CALL ? ", style=dashed" : "");
+    }
+
+    fprintf(file, "}\n");
+}
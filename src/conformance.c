@@ -0,0 +1,549 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "conformance.h"
+#include "conformance_model.h"
+#include "mcs51_helpers.h"
+#include "opcode_map_gen.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONFORMANCE_MAX_REPORTS (16) /// Failing cases printed per run
+
+/// Per-thread state, allocate it on the heap (it holds a mcs51_t and the instrumentation)
+typedef struct conformance_worker_t {
+    pthread_t thread;
+    const conformance_config_t* config;
+    uint64_t first_index;
+    uint64_t stride;
+
+    mcs51_t proc;
+    uint8_t pristine[sizeof(((mcs51_t*) 0)->D)]; /// DATA/SFRs after reset
+    instruction_register_t pristine_ir;
+    nvic_t pristine_nvic;
+
+    conformance_model_t model;
+    uint8_t model_xdata[0x10000];
+
+    profile_t profile;
+    coverage_t coverage;
+    memprofile_t memprofile;
+
+    conformance_result_t result;
+} conformance_worker_t;
+
+static pthread_mutex_t s_report_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int s_reports;
+
+const char* conformance_engine_name(unsigned int engine)
+{
+    static const char* const names[] = {
+            [MCS51_ENGINE_PLAIN] = "plain",
+            [MCS51_ENGINE_TRACE] = "trace",
+            [MCS51_ENGINE_PROFILE] = "profile",
+            [MCS51_ENGINE_COVERAGE] = "coverage",
+            [MCS51_ENGINE_FUZZ] = "fuzz",
+            [MCS51_ENGINE_MEMORY] = "memory",
+            [CONFORMANCE_ENGINE_PHASE] = "phase",
+    };
+
+    return engine <= CONFORMANCE_ENGINE_PHASE ? names[engine] : "unknown";
+}
+
+/// splitmix64
+static uint64_t next_random(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint8_t random_direct(uint64_t* random)
+{
+    static const uint8_t sfrs[] = {CONFORMANCE_MODEL_ACC, CONFORMANCE_MODEL_B, CONFORMANCE_MODEL_PSW,
+                                   CONFORMANCE_MODEL_DPL, CONFORMANCE_MODEL_DPH};
+    uint64_t value = next_random(random);
+
+    if (value % 8 == 0)
+        return sfrs[(value >> 8) % sizeof(sfrs)];
+    return (value >> 8) & 0x7F;
+}
+
+static uint8_t random_bit(uint64_t* random)
+{
+    static const uint8_t sfrs[] = {CONFORMANCE_MODEL_ACC, CONFORMANCE_MODEL_B, CONFORMANCE_MODEL_PSW};
+    uint64_t value = next_random(random);
+
+    if (value % 8 == 0)
+        return sfrs[(value >> 8) % sizeof(sfrs)] | ((value >> 16) & 0b111);
+    return (value >> 8) & 0x7F;
+}
+
+/// Mostly short branches, so that control flow stays within the case
+static uint8_t random_offset(uint64_t* random)
+{
+    uint64_t value = next_random(random);
+
+    if (value % 4 != 0)
+        return (uint8_t) ((int8_t) ((value >> 8) % 33) - 16);
+    return value >> 8;
+}
+
+void conformance_generate(uint64_t seed, uint64_t index, uint8_t max_instructions, conformance_case_t* c)
+{
+    uint64_t random = seed ^ (index * 0xD1B54A32D192ED03ULL);
+
+    if (max_instructions == 0 || max_instructions > CONFORMANCE_MAX_INSTRUCTIONS)
+        max_instructions = CONFORMANCE_MAX_INSTRUCTIONS;
+
+    memset(c, 0, sizeof(*c));
+    c->index = index;
+
+    for (unsigned int i = 0; i < sizeof(c->iram); i += 8)
+    {
+        uint64_t value = next_random(&random);
+        memcpy(&c->iram[i], &value, 8);
+    }
+
+    uint64_t value = next_random(&random);
+    c->acc = value >> 0;
+    c->b = value >> 8;
+    c->psw = value >> 16;
+    c->dpl = value >> 24;
+    c->dph = value >> 32;
+    c->p2 = value >> 40;
+    c->sp = value >> 48;
+
+    value = next_random(&random);
+    c->count = 1 + value % max_instructions;
+    c->origin = (value >> 8) % (0x10000 - 3 * CONFORMANCE_MAX_INSTRUCTIONS);
+
+    for (uint8_t i = 0; i < c->count; i++)
+    {
+        conformance_instruction_t* instruction = &c->instructions[i];
+        const opcode_t* opcode;
+
+        do
+            opcode = &opcode_map[next_random(&random) & 0xFF];
+        while (opcode->bytes == 0);
+
+        instruction->length = opcode->bytes;
+        instruction->bytes[0] = opcode->code;
+
+        // Operands in encoding order
+        const char* args[] = {opcode->arg1, opcode->arg2, opcode->arg3};
+        uint8_t slot = 1;
+
+        for (unsigned int a = 0; a < 3 && slot < opcode->bytes; a++)
+        {
+            const char* arg = args[a];
+            uint8_t remaining = opcode->bytes - slot;
+
+            if (strcmp(arg, "direct") == 0)
+                instruction->bytes[slot++] = random_direct(&random);
+            else if (strcmp(arg, "bit") == 0 || strcmp(arg, "/bit") == 0)
+                instruction->bytes[slot++] = random_bit(&random);
+            else if (strcmp(arg, "offset") == 0)
+                instruction->bytes[slot++] = random_offset(&random);
+            else if (strcmp(arg, "addr16") == 0)
+            {
+                uint16_t target = next_random(&random);
+                if (target % 4 != 0)
+                    target = c->origin + (target >> 2) % (3 * c->count);
+                instruction->bytes[slot++] = target >> 8;
+                instruction->bytes[slot++] = target & 0xFF;
+            } else if (strcmp(arg, "#immed") == 0 && a + 1 < 3 && args[a + 1][0] == '\0' && remaining == 2)
+            {
+                // MOV DPTR, #immed16
+                uint16_t immed = next_random(&random);
+                instruction->bytes[slot++] = immed >> 8;
+                instruction->bytes[slot++] = immed & 0xFF;
+            } else if (strcmp(arg, "#immed") == 0 || strcmp(arg, "addr11") == 0)
+                instruction->bytes[slot++] = next_random(&random);
+        }
+
+        while (slot < opcode->bytes)
+            instruction->bytes[slot++] = next_random(&random);
+    }
+}
+
+void conformance_print_case(const conformance_case_t* c, FILE* file)
+{
+    uint16_t address = c->origin;
+
+    fprintf(file, "Case %llu:\n", (unsigned long long) c->index);
+
+    for (uint8_t i = 0; i < c->count; i++)
+    {
+        const conformance_instruction_t* instruction = &c->instructions[i];
+        const opcode_t* opcode = &opcode_map[instruction->bytes[0]];
+
+        fprintf(file, "  %04X:", address);
+        for (uint8_t b = 0; b < 3; b++)
+        {
+            if (b < instruction->length)
+                fprintf(file, " %02X", instruction->bytes[b]);
+            else
+                fprintf(file, "   ");
+        }
+        fprintf(file, "  %s %s %s %s\n", opcode->mnemonic, opcode->arg1, opcode->arg2, opcode->arg3);
+
+        address += instruction->length;
+    }
+
+    fprintf(file, "  A=%02X B=%02X PSW=%02X SP=%02X DPTR=%02X%02X P2=%02X\n",
+            c->acc, c->b, c->psw, c->sp, c->dph, c->dpl, c->p2);
+}
+
+/// Write the instructions to CODE, the rest of CODE is zero (NOP)
+static uint16_t conformance_layout(conformance_worker_t* w, const conformance_case_t* c, bool* writes_xdata)
+{
+    uint16_t address = c->origin;
+
+    *writes_xdata = false;
+
+    for (uint8_t i = 0; i < c->count; i++)
+    {
+        const conformance_instruction_t* instruction = &c->instructions[i];
+
+        for (uint8_t b = 0; b < instruction->length; b++)
+        {
+            uint8_t byte = instruction->bytes[b];
+
+            // Jumps may execute operand bytes as opcodes
+            *writes_xdata |= byte == 0xF0 || byte == 0xF2 || byte == 0xF3;
+            w->proc.C[address++] = byte;
+        }
+    }
+
+    return address - c->origin;
+}
+
+static void conformance_load_model(conformance_worker_t* w, const conformance_case_t* c)
+{
+    conformance_model_t* m = &w->model;
+
+    m->pc = c->origin;
+    m->cycles = 0;
+    m->code = w->proc.C;
+    m->xdata = w->model_xdata;
+    m->xdata_log_count = 0;
+    m->xdata_log_overflow = false;
+
+    memcpy(m->iram, c->iram, sizeof(m->iram));
+    memcpy(m->sfr, &w->pristine[0x80], sizeof(m->sfr));
+    m->sfr[CONFORMANCE_MODEL_ACC - 0x80] = c->acc;
+    m->sfr[CONFORMANCE_MODEL_B - 0x80] = c->b;
+    m->sfr[CONFORMANCE_MODEL_PSW - 0x80] = c->psw;
+    m->sfr[CONFORMANCE_MODEL_SP - 0x80] = c->sp;
+    m->sfr[CONFORMANCE_MODEL_DPL - 0x80] = c->dpl;
+    m->sfr[CONFORMANCE_MODEL_DPH - 0x80] = c->dph;
+    m->sfr[CONFORMANCE_MODEL_P2 - 0x80] = c->p2;
+}
+
+static void conformance_load_proc(conformance_worker_t* w, const conformance_case_t* c, unsigned int engine)
+{
+    mcs51_t* p = &w->proc;
+
+    memcpy(p->D, w->pristine, sizeof(p->D));
+    memcpy(&p->D[0x00], &c->iram[0x00], 0x80);
+    memcpy(&p->D[0x100], &c->iram[0x80], 0x80);
+    p->D[SFR_ACC] = c->acc;
+    p->D[SFR_B] = c->b;
+    p->D[SFR_PSW] = c->psw;
+    p->D[SFR_SP] = c->sp;
+    p->D[SFR_DPL] = c->dpl;
+    p->D[SFR_DPH] = c->dph;
+    p->D[SFR_P2] = c->p2;
+
+    p->PC = c->origin;
+    p->_osc_periods = 0;
+    p->_instruction_register = w->pristine_ir;
+    p->_nvic = w->pristine_nvic;
+    p->_psw_dirty = false;
+    p->_sfr_dirty_sbuf = false;
+    update_register_bank(p);
+
+    p->_engine = engine == CONFORMANCE_ENGINE_PHASE ? MCS51_ENGINE_PLAIN : (mcs51_engine_t) engine;
+}
+
+static bool conformance_compare(conformance_worker_t* w, bool writes_xdata, unsigned int engine, FILE* out)
+{
+    mcs51_t* p = &w->proc;
+    conformance_model_t* m = &w->model;
+    bool equal = true;
+
+    mcs51_sync_psw(p);
+
+#define CONFORMANCE_EXPECT(condition, ...)                                   \
+    do {                                                                     \
+        if (!(condition))                                                    \
+        {                                                                    \
+            equal = false;                                                   \
+            if (out)                                                         \
+            {                                                                \
+                fprintf(out, "  %s: ", conformance_engine_name(engine));     \
+                fprintf(out, __VA_ARGS__);                                   \
+                fprintf(out, "\n");                                          \
+            }                                                                \
+        }                                                                    \
+    } while (false)
+
+    CONFORMANCE_EXPECT(p->PC == m->pc, "PC %04X, expected %04X", p->PC, m->pc);
+    CONFORMANCE_EXPECT(p->_osc_periods == 12 * m->cycles, "%llu cycles, expected %llu",
+                       (unsigned long long) p->_osc_periods / 12, (unsigned long long) m->cycles);
+
+    for (unsigned int i = 0; i < 0x100; i++)
+    {
+        uint8_t actual = p->D[i < 0x80 ? i : 0x100 + i - 0x80];
+        CONFORMANCE_EXPECT(actual == m->iram[i], "I:%02X = %02X, expected %02X", i, actual, m->iram[i]);
+    }
+
+    for (unsigned int i = 0x80; i < 0x100; i++)
+    {
+        uint8_t expected = i == CONFORMANCE_MODEL_PSW ? conformance_model_psw(m) : m->sfr[i - 0x80];
+        CONFORMANCE_EXPECT(p->D[i] == expected, "SFR %02X = %02X, expected %02X", i, p->D[i], expected);
+    }
+
+    // Only MOVX writes XDATA
+    if (writes_xdata && memcmp(p->X, m->xdata, sizeof(p->X)) != 0)
+    {
+        for (unsigned int i = 0; i < sizeof(p->X); i++)
+            CONFORMANCE_EXPECT(p->X[i] == m->xdata[i], "X:%04X = %02X, expected %02X", i, p->X[i], m->xdata[i]);
+
+        memset(p->X, 0, sizeof(p->X));
+    }
+
+#undef CONFORMANCE_EXPECT
+
+    return equal;
+}
+
+/// Undo the XDATA writes of the case
+static void conformance_clear_xdata(uint8_t* xdata, const conformance_model_t* m)
+{
+    if (m->xdata_log_overflow)
+    {
+        memset(xdata, 0, 0x10000);
+        return;
+    }
+
+    for (uint8_t i = 0; i < m->xdata_log_count; i++)
+        xdata[m->xdata_log[i]] = 0;
+}
+
+/**
+ * Execute a case with the model and the engines.
+ * @return Bit mask of the engines that do not match the model
+ */
+static uint32_t conformance_check(conformance_worker_t* w, const conformance_case_t* c, uint32_t engines, uint64_t* executed, FILE* out)
+{
+    mcs51_t* p = &w->proc;
+    bool writes_xdata;
+    uint16_t length = conformance_layout(w, c, &writes_xdata);
+    uint32_t failing = 0;
+
+    conformance_load_model(w, c);
+
+    *executed = 0;
+    while (*executed < c->count && conformance_model_step(&w->model))
+        (*executed)++;
+
+    for (unsigned int engine = 0; *executed > 0 && engine <= CONFORMANCE_ENGINE_PHASE; engine++)
+    {
+        if (!(engines & (1U << engine)))
+            continue;
+
+        conformance_load_proc(w, c, engine);
+
+        uint64_t end = 12 * w->model.cycles;
+
+        if (engine == CONFORMANCE_ENGINE_PHASE)
+        {
+            while (p->_osc_periods < end)
+                msc51_do_osc_period(p);
+        } else
+            msc51_run(p, end);
+
+        if (!conformance_compare(w, writes_xdata, engine, out))
+            failing |= 1U << engine;
+
+        conformance_clear_xdata(p->X, &w->model);
+    }
+
+    conformance_clear_xdata(w->model_xdata, &w->model);
+    memset(&p->C[c->origin], 0, length);
+
+    return failing;
+}
+
+/// Remove instructions as long as the case keeps failing
+static void conformance_shrink(conformance_worker_t* w, conformance_case_t* c, uint32_t engines)
+{
+    static __thread conformance_case_t candidate;
+    uint64_t executed;
+    bool progress = true;
+
+    while (progress)
+    {
+        progress = false;
+
+        for (uint8_t i = 0; i < c->count && c->count > 1; i++)
+        {
+            candidate = *c;
+            memmove(&candidate.instructions[i], &candidate.instructions[i + 1],
+                    (candidate.count - i - 1) * sizeof(conformance_instruction_t));
+            candidate.count--;
+
+            if (conformance_check(w, &candidate, engines, &executed, NULL))
+            {
+                *c = candidate;
+                progress = true;
+                i--;
+            }
+        }
+    }
+}
+
+static void conformance_report(conformance_worker_t* w, const conformance_case_t* c, uint32_t engines)
+{
+    FILE* report = w->config->report;
+    uint64_t executed;
+
+    pthread_mutex_lock(&s_report_mutex);
+
+    if (s_reports < CONFORMANCE_MAX_REPORTS)
+    {
+        s_reports++;
+        conformance_print_case(c, report);
+        conformance_check(w, c, engines, &executed, report);
+        fflush(report);
+    }
+
+    pthread_mutex_unlock(&s_report_mutex);
+}
+
+static void* conformance_worker(void* arg)
+{
+    conformance_worker_t* w = arg;
+    const conformance_config_t* config = w->config;
+    conformance_case_t c;
+
+    for (uint64_t index = w->first_index; index < config->cases; index += w->stride)
+    {
+        uint64_t executed;
+
+        conformance_generate(config->seed, index, config->max_instructions, &c);
+        uint32_t failing = conformance_check(w, &c, config->engines, &executed, NULL);
+
+        w->result.cases++;
+        w->result.instructions += executed;
+
+        if (!failing)
+            continue;
+
+        conformance_shrink(w, &c, failing);
+        failing = conformance_check(w, &c, config->engines, &executed, NULL);
+
+        if (w->result.failures++ == 0)
+        {
+            w->result.first_failure = c;
+            w->result.first_failure_engines = failing;
+        }
+
+        if (config->report)
+            conformance_report(w, &c, failing);
+    }
+
+    return NULL;
+}
+
+static conformance_worker_t* conformance_worker_new(const conformance_config_t* config, uint64_t first_index, uint64_t stride)
+{
+    conformance_worker_t* w = calloc(1, sizeof(conformance_worker_t));
+
+    if (!w)
+        return NULL;
+
+    w->config = config;
+    w->first_index = first_index;
+    w->stride = stride;
+
+    mcs51_init(&w->proc);
+    w->proc._profile = &w->profile;
+    w->proc._coverage = &w->coverage;
+    w->proc._memprofile = &w->memprofile;
+
+    mcs51_sync_psw(&w->proc);
+    memcpy(w->pristine, w->proc.D, sizeof(w->pristine));
+    w->pristine_ir = w->proc._instruction_register;
+    w->pristine_nvic = w->proc._nvic;
+
+    return w;
+}
+
+static void conformance_merge(conformance_result_t* result, const conformance_result_t* worker)
+{
+    if (worker->failures > 0 && (result->failures == 0 || worker->first_failure.index < result->first_failure.index))
+    {
+        result->first_failure = worker->first_failure;
+        result->first_failure_engines = worker->first_failure_engines;
+    }
+
+    result->cases += worker->cases;
+    result->instructions += worker->instructions;
+    result->failures += worker->failures;
+}
+
+conformance_result_t conformance_run(const conformance_config_t* config)
+{
+    conformance_result_t result = {};
+    unsigned int workers = config->workers > 0 ? config->workers : 1;
+    conformance_worker_t** threads = calloc(workers, sizeof(conformance_worker_t*));
+    bool allocated = threads != NULL;
+
+    for (unsigned int i = 0; allocated && i < workers; i++)
+    {
+        threads[i] = conformance_worker_new(config, i, workers);
+        allocated = threads[i] != NULL;
+    }
+
+    if (!allocated)
+    {
+        for (unsigned int i = 0; threads && i < workers; i++)
+            free(threads[i]);
+
+        free(threads);
+        result.error = true;
+        return result;
+    }
+
+    pthread_mutex_lock(&s_report_mutex);
+    s_reports = 0;
+    pthread_mutex_unlock(&s_report_mutex);
+
+    if (config->workers == 0)
+    {
+        conformance_worker(threads[0]);
+    } else
+    {
+        for (unsigned int i = 0; i < workers; i++)
+            pthread_create(&threads[i]->thread, NULL, &conformance_worker, threads[i]);
+
+        for (unsigned int i = 0; i < workers; i++)
+            pthread_join(threads[i]->thread, NULL);
+    }
+
+    for (unsigned int i = 0; i < workers; i++)
+    {
+        conformance_merge(&result, &threads[i]->result);
+        free(threads[i]);
+    }
+
+    free(threads);
+    return result;
+}
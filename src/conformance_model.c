@@ -0,0 +1,662 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "conformance_model.h"
+
+#define PSW_CY (0x80)
+#define PSW_AC (0x40)
+#define PSW_OV (0x04)
+#define PSW_P  (0x01)
+
+#define SFR(address) (m->sfr[(address) - 0x80])
+#define ACC          SFR(CONFORMANCE_MODEL_ACC)
+#define SP           SFR(CONFORMANCE_MODEL_SP)
+
+/// An operand in DATA/SFR space (direct) or IDATA space (@Ri)
+typedef struct location_t {
+    bool indirect;
+    uint8_t address;
+} location_t;
+
+bool conformance_model_direct_supported(uint8_t address)
+{
+    return address < 0x80
+           || address == CONFORMANCE_MODEL_ACC
+           || address == CONFORMANCE_MODEL_B
+           || address == CONFORMANCE_MODEL_PSW
+           || address == CONFORMANCE_MODEL_DPL
+           || address == CONFORMANCE_MODEL_DPH;
+}
+
+bool conformance_model_bit_supported(uint8_t bit)
+{
+    uint8_t byte = bit & 0xF8;
+
+    return bit < 0x80
+           || byte == CONFORMANCE_MODEL_ACC
+           || byte == CONFORMANCE_MODEL_B
+           || byte == CONFORMANCE_MODEL_PSW;
+}
+
+static uint8_t parity(uint8_t value)
+{
+    value ^= value >> 4;
+    value ^= value >> 2;
+    value ^= value >> 1;
+    return value & 1;
+}
+
+uint8_t conformance_model_psw(const conformance_model_t* m)
+{
+    return (SFR(CONFORMANCE_MODEL_PSW) & ~PSW_P) | parity(ACC);
+}
+
+static bool carry(const conformance_model_t* m)
+{
+    return SFR(CONFORMANCE_MODEL_PSW) & PSW_CY;
+}
+
+static void set_flag(conformance_model_t* m, uint8_t flag, bool value)
+{
+    if (value)
+        SFR(CONFORMANCE_MODEL_PSW) |= flag;
+    else
+        SFR(CONFORMANCE_MODEL_PSW) &= ~flag;
+}
+
+static uint8_t register_address(const conformance_model_t* m, uint8_t n)
+{
+    uint8_t bank = (SFR(CONFORMANCE_MODEL_PSW) >> 3) & 0b11;
+    return bank * 8 + n;
+}
+
+static uint8_t read_direct(const conformance_model_t* m, uint8_t address)
+{
+    if (address < 0x80)
+        return m->iram[address];
+    if (address == CONFORMANCE_MODEL_PSW)
+        return conformance_model_psw(m);
+    return SFR(address);
+}
+
+static void write_direct(conformance_model_t* m, uint8_t address, uint8_t value)
+{
+    if (address < 0x80)
+        m->iram[address] = value;
+    else
+        SFR(address) = value;
+}
+
+static uint8_t read(const conformance_model_t* m, location_t location)
+{
+    return location.indirect ? m->iram[location.address] : read_direct(m, location.address);
+}
+
+static void write(conformance_model_t* m, location_t location, uint8_t value)
+{
+    if (location.indirect)
+        m->iram[location.address] = value;
+    else
+        write_direct(m, location.address, value);
+}
+
+static uint8_t bit_byte(uint8_t bit)
+{
+    return bit < 0x80 ? 0x20 + bit / 8 : bit & 0xF8;
+}
+
+static bool read_bit(const conformance_model_t* m, uint8_t bit)
+{
+    return (read_direct(m, bit_byte(bit)) >> (bit % 8)) & 1;
+}
+
+static void write_bit(conformance_model_t* m, uint8_t bit, bool value)
+{
+    uint8_t byte = read_direct(m, bit_byte(bit));
+    uint8_t mask = 1 << (bit % 8);
+
+    write_direct(m, bit_byte(bit), value ? byte | mask : byte & ~mask);
+}
+
+static uint16_t dptr(const conformance_model_t* m)
+{
+    return (SFR(CONFORMANCE_MODEL_DPH) << 8) | SFR(CONFORMANCE_MODEL_DPL);
+}
+
+static void write_xdata(conformance_model_t* m, uint16_t address, uint8_t value)
+{
+    m->xdata[address] = value;
+
+    if (m->xdata_log_count < sizeof(m->xdata_log) / sizeof(m->xdata_log[0]))
+        m->xdata_log[m->xdata_log_count++] = address;
+    else
+        m->xdata_log_overflow = true;
+}
+
+static void push(conformance_model_t* m, uint8_t value)
+{
+    SP++;
+    m->iram[SP] = value;
+}
+
+static uint8_t pop(conformance_model_t* m)
+{
+    return m->iram[SP--];
+}
+
+/// Operand of the columns 4-F: 4 A, 5 direct, 6-7 @Ri, 8-F Rn
+static location_t location(const conformance_model_t* m, uint8_t opcode, uint8_t arg)
+{
+    uint8_t column = opcode & 0x0F;
+
+    if (column == 4)
+        return (location_t){.address = CONFORMANCE_MODEL_ACC};
+    if (column == 5)
+        return (location_t){.address = arg};
+    if (column < 8)
+        return (location_t){.indirect = true, .address = m->iram[register_address(m, column & 1)]};
+    return (location_t){.address = register_address(m, column & 7)};
+}
+
+static uint8_t add(conformance_model_t* m, uint8_t a, uint8_t b, uint8_t c)
+{
+    bool carry_7 = a + b + c > 0xFF;
+    bool carry_6 = (a & 0x7F) + (b & 0x7F) + c > 0x7F;
+
+    set_flag(m, PSW_CY, carry_7);
+    set_flag(m, PSW_AC, (a & 0x0F) + (b & 0x0F) + c > 0x0F);
+    set_flag(m, PSW_OV, carry_6 != carry_7);
+
+    return a + b + c;
+}
+
+static uint8_t subb(conformance_model_t* m, uint8_t a, uint8_t b, uint8_t c)
+{
+    bool borrow_7 = a - b - c < 0;
+    bool borrow_6 = (a & 0x7F) - (b & 0x7F) - c < 0;
+
+    set_flag(m, PSW_CY, borrow_7);
+    set_flag(m, PSW_AC, (a & 0x0F) - (b & 0x0F) - c < 0);
+    set_flag(m, PSW_OV, borrow_6 != borrow_7);
+
+    return a - b - c;
+}
+
+/// Does the instruction stay within the modelled subset?
+static bool supported(uint8_t opcode, uint8_t arg1, uint8_t arg2)
+{
+    uint8_t column = opcode & 0x0F;
+
+    if (opcode == 0xA5)
+        return false;
+
+    // Direct operand in the first argument byte
+    bool direct = column == 5
+                  || (opcode >= 0x86 && opcode <= 0x8F)
+                  || (opcode >= 0xA6 && opcode <= 0xAF)
+                  || opcode == 0x42 || opcode == 0x43 || opcode == 0x52 || opcode == 0x53
+                  || opcode == 0x62 || opcode == 0x63 || opcode == 0xC0 || opcode == 0xD0;
+
+    if (direct && !conformance_model_direct_supported(arg1))
+        return false;
+
+    // MOV direct, direct: source, destination
+    if (opcode == 0x85 && !conformance_model_direct_supported(arg2))
+        return false;
+
+    bool bit = opcode == 0x10 || opcode == 0x20 || opcode == 0x30 || opcode == 0x72 || opcode == 0x82
+               || opcode == 0x92 || opcode == 0xA0 || opcode == 0xA2 || opcode == 0xB0 || opcode == 0xB2
+               || opcode == 0xC2 || opcode == 0xD2;
+
+    if (bit && !conformance_model_bit_supported(arg1))
+        return false;
+
+    return true;
+}
+
+/// Columns 0-3: Jumps, calls, bit operations, rotations and the remaining special cases
+static void step_special(conformance_model_t* m, uint8_t opcode, uint8_t arg1, uint8_t arg2, uint16_t* next, uint8_t* cycles)
+{
+    uint16_t pc = m->pc;
+    int8_t rel2 = (int8_t) arg1; // offset of a 2 byte instruction
+    int8_t rel3 = (int8_t) arg2; // offset of a 3 byte instruction
+
+    // AJMP, ACALL
+    if ((opcode & 0x0F) == 0x01)
+    {
+        *next = pc + 2;
+        *cycles = 2;
+
+        if (opcode & 0x10)
+        {
+            push(m, *next & 0xFF);
+            push(m, *next >> 8);
+        }
+
+        *next = (*next & 0xF800) | ((opcode >> 5) << 8) | arg1;
+        return;
+    }
+
+    switch (opcode)
+    {
+        case 0x00: // NOP
+            *next = pc + 1;
+            *cycles = 1;
+            break;
+        case 0x02: // LJMP addr16
+            *next = (arg1 << 8) | arg2;
+            *cycles = 2;
+            break;
+        case 0x03: // RR A
+            ACC = (ACC >> 1) | (ACC << 7);
+            *next = pc + 1;
+            *cycles = 1;
+            break;
+        case 0x10: // JBC bit, rel
+            *next = pc + 3;
+            *cycles = 2;
+            if (read_bit(m, arg1))
+            {
+                write_bit(m, arg1, false);
+                *next += rel3;
+            }
+            break;
+        case 0x12: // LCALL addr16
+            *next = pc + 3;
+            *cycles = 2;
+            push(m, *next & 0xFF);
+            push(m, *next >> 8);
+            *next = (arg1 << 8) | arg2;
+            break;
+        case 0x13: // RRC A
+        {
+            bool c = ACC & 1;
+            ACC = (ACC >> 1) | (carry(m) << 7);
+            set_flag(m, PSW_CY, c);
+            *next = pc + 1;
+            *cycles = 1;
+            break;
+        }
+        case 0x20: // JB bit, rel
+        case 0x30: // JNB bit, rel
+            *next = pc + 3;
+            *cycles = 2;
+            if (read_bit(m, arg1) == (opcode == 0x20))
+                *next += rel3;
+            break;
+        case 0x22: // RET
+        case 0x32: // RETI (no interrupt in progress)
+        {
+            uint8_t high = pop(m);
+            uint8_t low = pop(m);
+            *next = (high << 8) | low;
+            *cycles = 2;
+            break;
+        }
+        case 0x23: // RL A
+            ACC = (ACC << 1) | (ACC >> 7);
+            *next = pc + 1;
+            *cycles = 1;
+            break;
+        case 0x33: // RLC A
+        {
+            bool c = ACC & 0x80;
+            ACC = (ACC << 1) | carry(m);
+            set_flag(m, PSW_CY, c);
+            *next = pc + 1;
+            *cycles = 1;
+            break;
+        }
+        case 0x40: // JC rel
+        case 0x50: // JNC rel
+            *next = pc + 2;
+            *cycles = 2;
+            if (carry(m) == (opcode == 0x40))
+                *next += rel2;
+            break;
+        case 0x60: // JZ rel
+        case 0x70: // JNZ rel
+            *next = pc + 2;
+            *cycles = 2;
+            if ((ACC == 0) == (opcode == 0x60))
+                *next += rel2;
+            break;
+        case 0x80: // SJMP rel
+            *next = pc + 2 + rel2;
+            *cycles = 2;
+            break;
+        case 0x42: // ORL direct, A
+        case 0x52: // ANL direct, A
+        case 0x62: // XRL direct, A
+        case 0x43: // ORL direct, #immed
+        case 0x53: // ANL direct, #immed
+        case 0x63: // XRL direct, #immed
+        {
+            uint8_t operand = opcode & 1 ? arg2 : ACC;
+            uint8_t value = read_direct(m, arg1);
+
+            if (opcode >> 4 == 4)
+                value |= operand;
+            else if (opcode >> 4 == 5)
+                value &= operand;
+            else
+                value ^= operand;
+
+            write_direct(m, arg1, value);
+            *next = pc + 2 + (opcode & 1);
+            *cycles = 1 + (opcode & 1);
+            break;
+        }
+        case 0x72: // ORL C, bit
+        case 0xA0: // ORL C, /bit
+            set_flag(m, PSW_CY, carry(m) || read_bit(m, arg1) != (opcode == 0xA0));
+            *next = pc + 2;
+            *cycles = 2;
+            break;
+        case 0x82: // ANL C, bit
+        case 0xB0: // ANL C, /bit
+            set_flag(m, PSW_CY, carry(m) && read_bit(m, arg1) != (opcode == 0xB0));
+            *next = pc + 2;
+            *cycles = 2;
+            break;
+        case 0x73: // JMP @A+DPTR
+            *next = ACC + dptr(m);
+            *cycles = 2;
+            break;
+        case 0x83: // MOVC A, @A+PC
+            *next = pc + 1;
+            ACC = m->code[(uint16_t) (ACC + *next)];
+            *cycles = 2;
+            break;
+        case 0x90: // MOV DPTR, #immed16
+            SFR(CONFORMANCE_MODEL_DPH) = arg1;
+            SFR(CONFORMANCE_MODEL_DPL) = arg2;
+            *next = pc + 3;
+            *cycles = 2;
+            break;
+        case 0x92: // MOV bit, C
+            write_bit(m, arg1, carry(m));
+            *next = pc + 2;
+            *cycles = 2;
+            break;
+        case 0x93: // MOVC A, @A+DPTR
+            ACC = m->code[(uint16_t) (ACC + dptr(m))];
+            *next = pc + 1;
+            *cycles = 2;
+            break;
+        case 0xA2: // MOV C, bit
+            set_flag(m, PSW_CY, read_bit(m, arg1));
+            *next = pc + 2;
+            *cycles = 1;
+            break;
+        case 0xA3: // INC DPTR
+        {
+            uint16_t value = dptr(m) + 1;
+            SFR(CONFORMANCE_MODEL_DPH) = value >> 8;
+            SFR(CONFORMANCE_MODEL_DPL) = value & 0xFF;
+            *next = pc + 1;
+            *cycles = 2;
+            break;
+        }
+        case 0xB2: // CPL bit
+            write_bit(m, arg1, !read_bit(m, arg1));
+            *next = pc + 2;
+            *cycles = 1;
+            break;
+        case 0xB3: // CPL C
+            set_flag(m, PSW_CY, !carry(m));
+            *next = pc + 1;
+            *cycles = 1;
+            break;
+        case 0xC0: // PUSH direct
+            push(m, read_direct(m, arg1));
+            *next = pc + 2;
+            *cycles = 2;
+            break;
+        case 0xC2: // CLR bit
+        case 0xD2: // SETB bit
+            write_bit(m, arg1, opcode == 0xD2);
+            *next = pc + 2;
+            *cycles = 1;
+            break;
+        case 0xC3: // CLR C
+        case 0xD3: // SETB C
+            set_flag(m, PSW_CY, opcode == 0xD3);
+            *next = pc + 1;
+            *cycles = 1;
+            break;
+        case 0xD0: // POP direct
+            write_direct(m, arg1, pop(m));
+            *next = pc + 2;
+            *cycles = 2;
+            break;
+        case 0xE0: // MOVX A, @DPTR
+            ACC = m->xdata[dptr(m)];
+            *next = pc + 1;
+            *cycles = 2;
+            break;
+        case 0xE2: // MOVX A, @Ri
+        case 0xE3:
+            ACC = m->xdata[(SFR(CONFORMANCE_MODEL_P2) << 8) | m->iram[register_address(m, opcode & 1)]];
+            *next = pc + 1;
+            *cycles = 2;
+            break;
+        case 0xF0: // MOVX @DPTR, A
+            write_xdata(m, dptr(m), ACC);
+            *next = pc + 1;
+            *cycles = 2;
+            break;
+        case 0xF2: // MOVX @Ri, A
+        case 0xF3:
+            write_xdata(m, (SFR(CONFORMANCE_MODEL_P2) << 8) | m->iram[register_address(m, opcode & 1)], ACC);
+            *next = pc + 1;
+            *cycles = 2;
+            break;
+    }
+}
+
+/// Columns 4-F: The operand (A, direct, @Ri or Rn) is selected by the column, the operation by the row
+static void step_operand(conformance_model_t* m, uint8_t opcode, uint8_t arg1, uint8_t arg2, uint16_t* next, uint8_t* cycles)
+{
+    uint16_t pc = m->pc;
+    uint8_t column = opcode & 0x0F;
+    location_t operand = location(m, opcode, arg1);
+    uint8_t length = column == 4 || column == 5 ? 2 : 1; // Operand byte
+    uint8_t source = column == 4 ? arg1 : read(m, operand); // #immed replaces A in the ALU rows
+
+    *cycles = 1;
+
+    switch (opcode >> 4)
+    {
+        case 0x0: // INC
+            write(m, operand, read(m, operand) + 1);
+            length = column == 5 ? 2 : 1;
+            break;
+        case 0x1: // DEC
+            write(m, operand, read(m, operand) - 1);
+            length = column == 5 ? 2 : 1;
+            break;
+        case 0x2: // ADD A, src
+            ACC = add(m, ACC, source, 0);
+            break;
+        case 0x3: // ADDC A, src
+            ACC = add(m, ACC, source, carry(m));
+            break;
+        case 0x4: // ORL A, src
+            ACC |= source;
+            break;
+        case 0x5: // ANL A, src
+            ACC &= source;
+            break;
+        case 0x6: // XRL A, src
+            ACC ^= source;
+            break;
+        case 0x7: // MOV dst, #immed
+            if (column == 4)
+                ACC = arg1;
+            else if (column == 5)
+            {
+                write_direct(m, arg1, arg2);
+                length = 3;
+                *cycles = 2;
+            } else
+            {
+                write(m, operand, arg1);
+                length = 2;
+            }
+            break;
+        case 0x8:
+            if (column == 4) // DIV AB, A and B are undefined (unchanged) for B = 0
+            {
+                uint8_t divisor = SFR(CONFORMANCE_MODEL_B);
+                set_flag(m, PSW_OV, divisor == 0);
+                if (divisor != 0)
+                {
+                    uint8_t dividend = ACC;
+                    ACC = dividend / divisor;
+                    SFR(CONFORMANCE_MODEL_B) = dividend % divisor;
+                }
+                set_flag(m, PSW_CY, false);
+                length = 1;
+                *cycles = 4;
+            } else if (column == 5) // MOV direct, direct (source first)
+            {
+                write_direct(m, arg2, read_direct(m, arg1));
+                length = 3;
+                *cycles = 2;
+            } else // MOV direct, @Ri / Rn
+            {
+                write_direct(m, arg1, source);
+                length = 2;
+                *cycles = 2;
+            }
+            break;
+        case 0x9: // SUBB A, src
+            ACC = subb(m, ACC, source, carry(m));
+            break;
+        case 0xA:
+            if (column == 4) // MUL AB
+            {
+                uint16_t product = ACC * SFR(CONFORMANCE_MODEL_B);
+                ACC = product & 0xFF;
+                SFR(CONFORMANCE_MODEL_B) = product >> 8;
+                set_flag(m, PSW_OV, product > 0xFF);
+                set_flag(m, PSW_CY, false);
+                length = 1;
+                *cycles = 4;
+            } else // MOV @Ri / Rn, direct
+            {
+                write(m, operand, read_direct(m, arg1));
+                length = 2;
+                *cycles = 2;
+            }
+            break;
+        case 0xB: // CJNE dst, src, rel
+        {
+            uint8_t left = column < 6 ? ACC : read(m, operand);
+            uint8_t right = column == 5 ? read_direct(m, arg1) : arg1;
+            int8_t rel = (int8_t) arg2;
+
+            set_flag(m, PSW_CY, left < right);
+            length = 3;
+            *cycles = 2;
+            if (left != right)
+                pc += rel;
+            break;
+        }
+        case 0xC:
+            if (column == 4) // SWAP A
+            {
+                ACC = (ACC << 4) | (ACC >> 4);
+            } else // XCH A, src
+            {
+                write(m, operand, ACC);
+                ACC = source;
+            }
+            length = column == 5 ? 2 : 1;
+            break;
+        case 0xD:
+            if (column == 4) // DA A
+            {
+                uint16_t value = ACC;
+                if ((value & 0x0F) > 9 || (SFR(CONFORMANCE_MODEL_PSW) & PSW_AC))
+                {
+                    value += 0x06;
+                    if (value > 0xFF)
+                        set_flag(m, PSW_CY, true);
+                    value &= 0xFF;
+                }
+                if ((value >> 4) > 9 || carry(m))
+                {
+                    value += 0x60;
+                    if (value > 0xFF)
+                        set_flag(m, PSW_CY, true);
+                }
+                ACC = value;
+                length = 1;
+            } else if (column == 5) // DJNZ direct, rel
+            {
+                uint8_t value = read_direct(m, arg1) - 1;
+                write_direct(m, arg1, value);
+                length = 3;
+                *cycles = 2;
+                if (value != 0)
+                    pc += (int8_t) arg2;
+            } else if (column < 8) // XCHD A, @Ri
+            {
+                uint8_t value = read(m, operand);
+                write(m, operand, (value & 0xF0) | (ACC & 0x0F));
+                ACC = (ACC & 0xF0) | (value & 0x0F);
+            } else // DJNZ Rn, rel
+            {
+                uint8_t value = read(m, operand) - 1;
+                write(m, operand, value);
+                length = 2;
+                *cycles = 2;
+                if (value != 0)
+                    pc += (int8_t) arg1;
+            }
+            break;
+        case 0xE:
+            if (column == 4) // CLR A
+            {
+                ACC = 0;
+                length = 1;
+            } else // MOV A, src
+                ACC = source;
+            break;
+        case 0xF:
+            if (column == 4) // CPL A
+                ACC = ~ACC;
+            else // MOV dst, A
+                write(m, operand, ACC);
+            length = column == 5 ? 2 : 1;
+            break;
+    }
+
+    *next = pc + length;
+}
+
+bool conformance_model_step(conformance_model_t* m)
+{
+    uint8_t opcode = m->code[m->pc];
+    uint8_t arg1 = m->code[(uint16_t) (m->pc + 1)];
+    uint8_t arg2 = m->code[(uint16_t) (m->pc + 2)];
+
+    if (!supported(opcode, arg1, arg2))
+        return false;
+
+    uint16_t next = 0;
+    uint8_t cycles = 0;
+
+    if ((opcode & 0x0F) < 4)
+        step_special(m, opcode, arg1, arg2, &next, &cycles);
+    else
+        step_operand(m, opcode, arg1, arg2, &next, &cycles);
+
+    m->pc = next;
+    m->cycles += cycles;
+    return true;
+}
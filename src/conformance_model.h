@@ -0,0 +1,58 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Reference model of the MCS51 instruction set for the conformance tests (conformance.h).
+ *
+ * The model is written from the instruction set manual and shares no code with the emulator:
+ * Instructions are decoded from the opcode bit patterns, flags are computed arithmetically instead
+ * of through the lazy PSW and the flag tables, and the cycle counts are part of the decoder.
+ *
+ * It covers the CPU core only (no timers, serial port or interrupts). Instructions that would touch
+ * anything else are rejected by conformance_model_step() before they change the state:
+ * - direct addresses other than DATA and ACC, B, PSW, DPL, DPH
+ * - bit addresses other than the bit-addressable DATA and the bits of ACC, B and PSW
+ * - the reserved opcode 0xA5
+ */
+typedef struct conformance_model_t {
+    uint16_t pc;
+    uint8_t iram[0x100]; /// DATA (0x00-0x7F) and IDATA (0x80-0xFF)
+    uint8_t sfr[0x80];   /// SFRs 0x80-0xFF, the parity flag is derived from ACC on every read
+    const uint8_t* code; /// 64 KB
+    uint8_t* xdata;      /// 64 KB
+    uint64_t cycles;     /// Machine cycles
+
+    uint16_t xdata_log[64]; /// XDATA addresses written, to undo the writes cheaply
+    uint8_t xdata_log_count;
+    bool xdata_log_overflow;
+} conformance_model_t;
+
+#define CONFORMANCE_MODEL_ACC (0xE0)
+#define CONFORMANCE_MODEL_B   (0xF0)
+#define CONFORMANCE_MODEL_PSW (0xD0)
+#define CONFORMANCE_MODEL_SP  (0x81)
+#define CONFORMANCE_MODEL_DPL (0x82)
+#define CONFORMANCE_MODEL_DPH (0x83)
+#define CONFORMANCE_MODEL_P2  (0xA0)
+
+/// Direct addresses the generator may use
+bool conformance_model_direct_supported(uint8_t address);
+
+/// Bit addresses the generator may use
+bool conformance_model_bit_supported(uint8_t bit);
+
+/// PSW including the parity flag
+uint8_t conformance_model_psw(const conformance_model_t* m);
+
+/**
+ * Execute one instruction.
+ * @return false if the instruction is outside of the modelled subset, the state is unchanged
+ */
+bool conformance_model_step(conformance_model_t* m);
@@ -0,0 +1,246 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "coverage.h"
+#include <stdlib.h>
+#include <string.h>
+
+const uint8_t coverage_branch_bytes[0x100] = {
+        [0x10] = 3, // JBC bit, offset
+        [0x20] = 3, // JB bit, offset
+        [0x30] = 3, // JNB bit, offset
+        [0x40] = 2, // JC offset
+        [0x50] = 2, // JNC offset
+        [0x60] = 2, // JZ offset
+        [0x70] = 2, // JNZ offset
+        [0xB4 ... 0xBF] = 3, // CJNE
+        [0xD5] = 3, // DJNZ direct, offset
+        [0xD8 ... 0xDF] = 2, // DJNZ Rn, offset
+};
+
+void coverage_reset(coverage_t* coverage)
+{
+    memset(coverage, 0, sizeof(*coverage));
+}
+
+static uint32_t coverage_count(const uint8_t* bitmap)
+{
+    uint32_t count = 0;
+
+    for (unsigned int i = 0; i < 0x10000 / 8; i++)
+        count += __builtin_popcount(bitmap[i]);
+
+    return count;
+}
+
+uint32_t coverage_count_executed(const coverage_t* coverage)
+{
+    return coverage_count(coverage->executed);
+}
+
+uint32_t coverage_count_branch_outcomes(const coverage_t* coverage)
+{
+    return coverage_count(coverage->branch_taken) + coverage_count(coverage->branch_not_taken);
+}
+
+void coverage_merge(coverage_t* dst, const coverage_t* src)
+{
+    for (unsigned int i = 0; i < 0x10000 / 8; i++)
+    {
+        dst->executed[i] |= src->executed[i];
+        dst->branch_taken[i] |= src->branch_taken[i];
+        dst->branch_not_taken[i] |= src->branch_not_taken[i];
+    }
+}
+
+bool coverage_save(const coverage_t* coverage, FILE* file)
+{
+    return fwrite(coverage, sizeof(*coverage), 1, file) == 1;
+}
+
+bool coverage_merge_file(coverage_t* coverage, FILE* file)
+{
+    // On the heap, merges may run concurrently
+    coverage_t* other = malloc(sizeof(coverage_t));
+    if (!other)
+        return false;
+
+    const bool ok = fread(other, sizeof(*other), 1, file) == 1;
+    if (ok)
+        coverage_merge(coverage, other);
+
+    free(other);
+    return ok;
+}
+
+static uint32_t coverage_map_file_index(coverage_map_t* map, const char* name)
+{
+    for (size_t i = 0; i < map->file_count; i++)
+    {
+        if (strcmp(map->files[i], name) == 0)
+            return i;
+    }
+
+    map->files = realloc(map->files, (map->file_count + 1) * sizeof(*map->files));
+    map->files[map->file_count] = strdup(name);
+    return map->file_count++;
+}
+
+static int coverage_line_compare(const void* a, const void* b)
+{
+    const coverage_line_t* x = a;
+    const coverage_line_t* y = b;
+
+    if (x->file != y->file)
+        return x->file < y->file ? -1 : 1;
+    if (x->line != y->line)
+        return x->line < y->line ? -1 : 1;
+    return (int) x->address - (int) y->address;
+}
+
+bool coverage_map_load(coverage_map_t* map, FILE* file)
+{
+    *map = (coverage_map_t){};
+
+    char line[512];
+    char name[256];
+    unsigned int address;
+    unsigned int line_number;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\0')
+            continue;
+
+        if (sscanf(line, "L %x %255s %u", &address, name, &line_number) == 3 && address <= 0xFFFF)
+        {
+            map->lines = realloc(map->lines, (map->line_count + 1) * sizeof(*map->lines));
+            map->lines[map->line_count++] = (coverage_line_t){
+                    .address = address,
+                    .file = coverage_map_file_index(map, name),
+                    .line = line_number,
+            };
+        } else if (sscanf(line, "F %x %255s", &address, name) == 2 && address <= 0xFFFF)
+        {
+            map->symbols = realloc(map->symbols, (map->symbol_count + 1) * sizeof(*map->symbols));
+            map->symbols[map->symbol_count++] = (coverage_symbol_t){.address = address, .name = strdup(name)};
+        } else
+        {
+            coverage_map_free(map);
+            return false;
+        }
+    }
+
+    if (map->line_count > 0)
+        qsort(map->lines, map->line_count, sizeof(*map->lines), &coverage_line_compare);
+
+    return true;
+}
+
+void coverage_map_free(coverage_map_t* map)
+{
+    for (size_t i = 0; i < map->file_count; i++)
+        free(map->files[i]);
+    for (size_t i = 0; i < map->symbol_count; i++)
+        free(map->symbols[i].name);
+
+    free(map->files);
+    free(map->lines);
+    free(map->symbols);
+    *map = (coverage_map_t){};
+}
+
+static const coverage_line_t* coverage_map_find(const coverage_map_t* map, uint16_t address)
+{
+    for (size_t i = 0; i < map->line_count; i++)
+    {
+        if (map->lines[i].address == address)
+            return &map->lines[i];
+    }
+
+    return NULL;
+}
+
+static void coverage_write_lcov_functions(const coverage_t* coverage, const coverage_map_t* map, uint32_t file_index, FILE* file)
+{
+    unsigned int found = 0;
+    unsigned int hit = 0;
+
+    for (size_t i = 0; i < map->symbol_count; i++)
+    {
+        const coverage_symbol_t* symbol = &map->symbols[i];
+        const coverage_line_t* line = coverage_map_find(map, symbol->address);
+        if (line == NULL || line->file != file_index)
+            continue;
+
+        bool executed = coverage_test(coverage->executed, symbol->address);
+        fprintf(file, "FN:%u,%s\n", line->line, symbol->name);
+        fprintf(file, "FNDA:%d,%s\n", executed, symbol->name);
+
+        found++;
+        hit += executed;
+    }
+
+    fprintf(file, "FNF:%u\nFNH:%u\n", found, hit);
+}
+
+void coverage_write_lcov(const coverage_t* coverage, const coverage_map_t* map, const uint8_t* code, FILE* file)
+{
+    size_t i = 0;
+
+    while (i < map->line_count)
+    {
+        uint32_t file_index = map->lines[i].file;
+
+        fprintf(file, "TN:\nSF:%s\n", map->files[file_index]);
+        coverage_write_lcov_functions(coverage, map, file_index, file);
+
+        unsigned int lines_found = 0;
+        unsigned int lines_hit = 0;
+        unsigned int branches_found = 0;
+        unsigned int branches_hit = 0;
+
+        // One source line may map to several instructions
+        while (i < map->line_count && map->lines[i].file == file_index)
+        {
+            uint32_t line_number = map->lines[i].line;
+            bool executed = false;
+            unsigned int block = 0;
+
+            for (; i < map->line_count && map->lines[i].file == file_index && map->lines[i].line == line_number; i++)
+            {
+                uint16_t address = map->lines[i].address;
+                executed |= coverage_test(coverage->executed, address);
+
+                if (coverage_branch_bytes[code[address]] == 0)
+                    continue;
+
+                if (coverage_test(coverage->executed, address))
+                {
+                    bool taken = coverage_test(coverage->branch_taken, address);
+                    bool not_taken = coverage_test(coverage->branch_not_taken, address);
+                    fprintf(file, "BRDA:%u,%u,0,%d\n", line_number, block, taken);
+                    fprintf(file, "BRDA:%u,%u,1,%d\n", line_number, block, not_taken);
+                    branches_hit += taken + not_taken;
+                } else
+                {
+                    fprintf(file, "BRDA:%u,%u,0,-\n", line_number, block);
+                    fprintf(file, "BRDA:%u,%u,1,-\n", line_number, block);
+                }
+
+                branches_found += 2;
+                block++;
+            }
+
+            fprintf(file, "DA:%u,%d\n", line_number, executed);
+            lines_found++;
+            lines_hit += executed;
+        }
+
+        fprintf(file, "BRF:%u\nBRH:%u\n", branches_found, branches_hit);
+        fprintf(file, "LF:%u\nLH:%u\n", lines_found, lines_hit);
+        fprintf(file, "end_of_record\n");
+    }
+}
@@ -0,0 +1,108 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "forkserver.h"
+#include "mcs51.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static bool forkserver_read(int fd, void* data, size_t length)
+{
+    uint8_t* bytes = data;
+
+    while (length > 0)
+    {
+        ssize_t n = read(fd, bytes, length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+
+        bytes += n;
+        length -= n;
+    }
+
+    return true;
+}
+
+static bool forkserver_write(int fd, const void* data, size_t length)
+{
+    const uint8_t* bytes = data;
+
+    while (length > 0)
+    {
+        ssize_t n = write(fd, bytes, length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+
+        bytes += n;
+        length -= n;
+    }
+
+    return true;
+}
+
+long forkserver_run(mcs51_t* p, uint16_t pc, uint64_t max_cycles, int request_fd, int response_fd, forkserver_fn_t fn, void* ctx)
+{
+    uint64_t end = p->_osc_periods + 12 * max_cycles;
+
+    while (p->PC != pc && p->_osc_periods < end)
+        msc51_do_instruction(p);
+
+    if (p->PC != pc)
+        return -1;
+
+    static uint8_t request[FORKSERVER_MAX_REQUEST];
+    long served = 0;
+
+    while (true)
+    {
+        uint32_t length;
+        if (!forkserver_read(request_fd, &length, sizeof(length)))
+            return served; // Client closed the pipe
+
+        if (length > sizeof(request) || !forkserver_read(request_fd, request, length))
+            return -1;
+
+        pid_t child = fork();
+        if (child < 0)
+            return -1;
+
+        if (child == 0)
+            _exit(fn(p, request, length, ctx));
+
+        int wait_status;
+        while (waitpid(child, &wait_status, 0) < 0)
+        {
+            if (errno != EINTR)
+                return -1;
+        }
+
+        int32_t status = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : 128 + WTERMSIG(wait_status);
+        if (!forkserver_write(response_fd, &status, sizeof(status)))
+            return -1;
+
+        served++;
+    }
+}
+
+bool forkserver_request(int request_fd, int response_fd, const uint8_t* request, size_t length, int* status)
+{
+    uint32_t header = length;
+    int32_t response;
+
+    if (length > FORKSERVER_MAX_REQUEST
+        || !forkserver_write(request_fd, &header, sizeof(header))
+        || !forkserver_write(request_fd, request, length)
+        || !forkserver_read(response_fd, &response, sizeof(response)))
+        return false;
+
+    *status = response;
+    return true;
+}
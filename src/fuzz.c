@@ -0,0 +1,532 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "fuzz.h"
+#include "sfr_definitions_gen.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static void fuzz_serial_tx_discard(char c)
+{
+}
+
+static void fuzz_unimplemented_opcode(mcs51_t* p)
+{
+    p->_fuzz->_result = FUZZ_CRASH_UNIMPLEMENTED_OPCODE;
+}
+
+static uint64_t fuzz_hash(const uint8_t* data, size_t length)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+
+    return hash;
+}
+
+static uint64_t fuzz_random(fuzz_t* fuzz)
+{
+    // xorshift64*
+    fuzz->_random ^= fuzz->_random >> 12;
+    fuzz->_random ^= fuzz->_random << 25;
+    fuzz->_random ^= fuzz->_random >> 27;
+    return fuzz->_random * 0x2545F4914F6CDD1DULL;
+}
+
+static void fuzz_record_edge(fuzz_t* fuzz, uint16_t from, uint16_t to)
+{
+    fuzz->edges[(uint16_t) (from * 0x9E37U) ^ to]++;
+}
+
+const char* fuzz_result_name(fuzz_result_t result)
+{
+    switch (result)
+    {
+        case FUZZ_RUNNING: return "running";
+        case FUZZ_OK: return "ok";
+        case FUZZ_TIMEOUT: return "timeout";
+        case FUZZ_CRASH_PC_OUT_OF_ROM: return "pc-out-of-rom";
+        case FUZZ_CRASH_UNIMPLEMENTED_OPCODE: return "unimplemented-opcode";
+        case FUZZ_CRASH_STACK_OVERFLOW: return "stack-overflow";
+        case FUZZ_CRASH_ASSERT: return "assert";
+    }
+
+    return "unknown";
+}
+
+bool fuzz_step(fuzz_t* fuzz, mcs51_t* p, uint16_t pc, uint8_t opcode)
+{
+    // Interrupt or high-level emulated routine between the instructions
+    if (pc != fuzz->_next_pc)
+        fuzz_record_edge(fuzz, fuzz->_next_pc, pc);
+
+    fuzz->_next_pc = p->PC;
+
+    // Control transfer or conditional branch
+    if (p->PC != (uint16_t) (pc + p->opcode_map[opcode].bytes) || coverage_branch_bytes[opcode])
+        fuzz_record_edge(fuzz, pc, p->PC);
+
+    if (fuzz->_result != FUZZ_RUNNING)
+        return true;
+
+    if (p->PC >= fuzz->config.rom_size)
+        fuzz->_result = FUZZ_CRASH_PC_OUT_OF_ROM;
+    else if (p->_stack.overflows != fuzz->snapshot._stack.overflows)
+        fuzz->_result = FUZZ_CRASH_STACK_OVERFLOW;
+    else if (fuzz->config.assert_enabled && p->PC == fuzz->config.assert_address)
+        fuzz->_result = FUZZ_CRASH_ASSERT;
+    else if (fuzz->semihost.exited)
+        fuzz->_result = fuzz->semihost.exit_code == 0 ? FUZZ_OK : FUZZ_CRASH_ASSERT;
+    else if (p->PC == fuzz->config.stop)
+        fuzz->_result = FUZZ_OK;
+
+    // UART RX: Deliver the next byte once the firmware has consumed the previous one
+    if (fuzz->_uart_position < fuzz->_uart_length
+        && (p->D[SFR_SCON] & SFR_SCON_REN_Msk)
+        && !(p->D[SFR_SCON] & SFR_SCON_RI_Msk))
+    {
+        p->D[SFR_SBUF] = fuzz->_uart_input[fuzz->_uart_position++];
+        p->D[SFR_SCON] |= SFR_SCON_RI_Msk;
+    }
+
+    return fuzz->_result != FUZZ_RUNNING;
+}
+
+bool fuzz_init(fuzz_t* fuzz, const fuzz_config_t* config, const uint8_t* code, size_t code_size)
+{
+    memset(fuzz, 0, sizeof(*fuzz));
+
+    fuzz->config = *config;
+    if (fuzz->config.rom_size == 0 || fuzz->config.rom_size > code_size)
+        fuzz->config.rom_size = code_size;
+    if (fuzz->config.max_input == 0 || fuzz->config.max_input > FUZZ_MAX_INPUT)
+        fuzz->config.max_input = FUZZ_MAX_INPUT;
+    fuzz->_random = 1;
+
+    mcs51_t* p = &fuzz->proc;
+    memcpy(p->C, code, code_size < sizeof(p->C) ? code_size : sizeof(p->C));
+    mcs51_init(p);
+
+    // Pushes beyond the guard are overflows (see stack.h), by default the top of IDATA
+    if (fuzz->config.sp_max == 0)
+        fuzz->config.sp_max = p->_stack.ceiling;
+    stack_set_guard(p, p->_stack.floor, fuzz->config.sp_max);
+
+    p->_on_serial_tx = &fuzz_serial_tx_discard;
+    p->_abort_on_unimplemented_opcode = false;
+    p->_fuzz = fuzz;
+
+    // Opcodes without cycles are not implemented (reserved)
+    for (unsigned int i = 0; i < 0x100; i++)
+    {
+        if (p->opcode_map[i].cycles == 0)
+        {
+            p->opcode_map[i].bytes = 1;
+            p->opcode_map[i].cycles = 1;
+            p->opcode_map[i].actor = &fuzz_unimplemented_opcode;
+        }
+    }
+
+    if (fuzz->config.semihosting)
+    {
+        // Firmware output is discarded while fuzzing
+        fuzz->semihost = (semihost_t){};
+        semihost_enable(p, &fuzz->semihost);
+    }
+
+    while (p->PC != fuzz->config.entry && p->_osc_periods < 12 * fuzz->config.init_cycles)
+        msc51_do_instruction(p);
+
+    if (p->PC != fuzz->config.entry)
+        return false;
+
+    p->_engine = MCS51_ENGINE_FUZZ;
+    fuzz->snapshot = *p;
+    return true;
+}
+
+fuzz_result_t fuzz_run(fuzz_t* fuzz, const uint8_t* input, size_t length)
+{
+    mcs51_t* p = &fuzz->proc;
+
+    // Restore everything except CODE, which the firmware cannot modify
+    const size_t code_begin = offsetof(mcs51_t, C);
+    const size_t code_end = code_begin + sizeof(p->C);
+    memcpy(p, &fuzz->snapshot, code_begin);
+    memcpy((uint8_t*) p + code_end, (const uint8_t*) &fuzz->snapshot + code_end, sizeof(mcs51_t) - code_end);
+    memset(fuzz->edges, 0, sizeof(fuzz->edges));
+    fuzz->semihost.exited = false;
+
+    if (length > fuzz->config.max_input)
+        length = fuzz->config.max_input;
+
+    fuzz->_uart_length = 0;
+    fuzz->_uart_position = 0;
+
+    if (fuzz->config.input == FUZZ_INPUT_XDATA)
+    {
+        for (size_t i = 0; i < length; i++)
+            p->X[(uint16_t) (fuzz->config.xdata_address + i)] = input[i];
+
+        p->X[fuzz->config.xdata_length_address] = length >> 8;
+        p->X[(uint16_t) (fuzz->config.xdata_length_address + 1)] = length & 0xFF;
+    } else
+    {
+        fuzz->_uart_input = input;
+        fuzz->_uart_length = length;
+    }
+
+    fuzz->_result = FUZZ_RUNNING;
+    fuzz->_next_pc = p->PC;
+
+    msc51_run(p, 12 * fuzz->config.budget_cycles);
+
+    if (fuzz->_result == FUZZ_RUNNING)
+        fuzz->_result = FUZZ_TIMEOUT;
+
+    fuzz->executions++;
+    return fuzz->_result;
+}
+
+/// AFL hit count buckets: 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+
+static uint8_t fuzz_bucket(uint8_t count)
+{
+    if (count <= 3)
+        return count == 3 ? 0x04 : count;
+    if (count <= 7)
+        return 0x08;
+    if (count <= 15)
+        return 0x10;
+    if (count <= 31)
+        return 0x20;
+    if (count <= 127)
+        return 0x40;
+    return 0x80;
+}
+
+static bool fuzz_merge_edges(fuzz_t* fuzz, uint8_t* seen)
+{
+    bool new_coverage = false;
+
+    for (unsigned int i = 0; i < FUZZ_MAP_SIZE; i++)
+    {
+        // Skip 8 untouched edges at once, the map is sparse
+        if (i % 8 == 0)
+        {
+            uint64_t word;
+            memcpy(&word, &fuzz->edges[i], sizeof(word));
+            if (word == 0)
+            {
+                i += 7;
+                continue;
+            }
+        }
+
+        if (fuzz->edges[i] == 0)
+            continue;
+
+        uint8_t bucket = fuzz_bucket(fuzz->edges[i]);
+        if (bucket & ~seen[i])
+        {
+            seen[i] |= bucket;
+            new_coverage = true;
+        }
+    }
+
+    return new_coverage;
+}
+
+bool fuzz_has_new_coverage(fuzz_t* fuzz)
+{
+    return fuzz_merge_edges(fuzz, fuzz->seen);
+}
+
+static fuzz_entry_t* fuzz_find_input(fuzz_t* fuzz, uint64_t hash)
+{
+    for (size_t i = 0; i < fuzz->corpus_count; i++)
+    {
+        if (fuzz->corpus[i].hash == hash)
+            return &fuzz->corpus[i];
+    }
+
+    return NULL;
+}
+
+bool fuzz_add_input(fuzz_t* fuzz, const uint8_t* input, size_t length)
+{
+    if (fuzz->corpus_count >= FUZZ_MAX_CORPUS || length == 0 || length > fuzz->config.max_input)
+        return false;
+
+    fuzz_entry_t* entry = &fuzz->corpus[fuzz->corpus_count];
+    entry->data = malloc(length);
+    if (entry->data == NULL)
+        return false;
+
+    fuzz->corpus_count++;
+    memcpy(entry->data, input, length);
+    entry->length = length;
+    entry->hash = fuzz_hash(input, length);
+    return true;
+}
+
+/// Write atomically (temporary file and rename), other workers may scan the directory
+static void fuzz_write_file(const char* dir, const char* prefix, const uint8_t* data, size_t length, uint64_t hash)
+{
+    char path[1024];
+    char tmp_path[1024];
+
+    snprintf(path, sizeof(path), "%s/%s%016llx", dir, prefix, (unsigned long long) hash);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.tmp-%016llx-%p", dir, (unsigned long long) hash, (void*) data);
+
+    FILE* file = fopen(tmp_path, "wb");
+    if (file == NULL)
+        return;
+
+    fwrite(data, 1, length, file);
+    fclose(file);
+    rename(tmp_path, path);
+}
+
+/// Insert the hash of an imported input, true if it was already in the set
+static bool fuzz_synced(fuzz_t* fuzz, uint64_t hash)
+{
+    hash |= 1; // 0 marks a free slot
+
+    size_t i = hash & (FUZZ_MAX_SYNCED - 1);
+    for (; fuzz->_synced[i] != 0; i = (i + 1) & (FUZZ_MAX_SYNCED - 1))
+    {
+        if (fuzz->_synced[i] == hash)
+            return true;
+    }
+
+    // Keep free slots for the probing to end, beyond that inputs are run on every sync
+    if (fuzz->_synced_count < FUZZ_MAX_SYNCED / 2)
+    {
+        fuzz->_synced[i] = hash;
+        fuzz->_synced_count++;
+    }
+
+    return false;
+}
+
+/// Import inputs of other workers (and of previous campaigns)
+static void fuzz_sync(fuzz_t* fuzz, const char* corpus_dir)
+{
+    DIR* dir = opendir(corpus_dir);
+    if (dir == NULL)
+        return;
+
+    static _Thread_local uint8_t input[FUZZ_MAX_INPUT];
+    struct dirent* dirent;
+
+    while ((dirent = readdir(dir)) != NULL && fuzz->corpus_count < FUZZ_MAX_CORPUS)
+    {
+        if (dirent->d_name[0] == '.')
+            continue;
+
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", corpus_dir, dirent->d_name);
+
+        FILE* file = fopen(path, "rb");
+        if (file == NULL)
+            continue;
+
+        size_t length = fread(input, 1, fuzz->config.max_input, file);
+        fclose(file);
+
+        const uint64_t hash = fuzz_hash(input, length);
+        if (length == 0 || fuzz_find_input(fuzz, hash) || fuzz_synced(fuzz, hash))
+            continue;
+
+        fuzz_run(fuzz, input, length);
+        if (fuzz_has_new_coverage(fuzz))
+            fuzz_add_input(fuzz, input, length);
+    }
+
+    closedir(dir);
+}
+
+static size_t fuzz_mutate(fuzz_t* fuzz, uint8_t* data, size_t length)
+{
+    static const uint8_t interesting[] = {0x00, 0x01, 0x7F, 0x80, 0xFF, 0x10, 0x20, 0x40};
+    unsigned int operations = 1U << (fuzz_random(fuzz) % 4);
+
+    for (unsigned int n = 0; n < operations; n++)
+    {
+        size_t position = fuzz_random(fuzz) % length;
+
+        switch (fuzz_random(fuzz) % 8)
+        {
+            case 0: data[position] ^= 1 << (fuzz_random(fuzz) % 8); break;
+            case 1: data[position] = fuzz_random(fuzz); break;
+            case 2: data[position] += (int) (fuzz_random(fuzz) % 17) - 8; break;
+            case 3: data[position] = interesting[fuzz_random(fuzz) % sizeof(interesting)]; break;
+            case 4: // Insert a byte
+                if (length < fuzz->config.max_input)
+                {
+                    memmove(&data[position + 1], &data[position], length - position);
+                    data[position] = fuzz_random(fuzz);
+                    length++;
+                }
+                break;
+            case 5: // Delete a byte
+                if (length > 1)
+                {
+                    memmove(&data[position], &data[position + 1], length - position - 1);
+                    length--;
+                }
+                break;
+            case 6: // Copy a block within the input
+            {
+                size_t source = fuzz_random(fuzz) % length;
+                size_t size = 1 + fuzz_random(fuzz) % (length - (source > position ? source : position));
+                memmove(&data[position], &data[source], size);
+                break;
+            }
+            case 7: // Splice with another corpus entry
+            {
+                const fuzz_entry_t* other = &fuzz->corpus[fuzz_random(fuzz) % fuzz->corpus_count];
+                if (other->length > position)
+                {
+                    memcpy(&data[position], &other->data[position], other->length - position);
+                    length = other->length;
+                }
+                break;
+            }
+        }
+    }
+
+    return length;
+}
+
+uint64_t fuzz_loop(fuzz_t* fuzz, const char* corpus_dir, const char* crash_dir, uint64_t executions, uint64_t seed)
+{
+    static _Thread_local uint8_t input[FUZZ_MAX_INPUT];
+    static _Thread_local uint8_t seen_crash[FUZZ_MAP_SIZE];
+
+    memset(seen_crash, 0, sizeof(seen_crash));
+    fuzz->_random = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    mkdir(corpus_dir, 0755);
+    mkdir(crash_dir, 0755);
+
+    fuzz_sync(fuzz, corpus_dir);
+
+    if (fuzz->corpus_count == 0)
+    {
+        uint8_t zero = 0x00;
+        fuzz_run(fuzz, &zero, 1);
+        fuzz_has_new_coverage(fuzz);
+        fuzz_add_input(fuzz, &zero, 1);
+    }
+
+    uint64_t crashes = 0;
+
+    for (uint64_t n = 1; n <= executions; n++)
+    {
+        const fuzz_entry_t* parent = &fuzz->corpus[fuzz_random(fuzz) % fuzz->corpus_count];
+        memcpy(input, parent->data, parent->length);
+        size_t length = fuzz_mutate(fuzz, input, parent->length);
+
+        fuzz_result_t result = fuzz_run(fuzz, input, length);
+
+        if (result >= FUZZ_CRASH_PC_OUT_OF_ROM)
+        {
+            // Unique crashes only: new edges among the crashing inputs
+            if (fuzz_merge_edges(fuzz, seen_crash))
+            {
+                char prefix[64];
+                snprintf(prefix, sizeof(prefix), "crash-%s-", fuzz_result_name(result));
+                fuzz_write_file(crash_dir, prefix, input, length, fuzz_hash(input, length));
+                crashes++;
+                fuzz->crashes++;
+            }
+        } else if (fuzz_has_new_coverage(fuzz) && fuzz_add_input(fuzz, input, length))
+        {
+            fuzz_write_file(corpus_dir, "id-", input, length, fuzz->corpus[fuzz->corpus_count - 1].hash);
+        }
+
+        if (n % FUZZ_SYNC_INTERVAL == 0)
+            fuzz_sync(fuzz, corpus_dir);
+    }
+
+    return crashes;
+}
+
+void fuzz_free(fuzz_t* fuzz)
+{
+    for (size_t i = 0; i < fuzz->corpus_count; i++)
+        free(fuzz->corpus[i].data);
+
+    fuzz->corpus_count = 0;
+}
+
+typedef struct fuzz_worker_t {
+    pthread_t thread;
+    const fuzz_config_t* config;
+    const uint8_t* code;
+    size_t code_size;
+    const char* corpus_dir;
+    const char* crash_dir;
+    uint64_t executions;
+    uint64_t seed;
+    uint64_t crashes;
+} fuzz_worker_t;
+
+static void* fuzz_worker(void* arg)
+{
+    fuzz_worker_t* worker = arg;
+    fuzz_t* fuzz = malloc(sizeof(fuzz_t));
+    if (fuzz == NULL)
+        return NULL;
+
+    if (fuzz_init(fuzz, worker->config, worker->code, worker->code_size))
+        worker->crashes = fuzz_loop(fuzz, worker->corpus_dir, worker->crash_dir, worker->executions, worker->seed);
+
+    fuzz_free(fuzz);
+    free(fuzz);
+    return NULL;
+}
+
+uint64_t fuzz_parallel(const fuzz_config_t* config, const uint8_t* code, size_t code_size, const char* corpus_dir,
+                       const char* crash_dir, unsigned int workers, uint64_t executions)
+{
+    fuzz_worker_t* threads = calloc(workers, sizeof(fuzz_worker_t));
+    uint64_t crashes = 0;
+    if (threads == NULL)
+        return 0;
+
+    // The corpus directory has to exist before the workers scan it
+    mkdir(corpus_dir, 0755);
+    mkdir(crash_dir, 0755);
+
+    for (unsigned int i = 0; i < workers; i++)
+    {
+        threads[i] = (fuzz_worker_t){
+                .config = config,
+                .code = code,
+                .code_size = code_size,
+                .corpus_dir = corpus_dir,
+                .crash_dir = crash_dir,
+                .executions = executions,
+                .seed = i + 1,
+        };
+        pthread_create(&threads[i].thread, NULL, &fuzz_worker, &threads[i]);
+    }
+
+    for (unsigned int i = 0; i < workers; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        crashes += threads[i].crashes;
+    }
+
+    free(threads);
+    return crashes;
+}
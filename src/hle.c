@@ -0,0 +1,82 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "hle.h"
+#include "mcs51.h"
+#include "mcs51_helpers.h"
+#include "mcs51_internal.h"
+#include <string.h>
+
+static void hle_update_entries(mcs51_t* p)
+{
+    memset(p->_hle_entries, 0, sizeof(p->_hle_entries));
+
+    for (int i = 0; i < HLE_MAX; i++)
+    {
+        hle_t* hle = &p->_hle[i];
+        if (hle->fn != 0)
+            p->_hle_entries[hle->address >> 5] |= 1U << (hle->address & 0x1F);
+    }
+}
+
+int hle_add(mcs51_t* p, uint16_t address, uint32_t cycles, hle_fn_t fn, void* ctx)
+{
+    for (int i = 0; i < HLE_MAX; i++)
+    {
+        hle_t* hle = &p->_hle[i];
+        if (hle->fn != 0)
+            continue;
+
+        *hle = (hle_t){.fn = fn, .ctx = ctx, .address = address, .cycles = cycles};
+        hle_update_entries(p);
+        return i;
+    }
+
+    return -1;
+}
+
+int hle_add_signature(mcs51_t* p, const uint8_t* signature, const uint8_t* mask, size_t length, uint32_t cycles, hle_fn_t fn, void* ctx)
+{
+    if (length == 0 || length > sizeof(p->C))
+        return -1;
+
+    for (size_t address = 0; address <= sizeof(p->C) - length; address++)
+    {
+        size_t i = 0;
+        while (i < length && ((p->C[address + i] ^ signature[i]) & (mask ? mask[i] : 0xFF)) == 0)
+            i++;
+
+        if (i == length)
+            return hle_add(p, address, cycles, fn, ctx);
+    }
+
+    return -1;
+}
+
+void hle_remove(mcs51_t* p, int handle)
+{
+    if (handle < 0 || handle >= HLE_MAX)
+        return;
+
+    p->_hle[handle] = (hle_t){};
+    hle_update_entries(p);
+}
+
+void hle_enter(mcs51_t* p)
+{
+    for (int i = 0; i < HLE_MAX; i++)
+    {
+        hle_t* hle = &p->_hle[i];
+        if (hle->fn == 0 || hle->address != p->PC)
+            continue;
+
+        hle->fn(p, hle->ctx);
+        p->PC = pop_sp_u16(p); // RET
+
+        // The timers and the other peripherals count the charged cycles (an event may reset the MCU)
+        mcs51_charge_cycles(p, hle->cycles);
+        return;
+    }
+}
@@ -0,0 +1,207 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "lockstep.h"
+#include "mcs51.h"
+#include <stdlib.h>
+#include <string.h>
+
+/// Execute one instruction (or an inserted LJMP) with the phase-accurate engine
+static void lockstep_reference_instruction(mcs51_t* p)
+{
+    do
+    {
+        msc51_do_osc_period(p);
+    } while (p->_osc_periods % 12 != 0 || p->_instruction_register.opcode.cycles != 0);
+}
+
+static void lockstep_step(lockstep_t* lockstep)
+{
+    lockstep_reference_instruction(lockstep->reference);
+    msc51_do_instruction(lockstep->candidate);
+}
+
+static uint64_t lockstep_hash_bytes(uint64_t hash, const uint8_t* data, size_t length)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, &data[i], sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+
+    for (; i < length; i++)
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+
+    return hash;
+}
+
+/// Materialize the lazily evaluated PSW flags and timer counts in D[]
+static void lockstep_sync(mcs51_t* p)
+{
+    mcs51_sync_psw(p);
+    mcs51_sync_timers(p);
+}
+
+uint64_t lockstep_hash(mcs51_t* p)
+{
+    lockstep_sync(p);
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = lockstep_hash_bytes(hash, (const uint8_t*) &p->PC, sizeof(p->PC));
+    hash = lockstep_hash_bytes(hash, p->D, sizeof(p->D));
+    hash = lockstep_hash_bytes(hash, p->X, sizeof(p->X));
+    hash = lockstep_hash_bytes(hash, (const uint8_t*) &p->_osc_periods, sizeof(p->_osc_periods));
+    hash = lockstep_hash_bytes(hash, &p->_nvic._isr_pending, 1);
+    hash = lockstep_hash_bytes(hash, &p->_nvic._isr_active_msk, 1);
+    hash = lockstep_hash_bytes(hash, &p->_nvic._isr_running_msk, 1);
+    return hash;
+}
+
+static bool lockstep_equal(mcs51_t* a, mcs51_t* b)
+{
+    lockstep_sync(a);
+    lockstep_sync(b);
+
+    return a->PC == b->PC
+           && a->_osc_periods == b->_osc_periods
+           && a->_nvic._isr_pending == b->_nvic._isr_pending
+           && a->_nvic._isr_active_msk == b->_nvic._isr_active_msk
+           && a->_nvic._isr_running_msk == b->_nvic._isr_running_msk
+           && memcmp(a->D, b->D, sizeof(a->D)) == 0
+           && memcmp(a->X, b->X, sizeof(a->X)) == 0;
+}
+
+bool lockstep_init(lockstep_t* lockstep, mcs51_t* reference, mcs51_t* candidate, uint64_t interval)
+{
+    *lockstep = (lockstep_t){
+            .reference = reference,
+            .candidate = candidate,
+            .interval = interval > 0 ? interval : 1,
+            ._reference_checkpoint = malloc(sizeof(mcs51_t)),
+            ._candidate_checkpoint = malloc(sizeof(mcs51_t)),
+    };
+
+    if (!lockstep->_reference_checkpoint || !lockstep->_candidate_checkpoint)
+    {
+        lockstep_free(lockstep);
+        return false;
+    }
+
+    return lockstep_equal(reference, candidate);
+}
+
+void lockstep_free(lockstep_t* lockstep)
+{
+    free(lockstep->_reference_checkpoint);
+    free(lockstep->_candidate_checkpoint);
+    lockstep->_reference_checkpoint = NULL;
+    lockstep->_candidate_checkpoint = NULL;
+}
+
+static void lockstep_restore(lockstep_t* lockstep, uint64_t steps)
+{
+    *lockstep->reference = *lockstep->_reference_checkpoint;
+    *lockstep->candidate = *lockstep->_candidate_checkpoint;
+
+    for (uint64_t i = 0; i < steps; i++)
+        lockstep_step(lockstep);
+}
+
+/// The states are equal at the checkpoint and differ after steps instructions
+static void lockstep_bisect(lockstep_t* lockstep, uint64_t steps)
+{
+    uint64_t equal = 0;
+    uint64_t different = steps;
+
+    while (different - equal > 1)
+    {
+        uint64_t middle = equal + (different - equal) / 2;
+        lockstep_restore(lockstep, middle);
+
+        if (lockstep_equal(lockstep->reference, lockstep->candidate))
+            equal = middle;
+        else
+            different = middle;
+    }
+
+    lockstep_restore(lockstep, equal);
+    lockstep->divergence_pc = lockstep->reference->PC;
+    lockstep->divergence_instruction = lockstep->instructions + equal;
+    lockstep_step(lockstep);
+
+    lockstep->instructions += different;
+    lockstep->diverged = true;
+}
+
+bool lockstep_run(lockstep_t* lockstep, uint64_t instructions)
+{
+    if (lockstep->diverged)
+        return false;
+
+    while (instructions > 0)
+    {
+        uint64_t steps = instructions < lockstep->interval ? instructions : lockstep->interval;
+
+        *lockstep->_reference_checkpoint = *lockstep->reference;
+        *lockstep->_candidate_checkpoint = *lockstep->candidate;
+
+        for (uint64_t i = 0; i < steps; i++)
+            lockstep_step(lockstep);
+
+        if (lockstep_hash(lockstep->reference) != lockstep_hash(lockstep->candidate))
+        {
+            lockstep_bisect(lockstep, steps);
+            return false;
+        }
+
+        lockstep->instructions += steps;
+        instructions -= steps;
+    }
+
+    return true;
+}
+
+void lockstep_print_divergence(lockstep_t* lockstep, FILE* file)
+{
+    mcs51_t* a = lockstep->reference;
+    mcs51_t* b = lockstep->candidate;
+
+    if (!lockstep->diverged)
+    {
+        fprintf(file, "No divergence in %llu instructions\n", (unsigned long long) lockstep->instructions);
+        return;
+    }
+
+    lockstep_sync(a);
+    lockstep_sync(b);
+
+    opcode_t* opcode = &a->opcode_map[a->C[lockstep->divergence_pc]];
+    fprintf(file, "Divergence at instruction %llu, PC 0x%04x: %s %s %s %s\n",
+            (unsigned long long) lockstep->divergence_instruction, lockstep->divergence_pc,
+            opcode->mnemonic, opcode->arg1, opcode->arg2, opcode->arg3);
+
+    if (a->PC != b->PC)
+        fprintf(file, "  PC: 0x%04x != 0x%04x\n", a->PC, b->PC);
+    if (a->_osc_periods != b->_osc_periods)
+        fprintf(file, "  Oscillator periods: %llu != %llu\n", (unsigned long long) a->_osc_periods, (unsigned long long) b->_osc_periods);
+    if (a->_nvic._isr_active_msk != b->_nvic._isr_active_msk)
+        fprintf(file, "  Active ISRs: 0x%02x != 0x%02x\n", a->_nvic._isr_active_msk, b->_nvic._isr_active_msk);
+
+    for (unsigned int i = 0; i < sizeof(a->D); i++)
+    {
+        if (a->D[i] != b->D[i])
+            fprintf(file, "  D[0x%03x]: 0x%02x != 0x%02x\n", i, a->D[i], b->D[i]);
+    }
+
+    for (unsigned int i = 0; i < sizeof(a->X); i++)
+    {
+        if (a->X[i] != b->X[i])
+            fprintf(file, "  X[0x%04x]: 0x%02x != 0x%02x\n", i, a->X[i], b->X[i]);
+    }
+}
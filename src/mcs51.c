@@ -8,16 +8,17 @@
 #include "mcs51_internal.h"
 #include "mcs51_register.h"
 #include "opcode.h"
+#include "sfr_map_gen.h"
 #include <assert.h>
 #include <stdio.h>
-#include <stdlib.h>
 
-static void mcs51_timer_cycle(mcs51_t* p);
 static void mcs51_set_address_latch_enable(mcs51_t* p);
 static void mcs51_reset_address_latch_enable(mcs51_t* p);
 
 static void msc51_idle(mcs51_t* p);
 
+static void update_clock_mode(mcs51_t* p);
+
 static void msc51_s1p1(mcs51_t* p);
 static void msc51_s1p2(mcs51_t* p);
 static void msc51_s2p1(mcs51_t* p);
@@ -31,6 +32,18 @@ static void msc51_s5p2(mcs51_t* p);
 static void msc51_s6p1(mcs51_t* p);
 static void msc51_s6p2(mcs51_t* p);
 
+static void (*const mcs51_engines[MCS51_ENGINE_COUNT])(mcs51_t* p, uint64_t osc_periods) = {
+        [MCS51_ENGINE_PLAIN] = &mcs51_core_plain,
+        [MCS51_ENGINE_TRACE] = &mcs51_core_trace,
+        [MCS51_ENGINE_PROFILE] = &mcs51_core_profile,
+        [MCS51_ENGINE_COVERAGE] = &mcs51_core_coverage,
+        [MCS51_ENGINE_FUZZ] = &mcs51_core_fuzz,
+        [MCS51_ENGINE_MEMORY] = &mcs51_core_memory,
+};
+
+/// Loaded into the instruction register for every machine cycle the CPU sleeps (IDLE or power-down)
+static const opcode_t s_sleep_opcode = {.code = 0x00, .bytes = 0, .cycles = 1, .mnemonic = "SLEEP", .arg1 = "", .arg2 = "", .arg3 = "", .actor = &msc51_idle};
+
 static void on_serial_tx_default_handler(char c)
 {
     putc(c, stdout);
@@ -39,10 +52,24 @@ static void on_serial_tx_default_handler(char c)
 
 void mcs51_init(mcs51_t* p)
 {
+    mcs51_init_variant(p, MCS51_VARIANT_AT89C51RD2);
+}
+
+void mcs51_init_variant(mcs51_t* p, mcs51_variant_t variant)
+{
+    assert(variant < MCS51_VARIANT_COUNT);
+    p->_variant = variant;
+    p->_indirect_address_map = mcs51_variant_profiles[variant].indirect_address_map;
+
     mcs51_register_opcodes(p);
-    mcs51_register_sfrs(p);
 
     nvic_init(&p->_nvic);
+    mcs51_register_sfrs(p);
+
+    scheduler_init(&p->_scheduler);
+    mcs51_timer_init(p);
+    mcs51_watchdog_init(p);
+    mcs51_stack_init(p);
 
     p->_state_phases[0] = &msc51_s1p1;
     p->_state_phases[1] = &msc51_s1p2;
@@ -57,7 +84,7 @@ void mcs51_init(mcs51_t* p)
     p->_state_phases[10] = &msc51_s6p1;
     p->_state_phases[11] = &msc51_s6p2;
 
-    p->_osc_frequency_hertz = 11059200;
+    timebase_init(&p->_timebase, 11059200);
 
     mcs51_reset(p);
 
@@ -69,7 +96,22 @@ void mcs51_reset(mcs51_t* p)
 {
     nvic_reset(&p->_nvic);
 
+    p->D[SFR_ACC] = 0x00;
+    p->D[SFR_B] = 0x00;
+    p->D[SFR_PSW] = 0x00;
+    p->_psw_dirty = false;
+    p->_psw_carry_vector = 0x00;
     p->D[SFR_SP] = 0x07;
+    p->D[SFR_DPL] = 0x00;
+    p->D[SFR_DPH] = 0x00;
+
+    p->D[SFR_P0] = 0xFF;
+    p->D[SFR_P1] = 0xFF;
+    p->D[SFR_P2] = 0xFF;
+    p->D[SFR_P3] = 0xFF;
+
+    p->D[SFR_IE] = 0x00;
+    p->D[SFR_IP] = 0x00;
     p->D[SFR_TCON] = 0x00;
 
     p->D[SFR_PCON] &= 0b00100000; // Bit 6 is don't care
@@ -81,12 +123,34 @@ void mcs51_reset(mcs51_t* p)
     p->D[SFR_TH1] = 0x00;
     p->D[SFR_TL1] = 0x00;
     p->D[SFR_SCON] = 0x00;
+    p->_sfr_dirty_sbuf = false;
+    p->_sbuf_tx = 0x00;
     p->D[SFR_AUXR] &= ~0b11;
 
     p->D[SFR_BRL] = 0x00;
     p->D[SFR_BDRCON] &= 0b11100000;
     p->D[SFR_SADDR] = 0x00;
     p->D[SFR_SADEN] = 0x00;
+    p->D[SFR_WDTPRG] &= ~(SFR_WDTPRG_WTO2_Msk | SFR_WDTPRG_WTO1_Msk | SFR_WDTPRG_WTO0_Msk);
+
+    p->D[SFR_T2CON] = 0x00;
+    p->D[SFR_T2MOD] &= ~(SFR_T2MOD_T2OE_Msk | SFR_T2MOD_DCEN_Msk);
+    p->D[SFR_RCAP2L] = 0x00;
+    p->D[SFR_RCAP2H] = 0x00;
+    p->D[SFR_TL2] = 0x00;
+    p->D[SFR_TH2] = 0x00;
+
+    p->D[SFR_AUXR1] &= ~(SFR_AUXR1_GF3_Msk | SFR_AUXR1_DPS_Msk);
+    p->_dps = 0;
+    p->_dptr_inactive[0] = 0x00;
+    p->_dptr_inactive[1] = 0x00;
+    p->D[SFR_IPH] &= 0b11000000;
+    p->D[SFR_CKCON0] = 0x00;
+
+    update_register_bank(p);
+    update_clock_mode(p);
+    mcs51_timer_update(p);
+    mcs51_watchdog_reset(p);
 }
 
 void mcs51_print_state(mcs51_t* p)
@@ -97,6 +161,83 @@ void mcs51_print_state(mcs51_t* p)
     printf("S%dP%d", state, phase);
 }
 
+void mcs51_sync_psw(mcs51_t* p)
+{
+    sync_psw(p);
+}
+
+void mcs51_sync_timers(mcs51_t* p)
+{
+    mcs51_timer_sync(p);
+}
+
+/// Start a timebase segment if CKCON0.X2 changed
+static void update_clock_mode(mcs51_t* p)
+{
+    const uint8_t periods_per_osc = p->D[SFR_CKCON0] & SFR_CKCON0_X2_Msk ? 2 : 1;
+
+    if (periods_per_osc != p->_timebase.periods_per_osc)
+        timebase_change(&p->_timebase, p->_osc_periods, p->_timebase.hertz, periods_per_osc);
+}
+
+void mcs51_clock_mode_changed(mcs51_t* p)
+{
+    mcs51_timer_sync(p);
+    update_clock_mode(p);
+    mcs51_timer_update(p);
+}
+
+void mcs51_set_osc_frequency(mcs51_t* p, uint64_t hertz)
+{
+    timebase_change(&p->_timebase, p->_osc_periods, hertz, p->_timebase.periods_per_osc);
+}
+
+void mcs51_power_mode_changed(mcs51_t* p)
+{
+    mcs51_timer_sync(p);
+    mcs51_timer_update(p);
+    mcs51_watchdog_update(p);
+}
+
+void mcs51_charge_cycles(mcs51_t* p, uint64_t cycles)
+{
+    for (uint64_t i = 0; i < cycles; i++)
+    {
+        // S5P2 and S6P2 of the machine cycle
+        const uint64_t s6p2 = p->_osc_periods / 12 * 12 + 11;
+
+        nvic_latch_interrupt_flags(&p->_nvic, p);
+        if (p->_scheduler.next_due <= s6p2)
+            scheduler_run(p, s6p2);
+
+        p->_osc_periods += 12;
+    }
+}
+
+bool mcs51_serial_rx(mcs51_t* p, uint8_t byte)
+{
+    const uint8_t scon = p->D[SFR_SCON];
+    const bool mode_1 = (scon & (SFR_SCON_SM0_Msk | SFR_SCON_SM1_Msk)) == SFR_SCON_SM1_Msk;
+
+    // The byte is lost if the previous one was not taken yet (RI still set)
+    if (!mode_1 || !(scon & SFR_SCON_REN_Msk) || (scon & SFR_SCON_RI_Msk))
+        return false;
+
+    p->D[SFR_SBUF] = byte;
+    p->D[SFR_SCON] |= SFR_SCON_RI_Msk;
+    return true;
+}
+
+uint8_t mcs51_read_direct(mcs51_t* p, uint8_t address)
+{
+    return read_direct(p, address);
+}
+
+void mcs51_write_direct(mcs51_t* p, uint8_t address, uint8_t value)
+{
+    write_direct(p, address, value);
+}
+
 void mcs51_print_current_instruction(mcs51_t* p)
 {
     opcode_t opcode = p->_instruction_register.opcode;
@@ -119,7 +260,12 @@ void mcs51_print_current_instruction(mcs51_t* p)
 
 double msc51_execution_time_ms(mcs51_t* p)
 {
-    return (double) p->_osc_periods * 1000. / p->_osc_frequency_hertz;
+    return (double) msc51_execution_time_ns(p) / 1000000.;
+}
+
+uint64_t msc51_execution_time_ns(mcs51_t* p)
+{
+    return timebase_ns(&p->_timebase, p->_osc_periods);
 }
 
 void msc51_do_machine_cycle(mcs51_t* p)
@@ -136,6 +282,38 @@ void msc51_do_osc_period(mcs51_t* p)
 {
     p->_state_phases[p->_osc_periods % 12](p);
     p->_osc_periods++;
+
+    if (p->_vcd)
+        vcd_sample(p->_vcd, p);
+}
+
+void msc51_run(mcs51_t* p, uint64_t osc_periods)
+{
+    uint64_t end = p->_osc_periods + osc_periods;
+
+    // Complete the current instruction phase by phase
+    while (p->_osc_periods < end && (p->_osc_periods % 12 != 0 || p->_instruction_register.opcode.cycles != 0))
+        msc51_do_osc_period(p);
+
+    assert(p->_engine < MCS51_ENGINE_COUNT);
+    assert(p->_engine != MCS51_ENGINE_PROFILE || p->_profile);
+    assert(p->_engine != MCS51_ENGINE_COVERAGE || p->_coverage);
+    assert(p->_engine != MCS51_ENGINE_FUZZ || p->_fuzz);
+    assert(p->_engine != MCS51_ENGINE_MEMORY || p->_memprofile);
+
+    mcs51_engines[p->_engine](p, end);
+}
+
+void msc51_run_until_ns(mcs51_t* p, uint64_t ns)
+{
+    // A clock change of the firmware starts a new timebase segment, the remaining periods are recomputed
+    while (msc51_execution_time_ns(p) < ns)
+        msc51_run(p, timebase_periods(&p->_timebase, ns) - p->_osc_periods);
+}
+
+void msc51_do_instruction(mcs51_t* p)
+{
+    msc51_run(p, 1);
 }
 
 //////////// PHASES BEGIN ////////////
@@ -151,14 +329,23 @@ void msc51_s1p2(mcs51_t* p)
     /// Select a pending interrupt if applicable
     nvic_run_interrupt_controller(&p->_nvic, p);
 
+    // IDLE and power-down: The CPU does not fetch, an enabled interrupt wakes it up (nvic_jump_to_isr())
+    if (p->_instruction_register.opcode.cycles == 0 && is_sleeping(p))
+    {
+        mcs51_reset_and_load_instruction_register(p, s_sleep_opcode);
+    }
     // Latch opcode into instruction register (Fetch)
-    if (p->_instruction_register.opcode.cycles == 0)
+    else if (p->_instruction_register.opcode.cycles == 0)
     {
+        // High-level emulated routines run in host code and return to the caller
+        while (is_hle_entry(p, p->PC))
+            hle_enter(p);
+
         uint8_t opcode = p->C[p->PC];
         mcs51_reset_and_load_instruction_register(p, p->opcode_map[opcode]);
 
         // Note: The instruction register arguments are currently unused
-        mcs51_load_instruction_register_arguments(p, p->C[p->PC + 1], p->C[p->PC + 2], p->C[p->PC + 3]);
+        mcs51_load_instruction_register_arguments(p, p->C[(uint16_t) (p->PC + 1)], p->C[(uint16_t) (p->PC + 2)], p->C[(uint16_t) (p->PC + 3)]);
 
         p->PC++; // The opcode actor will pop the arguments from the PC
     }
@@ -214,7 +401,9 @@ void msc51_s6p1(mcs51_t* p)
 
 void msc51_s6p2(mcs51_t* p)
 {
-    mcs51_timer_cycle(p);
+    // Timers, serial port and the events of the host
+    if (p->_scheduler.next_due <= p->_osc_periods)
+        scheduler_run(p, p->_osc_periods);
 }
 
 //////////// PHASES END ////////////
@@ -245,100 +434,3 @@ void msc51_idle(mcs51_t* p)
 {
     // NOP
 }
-
-void mcs51_timer_cycle(mcs51_t* p)
-{
-    // Timer 0 running
-    // Mode 0 is a 13 bit Timer mode and uses 8 bits of high byte and 5 bit prescaler of low byte.
-    // The value that the Timer can update in mode0 is from 0000H to 1FFFH. The 5 bits of lower byte
-    // append with the bits of higher byte. The Timer rolls over from 1FFFH to 0000H to raise the Timer flag.
-    if (p->D[SFR_TCON] & SFR_TCON_TR0_Msk)
-    {
-        uint8_t mode = ((p->D[SFR_TMOD] & SFR_TMOD_T0M1_Msk) >> SFR_TMOD_T0M1_Pos) << 1 | ((p->D[SFR_TMOD] & SFR_TMOD_T0M0_Msk) >> SFR_TMOD_T0M0_Pos);
-
-        // Timer 0 Mode 0 (13-bit)
-        if (mode == 0)
-        {
-            // Over-run TL0 ("prescaler" overrun)
-            if (++p->D[SFR_TL0] > 0b11111) // Pre-increment
-            {
-                p->D[SFR_TL0] = 0x00;
-
-                // Over-run TH0
-                if (++p->D[SFR_TH0] == 0x00) // Pre-increment
-                {
-                    if (p->D[SFR_IE] & SFR_IE_EA_Msk && p->D[SFR_IE] & SFR_IE_ET0_Msk)
-                    {
-                        p->D[SFR_TCON] |= SFR_TCON_TF0_Msk;
-                    }
-                }
-            }
-        }
-        // Timer 0 Mode 1 (16-bit)
-        else if (mode == 1)
-        {
-            // Over-run TL0
-            if (++p->D[SFR_TL0] == 0x00) // Pre-increment
-            {
-                // Over-run TH0
-                if (++p->D[SFR_TH0] == 0x00) // Pre-increment
-                {
-                    if (p->D[SFR_IE] & SFR_IE_EA_Msk && p->D[SFR_IE] & SFR_IE_ET0_Msk)
-                    {
-                        p->D[SFR_TCON] |= SFR_TCON_TF0_Msk;
-                    }
-                }
-            }
-        } else
-        {
-            fprintf(stderr, "Unimplemented timer 0 mode: %d\n", mode);
-            abort();
-        }
-    }
-
-
-    // Timer 1 running
-    if (p->D[SFR_TCON] & SFR_TCON_TR1_Msk)
-    {
-        uint8_t mode = ((p->D[SFR_TMOD] & SFR_TMOD_T1M1_Msk) >> SFR_TMOD_T1M1_Pos) << 1 | ((p->D[SFR_TMOD] & SFR_TMOD_T1M0_Msk) >> SFR_TMOD_T1M0_Pos);
-
-        // Timer 1 Mode 2 (auto-reload)
-        if (mode == 2)
-        {
-            // Over-run
-            if (++p->D[SFR_TL1] == 0x00) // Pre-increment
-            {
-                // Reload
-                p->D[SFR_TL1] = p->D[SFR_TH1];
-
-                if (p->D[SFR_IE] & SFR_IE_EA_Msk && p->D[SFR_IE] & SFR_IE_ET1_Msk)
-                {
-                    p->D[SFR_TCON] |= SFR_TCON_TF1_Msk;
-                }
-
-                uint8_t serial_mode = ((p->D[SFR_SCON] & SFR_SCON_SM0_Msk) >> SFR_SCON_SM0_Pos) << 1 | ((p->D[SFR_SCON] & SFR_SCON_SM1_Msk) >> SFR_SCON_SM1_Pos);
-
-                // Serial mode 1: 8-bit, 1 stop
-                if (serial_mode == 1)
-                {
-                    // SBUF SFR is dirty
-                    if (p->_sfr_dirty_sbuf)
-                    {
-                        p->_sfr_dirty_sbuf = false;
-                        p->D[SFR_SCON] |= SFR_SCON_TI_Msk; // Set the Transmit Interrupt flag (cleared by software)
-
-                        p->_on_serial_tx((char) p->D[SFR_SBUF]);
-                    }
-                } else
-                {
-                    fprintf(stderr, "Unimplemented serial mode: %d\n", serial_mode);
-                    abort();
-                }
-            }
-        } else
-        {
-            fprintf(stderr, "Unimplemented timer 1 mode: %d\n", mode);
-            abort();
-        }
-    }
-}
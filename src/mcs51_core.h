@@ -0,0 +1,244 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Interpreter core template (no include guard, instantiated once per translation unit).
+ *
+ * The including file defines the function name and the compile-time features:
+ *   MCS51_CORE_NAME      Name of the generated function
+ *   MCS51_CORE_TRACE     Call the _on_trace hook and sample the VCD recorder per instruction
+ *   MCS51_CORE_PROFILE   Collect the execution profile (_profile)
+ *   MCS51_CORE_COVERAGE  Collect the CODE coverage (_coverage), branch outcomes in jump_relative_if()
+ *   MCS51_CORE_FUZZ      Record edges and end the run on a crash or stop condition (_fuzz)
+ *   MCS51_CORE_MEMORY    Count the memory accesses of the operand helpers (_memprofile)
+ *   MCS51_CORE_SUPERINSTRUCTIONS  Fuse the opcode sequences of superinstructions.txt
+ *
+ * Instead of calling the actors through opcode_t.actor, the actors of opcode_impl.c and the
+ * generated templates are inlined as the case arms of a single switch (opcode_switch_gen.h).
+ * opcode_impl.c stays the single source of truth for the instruction semantics.
+ *
+ * One loop iteration executes a complete instruction and is equivalent to 12 oscillator periods
+ * per machine cycle of the phase-accurate msc51_do_osc_period():
+ *   S1P2          Interrupt controller (may insert an LJMP), fetch
+ *   S4P2          Execute
+ *   S5P2, S6P2    Latch interrupt flags and run the scheduled events (scheduler.h)
+ * ALE is not driven and a VCD recorder is sampled once per instruction (trace core only).
+ * The machine cycles are only stepped through if an event is due during the instruction.
+ *
+ * IDLE and power-down: Machine cycles up to the next scheduled event are skipped at once,
+ * the cycles with an event and the following one run as above.
+ *
+ * Superinstructions: After an instruction that starts a listed opcode sequence, the case arm completes
+ * it, checks the next opcode and executes it without going through the dispatch, provided that the
+ * instruction boundary does not end the run or insert an interrupt (mcs51_core_fuse()). The opcode is
+ * checked after the completion, whose scheduler events may move the PC (watchdog reset).
+ */
+
+#ifndef MCS51_CORE_TRACE
+#define MCS51_CORE_TRACE 0
+#endif
+
+#ifndef MCS51_CORE_PROFILE
+#define MCS51_CORE_PROFILE 0
+#endif
+
+#ifndef MCS51_CORE_COVERAGE
+#define MCS51_CORE_COVERAGE 0
+#endif
+
+#ifndef MCS51_CORE_FUZZ
+#define MCS51_CORE_FUZZ 0
+#endif
+
+#ifndef MCS51_CORE_MEMORY
+#define MCS51_CORE_MEMORY 0
+#endif
+
+#ifndef MCS51_CORE_SUPERINSTRUCTIONS
+#define MCS51_CORE_SUPERINSTRUCTIONS 0
+#endif
+
+#include "mcs51.h"
+#include "mcs51_helpers.h"
+#include "mcs51_internal.h"
+
+#if MCS51_CORE_FUZZ
+#include "fuzz.h"
+#endif
+
+#define IMPL(name) static inline __attribute__((always_inline)) void name(mcs51_t* p)
+#include "opcode_impl.c"
+
+/**
+ * S5P2 and S6P2 of every machine cycle of the completed instruction.
+ * Nothing to do if a superinstruction completed the instruction already (it may have inserted an LJMP).
+ */
+static inline __attribute__((always_inline)) void mcs51_core_complete(mcs51_t* p, uint8_t cycles)
+{
+    if (cycles == 0)
+        return;
+
+    const uint64_t end = p->_osc_periods + 12 * cycles;
+
+    // No event during the instruction: Every machine cycle latches the same interrupt flags
+    if (p->_scheduler.next_due >= end)
+    {
+        nvic_latch_interrupt_flags(&p->_nvic, p);
+        p->_osc_periods = end;
+    } else
+    {
+        for (; p->_osc_periods < end; p->_osc_periods += 12)
+        {
+            nvic_latch_interrupt_flags(&p->_nvic, p);
+
+            if (p->_scheduler.next_due <= p->_osc_periods + 11)
+                scheduler_run(p, p->_osc_periods + 11);
+        }
+    }
+
+    p->_instruction_register.opcode.cycles = 0;
+}
+
+/**
+ * Complete the current instruction of a superinstruction and run the next instruction boundary.
+ * @return true if the next instruction may be executed directly (it is not fetched yet)
+ */
+static inline __attribute__((always_inline)) bool mcs51_core_fuse(mcs51_t* p, uint8_t* cycles, uint64_t osc_periods)
+{
+    mcs51_core_complete(p, *cycles);
+    *cycles = 0;
+
+    if (p->_osc_periods >= osc_periods || is_hle_entry(p, p->PC) || is_sleeping(p))
+        return false;
+
+    // S1P2: An inserted LJMP is executed by the next loop iteration
+    nvic_run_interrupt_controller(&p->_nvic, p);
+    if (p->_instruction_register.opcode.cycles != 0)
+        return false;
+
+    p->_instruction_register.accessed_sfr_ie = false;
+    p->_instruction_register.accessed_sfr_ip = false;
+    return true;
+}
+
+void MCS51_CORE_NAME(mcs51_t* p, uint64_t osc_periods)
+{
+    instruction_register_t* ir = &p->_instruction_register;
+
+    // Sleeping: The interrupt flags did not change during the previous machine cycle
+    bool settled = false;
+
+    // A superinstruction ran the instruction boundary (mcs51_core_fuse()), but the next opcode is not fused
+    bool fused = false;
+
+    while (p->_osc_periods < osc_periods)
+    {
+        // S1P2: Select a pending interrupt if applicable
+        if (!fused)
+            nvic_run_interrupt_controller(&p->_nvic, p);
+        fused = false;
+
+        uint8_t cycles = 0;
+
+        // The interrupt controller inserted an LJMP to the ISR
+        if (ir->opcode.cycles != 0)
+        {
+            settled = false;
+            cycles = ir->opcode.cycles;
+
+            ir->opcode.actor(p);
+
+#if MCS51_CORE_MEMORY
+            // The actor (nvic.c) is not compiled with the memory profiler: Count the pushed return address
+            p->_memprofile->_pc = p->_nvic._ljmp_vector;
+            record_data_access(p, to_indirect_address(p, SP - 1), true);
+            record_data_access(p, to_indirect_address(p, SP), true);
+#endif
+
+#if MCS51_CORE_PROFILE
+            profile_record_interrupt(p->_profile);
+#endif
+        } else if (is_sleeping(p))
+        {
+            const uint64_t cycle = p->_osc_periods / 12;
+            const uint64_t event_cycle = p->_scheduler.next_due / 12;
+
+            ir->opcode.code = 0x00;
+            ir->accessed_sfr_ie = false;
+            ir->accessed_sfr_ip = false;
+
+            // Skip the machine cycles up to the next event, they change nothing
+            if (settled && event_cycle > cycle)
+            {
+                uint64_t remaining = (osc_periods - p->_osc_periods + 11) / 12;
+                uint64_t skip = event_cycle - cycle < remaining ? event_cycle - cycle : remaining;
+
+                p->_osc_periods += 12 * skip;
+                continue;
+            }
+
+            // A cycle with an event, or the first cycle asleep: The interrupt flags are latched step by step
+            cycles = 1;
+            settled = event_cycle > cycle;
+            mcs51_core_complete(p, cycles);
+            continue;
+        } else
+        {
+            settled = false;
+
+            // High-level emulated routines run in host code and return to the caller
+            while (is_hle_entry(p, p->PC))
+                hle_enter(p);
+
+            // Fetch
+            uint16_t pc = p->PC;
+            uint8_t opcode = p->C[pc];
+
+#if MCS51_CORE_TRACE
+            mcs51_reset_and_load_instruction_register(p, p->opcode_map[opcode]);
+            mcs51_load_instruction_register_arguments(p, p->C[(uint16_t) (p->PC + 1)], p->C[(uint16_t) (p->PC + 2)], p->C[(uint16_t) (p->PC + 3)]);
+
+            if (p->_on_trace)
+                p->_on_trace(p);
+#else
+            // Only the fields evaluated by the actors and the interrupt controller
+            ir->opcode.code = opcode;
+            ir->accessed_sfr_ie = false;
+            ir->accessed_sfr_ip = false;
+#endif
+
+#if MCS51_CORE_PROFILE
+            profile_record(p->_profile, pc, opcode);
+#endif
+
+#if MCS51_CORE_COVERAGE
+            p->_coverage->executed[pc >> 3] |= 1 << (pc & 0b111);
+#endif
+
+#if MCS51_CORE_MEMORY
+            p->_memprofile->_pc = pc;
+#endif
+
+            p->PC++;
+
+            // Execute
+#include "opcode_switch_gen.h"
+
+#if MCS51_CORE_FUZZ
+            if (fuzz_step(p->_fuzz, p, pc, opcode))
+                break;
+#endif
+        }
+
+        mcs51_core_complete(p, cycles);
+
+#if MCS51_CORE_TRACE
+        if (p->_vcd)
+            vcd_sample(p->_vcd, p);
+#endif
+    }
+}
+
+#undef IMPL
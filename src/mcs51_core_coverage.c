@@ -0,0 +1,9 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#define MCS51_CORE_NAME mcs51_core_coverage
+#define MCS51_CORE_COVERAGE 1
+
+#include "mcs51_core.h"
@@ -5,59 +5,104 @@
 
 #pragma once
 
+#include "alu_flags_gen.h"
+#include "mcs51_internal.h"
+#include "mcs51_register.h"
+#include "sfr_address_map_gen.h"
 #include "sfr_definitions_gen.h"
 #include <assert.h>
+#include <stdbool.h>
 #include <stdio.h>
 
-static inline uint8_t register_bank_index(mcs51_t* p)
+/**
+ * Update the cached base address of the selected register bank (PSW RS1, RS0).
+ * Must be called whenever the PSW is written.
+ */
+static inline void update_register_bank(mcs51_t* p)
 {
-    return p->D[SFR_PSW] >> 3 & 0b11;
+    p->_register_bank = (p->D[SFR_PSW] & (SFR_PSW_RS1_Msk | SFR_PSW_RS0_Msk)) >> SFR_PSW_RS0_Pos << 3;
 }
 
 #define GET_C()   ((p->D[SFR_PSW] >> 7) & 0b1)
 #define SET_C()   p->D[SFR_PSW] |= (1 << 7)
 #define CLEAR_C() p->D[SFR_PSW] &= ~(1 << 7)
+#define PUT_C(v)           \
+    do {                   \
+        if (v)             \
+            SET_C();       \
+        else               \
+            CLEAR_C();     \
+    } while (false)
 
 #define SP        (p->D[SFR_SP])
 #define ACC       (p->D[SFR_ACC])
-#define R0        (p->D[register_bank_index(p) * 0x8 + 0x0])
-#define R1        (p->D[register_bank_index(p) * 0x8 + 0x1])
-#define R2        (p->D[register_bank_index(p) * 0x8 + 0x2])
-#define R3        (p->D[register_bank_index(p) * 0x8 + 0x3])
-#define R4        (p->D[register_bank_index(p) * 0x8 + 0x4])
-#define R5        (p->D[register_bank_index(p) * 0x8 + 0x5])
-#define R6        (p->D[register_bank_index(p) * 0x8 + 0x6])
-#define R7        (p->D[register_bank_index(p) * 0x8 + 0x7])
+#define R0        (p->D[p->_register_bank + 0x0])
+#define R1        (p->D[p->_register_bank + 0x1])
+#define R2        (p->D[p->_register_bank + 0x2])
+#define R3        (p->D[p->_register_bank + 0x3])
+#define R4        (p->D[p->_register_bank + 0x4])
+#define R5        (p->D[p->_register_bank + 0x5])
+#define R6        (p->D[p->_register_bank + 0x6])
+#define R7        (p->D[p->_register_bank + 0x7])
 
 /**
  * Translate an address in indirect addressing mode to a "physical" address.
- * The SFR region is inaccessible via indirect addressing mode.
+ * The SFR region is inaccessible via indirect addressing mode, 0x80-0xFF map to the upper IDATA
+ * region (or an unused region, if the variant has 128 bytes IDATA only).
+ */
+static inline uint16_t to_indirect_address(mcs51_t* p, uint8_t address)
+{
+    return p->_indirect_address_map[address];
+}
+
+/// Count an access of D[index] in the memory profile, only compiled into the MCS51_ENGINE_MEMORY core
+static inline void record_data_access(mcs51_t* p, uint16_t index, bool write)
+{
+#if MCS51_CORE_MEMORY
+    memprofile_record(p->_memprofile, &p->_memprofile->data[index], write);
+#else
+    (void) p;
+    (void) index;
+    (void) write;
+#endif
+}
+
+/**
+ * Relative jump of a conditional branch, the PC points behind the instruction. The coverage core
+ * records the outcome of the condition (see coverage_record_branch()).
  */
-static inline uint16_t to_indirect_address(uint8_t address)
+static inline void jump_relative_if(mcs51_t* p, bool condition, int8_t offset)
 {
-    uint16_t indirect = address;
+#if MCS51_CORE_COVERAGE
+    const uint8_t bytes = coverage_branch_bytes[p->_instruction_register.opcode.code];
+    coverage_record_branch(p->_coverage, p->PC - bytes, condition);
+#endif
 
-    // Select bit 7 and shift it left: 0x80 -> 0x100
-    uint16_t bit_7 = indirect & 0x80;
-    // Clear bit 7
-    indirect &= ~bit_7;
-    // Apply bit 8
-    indirect |= bit_7 << 1;
+    if (condition)
+        p->PC += offset;
+}
 
-    return indirect;
+static inline bool is_sfr_hooked(const uint32_t* bitmap, uint8_t address)
+{
+    return bitmap[address >> 5] & (1U << (address & 0x1F));
 }
 
+static inline bool is_hle_entry(mcs51_t* p, uint16_t address)
+{
+    return p->_hle_entries[address >> 5] & (1U << (address & 0x1F));
+}
 
-static inline void check_sfr_write_access(mcs51_t* p, uint8_t address)
+/// IDLE or power-down mode (PCON IDL, PD): The CPU does not fetch instructions
+static inline bool is_sleeping(mcs51_t* p)
 {
-    sfr_t* sfr = &p->sfr_map[address];
-    sfr->on_write(sfr, p);
+    return p->D[SFR_PCON] & (SFR_PCON_IDL_Msk | SFR_PCON_PD_Msk);
 }
 
 static inline void check_sfr_read_access(mcs51_t* p, uint8_t address)
 {
-    sfr_t* sfr = &p->sfr_map[address];
-    sfr->on_read(sfr, p);
+    // Most addresses (plain DATA, registers, passive SFRs) are not hooked
+    if (is_sfr_hooked(p->_sfr_hooked_read, address))
+        mcs51_sfr_read_hooked(p, address);
 }
 
 static inline uint8_t pop_pc_u8(mcs51_t* p)
@@ -72,20 +117,53 @@ static inline int8_t pop_pc_s8(mcs51_t* p)
 
 static inline uint16_t pop_pc_u16(mcs51_t* p)
 {
-    return (((uint16_t) pop_pc_u8(p)) << 8) | pop_pc_u8(p);
+    uint16_t high = pop_pc_u8(p);
+    uint16_t low = pop_pc_u8(p);
+    return (high << 8) | (low << 0);
+}
+
+/**
+ * DATA (0x00-0x7F) is the same memory for direct and indirect addressing: Watchers of these
+ * addresses (watch.h) also see the accesses through @R0, @R1 and the stack.
+ */
+static inline uint8_t read_indirect(mcs51_t* p, uint8_t address)
+{
+    const uint16_t index = to_indirect_address(p, address);
+
+    if (address < 0x80)
+        check_sfr_read_access(p, address);
+
+    record_data_access(p, index, false);
+    return p->D[index];
+}
+
+static inline void write_indirect(mcs51_t* p, uint8_t address, uint8_t value)
+{
+    const uint16_t index = to_indirect_address(p, address);
+    record_data_access(p, index, true);
+
+    if (address < 0x80 && is_sfr_hooked(p->_sfr_hooked_write, address))
+        mcs51_sfr_write_hooked(p, address, value);
+    else
+        p->D[index] = value;
 }
 
+/**
+ * The stack lives in IDATA: A stack pointer above 0x7F addresses the upper IDATA region, not the SFRs.
+ */
 static inline void push_sp_u8(mcs51_t* p, uint8_t v)
 {
     SP += 1;
-    // printf("Pushing SP %x: %x\n", SP, v);
-    p->D[SP] = v;
+    write_indirect(p, SP, v);
+
+    // One compare: Below the high-water mark, or the slow path (new mark or overflow)
+    if ((uint8_t) (SP - p->_stack.floor) >= p->_stack._check)
+        mcs51_stack_push_check(p);
 }
 
 static inline uint8_t pop_sp_u8(mcs51_t* p)
 {
-    // printf("Popping SP %x: %x\n", SP, p->D[SP]);
-    return p->D[SP--]; // Post-decrement
+    return read_indirect(p, SP--); // Post-decrement
 }
 
 static inline void push_sp_u16(mcs51_t* p, uint16_t v)
@@ -101,22 +179,88 @@ static inline uint16_t pop_sp_u16(mcs51_t* p)
     return (high << 8) | (low << 0);
 }
 
-static inline uint8_t bit_mask(uint8_t bit)
+static inline uint8_t read_direct(mcs51_t* p, uint8_t address)
 {
-    return 0x01 << (bit % 8);
+    check_sfr_read_access(p, address);
+    record_data_access(p, address, false);
+    return p->D[address];
 }
 
-static inline uint8_t bit_byte_index(uint8_t bit)
+static inline void write_direct(mcs51_t* p, uint8_t address, uint8_t value)
 {
-    const uint8_t bit_addressable_memory_start = 0x20;
-    uint8_t offset = 0;
+    record_data_access(p, address, true);
 
-    // Regular RAM
-    if (bit < SFR_BASE_ADDRESS)
-        offset = bit_addressable_memory_start + (bit / 8);
-    // SFRs
+    if (is_sfr_hooked(p->_sfr_hooked_write, address))
+        mcs51_sfr_write_hooked(p, address, value);
     else
-        offset = bit - (bit % 8);
+        p->D[address] = value;
+}
+
+
+/**
+ * Bit addresses 0x00-0x7F are located in D:20-D:2F, 0x80-0xFF in the SFRs at addresses divisible by 8
+ * (sfr_bit_address_map, generated from sfrs.md).
+ */
+static inline bool read_bit(mcs51_t* p, uint8_t bit)
+{
+    sfr_bit_address_t location = sfr_bit_address_map[bit];
+
+    return (read_direct(p, location.byte) & location.mask) != 0;
+}
+
+/**
+ * Bit writes are read-modify-write operations on the containing byte.
+ */
+static inline void write_bit(mcs51_t* p, uint8_t bit, bool value)
+{
+    sfr_bit_address_t location = sfr_bit_address_map[bit];
+    uint8_t byte = read_direct(p, location.byte);
+
+    write_direct(p, location.byte, value ? (byte | location.mask) : (byte & ~location.mask));
+}
+
+/**
+ * Materialize the lazily evaluated PSW flags. P is derived from the accumulator,
+ * AC and OV from the carry vector of the last ADD, ADDC or SUBB. C is always up to date.
+ */
+static inline void sync_psw(mcs51_t* p)
+{
+    uint8_t psw = p->D[SFR_PSW] & ~SFR_PSW_P_Msk;
+
+    if (p->_psw_dirty)
+    {
+        const uint8_t lazy_flags = SFR_PSW_AC_Msk | SFR_PSW_OV_Msk;
+        psw = (psw & ~lazy_flags) | (alu_flags_table[p->_psw_carry_vector] & lazy_flags);
+        p->_psw_dirty = false;
+    }
+
+    p->D[SFR_PSW] = psw | (parity_table[ACC] << SFR_PSW_P_Pos);
+}
+
+/**
+ * Add b and the carry to a. C is updated, AC and OV are evaluated lazily (see sync_psw()).
+ */
+static inline uint8_t alu_add(mcs51_t* p, uint8_t a, uint8_t b, uint8_t carry)
+{
+    uint16_t result = a + b + carry;
+
+    p->_psw_carry_vector = ((a ^ b ^ result) >> 4) & 0x1F;
+    p->_psw_dirty = true;
+    p->D[SFR_PSW] = (p->D[SFR_PSW] & ~SFR_PSW_C_Msk) | (((result >> 8) & 0b1) << SFR_PSW_C_Pos);
+
+    return result;
+}
+
+/**
+ * Subtract b and the borrow (carry) from a. C is updated, AC and OV are evaluated lazily (see sync_psw()).
+ */
+static inline uint8_t alu_sub(mcs51_t* p, uint8_t a, uint8_t b, uint8_t borrow)
+{
+    uint16_t result = a - b - borrow;
+
+    p->_psw_carry_vector = ((a ^ b ^ result) >> 4) & 0x1F;
+    p->_psw_dirty = true;
+    p->D[SFR_PSW] = (p->D[SFR_PSW] & ~SFR_PSW_C_Msk) | (((result >> 8) & 0b1) << SFR_PSW_C_Pos);
 
-    return offset;
+    return result;
 }
@@ -10,3 +10,53 @@
 void mcs51_reset_and_load_instruction_register(mcs51_t* p, opcode_t opcode);
 
 void mcs51_load_instruction_register_arguments(mcs51_t* p, uint8_t arg1, uint8_t arg2, uint8_t arg3);
+
+/// Register the timer overflow events (timer.c)
+void mcs51_timer_init(mcs51_t* p);
+
+/// Materialize the counts of the running timers in TLx/THx
+void mcs51_timer_sync(mcs51_t* p);
+
+/// Restart the timers from TMOD, TCON, PCON and TLx/THx, after mcs51_timer_sync() (it counts with the previous configuration)
+void mcs51_timer_update(mcs51_t* p);
+
+/// Register the watchdog expiry event (watchdog.c)
+void mcs51_watchdog_init(mcs51_t* p);
+
+/// Stop the watchdog (MCU reset)
+void mcs51_watchdog_reset(mcs51_t* p);
+
+/// Write to WDTRST: 0x1E followed by 0xE1 starts or services the watchdog
+void mcs51_watchdog_write(mcs51_t* p, uint8_t value);
+
+/// Freeze or resume the watchdog after a power-down change
+void mcs51_watchdog_update(mcs51_t* p);
+
+/// Default stack guard of the variant (stack.c)
+void mcs51_stack_init(mcs51_t* p);
+
+/// Slow path of a push above the stack high-water mark: Raise the mark or record an overflow
+void mcs51_stack_push_check(mcs51_t* p);
+
+/// The timebase and the timers follow a change of CKCON0 (X2 mode, peripheral clocks), call after the write
+void mcs51_clock_mode_changed(mcs51_t* p);
+
+/// The peripherals follow a change of PCON IDL/PD, call after the write (the oscillator stops in power-down mode)
+void mcs51_power_mode_changed(mcs51_t* p);
+
+/**
+ * Machine cycles without an instruction (charged by HLE): The interrupt flags are latched and the
+ * scheduled events run as in the cycles of an instruction.
+ */
+void mcs51_charge_cycles(mcs51_t* p, uint64_t cycles);
+
+/**
+ * Interpreter cores, generated from mcs51_core.h.
+ * Execute complete instructions until osc_periods is reached, starting at an instruction boundary.
+ */
+void mcs51_core_plain(mcs51_t* p, uint64_t osc_periods);
+void mcs51_core_trace(mcs51_t* p, uint64_t osc_periods);
+void mcs51_core_profile(mcs51_t* p, uint64_t osc_periods);
+void mcs51_core_coverage(mcs51_t* p, uint64_t osc_periods);
+void mcs51_core_fuzz(mcs51_t* p, uint64_t osc_periods);
+void mcs51_core_memory(mcs51_t* p, uint64_t osc_periods);
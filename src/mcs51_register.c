@@ -5,6 +5,8 @@
 
 #include "mcs51_register.h"
 #include "mcs51.h"
+#include "mcs51_helpers.h"
+#include "mcs51_internal.h"
 #include "opcode_map_gen.h"
 #include "sfr_definitions_gen.h"
 #include "sfr_map_gen.h"
@@ -32,6 +34,20 @@ static void noop(sfr_t* sfr, mcs51_t* p)
 static void on_write_sbuf(sfr_t* sfr, mcs51_t* p)
 {
     p->_sfr_dirty_sbuf = true;
+    p->_sbuf_tx = p->D[SFR_SBUF];
+}
+
+static void on_read_psw(sfr_t* sfr, mcs51_t* p)
+{
+    sync_psw(p);
+}
+
+static void on_write_psw(sfr_t* sfr, mcs51_t* p)
+{
+    // The written value replaces the lazily evaluated flags (P is read-only and derived on read)
+    p->_psw_dirty = false;
+
+    update_register_bank(p);
 }
 
 static void on_read_write_ie(sfr_t* sfr, mcs51_t* p)
@@ -44,9 +60,157 @@ static void on_read_write_ip(sfr_t* sfr, mcs51_t* p)
     p->_instruction_register.accessed_sfr_ip = true;
 }
 
+static void on_read_timer(sfr_t* sfr, mcs51_t* p)
+{
+    mcs51_timer_sync(p);
+}
+
+static void on_write_timer_control(sfr_t* sfr, mcs51_t* p)
+{
+    mcs51_timer_sync(p);
+    mcs51_timer_update(p);
+}
+
+static void on_write_timer_count(sfr_t* sfr, mcs51_t* p)
+{
+    // The other byte of the count is materialized, the written one is kept
+    uint8_t value = p->D[sfr->address];
+    mcs51_timer_sync(p);
+    p->D[sfr->address] = value;
+
+    mcs51_timer_update(p);
+}
+
+static void on_write_pcon(sfr_t* sfr, mcs51_t* p)
+{
+    mcs51_power_mode_changed(p);
+}
+
+static void on_write_wdtrst(sfr_t* sfr, mcs51_t* p)
+{
+    mcs51_watchdog_write(p, p->D[SFR_WDTRST]);
+}
+
+static void on_write_ckcon0(sfr_t* sfr, mcs51_t* p)
+{
+    mcs51_clock_mode_changed(p);
+}
+
+/// AUXR1.DPS selects one of two DPTRs, the selected one is kept in DPL/DPH
+static void on_write_auxr1(sfr_t* sfr, mcs51_t* p)
+{
+    p->D[SFR_AUXR1] &= ~0b100; // Bit 2 is stuck at 0, so INC AUXR1 toggles DPS
+
+    const uint8_t dps = p->D[SFR_AUXR1] & SFR_AUXR1_DPS_Msk;
+    if (dps == p->_dps)
+        return;
+
+    const uint8_t dpl = p->D[SFR_DPL];
+    const uint8_t dph = p->D[SFR_DPH];
+    p->D[SFR_DPL] = p->_dptr_inactive[0];
+    p->D[SFR_DPH] = p->_dptr_inactive[1];
+    p->_dptr_inactive[0] = dpl;
+    p->_dptr_inactive[1] = dph;
+    p->_dps = dps;
+}
+
+/// Timer 2 and its interrupt (8052)
+static void register_timer_2(mcs51_t* p)
+{
+    p->sfr_map[SFR_TL2].on_read = &on_read_timer;
+    p->sfr_map[SFR_TL2].on_write = &on_write_timer_count;
+    p->sfr_map[SFR_TH2].on_read = &on_read_timer;
+    p->sfr_map[SFR_TH2].on_write = &on_write_timer_count;
+    p->sfr_map[SFR_T2CON].on_write = &on_write_timer_control;
+
+    p->_nvic._sources |= SFR_IE_ET2_Msk;
+}
+
+static void register_sfrs_8051(mcs51_t* p)
+{
+}
+
+static void register_sfrs_8052(mcs51_t* p)
+{
+    register_timer_2(p);
+}
+
+static void register_sfrs_at89c51rd2(mcs51_t* p)
+{
+    register_timer_2(p);
+
+    p->sfr_map[SFR_AUXR1].on_write = &on_write_auxr1;
+
+    p->sfr_map[SFR_IPH].on_write = &on_read_write_ip;
+    p->sfr_map[SFR_IPH].on_read = &on_read_write_ip;
+    p->_nvic._iph_mask = 0xFF;
+
+    p->sfr_map[SFR_BDRCON].on_write = &on_write_timer_control; // Baud rate generator (timer.c)
+    p->sfr_map[SFR_CKCON0].on_write = &on_write_ckcon0;        // X2 mode
+
+    p->sfr_map[SFR_WDTRST].on_write = &on_write_wdtrst;
+}
+
+/// Peripherals beyond the 8051 core, installed once at init
+static void (*const s_register_variant_sfrs[MCS51_VARIANT_COUNT])(mcs51_t* p) = {
+        [MCS51_VARIANT_8051] = &register_sfrs_8051,
+        [MCS51_VARIANT_8052] = &register_sfrs_8052,
+        [MCS51_VARIANT_AT89C51RD2] = &register_sfrs_at89c51rd2,
+};
+
+void mcs51_update_sfr_hooks(mcs51_t* p)
+{
+    for (unsigned int i = 0; i < SFR_MAP_SIZE; i++)
+    {
+        bool hooked_read = p->sfr_map[i].on_read != &noop;
+        bool hooked_write = p->sfr_map[i].on_write != &noop;
+
+        for (int w = 0; w < WATCH_MAX; w++)
+        {
+            watch_t* watch = &p->_watches[w];
+            if (watch->fn != 0 && watch->address == i)
+            {
+                hooked_read |= (watch->kind & WATCH_READ) != 0;
+                hooked_write |= (watch->kind & WATCH_WRITE) != 0;
+            }
+        }
+
+        const uint32_t bit = 1U << (i & 0x1F);
+
+        if (hooked_read)
+            p->_sfr_hooked_read[i >> 5] |= bit;
+        else
+            p->_sfr_hooked_read[i >> 5] &= ~bit;
+
+        if (hooked_write)
+            p->_sfr_hooked_write[i >> 5] |= bit;
+        else
+            p->_sfr_hooked_write[i >> 5] &= ~bit;
+    }
+}
+
+void mcs51_sfr_read_hooked(mcs51_t* p, uint8_t address)
+{
+    sfr_t* sfr = &p->sfr_map[address];
+    sfr->on_read(sfr, p);
+
+    watch_notify(p, address, WATCH_READ, p->D[address], p->D[address]);
+}
+
+void mcs51_sfr_write_hooked(mcs51_t* p, uint8_t address, uint8_t value)
+{
+    uint8_t old_value = p->D[address];
+    p->D[address] = value;
+
+    sfr_t* sfr = &p->sfr_map[address];
+    sfr->on_write(sfr, p);
+
+    watch_notify(p, address, WATCH_WRITE, old_value, value);
+}
+
 void mcs51_register_sfrs(mcs51_t* p)
 {
-    assert(sizeof(p->sfr_map) == sizeof(sfr_map));
+    const sfr_t* sfr_map = mcs51_variant_profiles[p->_variant].sfr_map;
 
     for (unsigned int i = 0; i < SFR_MAP_SIZE; i++)
     {
@@ -58,9 +222,28 @@ void mcs51_register_sfrs(mcs51_t* p)
 
     p->sfr_map[SFR_SBUF].on_write = &on_write_sbuf;
 
+    p->sfr_map[SFR_PSW].on_read = &on_read_psw;
+    p->sfr_map[SFR_PSW].on_write = &on_write_psw;
+
     p->sfr_map[SFR_IE].on_write = &on_read_write_ie;
     p->sfr_map[SFR_IE].on_read = &on_read_write_ie;
 
     p->sfr_map[SFR_IP].on_write = &on_read_write_ip;
     p->sfr_map[SFR_IP].on_read = &on_read_write_ip;
+
+    // The timers are counted lazily (timer.h)
+    const uint8_t timer_counts[] = {SFR_TL0, SFR_TH0, SFR_TL1, SFR_TH1};
+    for (unsigned int i = 0; i < sizeof(timer_counts); i++)
+    {
+        p->sfr_map[timer_counts[i]].on_read = &on_read_timer;
+        p->sfr_map[timer_counts[i]].on_write = &on_write_timer_count;
+    }
+
+    p->sfr_map[SFR_TMOD].on_write = &on_write_timer_control;
+    p->sfr_map[SFR_TCON].on_write = &on_write_timer_control;
+    p->sfr_map[SFR_PCON].on_write = &on_write_pcon;
+
+    s_register_variant_sfrs[p->_variant](p);
+
+    mcs51_update_sfr_hooks(p);
 }
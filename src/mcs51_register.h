@@ -5,7 +5,17 @@
 
 #pragma once
 
+#include <stdint.h>
+
 typedef struct mcs51_t mcs51_t;
 
 void mcs51_register_opcodes(mcs51_t* p);
+
+/// Copy the SFR map of the variant and install the peripheral hooks, after nvic_init() (enables the interrupt sources)
 void mcs51_register_sfrs(mcs51_t* p);
+
+/// Run the SFR read hook and read watchers (slow path of check_sfr_read_access())
+void mcs51_sfr_read_hooked(mcs51_t* p, uint8_t address);
+
+/// Write the value, run the SFR write hook and write watchers (slow path of write_direct())
+void mcs51_sfr_write_hooked(mcs51_t* p, uint8_t address, uint8_t value);
@@ -0,0 +1,206 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "memprofile.h"
+#include "cfg.h"
+#include "mcs51.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char s_heat[] = " .:-=+*#%@";
+
+void memprofile_reset(memprofile_t* m)
+{
+    memset(m, 0, sizeof(*m));
+}
+
+/// Index of the largest count that is smaller than the limit (or equal, but at a higher index)
+static long memprofile_next_max(const uint64_t* counts, long size, uint64_t limit, long limit_index)
+{
+    long max_index = -1;
+
+    for (long i = 0; i < size; i++)
+    {
+        bool below_limit = counts[i] < limit || (counts[i] == limit && i > limit_index);
+        if (counts[i] > 0 && below_limit && (max_index < 0 || counts[i] > counts[max_index]))
+            max_index = i;
+    }
+
+    return max_index;
+}
+
+static uint64_t memprofile_total(const memprofile_cell_t* cell)
+{
+    return (uint64_t) cell->reads + cell->writes;
+}
+
+static void memprofile_print_data_address(const mcs51_t* p, long index, FILE* file)
+{
+    if (index < 0x80)
+        fprintf(file, "D:0x%02lX   ", index);
+    else if (index < 0x100 && p->sfr_map[index].name)
+        fprintf(file, "%-9s", p->sfr_map[index].name);
+    else if (index < 0x100)
+        fprintf(file, "S:0x%02lX   ", index);
+    else
+        fprintf(file, "I:0x%02lX   ", index - 0x100 + 0x80);
+}
+
+static void memprofile_print_counts(const memprofile_cell_t* cell, FILE* file)
+{
+    fprintf(file, "  %10u  %10u  ", cell->reads, cell->writes);
+}
+
+static void memprofile_print_top_instruction(const memprofile_cell_t* cell, const mcs51_t* p, FILE* file)
+{
+    char text[64];
+    cfg_format_instruction(p, cell->pc, text, sizeof(text));
+    fprintf(file, "  0x%04X %s\n", cell->pc, text);
+}
+
+/// Print the top_n cells by counts
+static void memprofile_print_top(const memprofile_t* m, const mcs51_t* p, FILE* file, unsigned int top_n, const uint64_t* counts, long size,
+                                 bool xdata)
+{
+    uint64_t limit = UINT64_MAX;
+    long index = -1;
+
+    for (unsigned int n = 0; n < top_n; n++)
+    {
+        index = memprofile_next_max(counts, size, limit, index);
+        if (index < 0)
+            break;
+
+        limit = counts[index];
+
+        const memprofile_cell_t* cell = xdata ? &m->xdata[index] : &m->data[index];
+        memprofile_print_counts(cell, file);
+        if (xdata)
+            fprintf(file, "X:0x%04lX ", index);
+        else
+            memprofile_print_data_address(p, index, file);
+        memprofile_print_top_instruction(cell, p, file);
+    }
+}
+
+void memprofile_print(const memprofile_t* m, const mcs51_t* p, FILE* file, unsigned int top_n)
+{
+    uint64_t data_counts[0x200];
+    uint64_t sfr_counts[0x200] = {0};
+    uint64_t* counts = malloc(0x10000 * sizeof(uint64_t));
+    if (!counts)
+        return;
+
+    for (long i = 0; i < 0x200; i++)
+    {
+        const bool sfr = i >= 0x80 && i < 0x100;
+        data_counts[i] = sfr ? 0 : memprofile_total(&m->data[i]);
+        sfr_counts[i] = sfr ? m->data[i].reads : 0;
+    }
+
+    fprintf(file, "Top DATA/IDATA bytes:\n");
+    fprintf(file, "       reads      writes  address  top instruction\n");
+    memprofile_print_top(m, p, file, top_n, data_counts, 0x200, false);
+
+    fprintf(file, "Hardest polled SFRs (reads):\n");
+    memprofile_print_top(m, p, file, top_n, sfr_counts, 0x200, false);
+
+    // Every MOVX is a candidate, the most accessed bytes gain the most in DATA
+    for (long i = 0; i < 0x10000; i++)
+        counts[i] = memprofile_total(&m->xdata[i]);
+
+    fprintf(file, "XDATA bytes to move into DATA:\n");
+    memprofile_print_top(m, p, file, top_n, counts, 0x10000, true);
+
+    for (long i = 0; i < 0x10000; i++)
+        counts[i] = m->pc_accesses[i];
+
+    fprintf(file, "Top accessing instructions:\n");
+    uint64_t limit = UINT64_MAX;
+    long index = -1;
+    for (unsigned int n = 0; n < top_n; n++)
+    {
+        index = memprofile_next_max(counts, 0x10000, limit, index);
+        if (index < 0)
+            break;
+
+        limit = counts[index];
+
+        char text[64];
+        cfg_format_instruction(p, (uint16_t) index, text, sizeof(text));
+        fprintf(file, "  %10llu  0x%04lX %s\n", (unsigned long long) limit, index, text);
+    }
+
+    free(counts);
+}
+
+static unsigned int memprofile_bits(uint64_t value)
+{
+    unsigned int bits = 0;
+    while (value)
+    {
+        bits++;
+        value >>= 1;
+    }
+
+    return bits;
+}
+
+/// Heat level 1 - 9 of an access count, logarithmic relative to the maximum
+static char memprofile_heat(uint64_t count, unsigned int max_bits)
+{
+    if (count == 0)
+        return s_heat[0];
+
+    return s_heat[1 + (memprofile_bits(count) - 1) * 8 / (max_bits > 1 ? max_bits - 1 : 1)];
+}
+
+static void memprofile_print_line(const memprofile_cell_t* cells, const char* label, unsigned int max_bits, FILE* file)
+{
+    fprintf(file, "%s |", label);
+    for (int i = 0; i < 16; i++)
+        fputc(memprofile_heat(memprofile_total(&cells[i]), max_bits), file);
+    fprintf(file, "|\n");
+}
+
+void memprofile_print_heatmap(const memprofile_t* m, FILE* file)
+{
+    uint64_t max = 0;
+    for (long i = 0; i < 0x200; i++)
+        max = memprofile_total(&m->data[i]) > max ? memprofile_total(&m->data[i]) : max;
+    for (long i = 0; i < 0x10000; i++)
+        max = memprofile_total(&m->xdata[i]) > max ? memprofile_total(&m->xdata[i]) : max;
+
+    const unsigned int max_bits = memprofile_bits(max);
+    char label[16];
+
+    fprintf(file, "Accesses (' ' none, '%c' up to %llu):\n", s_heat[sizeof(s_heat) - 2], (unsigned long long) max);
+    fprintf(file, "          0123456789ABCDEF\n");
+
+    for (long line = 0; line < 0x200; line += 16)
+    {
+        if (line < 0x80)
+            snprintf(label, sizeof(label), "D:0x%02lX  ", line);
+        else if (line < 0x100)
+            snprintf(label, sizeof(label), "S:0x%02lX  ", line);
+        else
+            snprintf(label, sizeof(label), "I:0x%02lX  ", line - 0x100 + 0x80);
+
+        memprofile_print_line(&m->data[line], label, max_bits, file);
+    }
+
+    for (long line = 0; line < 0x10000; line += 16)
+    {
+        bool accessed = false;
+        for (int i = 0; i < 16 && !accessed; i++)
+            accessed = memprofile_total(&m->xdata[line + i]) > 0;
+
+        if (!accessed)
+            continue;
+
+        snprintf(label, sizeof(label), "X:0x%04lX", line);
+        memprofile_print_line(&m->xdata[line], label, max_bits, file);
+    }
+}
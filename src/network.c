@@ -0,0 +1,362 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "network.h"
+#include "mcs51.h"
+#include "scheduler.h"
+#include "sfr_definitions_gen.h"
+#include "timebase.h"
+#include "watch.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Worker threads of network_run(), they run every workers-th node through each window
+typedef struct network_pool_t {
+    network_t* network;
+    unsigned int workers;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation; /// Incremented for every window
+    uint64_t target_ns;
+    unsigned int pending; /// Workers still running the current window
+    bool stop;
+} network_pool_t;
+
+typedef struct network_worker_t {
+    pthread_t thread;
+    network_pool_t* pool;
+    unsigned int index;
+} network_worker_t;
+
+/// Node the calling thread runs, _on_serial_tx has no context
+static __thread network_node_t* s_current_node;
+
+static void network_queue_push(network_queue_t* queue, const network_message_t* message)
+{
+    if (queue->count == queue->capacity)
+    {
+        queue->capacity = queue->capacity ? 2 * queue->capacity : 16;
+        queue->items = realloc(queue->items, queue->capacity * sizeof(network_message_t));
+        assert(queue->items);
+    }
+
+    queue->items[queue->count++] = *message;
+}
+
+/// Drop the consumed messages in front of head
+static void network_queue_compact(network_queue_t* queue)
+{
+    memmove(queue->items, &queue->items[queue->head], (queue->count - queue->head) * sizeof(network_message_t));
+    queue->count -= queue->head;
+    queue->head = 0;
+}
+
+static int network_message_compare(const void* a, const void* b)
+{
+    const network_message_t* x = a;
+    const network_message_t* y = b;
+
+    if (x->arrival_ns != y->arrival_ns)
+        return x->arrival_ns < y->arrival_ns ? -1 : 1;
+
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static void network_arm(network_node_t* node)
+{
+    const network_queue_t* inbox = &node->_inbox;
+
+    if (inbox->head < inbox->count)
+        scheduler_arm(node->mcu, node->_event, inbox->items[inbox->head].due);
+    else
+        scheduler_cancel(node->mcu, node->_event);
+}
+
+static void network_deliver(mcs51_t* p, uint64_t due, void* ctx)
+{
+    network_node_t* node = ctx;
+    network_queue_t* inbox = &node->_inbox;
+
+    while (inbox->head < inbox->count && inbox->items[inbox->head].due <= due)
+    {
+        const network_message_t* message = &inbox->items[inbox->head++];
+
+        if (message->kind == NETWORK_LINK_SERIAL)
+        {
+            if (mcs51_serial_rx(p, message->value))
+                node->rx_bytes++;
+            else
+                node->rx_dropped++;
+        } else
+        {
+            // The pins are inputs, the port latch follows them
+            p->D[message->port] = (p->D[message->port] & ~message->mask) | (message->value & message->mask);
+        }
+    }
+
+    network_arm(node);
+}
+
+static void network_on_serial_tx(char c)
+{
+    network_node_t* node = s_current_node;
+    assert(node);
+
+    const network_message_t sent = {.arrival_ns = msc51_execution_time_ns(node->mcu), .kind = NETWORK_LINK_SERIAL, .value = (uint8_t) c};
+    network_queue_push(&node->_outbox, &sent);
+}
+
+static void network_on_port_write(mcs51_t* p, uint8_t address, watch_kind_t kind, uint8_t old_value, uint8_t new_value, void* ctx)
+{
+    network_node_t* node = ctx;
+
+    const network_message_t sent = {.arrival_ns = msc51_execution_time_ns(p), .kind = NETWORK_LINK_PINS, .port = address, .value = new_value};
+    network_queue_push(&node->_outbox, &sent);
+}
+
+void network_init(network_t* network)
+{
+    *network = (network_t){0};
+}
+
+void network_free(network_t* network)
+{
+    for (unsigned int i = 0; i < network->node_count; i++)
+    {
+        free(network->nodes[i]._outbox.items);
+        free(network->nodes[i]._inbox.items);
+    }
+
+    network_init(network);
+}
+
+int network_add_mcu(network_t* network, mcs51_t* p)
+{
+    if (network->node_count == NETWORK_MAX_NODES)
+        return -1;
+
+    const unsigned int index = network->node_count;
+    network_node_t* node = &network->nodes[index];
+    *node = (network_node_t){.mcu = p, .network = network, .index = index};
+
+    node->_event = scheduler_add(p, &network_deliver, node);
+    if (node->_event < 0)
+        return -1;
+
+    p->_on_serial_tx = &network_on_serial_tx;
+
+    network->node_count++;
+    return (int) index;
+}
+
+static int network_connect(network_t* network, network_link_t link)
+{
+    assert(link.from < network->node_count && link.to < network->node_count);
+    assert(link.latency_ns > 0); // The lookahead of the synchronization
+
+    if (network->link_count == NETWORK_MAX_LINKS)
+        return -1;
+
+    network->links[network->link_count] = link;
+    return (int) network->link_count++;
+}
+
+int network_connect_serial(network_t* network, unsigned int from, unsigned int to, uint64_t latency_ns)
+{
+    return network_connect(network, (network_link_t){.kind = NETWORK_LINK_SERIAL, .from = from, .to = to, .latency_ns = latency_ns});
+}
+
+int network_connect_pins(network_t* network, unsigned int from, uint8_t from_port, unsigned int to, uint8_t to_port, uint8_t mask, uint64_t latency_ns)
+{
+    assert(from_port >= SFR_P0 && from_port <= SFR_P3 && (from_port & 0x0F) == 0);
+
+    // One watcher per port, shared by the links of the port
+    network_node_t* node = &network->nodes[from];
+    const uint8_t port_bit = 1U << ((from_port - SFR_P0) >> 4);
+    if (!(node->_watched_ports & port_bit))
+    {
+        if (watch_add(node->mcu, from_port, WATCH_WRITE, &network_on_port_write, node) < 0)
+            return -1;
+        node->_watched_ports |= port_bit;
+    }
+
+    return network_connect(network, (network_link_t){.kind = NETWORK_LINK_PINS, .from = from, .to = to, .from_port = from_port, .to_port = to_port, .mask = mask, .latency_ns = latency_ns});
+}
+
+/// The shortest link latency, messages sent in a window arrive in a later one
+static uint64_t network_lookahead(const network_t* network)
+{
+    uint64_t lookahead = UINT64_MAX;
+
+    for (unsigned int i = 0; i < network->link_count; i++)
+    {
+        if (network->links[i].latency_ns < lookahead)
+            lookahead = network->links[i].latency_ns;
+    }
+
+    return lookahead;
+}
+
+static void network_run_nodes(network_t* network, unsigned int worker, unsigned int workers, uint64_t target_ns)
+{
+    for (unsigned int i = worker; i < network->node_count; i += workers)
+    {
+        s_current_node = &network->nodes[i];
+        msc51_run_until_ns(network->nodes[i].mcu, target_ns);
+    }
+
+    s_current_node = 0;
+}
+
+/// Barrier: Route the sent messages over the links into the inboxes of the receivers
+static void network_exchange(network_t* network)
+{
+    uint32_t order = 0;
+
+    for (unsigned int i = 0; i < network->node_count; i++)
+    {
+        network_node_t* sender = &network->nodes[i];
+
+        for (size_t m = 0; m < sender->_outbox.count; m++)
+        {
+            const network_message_t* sent = &sender->_outbox.items[m];
+
+            if (sent->kind == NETWORK_LINK_SERIAL && network->on_serial_tx)
+                network->on_serial_tx(network, i, sent->value, sent->arrival_ns);
+
+            for (unsigned int l = 0; l < network->link_count; l++)
+            {
+                const network_link_t* link = &network->links[l];
+                if (link->from != i || link->kind != sent->kind || (link->kind == NETWORK_LINK_PINS && link->from_port != sent->port))
+                    continue;
+
+                const network_message_t message = {
+                        .arrival_ns = sent->arrival_ns + link->latency_ns,
+                        .order = order++,
+                        .kind = link->kind,
+                        .port = link->to_port,
+                        .mask = link->mask,
+                        .value = sent->value,
+                };
+                network_queue_push(&network->nodes[link->to]._inbox, &message);
+            }
+        }
+
+        sender->_outbox.count = 0;
+    }
+
+    for (unsigned int i = 0; i < network->node_count; i++)
+    {
+        network_node_t* node = &network->nodes[i];
+        network_queue_t* inbox = &node->_inbox;
+
+        network_queue_compact(inbox);
+        qsort(inbox->items, inbox->count, sizeof(network_message_t), &network_message_compare);
+
+        for (size_t m = 0; m < inbox->count; m++)
+            inbox->items[m].due = timebase_periods(&node->mcu->_timebase, inbox->items[m].arrival_ns);
+
+        network_arm(node);
+    }
+}
+
+static void* network_worker(void* arg)
+{
+    network_worker_t* worker = arg;
+    network_pool_t* pool = worker->pool;
+    uint64_t generation = 0;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->generation == generation)
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        generation = pool->generation;
+        const bool stop = pool->stop;
+        const uint64_t target_ns = pool->target_ns;
+        pthread_mutex_unlock(&pool->mutex);
+
+        if (stop)
+            return 0;
+
+        network_run_nodes(pool->network, worker->index, pool->workers, target_ns);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+/// Start a window (or stop) on all workers and wait for them
+static void network_pool_dispatch(network_pool_t* pool, uint64_t target_ns, bool stop)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->target_ns = target_ns;
+    pool->stop = stop;
+    pool->pending = pool->workers;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+
+    while (!stop && pool->pending > 0)
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void network_run(network_t* network, uint64_t ns, unsigned int workers)
+{
+    const uint64_t lookahead = network_lookahead(network);
+
+    if (workers > network->node_count)
+        workers = network->node_count;
+
+    network_pool_t pool = {.network = network, .workers = workers};
+    network_worker_t* threads = calloc(workers, sizeof(network_worker_t));
+
+    if (workers > 0)
+    {
+        pthread_mutex_init(&pool.mutex, NULL);
+        pthread_cond_init(&pool.start, NULL);
+        pthread_cond_init(&pool.done, NULL);
+
+        for (unsigned int i = 0; i < workers; i++)
+        {
+            threads[i] = (network_worker_t){.pool = &pool, .index = i};
+            pthread_create(&threads[i].thread, NULL, &network_worker, &threads[i]);
+        }
+    }
+
+    while (network->time_ns < ns)
+    {
+        const uint64_t target_ns = ns - network->time_ns > lookahead ? network->time_ns + lookahead : ns;
+
+        if (workers > 0)
+            network_pool_dispatch(&pool, target_ns, false);
+        else
+            network_run_nodes(network, 0, 1, target_ns);
+
+        network->time_ns = target_ns;
+        network->windows++;
+        network_exchange(network);
+    }
+
+    if (workers > 0)
+    {
+        network_pool_dispatch(&pool, 0, true);
+
+        for (unsigned int i = 0; i < workers; i++)
+            pthread_join(threads[i].thread, NULL);
+
+        pthread_cond_destroy(&pool.done);
+        pthread_cond_destroy(&pool.start);
+        pthread_mutex_destroy(&pool.mutex);
+    }
+
+    free(threads);
+}
@@ -19,12 +19,19 @@ void nvic_init(nvic_t* nvic)
     nvic->map[2] = (interrupt_t){.name = "INT1 (IE1)", .bit_mask = SFR_IE_EX1_Msk, .vector = 0x0013, .sfr_address = SFR_TCON, .sfr_bit_mask = SFR_TCON_IE1_Msk, .clears_flag = true};
     nvic->map[3] = (interrupt_t){.name = "Timer 1 (TF1)", .bit_mask = SFR_IE_ET1_Msk, .vector = 0x001B, .sfr_address = SFR_TCON, .sfr_bit_mask = SFR_TCON_TF1_Msk, .clears_flag = true};
     nvic->map[4] = (interrupt_t){.name = "Serial (TI/RI)", .bit_mask = SFR_IE_ES_Msk, .vector = 0x0023, .sfr_address = SFR_SCON, .sfr_bit_mask = SFR_SCON_RI_Msk | SFR_SCON_TI_Msk};
+    nvic->map[5] = (interrupt_t){.name = "Timer 2 (TF2/EXF2)", .bit_mask = SFR_IE_ET2_Msk, .vector = 0x002B, .sfr_address = SFR_T2CON, .sfr_bit_mask = SFR_T2CON_TF2_Msk | SFR_T2CON_EXF2_Msk};
+
+    // 8051, the variant adds its sources (mcs51_register_sfrs())
+    nvic->_sources = SFR_IE_ES_Msk | SFR_IE_ET1_Msk | SFR_IE_EX1_Msk | SFR_IE_ET0_Msk | SFR_IE_EX0_Msk;
+    nvic->_wake_up = SFR_IE_EX1_Msk | SFR_IE_EX0_Msk;
+    nvic->_iph_mask = 0x00;
 }
 
 void nvic_reset(nvic_t* nvic)
 {
     nvic->_isr_pending = 0;
     nvic->_isr_active_msk = 0;
+    nvic->_isr_running_msk = 0;
 }
 
 /**
@@ -38,17 +45,19 @@ void nvic_latch_interrupt_flags(nvic_t* nvic, mcs51_t* p)
 {
     nvic->_isr_pending = 0;
 
-    /// MSB [ RI/TI | TF1 | IE1 | TF0 | IE0 ] LSB
+    /// MSB [ TF2/EXF2 | RI/TI | TF1 | IE1 | TF0 | IE0 ] LSB
     nvic->_isr_pending |= (p->D[SFR_TCON] & SFR_TCON_IE0_Msk) >> SFR_TCON_IE0_Pos << 0;
     nvic->_isr_pending |= (p->D[SFR_TCON] & SFR_TCON_TF0_Msk) >> SFR_TCON_TF0_Pos << 1;
     nvic->_isr_pending |= (p->D[SFR_TCON] & SFR_TCON_IE1_Msk) >> SFR_TCON_IE1_Pos << 2;
     nvic->_isr_pending |= (p->D[SFR_TCON] & SFR_TCON_TF1_Msk) >> SFR_TCON_TF1_Pos << 3;
     nvic->_isr_pending |= (p->D[SFR_SCON] & SFR_SCON_RI_Msk) >> SFR_SCON_RI_Pos << 4;
     nvic->_isr_pending |= (p->D[SFR_SCON] & SFR_SCON_TI_Msk) >> SFR_SCON_TI_Pos << 4;
-}
+    nvic->_isr_pending |= (p->D[SFR_T2CON] & SFR_T2CON_TF2_Msk) >> SFR_T2CON_TF2_Pos << 5;
+    nvic->_isr_pending |= (p->D[SFR_T2CON] & SFR_T2CON_EXF2_Msk) >> SFR_T2CON_EXF2_Pos << 5;
 
+    nvic->_isr_pending &= nvic->_sources;
+}
 
-// TODO SFR_IP Interrupt Prios
 
 // Convert an (interrupt) mask to the bit number. Does not work for an empty mask.
 static uint8_t nvic_interrupt_mask_to_bit_number(uint8_t interrupt_mask)
@@ -71,22 +80,29 @@ static uint8_t nvic_scan(uint8_t interrupt_bit_mask)
     return interrupt_bit_mask & mask;
 }
 
-static uint8_t nvic_priority_scan(uint8_t priority_mask, uint8_t interrupt_bit_mask)
+/// Scan the priority levels from 3 (IPH and IP set) to 0, without IPH only levels 1 and 0 are used
+static uint8_t nvic_priority_scan(nvic_t* nvic, mcs51_t* p, uint8_t interrupt_bit_mask)
 {
-    uint8_t prio_mask_high = nvic_scan(priority_mask & interrupt_bit_mask);
-    if (prio_mask_high)
+    const uint8_t ip = p->D[SFR_IP];
+    const uint8_t iph = p->D[SFR_IPH] & nvic->_iph_mask;
+    const uint8_t levels[4] = {iph & ip, iph & ~ip, ~iph & ip, ~iph & ~ip};
+
+    for (unsigned int i = 0; i < 4; i++)
     {
-        return prio_mask_high;
+        uint8_t prio_mask = nvic_scan(levels[i] & interrupt_bit_mask);
+        if (prio_mask)
+        {
+            return prio_mask;
+        }
     }
 
-    // Lower priority
-    return nvic_scan(interrupt_bit_mask);
+    return 0;
 }
 
 static void nvic_select_next_interrupt(nvic_t* nvic, mcs51_t* p, uint8_t interrupt_bit_mask)
 {
     // Scan for the highest priority interrupt
-    uint8_t interrupt_mask = nvic_priority_scan(p->D[SFR_IP], interrupt_bit_mask);
+    uint8_t interrupt_mask = nvic_priority_scan(nvic, p, interrupt_bit_mask);
 
     if (interrupt_mask)
     {
@@ -114,6 +130,10 @@ void nvic_run_interrupt_controller(nvic_t* nvic, mcs51_t* p)
     uint8_t interrupt_enable = p->D[SFR_IE];
     uint8_t pending_and_enabled = nvic->_isr_pending & interrupt_enable;
 
+    // Power-down is ended by a reset or an external interrupt only, others stay pending
+    if (p->D[SFR_PCON] & SFR_PCON_PD_Msk)
+        pending_and_enabled &= nvic->_wake_up;
+
     // Current instruction complete AND all interrupts are enabled AND current instruction is not RETI
     // AND current instruction does not have access to IP or IE
     if (p->_instruction_register.opcode.cycles == 0
@@ -132,7 +152,7 @@ void nvic_reti(nvic_t* nvic, mcs51_t* p)
     nvic->_isr_active_msk &= ~(nvic->_isr_running_msk);
 
     // Scan for the highest priority interrupt
-    nvic->_isr_running_msk = nvic_priority_scan(p->D[SFR_IP], nvic->_isr_active_msk);
+    nvic->_isr_running_msk = nvic_priority_scan(nvic, p, nvic->_isr_active_msk);
 }
 
 static void nvic_inserted_LJMP(mcs51_t* p)
@@ -143,6 +163,14 @@ static void nvic_inserted_LJMP(mcs51_t* p)
 
 void nvic_jump_to_isr(nvic_t* nvic, mcs51_t* p, interrupt_t interrupt)
 {
+    // An enabled interrupt terminates IDLE mode, an external one power-down mode (nvic_run_interrupt_controller()).
+    // The ISR returns behind the instruction that set IDL/PD
+    if (is_sleeping(p))
+    {
+        p->D[SFR_PCON] &= ~(SFR_PCON_IDL_Msk | SFR_PCON_PD_Msk);
+        mcs51_power_mode_changed(p); // The oscillator restarts after power-down
+    }
+
     nvic->_isr_running_msk = interrupt.bit_mask;
     nvic->_isr_active_msk |= nvic->_isr_running_msk;
     nvic->_ljmp_vector = interrupt.vector;
@@ -6,168 +6,57 @@
 #include "mcs51.h"
 #include "mcs51_helpers.h"
 
+/// The interpreter cores (mcs51_core.h) include this file with inlined actors
+#ifndef IMPL
 #define IMPL(name) void name(mcs51_t* p)
+#endif
 
-IMPL(NOP)
-{
-}
-
-IMPL(INC_direct)
-{
-    uint8_t direct = pop_pc_u8(p);
-    p->D[direct] += 1;
-
-    check_sfr_write_access(p, direct);
-}
-
-IMPL(INC_DPTR)
-{
-    if (++p->D[SFR_DPL] == 0) // Pre-increment
-    {
-        p->D[SFR_DPH] += 1;
-    }
-}
-
-IMPL(INC_A)
-{
-    ACC += 1;
-}
-
-IMPL(INC_R0)
-{
-    R0 += 1;
-}
-
-IMPL(INC_R1)
-{
-    R1 += 1;
-}
-
-IMPL(INC_R2)
-{
-    R2 += 1;
-}
-
-IMPL(INC_R3)
-{
-    R3 += 1;
-}
-
-IMPL(INC_R4)
-{
-    R4 += 1;
-}
-
-IMPL(INC_R5)
-{
-    R5 += 1;
-}
-
-IMPL(INC_R6)
-{
-    R6 += 1;
-}
-
-IMPL(INC_R7)
-{
-    R7 += 1;
-}
-
-IMPL(DEC_R0)
-{
-    R0 -= 1;
-}
-
-IMPL(DEC_R1)
-{
-    R1 -= 1;
-}
-
-IMPL(DEC_R2)
-{
-    R2 -= 1;
-}
-
-IMPL(DEC_direct)
-{
-    uint8_t direct = pop_pc_u8(p);
-    p->D[direct] -= 1;
-
-    check_sfr_write_access(p, direct);
-}
-
-IMPL(ADD_A_immed)
-{
-    uint8_t immed = pop_pc_u8(p);
-    ACC += immed;
-}
-
-IMPL(ADD_A_direct)
-{
-    uint8_t direct = pop_pc_u8(p);
-    ACC += p->D[direct];
-
-    check_sfr_read_access(p, direct);
-}
-
-IMPL(ADD_A_R0)
-{
-    ACC += R0;
-}
-
-IMPL(ADD_A_R1)
-{
-    ACC += R1;
-}
-
-IMPL(ADD_A_R2)
-{
-    ACC += R2;
-}
-
-IMPL(ADD_A_R3)
-{
-    ACC += R3;
-}
+/**
+ * Actors of the regular instruction families (ADD, MOV, ANL, CJNE, SETB, ...) are generated from
+ * operand class templates (A, Rn, @Ri, direct, #immed, bit) by generate_opcode.py.
+ * Actors implemented in this file take precedence over the generated ones.
+ */
+#include "opcode_impl_template_gen.h"
 
-IMPL(ADD_A_R4)
+static inline uint16_t dptr(mcs51_t* p)
 {
-    ACC += R4;
+    return (((uint16_t) p->D[SFR_DPH]) << 8) | p->D[SFR_DPL];
 }
 
-IMPL(ADD_A_R5)
+/**
+ * MOVX @Ri: The lower address byte is taken from Ri, the upper address byte from P2.
+ */
+static inline uint16_t xdata_address(mcs51_t* p, uint8_t ri)
 {
-    ACC += R5;
+    return (((uint16_t) p->D[SFR_P2]) << 8) | ri;
 }
 
-IMPL(ADD_A_R6)
+static inline uint8_t read_xdata(mcs51_t* p, uint16_t address)
 {
-    ACC += R6;
+#if MCS51_CORE_MEMORY
+    memprofile_record(p->_memprofile, &p->_memprofile->xdata[address], false);
+#endif
+    return p->X[address];
 }
 
-IMPL(ADD_A_R7)
+static inline void write_xdata(mcs51_t* p, uint16_t address, uint8_t value)
 {
-    ACC += R7;
+#if MCS51_CORE_MEMORY
+    memprofile_record(p->_memprofile, &p->_memprofile->xdata[address], true);
+#endif
+    p->X[address] = value;
 }
 
-IMPL(SUBB_A_R6)
+IMPL(NOP)
 {
-    uint8_t underflow = ACC < (GET_C() + R6);
-    ACC = ACC - GET_C() - R6;
-    if (underflow)
-        SET_C();
-    else
-        CLEAR_C();
 }
 
-IMPL(SUBB_A_R7)
+IMPL(INC_DPTR)
 {
-    uint8_t underflow = ACC < (GET_C() + R7);
-    ACC = ACC - GET_C() - R7;
-    if (underflow)
-        SET_C();
-    else
-        CLEAR_C();
+    if (++p->D[SFR_DPL] == 0) // Pre-increment
+    {
+        p->D[SFR_DPH] += 1;
+    }
 }
 
 /**
@@ -178,6 +67,8 @@ IMPL(SUBB_A_R7)
  */
 IMPL(MUL_AB)
 {
+    sync_psw(p);
+
     uint16_t product = (uint16_t) p->D[SFR_ACC] * p->D[SFR_B];
 
     p->D[SFR_ACC] = (product >> 0) & 0xFF;
@@ -191,329 +82,105 @@ IMPL(MUL_AB)
     p->D[SFR_PSW] &= ~SFR_PSW_C_Msk;
 }
 
-IMPL(SWAP_A)
-{
-    ACC = ((ACC >> 4) & 0x0F) | ((ACC << 4) & 0xF0);
-}
-
-IMPL(RL_A)
-{
-    if (ACC & 0b10000000)
-        ACC = (ACC << 1) | 0b1;
-    else
-        ACC = (ACC << 1);
-}
-
-IMPL(CPL_bit)
-{
-    uint8_t bit = pop_pc_u8(p);
-
-    uint8_t mask = bit_mask(bit);
-    uint8_t byte_idx = bit_byte_index(bit);
-
-    if ((p->D[byte_idx] & mask) == 0)
-        p->D[byte_idx] |= mask;
-    else
-        p->D[byte_idx] &= ~mask;
-
-    check_sfr_write_access(p, byte_idx);
-}
-
-IMPL(SETB_bit)
+/**
+ * The DIV instruction divides the unsigned 8-bit integer in the accumulator by the unsigned 8-bit
+ * integer in the B register. The quotient is returned in the accumulator and the remainder in B.
+ * A division by zero leaves A and B undefined (unchanged here) and sets the OV flag.
+ * The carry flag is always cleared.
+ */
+IMPL(DIV_AB)
 {
-    uint8_t bit = pop_pc_u8(p);
-
-    uint8_t mask = bit_mask(bit);
-    uint8_t byte_idx = bit_byte_index(bit);
-
-    p->D[byte_idx] |= mask;
+    sync_psw(p);
 
-    check_sfr_write_access(p, byte_idx);
-}
+    uint8_t divisor = p->D[SFR_B];
 
-IMPL(CLR_C)
-{
-    CLEAR_C();
-}
+    if (divisor == 0)
+    {
+        p->D[SFR_PSW] |= SFR_PSW_OV_Msk;
+    } else
+    {
+        uint8_t dividend = p->D[SFR_ACC];
+        p->D[SFR_ACC] = dividend / divisor;
+        p->D[SFR_B] = dividend % divisor;
+        p->D[SFR_PSW] &= ~SFR_PSW_OV_Msk;
+    }
 
-IMPL(CLR_A)
-{
-    ACC = 0;
+    p->D[SFR_PSW] &= ~SFR_PSW_C_Msk;
 }
 
-IMPL(CLR_bit)
+/**
+ * Decimal adjust the accumulator after a BCD addition.
+ * The carry flag is set if the result exceeds 99, it is never cleared.
+ */
+IMPL(DA_A)
 {
-    uint8_t bit = pop_pc_u8(p);
+    sync_psw(p);
 
-    uint8_t mask = bit_mask(bit);
-    uint8_t byte_idx = bit_byte_index(bit);
-
-    p->D[byte_idx] &= ~mask;
-
-    check_sfr_write_access(p, byte_idx);
-}
+    uint16_t result = ACC;
 
-IMPL(MOV_C_bit)
-{
-    uint8_t bit = pop_pc_u8(p);
+    if ((result & 0x0F) > 0x09 || (p->D[SFR_PSW] & SFR_PSW_AC_Msk))
+        result += 0x06;
 
-    uint8_t mask = bit_mask(bit);
-    uint8_t byte_idx = bit_byte_index(bit);
+    if ((result & 0x1F0) > 0x90 || GET_C())
+        result += 0x60;
 
-    if (p->D[byte_idx] & mask)
+    if (result > 0xFF)
         SET_C();
-    else
-        CLEAR_C();
-}
-
-IMPL(MOV_R1_direct)
-{
-    uint8_t direct = pop_pc_u8(p);
-    R1 = p->D[direct];
 
-    check_sfr_read_access(p, direct);
+    ACC = result;
 }
 
-IMPL(MOV_direct_direct)
-{
-    uint8_t direct1 = pop_pc_u8(p);
-    uint8_t direct2 = pop_pc_u8(p);
-    p->D[direct1] = p->D[direct2];
-
-    check_sfr_read_access(p, direct2);
-    check_sfr_write_access(p, direct1);
-}
-
-IMPL(MOV_direct_A)
-{
-    uint8_t direct = pop_pc_u8(p);
-    p->D[direct] = ACC;
-
-    check_sfr_write_access(p, direct);
-}
-
-IMPL(MOV_direct_R0)
-{
-    uint8_t direct = pop_pc_u8(p);
-    p->D[direct] = R0;
-
-    check_sfr_write_access(p, direct);
-}
-
-IMPL(MOV_direct_R1)
-{
-    uint8_t direct = pop_pc_u8(p);
-    p->D[direct] = R1;
-
-    check_sfr_write_access(p, direct);
-}
-
-IMPL(MOV_direct_R2)
-{
-    uint8_t direct = pop_pc_u8(p);
-    p->D[direct] = R2;
-
-    check_sfr_write_access(p, direct);
-}
-
-IMPL(MOV_direct_R3)
-{
-    uint8_t direct = pop_pc_u8(p);
-    p->D[direct] = R3;
-
-    check_sfr_write_access(p, direct);
-}
-
-IMPL(MOV_direct_AtR0)
-{
-    uint8_t direct = pop_pc_u8(p);
-    p->D[direct] = p->D[R0];
-
-    check_sfr_write_access(p, direct);
-}
-
-IMPL(MOV_direct_AtR1)
-{
-    uint8_t direct = pop_pc_u8(p);
-    p->D[direct] = p->D[R1];
-
-    check_sfr_write_access(p, direct);
-}
-
-IMPL(MOV_R2_A)
-{
-    R2 = ACC;
-}
-
-IMPL(MOV_R3_A)
-{
-    R3 = ACC;
-}
-
-IMPL(MOV_R4_A)
-{
-    R4 = ACC;
-}
-
-IMPL(MOV_R6_A)
-{
-    R6 = ACC;
-}
-
-IMPL(MOV_R1_immed)
-{
-    uint8_t immed = pop_pc_u8(p);
-    R1 = immed;
-}
-
-IMPL(MOV_R3_immed)
-{
-    uint8_t immed = pop_pc_u8(p);
-    R3 = immed;
-}
-
-IMPL(MOV_R4_immed)
-{
-    uint8_t immed = pop_pc_u8(p);
-    R4 = immed;
-}
-
-IMPL(MOV_R7_immed)
-{
-    uint8_t immed = pop_pc_u8(p);
-    R7 = immed;
-}
-
-IMPL(MOV_direct_immed)
-{
-    uint8_t direct = pop_pc_u8(p);
-    uint8_t immed = pop_pc_u8(p);
-
-    p->D[direct] = immed;
-
-    check_sfr_write_access(p, direct);
-}
-
-IMPL(MOV_A_direct)
-{
-    uint8_t direct = pop_pc_u8(p);
-    ACC = p->D[direct];
-
-    check_sfr_read_access(p, direct);
-}
-
-IMPL(MOV_A_AtR0)
-{
-    uint16_t indirect = to_indirect_address(R1);
-    ACC = p->D[indirect];
-}
-
-IMPL(MOV_A_AtR1)
-{
-    uint16_t indirect = to_indirect_address(R0);
-    ACC = p->D[indirect];
-}
-
-IMPL(MOV_A_immed)
-{
-    uint8_t immed = pop_pc_u8(p);
-
-    ACC = immed;
-}
-
-IMPL(MOV_R0_A)
-{
-    R0 = ACC;
-}
-
-IMPL(MOV_R1_A)
-{
-    R1 = ACC;
-}
-
-IMPL(MOV_R0_direct)
-{
-    uint8_t direct = pop_pc_u8(p);
-
-    R0 = p->D[direct];
-
-    check_sfr_read_access(p, direct);
-}
-
-IMPL(MOV_R0_immed)
-{
-    uint8_t immed = pop_pc_u8(p);
-
-    R0 = immed;
-}
-
-IMPL(MOV_AtR0_A)
-{
-    uint16_t indirect = to_indirect_address(R0);
-    p->D[indirect] = ACC;
-}
-
-IMPL(MOV_AtR1_A)
-{
-    uint16_t indirect = to_indirect_address(R1);
-    p->D[indirect] = ACC;
-}
-
-IMPL(MOV_AtR0_immed)
+IMPL(SWAP_A)
 {
-    uint8_t immed = pop_pc_u8(p);
-    uint16_t indirect = to_indirect_address(R0);
-    p->D[indirect] = immed;
+    ACC = ((ACC >> 4) & 0x0F) | ((ACC << 4) & 0xF0);
 }
 
-IMPL(MOV_A_R0)
+IMPL(RL_A)
 {
-    ACC = R0;
+    if (ACC & 0b10000000)
+        ACC = (ACC << 1) | 0b1;
+    else
+        ACC = (ACC << 1);
 }
 
-IMPL(MOV_A_R1)
+IMPL(RLC_A)
 {
-    ACC = R1;
-}
+    uint8_t carry = GET_C();
 
-IMPL(MOV_A_R2)
-{
-    ACC = R2;
+    PUT_C(ACC & 0b10000000);
+    ACC = (ACC << 1) | carry;
 }
 
-IMPL(MOV_A_R3)
+IMPL(RR_A)
 {
-    ACC = R3;
+    if (ACC & 0b1)
+        ACC = (ACC >> 1) | 0b10000000;
+    else
+        ACC = (ACC >> 1);
 }
 
-IMPL(MOV_A_R4)
+IMPL(RRC_A)
 {
-    ACC = R4;
-}
+    uint8_t carry = GET_C();
 
-IMPL(MOV_A_R5)
-{
-    ACC = R5;
+    PUT_C(ACC & 0b1);
+    ACC = (ACC >> 1) | (carry << 7);
 }
 
-IMPL(MOV_A_R6)
+IMPL(XCHD_A_AtR0)
 {
-    ACC = R6;
-}
+    uint8_t at = read_indirect(p, R0);
 
-IMPL(MOV_A_R7)
-{
-    ACC = R7;
+    write_indirect(p, R0, (at & 0xF0) | (ACC & 0x0F));
+    ACC = (ACC & 0xF0) | (at & 0x0F);
 }
 
-IMPL(MOV_R5_A)
+IMPL(XCHD_A_AtR1)
 {
-    R5 = ACC;
-}
+    uint8_t at = read_indirect(p, R1);
 
-IMPL(MOV_R7_A)
-{
-    R7 = ACC;
+    write_indirect(p, R1, (at & 0xF0) | (ACC & 0x0F));
+    ACC = (ACC & 0xF0) | (at & 0x0F);
 }
 
 IMPL(MOV_DPTR_immed)
@@ -526,269 +193,85 @@ IMPL(MOV_DPTR_immed)
 
 IMPL(MOVX_A_AtDPTR)
 {
-
-    uint16_t dptr = (((uint16_t) p->D[SFR_DPH]) << 8) | p->D[SFR_DPL];
-    ACC = p->X[dptr];
+    ACC = read_xdata(p, dptr(p));
 }
 
-IMPL(MOVX_AtDPTR_A)
+IMPL(MOVX_A_AtR0)
 {
-
-    uint16_t dptr = (((uint16_t) p->D[SFR_DPH]) << 8) | p->D[SFR_DPL];
-    p->X[dptr] = ACC;
+    ACC = read_xdata(p, xdata_address(p, R0));
 }
 
-IMPL(MOVC_A_AtAPlusDPTR)
-{
-
-    uint16_t dptr = (((uint16_t) p->D[SFR_DPH]) << 8) | p->D[SFR_DPL];
-    ACC = p->C[ACC + dptr];
-}
-
-IMPL(ANL_A_AtR1)
-{
-    uint16_t indirect = to_indirect_address(R1);
-    ACC &= p->D[indirect];
-}
-
-IMPL(ANL_C_Negbit)
+IMPL(MOVX_A_AtR1)
 {
-    uint8_t bit = pop_pc_u8(p);
-
-    uint8_t mask = bit_mask(bit);
-    uint8_t byte_idx = bit_byte_index(bit);
-
-    if (GET_C() && !(p->D[byte_idx] & mask))
-        SET_C();
-    else
-        CLEAR_C();
+    ACC = read_xdata(p, xdata_address(p, R1));
 }
 
-IMPL(ANL_A_direct)
-{
-    uint8_t direct = pop_pc_u8(p);
-
-    ACC &= p->D[direct];
-
-    check_sfr_read_access(p, direct);
-}
-
-IMPL(ANL_A_immed)
-{
-    uint8_t immed = pop_pc_u8(p);
-
-    ACC &= immed;
-}
-
-IMPL(ANL_direct_A)
-{
-    uint8_t direct = pop_pc_u8(p);
-
-    p->D[direct] &= ACC;
-
-    check_sfr_write_access(p, direct);
-}
-
-IMPL(ANL_A_R2)
-{
-    ACC &= R2;
-}
-
-IMPL(ANL_A_R6)
-{
-    ACC &= R6;
-}
-
-IMPL(ORL_A_R1)
-{
-    ACC |= R1;
-}
-
-IMPL(ORL_A_R6)
-{
-    ACC |= R6;
-}
-
-IMPL(ORL_direct_immed)
-{
-    uint8_t direct = pop_pc_u8(p);
-    uint8_t immed = pop_pc_u8(p);
-
-    p->D[direct] |= immed;
-
-    check_sfr_write_access(p, direct);
-}
-
-IMPL(CJNE_AtR1_immed_offset)
-{
-    uint8_t immed = pop_pc_u8(p);
-    int8_t offset = pop_pc_s8(p);
-
-    uint16_t indirect = to_indirect_address(R0);
-    uint8_t at = p->D[indirect];
-    if (at != immed)
-        p->PC = p->PC + offset;
-
-    if (at < immed)
-        SET_C();
-    else
-        CLEAR_C();
-}
-
-IMPL(CJNE_R0_immed_offset)
+IMPL(MOVX_AtDPTR_A)
 {
-    uint8_t immed = pop_pc_u8(p);
-    int8_t offset = pop_pc_s8(p);
-
-    if (R0 != immed)
-        p->PC = p->PC + offset;
-
-    if (R0 < immed)
-        SET_C();
-    else
-        CLEAR_C();
+    write_xdata(p, dptr(p), ACC);
 }
 
-IMPL(CJNE_R2_immed_offset)
+IMPL(MOVX_AtR0_A)
 {
-    uint8_t immed = pop_pc_u8(p);
-    int8_t offset = pop_pc_s8(p);
-
-    if (R2 != immed)
-        p->PC = p->PC + offset;
-
-    if (R2 < immed)
-        SET_C();
-    else
-        CLEAR_C();
+    write_xdata(p, xdata_address(p, R0), ACC);
 }
 
-IMPL(CJNE_R4_immed_offset)
+IMPL(MOVX_AtR1_A)
 {
-    uint8_t immed = pop_pc_u8(p);
-    int8_t offset = pop_pc_s8(p);
-
-    if (R4 != immed)
-        p->PC = p->PC + offset;
-
-    if (R4 < immed)
-        SET_C();
-    else
-        CLEAR_C();
+    write_xdata(p, xdata_address(p, R1), ACC);
 }
 
-IMPL(CJNE_A_immed_offset)
+IMPL(MOVC_A_AtAPlusDPTR)
 {
-    uint8_t immed = pop_pc_u8(p);
-    int8_t offset = pop_pc_s8(p);
-
-    if (ACC != immed)
-        p->PC = p->PC + offset;
-
-    if (ACC < immed)
-        SET_C();
-    else
-        CLEAR_C();
+    ACC = p->C[(uint16_t) (ACC + dptr(p))];
 }
 
-IMPL(CJNE_A_direct_offset)
+/**
+ * The PC has already been incremented to the address of the following instruction.
+ */
+IMPL(MOVC_A_AtAPlusPC)
 {
-    uint8_t direct = pop_pc_u8(p);
-    int8_t offset = pop_pc_s8(p);
-
-    if (ACC != p->D[direct])
-        p->PC = p->PC + offset;
-
-    if (ACC < p->D[direct])
-        SET_C();
-    else
-        CLEAR_C();
-
-    check_sfr_read_access(p, direct);
+    ACC = p->C[(uint16_t) (ACC + p->PC)];
 }
 
-IMPL(JB_bit_offset)
+IMPL(JC_offset)
 {
-    uint8_t bit = pop_pc_u8(p);
     int8_t offset = pop_pc_s8(p);
 
-    uint8_t mask = bit_mask(bit);
-    uint8_t byte_idx = bit_byte_index(bit);
-
-    if (p->D[byte_idx] & mask)
-        p->PC = p->PC + offset;
+    jump_relative_if(p, GET_C() == 1, offset);
 }
 
-IMPL(JC_offset)
+IMPL(JNC_offset)
 {
     int8_t offset = pop_pc_s8(p);
 
-    if (GET_C() == 1)
-        p->PC = p->PC + offset;
+    jump_relative_if(p, GET_C() == 0, offset);
 }
 
 IMPL(JZ_offset)
 {
     int8_t offset = pop_pc_s8(p);
 
-    if (ACC == 0)
-        p->PC += offset;
+    jump_relative_if(p, ACC == 0, offset);
 }
 
 IMPL(JNZ_offset)
 {
     int8_t offset = pop_pc_s8(p);
 
-    if (ACC != 0)
-        p->PC += offset;
+    jump_relative_if(p, ACC != 0, offset);
 }
 
-IMPL(DJNZ_R7_offset)
-{
-    int8_t offset = pop_pc_s8(p);
-    // p->PC += 2; // This should be 3? See Keil documentation...
-    R7 -= 1;
-    if (R7 != 0)
-        p->PC += offset;
-}
-
-IMPL(JNB_bit_offset)
-{
-    uint8_t bit = pop_pc_u8(p);
-    int8_t offset = pop_pc_s8(p);
-
-    uint8_t mask = bit_mask(bit);
-    uint8_t byte_idx = bit_byte_index(bit);
-
-    if ((p->D[byte_idx] & mask) == 0)
-        p->PC += offset;
-}
-
-/**
- * TODO: When this instruction is used to modify an output port, the value used as the port data is read
- * from the output data latch, not the input pins of the port.
- */
-IMPL(JBC_bit_offset)
+IMPL(SJMP_offset)
 {
-    uint8_t bit = pop_pc_u8(p);
     int8_t offset = pop_pc_s8(p);
 
-    uint8_t mask = bit_mask(bit);
-    uint8_t byte_idx = bit_byte_index(bit);
-
-    if (p->D[byte_idx] & mask)
-    {
-        p->D[byte_idx] &= ~mask; // Clear bit
-        check_sfr_write_access(p, byte_idx);
-        p->PC += offset;
-    }
+    p->PC += offset;
 }
 
-IMPL(SJMP_offset)
+IMPL(JMP_AtAPlusDPTR)
 {
-    int8_t offset = pop_pc_s8(p);
-
-    p->PC += offset;
+    p->PC = ACC + dptr(p);
 }
 
 IMPL(LJMP_addr16)
@@ -797,29 +280,31 @@ IMPL(LJMP_addr16)
     p->PC = addr16;
 }
 
+/**
+ * The upper three address bits are encoded in the opcode:
+ * A10-A9-A8-0-0-0-0-1		A7-A6-A5-A4-A3-A2-A1-A0
+ * The target lies within the 2K page of the following instruction.
+ */
 IMPL(AJMP_addr11)
 {
-    // A10-A9-A8-1-0-0-0-1		A7-A6-A5-A4-A3-A2-A1-A0
     uint8_t code = p->_instruction_register.opcode.code;
-    uint8_t addr11 = pop_pc_u8(p);
-
-    uint16_t a = (uint16_t) code << 3;
-    a |= addr11;
+    uint16_t addr11 = ((uint16_t) (code >> 5) << 8) | pop_pc_u8(p);
 
-    p->PC = p->PC & ~0x3FF; // Clear bit 10-0
-    p->PC |= a;
+    p->PC = p->PC & ~0x7FF; // Clear bit 10-0
+    p->PC |= addr11;
 }
 
+/**
+ * A10-A9-A8-1-0-0-0-1		A7-A6-A5-A4-A3-A2-A1-A0
+ */
 IMPL(ACALL_addr11)
 {
-    // A10-A9-A8-1-0-0-0-1		A7-A6-A5-A4-A3-A2-A1-A0
     uint8_t code = p->_instruction_register.opcode.code;
-    uint16_t addr11 = pop_pc_u8(p);
-    addr11 |= ((uint16_t) code >> 5);
+    uint16_t addr11 = ((uint16_t) (code >> 5) << 8) | pop_pc_u8(p);
 
     push_sp_u16(p, p->PC);
 
-    p->PC = p->PC & ~0x3FF; // Clear bit 10-0
+    p->PC = p->PC & ~0x7FF; // Clear bit 10-0
     p->PC |= addr11;
 }
 
@@ -847,16 +332,12 @@ IMPL(PUSH_direct)
 {
     uint8_t direct = pop_pc_u8(p);
 
-    push_sp_u8(p, p->D[direct]);
-
-    check_sfr_read_access(p, direct); // Todo: Is this even possible?
+    push_sp_u8(p, read_direct(p, direct));
 }
 
 IMPL(POP_direct)
 {
     uint8_t direct = pop_pc_u8(p);
 
-    p->D[direct] = pop_sp_u8(p);
-
-    check_sfr_write_access(p, direct); // Todo: Is this even possible?
+    write_direct(p, direct, pop_sp_u8(p));
 }
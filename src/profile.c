@@ -0,0 +1,162 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "profile.h"
+#include "mcs51.h"
+#include <stdbool.h>
+#include <string.h>
+
+void profile_reset(profile_t* profile)
+{
+    memset(profile, 0, sizeof(*profile));
+}
+
+/// Index of the largest count that is smaller than the limit (or equal, but at a higher index)
+static long profile_next_max(const uint64_t* counts, long size, uint64_t limit, long limit_index)
+{
+    long max_index = -1;
+
+    for (long i = 0; i < size; i++)
+    {
+        bool below_limit = counts[i] < limit || (counts[i] == limit && i > limit_index);
+        if (counts[i] > 0 && below_limit && (max_index < 0 || counts[i] > counts[max_index]))
+            max_index = i;
+    }
+
+    return max_index;
+}
+
+static void profile_print_opcode(const mcs51_t* p, uint8_t code, FILE* file)
+{
+    const opcode_t* opcode = &p->opcode_map[code];
+    fprintf(file, "%s %s %s %s", opcode->mnemonic, opcode->arg1, opcode->arg2, opcode->arg3);
+}
+
+/// Print the opcodes (first opcode in the most significant byte) separated by semicolons
+static void profile_print_sequence(const mcs51_t* p, uint32_t opcodes, unsigned int length, FILE* file)
+{
+    for (int i = (int) length - 1; i >= 0; i--)
+    {
+        profile_print_opcode(p, (opcodes >> (8 * i)) & 0xFF, file);
+        if (i > 0)
+            fprintf(file, "; ");
+    }
+}
+
+static void profile_triple_counts(const profile_t* profile, uint64_t* counts)
+{
+    for (long i = 0; i < PROFILE_TRIPLE_SLOTS; i++)
+        counts[i] = profile->triples[i].count;
+}
+
+void profile_print(const profile_t* profile, const mcs51_t* p, FILE* file, unsigned int top_n)
+{
+    fprintf(file, "Executed instructions: %llu\n", (unsigned long long) profile->instructions);
+
+    fprintf(file, "Top opcodes:\n");
+    uint64_t limit = UINT64_MAX;
+    long index = -1;
+    for (unsigned int n = 0; n < top_n; n++)
+    {
+        index = profile_next_max(profile->opcode_count, 0x100, limit, index);
+        if (index < 0)
+            break;
+
+        limit = profile->opcode_count[index];
+        fprintf(file, "  %12llu  0x%02lx ", (unsigned long long) limit, index);
+        profile_print_opcode(p, index, file);
+        fprintf(file, "\n");
+    }
+
+    fprintf(file, "Top CODE addresses:\n");
+    limit = UINT64_MAX;
+    index = -1;
+    for (unsigned int n = 0; n < top_n; n++)
+    {
+        index = profile_next_max(profile->pc_count, 0x10000, limit, index);
+        if (index < 0)
+            break;
+
+        limit = profile->pc_count[index];
+        fprintf(file, "  %12llu  0x%04lx ", (unsigned long long) limit, index);
+        profile_print_opcode(p, p->C[index], file);
+        fprintf(file, "\n");
+    }
+
+    fprintf(file, "Top opcode pairs:\n");
+    limit = UINT64_MAX;
+    index = -1;
+    for (unsigned int n = 0; n < top_n; n++)
+    {
+        index = profile_next_max(profile->pair_count, 0x10000, limit, index);
+        if (index < 0)
+            break;
+
+        limit = profile->pair_count[index];
+        fprintf(file, "  %12llu  %04lx ", (unsigned long long) limit, index);
+        profile_print_sequence(p, index, 2, file);
+        fprintf(file, "\n");
+    }
+
+    uint64_t triple_counts[PROFILE_TRIPLE_SLOTS];
+    profile_triple_counts(profile, triple_counts);
+
+    fprintf(file, "Top opcode triples (approximate):\n");
+    limit = UINT64_MAX;
+    index = -1;
+    for (unsigned int n = 0; n < top_n; n++)
+    {
+        index = profile_next_max(triple_counts, PROFILE_TRIPLE_SLOTS, limit, index);
+        if (index < 0)
+            break;
+
+        limit = triple_counts[index];
+        fprintf(file, "  %12llu  %06x ", (unsigned long long) limit, profile->triples[index].opcodes);
+        profile_print_sequence(p, profile->triples[index].opcodes, 3, file);
+        fprintf(file, "\n");
+    }
+}
+
+static void profile_write_superinstruction(const mcs51_t* p, uint32_t opcodes, unsigned int length, uint64_t count, FILE* file)
+{
+    for (int i = (int) length - 1; i >= 0; i--)
+        fprintf(file, "%02X ", (opcodes >> (8 * i)) & 0xFF);
+
+    fprintf(file, "%*s# %llu: ", 3 * (3 - length), "", (unsigned long long) count);
+    profile_print_sequence(p, opcodes, length, file);
+    fprintf(file, "\n");
+}
+
+void profile_write_superinstructions(const profile_t* profile, const mcs51_t* p, FILE* file, unsigned int top_n)
+{
+    fprintf(file, "# Superinstructions, generated from a profile of %llu instructions\n", (unsigned long long) profile->instructions);
+
+    uint64_t limit = UINT64_MAX;
+    long index = -1;
+    for (unsigned int n = 0; n < top_n; n++)
+    {
+        index = profile_next_max(profile->pair_count, 0x10000, limit, index);
+        if (index < 0)
+            break;
+
+        limit = profile->pair_count[index];
+        profile_write_superinstruction(p, index, 2, limit, file);
+    }
+
+    uint64_t triple_counts[PROFILE_TRIPLE_SLOTS];
+    profile_triple_counts(profile, triple_counts);
+
+    limit = UINT64_MAX;
+    index = -1;
+    for (unsigned int n = 0; n < top_n; n++)
+    {
+        index = profile_next_max(triple_counts, PROFILE_TRIPLE_SLOTS, limit, index);
+        if (index < 0)
+            break;
+
+        limit = triple_counts[index];
+        profile_write_superinstruction(p, profile->triples[index].opcodes, 3, limit, file);
+    }
+}
@@ -0,0 +1,162 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "scheduler.h"
+#include "mcs51.h"
+#include <assert.h>
+
+static bool scheduler_before(const scheduler_t* s, uint8_t a, uint8_t b)
+{
+    const uint64_t due_a = s->events[a].due;
+    const uint64_t due_b = s->events[b].due;
+
+    // Events due in the same period run in the order of their handles (deterministic)
+    return due_a < due_b || (due_a == due_b && a < b);
+}
+
+static void scheduler_swap(scheduler_t* s, uint8_t i, uint8_t j)
+{
+    uint8_t handle = s->heap[i];
+    s->heap[i] = s->heap[j];
+    s->heap[j] = handle;
+
+    s->events[s->heap[i]].heap_index = i;
+    s->events[s->heap[j]].heap_index = j;
+}
+
+static void scheduler_sift_up(scheduler_t* s, uint8_t i)
+{
+    while (i > 0)
+    {
+        uint8_t parent = (i - 1) / 2;
+        if (!scheduler_before(s, s->heap[i], s->heap[parent]))
+            break;
+
+        scheduler_swap(s, i, parent);
+        i = parent;
+    }
+}
+
+static void scheduler_sift_down(scheduler_t* s, uint8_t i)
+{
+    for (;;)
+    {
+        uint8_t first = i;
+        uint8_t left = 2 * i + 1;
+        uint8_t right = 2 * i + 2;
+
+        if (left < s->heap_size && scheduler_before(s, s->heap[left], s->heap[first]))
+            first = left;
+        if (right < s->heap_size && scheduler_before(s, s->heap[right], s->heap[first]))
+            first = right;
+
+        if (first == i)
+            return;
+
+        scheduler_swap(s, i, first);
+        i = first;
+    }
+}
+
+static void scheduler_update_next_due(scheduler_t* s)
+{
+    s->next_due = s->heap_size != 0 ? s->events[s->heap[0]].due : UINT64_MAX;
+}
+
+void scheduler_init(scheduler_t* s)
+{
+    *s = (scheduler_t){.next_due = UINT64_MAX};
+
+    for (int i = 0; i < SCHEDULER_MAX; i++)
+        s->events[i].heap_index = SCHEDULER_NOT_ARMED;
+}
+
+int scheduler_add(mcs51_t* p, scheduler_fn_t fn, void* ctx)
+{
+    for (int i = 0; i < SCHEDULER_MAX; i++)
+    {
+        scheduler_event_t* event = &p->_scheduler.events[i];
+        if (event->fn != 0)
+            continue;
+
+        *event = (scheduler_event_t){.fn = fn, .ctx = ctx, .heap_index = SCHEDULER_NOT_ARMED};
+        return i;
+    }
+
+    return -1;
+}
+
+void scheduler_remove(mcs51_t* p, int handle)
+{
+    if (handle < 0 || handle >= SCHEDULER_MAX)
+        return;
+
+    scheduler_cancel(p, handle);
+    p->_scheduler.events[handle] = (scheduler_event_t){.heap_index = SCHEDULER_NOT_ARMED};
+}
+
+void scheduler_arm(mcs51_t* p, int handle, uint64_t due)
+{
+    scheduler_t* s = &p->_scheduler;
+    assert(handle >= 0 && handle < SCHEDULER_MAX && s->events[handle].fn);
+
+    scheduler_event_t* event = &s->events[handle];
+    event->due = due;
+
+    if (event->heap_index == SCHEDULER_NOT_ARMED)
+    {
+        event->heap_index = s->heap_size++;
+        s->heap[event->heap_index] = handle;
+    }
+
+    scheduler_sift_up(s, event->heap_index);
+    scheduler_sift_down(s, event->heap_index);
+    scheduler_update_next_due(s);
+}
+
+void scheduler_cancel(mcs51_t* p, int handle)
+{
+    scheduler_t* s = &p->_scheduler;
+    if (handle < 0 || handle >= SCHEDULER_MAX || s->events[handle].heap_index == SCHEDULER_NOT_ARMED)
+        return;
+
+    uint8_t i = s->events[handle].heap_index;
+    uint8_t last = --s->heap_size;
+    s->events[handle].heap_index = SCHEDULER_NOT_ARMED;
+
+    // Move the last event into the gap
+    if (i != last)
+    {
+        s->heap[i] = s->heap[last];
+        s->events[s->heap[i]].heap_index = i;
+        scheduler_sift_up(s, i);
+        scheduler_sift_down(s, i);
+    }
+
+    scheduler_update_next_due(s);
+}
+
+uint64_t scheduler_due(const mcs51_t* p, int handle)
+{
+    if (handle < 0 || handle >= SCHEDULER_MAX || p->_scheduler.events[handle].heap_index == SCHEDULER_NOT_ARMED)
+        return UINT64_MAX;
+
+    return p->_scheduler.events[handle].due;
+}
+
+void scheduler_run(mcs51_t* p, uint64_t osc_period)
+{
+    scheduler_t* s = &p->_scheduler;
+
+    while (s->next_due <= osc_period)
+    {
+        uint8_t handle = s->heap[0];
+        scheduler_event_t* event = &s->events[handle];
+        uint64_t due = event->due;
+
+        scheduler_cancel(p, handle);
+        event->fn(p, due, event->ctx);
+    }
+}
@@ -0,0 +1,117 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "semihost.h"
+#include "mcs51.h"
+#include "mcs51_helpers.h"
+#include <time.h>
+
+static inline uint16_t dptr(mcs51_t* p)
+{
+    return (((uint16_t) p->D[SFR_DPH]) << 8) | p->D[SFR_DPL];
+}
+
+static FILE* semihost_file(semihost_t* semihost, uint8_t number)
+{
+    return number < SEMIHOST_MAX_FILES ? semihost->files[number] : NULL;
+}
+
+static void semihost_return_u16(mcs51_t* p, uint16_t value)
+{
+    R4 = value >> 8;
+    R5 = value & 0xFF;
+}
+
+static void semihost_return_u32(mcs51_t* p, uint32_t value)
+{
+    R4 = value >> 24;
+    R5 = value >> 16;
+    R6 = value >> 8;
+    R7 = value;
+}
+
+/// Transfer between a file and XDATA, wrapping around at the end of XDATA
+static bool semihost_transfer(mcs51_t* p, FILE* file, bool write)
+{
+    uint16_t address = dptr(p);
+    uint16_t length = ((uint16_t) R4 << 8) | R5;
+    uint16_t done = 0;
+
+    while (done < length)
+    {
+        uint16_t chunk = length - done;
+        if (chunk > sizeof(p->X) - address)
+            chunk = sizeof(p->X) - address;
+
+        size_t n = write ? fwrite(&p->X[address], 1, chunk, file) : fread(&p->X[address], 1, chunk, file);
+        done += n;
+        address += n;
+
+        if (n < chunk)
+            break;
+    }
+
+    if (write)
+        fflush(file);
+
+    semihost_return_u16(p, done);
+    return !ferror(file);
+}
+
+static void semihost_call(mcs51_t* p)
+{
+    semihost_t* semihost = p->_semihost;
+    bool success = true;
+
+    switch (p->D[SFR_ACC])
+    {
+        case SEMIHOST_WRITE:
+        case SEMIHOST_READ:
+        {
+            FILE* file = semihost_file(semihost, R7);
+            success = file != NULL && semihost_transfer(p, file, p->D[SFR_ACC] == SEMIHOST_WRITE);
+            break;
+        }
+        case SEMIHOST_EXIT:
+            if (!semihost->exited)
+            {
+                semihost->exited = true;
+                semihost->exit_code = R7;
+            }
+            p->PC--; // Halt, A is kept to repeat the call
+            return;
+        case SEMIHOST_CLOCK:
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            semihost_return_u32(p, (uint32_t) (now.tv_sec * 1000 + now.tv_nsec / 1000000));
+            break;
+        }
+        case SEMIHOST_CYCLES:
+            semihost_return_u32(p, (uint32_t) (p->_osc_periods / 12));
+            break;
+        default:
+            success = false;
+            break;
+    }
+
+    p->D[SFR_ACC] = success ? 0x00 : 0xFF;
+}
+
+void semihost_init(semihost_t* semihost)
+{
+    *semihost = (semihost_t){.files = {stdin, stdout, stderr}};
+}
+
+void semihost_enable(mcs51_t* p, semihost_t* semihost)
+{
+    p->_semihost = semihost;
+
+    opcode_t* opcode = &p->opcode_map[SEMIHOST_OPCODE];
+    opcode->bytes = 1;
+    opcode->cycles = 1;
+    opcode->mnemonic = "SEMIHOST";
+    opcode->actor = &semihost_call;
+}
@@ -0,0 +1,102 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "stack.h"
+#include "mcs51.h"
+#include "mcs51_helpers.h"
+#include "mcs51_internal.h"
+#include "sfr_map_gen.h"
+#include <assert.h>
+
+static void stack_update_check(stack_guard_t* stack)
+{
+    const uint16_t span = stack->ceiling - stack->floor + 1;
+    const uint16_t check = stack->high_water >= stack->floor ? stack->high_water - stack->floor + 1 : 0;
+
+    stack->_check = check < span ? check : span;
+}
+
+void mcs51_stack_init(mcs51_t* p)
+{
+    p->_stack = (stack_guard_t){
+            .floor = 0x08,
+            .ceiling = mcs51_variant_profiles[p->_variant].idata_size - 1,
+            .high_water = 0x07,
+    };
+    stack_update_check(&p->_stack);
+}
+
+void mcs51_stack_push_check(mcs51_t* p)
+{
+    stack_guard_t* stack = &p->_stack;
+    const uint8_t offset = SP - stack->floor;
+
+    // Above the high-water mark, but within the guard
+    if (offset <= stack->ceiling - stack->floor)
+    {
+        stack->high_water = SP;
+        stack->_check = offset + 1;
+        return;
+    }
+
+    stack_overflow_t* overflow = &stack->last_overflow;
+    *overflow = (stack_overflow_t){.osc_period = p->_osc_periods, .sp = SP, .chain = {p->PC}};
+    overflow->chain_length = 1 + stack_unwind(p, &overflow->chain[1], STACK_CHAIN_MAX - 1);
+    stack->overflows++;
+
+    if (stack->on_overflow)
+        stack->on_overflow(p, overflow);
+}
+
+void stack_set_guard(mcs51_t* p, uint8_t floor, uint8_t ceiling)
+{
+    assert(floor <= ceiling);
+
+    p->_stack.floor = floor;
+    p->_stack.ceiling = ceiling;
+    stack_update_check(&p->_stack);
+}
+
+/// A return address follows an ACALL or LCALL
+static bool stack_is_return_address(const mcs51_t* p, uint16_t address)
+{
+    return (address >= 2 && (p->C[address - 2] & 0x1F) == 0x11) || (address >= 3 && p->C[address - 3] == 0x12);
+}
+
+uint8_t stack_unwind(const mcs51_t* p, uint16_t* chain, uint8_t max)
+{
+    const stack_guard_t* stack = &p->_stack;
+    const uint8_t sp = p->D[SFR_SP];
+    uint8_t length = 0;
+
+    // After a wrap past 0xFF (or a push below the floor) the chain ends at the top of the guard
+    int i = sp >= stack->floor && sp <= stack->ceiling ? sp : stack->ceiling;
+
+    // A call pushes the low byte first
+    while (i > stack->floor && length < max)
+    {
+        const uint16_t address = p->D[p->_indirect_address_map[i]] << 8 | p->D[p->_indirect_address_map[i - 1]];
+
+        if (stack_is_return_address(p, address))
+        {
+            chain[length++] = address;
+            i -= 2;
+        } else
+        {
+            i--;
+        }
+    }
+
+    return length;
+}
+
+void stack_print_overflow(const stack_overflow_t* overflow, FILE* file)
+{
+    fprintf(file, "Stack overflow: SP 0x%02X at PC 0x%04X (state phase %llu)\n", overflow->sp, overflow->chain[0],
+            (unsigned long long) overflow->osc_period);
+
+    for (uint8_t i = 1; i < overflow->chain_length; i++)
+        fprintf(file, "  returns to 0x%04X\n", overflow->chain[i]);
+}
@@ -0,0 +1,74 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "timebase.h"
+#include <assert.h>
+
+#define NS_PER_SECOND (1000000000ULL)
+
+/// State phases per second, below 2^32 so the fraction of a nanosecond fits the 64-bit arithmetic
+static uint64_t timebase_rate(const timebase_t* tb)
+{
+    return tb->hertz * tb->periods_per_osc;
+}
+
+static uint64_t timebase_time(const timebase_t* tb, uint64_t periods, uint32_t* fraction)
+{
+    assert(periods >= tb->start_periods);
+
+    const uint64_t rate = timebase_rate(tb);
+    const uint64_t delta = periods - tb->start_periods;
+
+    // Split into whole seconds and the remainder to avoid an overflow of delta * 10^9
+    const uint64_t remainder = delta % rate * NS_PER_SECOND;
+    uint64_t ns = delta / rate * NS_PER_SECOND + remainder / rate;
+
+    const uint64_t sub_ns = ((remainder % rate) << 32) / rate + tb->start_fraction;
+    *fraction = (uint32_t) sub_ns;
+
+    return tb->start_ns + ns + (sub_ns >> 32);
+}
+
+void timebase_init(timebase_t* tb, uint64_t hertz)
+{
+    *tb = (timebase_t){.hertz = hertz, .periods_per_osc = 1};
+    assert(hertz > 0 && timebase_rate(tb) < (1ULL << 32));
+}
+
+void timebase_change(timebase_t* tb, uint64_t periods, uint64_t hertz, uint8_t periods_per_osc)
+{
+    uint32_t fraction;
+    tb->start_ns = timebase_time(tb, periods, &fraction);
+    tb->start_fraction = fraction;
+    tb->start_periods = periods;
+
+    tb->hertz = hertz;
+    tb->periods_per_osc = periods_per_osc;
+    assert(hertz > 0 && timebase_rate(tb) < (1ULL << 32));
+}
+
+uint64_t timebase_ns(const timebase_t* tb, uint64_t periods)
+{
+    uint32_t fraction;
+    return timebase_time(tb, periods, &fraction);
+}
+
+uint64_t timebase_periods(const timebase_t* tb, uint64_t ns)
+{
+    if (ns <= tb->start_ns)
+        return tb->start_periods;
+
+    // Estimate without the start fraction, then correct by the exact mapping
+    const uint64_t rate = timebase_rate(tb);
+    const uint64_t delta = ns - tb->start_ns;
+    uint64_t periods = tb->start_periods + delta / NS_PER_SECOND * rate + (delta % NS_PER_SECOND * rate + NS_PER_SECOND - 1) / NS_PER_SECOND;
+
+    while (timebase_ns(tb, periods) < ns)
+        periods++;
+    while (periods > tb->start_periods && timebase_ns(tb, periods - 1) >= ns)
+        periods--;
+
+    return periods;
+}
@@ -0,0 +1,314 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "timer.h"
+#include "mcs51.h"
+#include "mcs51_internal.h"
+#include "scheduler.h"
+#include "sfr_definitions_gen.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/// Counting modes, 0-3 are the TMOD modes of timer 0 and 1
+enum
+{
+    TIMER_MODE_13_BIT = 0,
+    TIMER_MODE_16_BIT = 1,
+    TIMER_MODE_8_BIT_AUTO_RELOAD = 2,
+    TIMER_MODE_SPLIT = 3,
+    TIMER_MODE_2_AUTO_RELOAD = 4, /// Timer 2: 16-bit auto-reload from RCAP2H/RCAP2L
+    TIMER_MODE_2_BAUD_RATE = 5,   /// Timer 2: Baud rate generator (RCLK or TCLK), clocked with F_OSC / 2
+    TIMER_MODE_UNIMPLEMENTED = 6,
+};
+
+typedef struct timer_sfrs_t {
+    uint8_t tl;
+    uint8_t th;
+    uint8_t control; /// SFR of TR and TF
+    uint8_t tr_msk;
+    uint8_t tf_msk;
+    uint8_t et_msk;
+    uint8_t x2_msk;             /// CKCON0: Standard peripheral clock in X2 mode
+    uint16_t implemented_modes; /// Bit mask
+} timer_sfrs_t;
+
+static const timer_sfrs_t s_timer_sfrs[3] = {
+        {.tl = SFR_TL0, .th = SFR_TH0, .control = SFR_TCON, .tr_msk = SFR_TCON_TR0_Msk, .tf_msk = SFR_TCON_TF0_Msk, .et_msk = SFR_IE_ET0_Msk, .x2_msk = SFR_CKCON0_T0X2_Msk, .implemented_modes = 0b000011},
+        {.tl = SFR_TL1, .th = SFR_TH1, .control = SFR_TCON, .tr_msk = SFR_TCON_TR1_Msk, .tf_msk = SFR_TCON_TF1_Msk, .et_msk = SFR_IE_ET1_Msk, .x2_msk = SFR_CKCON0_T1X2_Msk, .implemented_modes = 0b000100},
+        {.tl = SFR_TL2, .th = SFR_TH2, .control = SFR_T2CON, .tr_msk = SFR_T2CON_TR2_Msk, .tf_msk = SFR_T2CON_TF2_Msk, .et_msk = SFR_IE_ET2_Msk, .x2_msk = SFR_CKCON0_T2X2_Msk, .implemented_modes = 0b110000},
+};
+
+/// Increments from zero to the overflow
+static const uint32_t s_timer_range[6] = {0x2000, 0x10000, 0x100, 0, 0x10000, 0x10000};
+
+static bool has_sfr(mcs51_t* p, uint8_t address)
+{
+    return p->sfr_map[address].name != 0;
+}
+
+/// Timer 2 exists on the 8052 and its derivatives
+static unsigned int timer_count(mcs51_t* p)
+{
+    return has_sfr(p, SFR_T2CON) ? 3 : 2;
+}
+
+static uint8_t timer_mode(mcs51_t* p, unsigned int index)
+{
+    if (index == 0)
+        return (p->D[SFR_TMOD] & (SFR_TMOD_T0M1_Msk | SFR_TMOD_T0M0_Msk)) >> SFR_TMOD_T0M0_Pos;
+    if (index == 1)
+        return (p->D[SFR_TMOD] & (SFR_TMOD_T1M1_Msk | SFR_TMOD_T1M0_Msk)) >> SFR_TMOD_T1M0_Pos;
+
+    const uint8_t t2con = p->D[SFR_T2CON];
+    if (t2con & SFR_T2CON_C_T2_Msk)
+        return TIMER_MODE_UNIMPLEMENTED; // Counter of the T2 pin
+    if (t2con & (SFR_T2CON_RCLK_Msk | SFR_T2CON_TCLK_Msk))
+        return TIMER_MODE_2_BAUD_RATE;
+    if (t2con & SFR_T2CON_CP_RL2_Msk)
+        return TIMER_MODE_UNIMPLEMENTED; // Capture on T2EX
+
+    return TIMER_MODE_2_AUTO_RELOAD;
+}
+
+/**
+ * Mode 0 is a 13 bit Timer mode and uses 8 bits of high byte and 5 bit prescaler of low byte.
+ * The value that the Timer can update in mode0 is from 0000H to 1FFFH. The 5 bits of lower byte
+ * append with the bits of higher byte. The Timer rolls over from 1FFFH to 0000H to raise the Timer flag.
+ * A TL0 above the prescaler range overflows into TH0 on the next increment.
+ */
+static uint32_t timer_load(mcs51_t* p, unsigned int index, uint8_t mode)
+{
+    const uint8_t tl = p->D[s_timer_sfrs[index].tl];
+    const uint8_t th = p->D[s_timer_sfrs[index].th];
+
+    switch (mode)
+    {
+        case TIMER_MODE_13_BIT:
+            return th << 5 | (tl > 0b11111 ? 0b11111 : tl);
+        case TIMER_MODE_8_BIT_AUTO_RELOAD:
+            return tl;
+        default:
+            return th << 8 | tl;
+    }
+}
+
+static void timer_store(mcs51_t* p, unsigned int index, uint8_t mode, uint32_t count)
+{
+    switch (mode)
+    {
+        case TIMER_MODE_13_BIT:
+            p->D[s_timer_sfrs[index].th] = count >> 5;
+            p->D[s_timer_sfrs[index].tl] = count & 0b11111;
+            break;
+        case TIMER_MODE_8_BIT_AUTO_RELOAD:
+            p->D[s_timer_sfrs[index].tl] = count;
+            break;
+        default:
+            p->D[s_timer_sfrs[index].th] = count >> 8;
+            p->D[s_timer_sfrs[index].tl] = count & 0xFF;
+            break;
+    }
+}
+
+/// Count after the overflow: Mode 2 reloads TL from TH, timer 2 from RCAP2H/RCAP2L, the other modes roll over to zero
+static uint32_t timer_reload(mcs51_t* p, unsigned int index, uint8_t mode)
+{
+    switch (mode)
+    {
+        case TIMER_MODE_8_BIT_AUTO_RELOAD:
+            return p->D[s_timer_sfrs[index].th];
+        case TIMER_MODE_2_AUTO_RELOAD:
+        case TIMER_MODE_2_BAUD_RATE:
+            return p->D[SFR_RCAP2H] << 8 | p->D[SFR_RCAP2L];
+        default:
+            return 0;
+    }
+}
+
+/**
+ * State phases per increment of a peripheral clocked with period oscillator periods in the standard
+ * mode. In X2 mode the state phases are half oscillator periods, a peripheral keeps its speed
+ * relative to the CPU unless its CKCON0 bit selects the standard peripheral clock.
+ */
+static uint64_t peripheral_period(mcs51_t* p, uint64_t period, uint8_t x2_msk)
+{
+    const bool x2 = p->_timebase.periods_per_osc == 2;
+    return x2 && (p->D[SFR_CKCON0] & x2_msk) ? 2 * period : period;
+}
+
+/// Arm the overflow event of a running timer: The increments happen in the last of every period state phases
+static void timer_arm(mcs51_t* p, mcs51_timer_t* t)
+{
+    const uint64_t increments = s_timer_range[t->mode] - t->start_count;
+    scheduler_arm(p, t->event, t->period * (t->start_osc / t->period + increments) - 1);
+}
+
+/// The serial port transmitter is clocked by the overflows of its baud rate source
+static void serial_tx_clock(mcs51_t* p)
+{
+    uint8_t serial_mode = ((p->D[SFR_SCON] & SFR_SCON_SM0_Msk) >> SFR_SCON_SM0_Pos) << 1 | ((p->D[SFR_SCON] & SFR_SCON_SM1_Msk) >> SFR_SCON_SM1_Pos);
+
+    // Serial mode 1: 8-bit, 1 stop
+    if (serial_mode == 1)
+    {
+        // SBUF SFR is dirty
+        if (p->_sfr_dirty_sbuf)
+        {
+            p->_sfr_dirty_sbuf = false;
+            p->D[SFR_SCON] |= SFR_SCON_TI_Msk; // Set the Transmit Interrupt flag (cleared by software)
+
+            p->_on_serial_tx((char) p->_sbuf_tx);
+        }
+    } else
+    {
+        fprintf(stderr, "Unimplemented serial mode: %d\n", serial_mode);
+        abort();
+    }
+}
+
+static void timer_overflow(mcs51_t* p, unsigned int index, uint64_t due)
+{
+    mcs51_timer_t* t = &p->_timers[index];
+
+    t->start_count = timer_reload(p, index, t->mode);
+    t->start_osc = due + 1;
+    timer_store(p, index, t->mode, t->start_count);
+    timer_arm(p, t);
+}
+
+static void timer_0_overflow(mcs51_t* p, uint64_t due, void* ctx)
+{
+    timer_overflow(p, 0, due);
+
+    if (p->D[SFR_IE] & SFR_IE_EA_Msk && p->D[SFR_IE] & SFR_IE_ET0_Msk)
+    {
+        p->D[SFR_TCON] |= SFR_TCON_TF0_Msk;
+    }
+}
+
+static void timer_1_overflow(mcs51_t* p, uint64_t due, void* ctx)
+{
+    timer_overflow(p, 1, due);
+
+    if (p->D[SFR_IE] & SFR_IE_EA_Msk && p->D[SFR_IE] & SFR_IE_ET1_Msk)
+    {
+        p->D[SFR_TCON] |= SFR_TCON_TF1_Msk;
+    }
+
+    if (p->_serial_tx_clock == MCS51_SERIAL_CLOCK_TIMER_1)
+        serial_tx_clock(p);
+}
+
+static void timer_2_overflow(mcs51_t* p, uint64_t due, void* ctx)
+{
+    timer_overflow(p, 2, due);
+
+    // TF2 is not set in baud rate generator mode
+    if (p->_timers[2].mode == TIMER_MODE_2_AUTO_RELOAD)
+        p->D[SFR_T2CON] |= SFR_T2CON_TF2_Msk;
+
+    if (p->_serial_tx_clock == MCS51_SERIAL_CLOCK_TIMER_2)
+        serial_tx_clock(p);
+}
+
+/**
+ * Internal baud rate generator (AT89C51RD2): An 8-bit counter, reloaded from BRL, clocked with
+ * F_OSC / 2 (BDRCON.SPD) or F_OSC / 12. It cannot be read, so only its overflows are scheduled.
+ */
+static uint64_t brg_period(mcs51_t* p)
+{
+    return peripheral_period(p, p->D[SFR_BDRCON] & SFR_BDRCON_SPD_Msk ? 2 : 12, SFR_CKCON0_SIX2_Msk);
+}
+
+static void brg_overflow(mcs51_t* p, uint64_t due, void* ctx)
+{
+    scheduler_arm(p, p->_brg_event, due + brg_period(p) * (0x100 - p->D[SFR_BRL]));
+
+    if (p->_serial_tx_clock == MCS51_SERIAL_CLOCK_BRG)
+        serial_tx_clock(p);
+}
+
+void mcs51_timer_init(mcs51_t* p)
+{
+    static const scheduler_fn_t overflow[3] = {&timer_0_overflow, &timer_1_overflow, &timer_2_overflow};
+
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        p->_timers[i] = (mcs51_timer_t){.event = scheduler_add(p, overflow[i], 0)};
+        assert(p->_timers[i].event >= 0);
+    }
+
+    p->_brg_event = scheduler_add(p, &brg_overflow, 0);
+    assert(p->_brg_event >= 0);
+}
+
+void mcs51_timer_sync(mcs51_t* p)
+{
+    // The increments of the current machine cycle are still ahead
+    const uint64_t now = p->_osc_periods / 12 * 12;
+
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        mcs51_timer_t* t = &p->_timers[i];
+        if (!t->running || now <= t->start_osc)
+            continue;
+
+        // Less than the increments up to the overflow, which restarts the count (timer_overflow())
+        t->start_count += now / t->period - t->start_osc / t->period;
+        t->start_osc = now;
+        timer_store(p, i, t->mode, t->start_count);
+    }
+}
+
+void mcs51_timer_update(mcs51_t* p)
+{
+    const bool power_down = p->D[SFR_PCON] & SFR_PCON_PD_Msk; // The oscillator is stopped in power-down mode
+
+    for (unsigned int i = 0; i < timer_count(p); i++)
+    {
+        mcs51_timer_t* t = &p->_timers[i];
+        const timer_sfrs_t* sfrs = &s_timer_sfrs[i];
+
+        t->running = (p->D[sfrs->control] & sfrs->tr_msk) && !power_down;
+        t->mode = timer_mode(p, i);
+
+        if (!t->running)
+        {
+            scheduler_cancel(p, t->event);
+            continue;
+        }
+
+        if (!(sfrs->implemented_modes & (1U << t->mode)))
+        {
+            fprintf(stderr, "Unimplemented timer %u mode: %d\n", i, t->mode);
+            abort();
+        }
+
+        t->period = peripheral_period(p, t->mode == TIMER_MODE_2_BAUD_RATE ? 2 : 12, sfrs->x2_msk);
+        t->start_count = timer_load(p, i, t->mode);
+        t->start_osc = p->_osc_periods / 12 * 12;
+        timer_arm(p, t);
+    }
+
+    // Baud rate generator, restarted from BRL
+    if (has_sfr(p, SFR_BDRCON) && (p->D[SFR_BDRCON] & SFR_BDRCON_BRR_Msk) && !power_down)
+    {
+        const uint64_t period = brg_period(p);
+        const uint64_t start_osc = p->_osc_periods / 12 * 12;
+        scheduler_arm(p, p->_brg_event, period * (start_osc / period + 0x100 - p->D[SFR_BRL]) - 1);
+    } else
+    {
+        scheduler_cancel(p, p->_brg_event);
+    }
+
+    // Transmit clock: BDRCON.TBCK selects the baud rate generator, T2CON.TCLK timer 2, otherwise timer 1
+    if (has_sfr(p, SFR_BDRCON) && (p->D[SFR_BDRCON] & SFR_BDRCON_TBCK_Msk))
+        p->_serial_tx_clock = MCS51_SERIAL_CLOCK_BRG;
+    else if (has_sfr(p, SFR_T2CON) && (p->D[SFR_T2CON] & SFR_T2CON_TCLK_Msk))
+        p->_serial_tx_clock = MCS51_SERIAL_CLOCK_TIMER_2;
+    else
+        p->_serial_tx_clock = MCS51_SERIAL_CLOCK_TIMER_1;
+}
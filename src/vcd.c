@@ -0,0 +1,218 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "vcd.h"
+#include "mcs51.h"
+#include "sfr_definitions_gen.h"
+#include <string.h>
+
+/// Longest value change line: 'b' + 32 digits + ' ' + id + '\n'
+#define VCD_MAX_LINE (40)
+
+static uint32_t sample_byte(mcs51_t* p, const vcd_signal_t* signal)
+{
+    return p->D[signal->address];
+}
+
+static uint32_t sample_bit(mcs51_t* p, const vcd_signal_t* signal)
+{
+    return (p->D[signal->address] >> signal->bit) & 0b1;
+}
+
+static uint32_t sample_ale(mcs51_t* p, const vcd_signal_t* signal)
+{
+    return p->_ale;
+}
+
+static uint32_t sample_isr_active(mcs51_t* p, const vcd_signal_t* signal)
+{
+    return p->_nvic._isr_active_msk;
+}
+
+void vcd_init(vcd_t* vcd, FILE* file)
+{
+    vcd->file = file;
+    vcd->signal_count = 0;
+    vcd->_header_written = false;
+    vcd->_timestamp = 0;
+    vcd->_buffer_used = 0;
+}
+
+bool vcd_add_signal(vcd_t* vcd, const char* name, uint8_t width, vcd_sampler_t sample, uint8_t address, uint8_t bit)
+{
+    // Signals cannot be added once the definitions are written
+    if (vcd->_header_written || vcd->signal_count >= VCD_MAX_SIGNALS)
+        return false;
+
+    if (width == 0 || width > 32)
+        return false;
+
+    vcd->signals[vcd->signal_count] = (vcd_signal_t){
+            .name = name,
+            .width = width,
+            .sample = sample,
+            .address = address,
+            .bit = bit,
+            .id = (char) ('!' + vcd->signal_count), // Printable ASCII 33 - 126
+    };
+    vcd->signal_count++;
+
+    return true;
+}
+
+bool vcd_add_sfr(vcd_t* vcd, const char* name, uint8_t address)
+{
+    return vcd_add_signal(vcd, name, 8, &sample_byte, address, 0);
+}
+
+bool vcd_add_sfr_bit(vcd_t* vcd, const char* name, uint8_t address, uint8_t bit)
+{
+    return vcd_add_signal(vcd, name, 1, &sample_bit, address, bit);
+}
+
+bool vcd_add_ale(vcd_t* vcd)
+{
+    return vcd_add_signal(vcd, "ALE", 1, &sample_ale, 0, 0);
+}
+
+bool vcd_add_isr_active(vcd_t* vcd)
+{
+    // One bit per interrupt source, Timer 2 included (8052, AT89C51RD2)
+    return vcd_add_signal(vcd, "ISR_ACTIVE", sizeof(((const nvic_t*) NULL)->map) / sizeof(interrupt_t), &sample_isr_active, 0, 0);
+}
+
+bool vcd_add_serial_tx(vcd_t* vcd)
+{
+    return vcd_add_sfr(vcd, "SBUF", SFR_SBUF)
+           && vcd_add_sfr_bit(vcd, "TI", SFR_SCON, SFR_SCON_TI_Pos);
+}
+
+void vcd_flush(vcd_t* vcd)
+{
+    if (vcd->_buffer_used > 0)
+    {
+        fwrite(vcd->_buffer, 1, vcd->_buffer_used, vcd->file);
+        vcd->_buffer_used = 0;
+    }
+}
+
+static void vcd_write(vcd_t* vcd, const char* str, size_t len)
+{
+    if (vcd->_buffer_used + len > VCD_BUFFER_SIZE)
+        vcd_flush(vcd);
+
+    memcpy(&vcd->_buffer[vcd->_buffer_used], str, len);
+    vcd->_buffer_used += len;
+}
+
+static void vcd_write_value(vcd_t* vcd, const vcd_signal_t* signal, uint32_t value)
+{
+    char line[VCD_MAX_LINE];
+    size_t len = 0;
+
+    if (signal->width == 1)
+    {
+        line[len++] = (char) ('0' + (value & 0b1));
+    } else
+    {
+        line[len++] = 'b';
+        for (int i = signal->width - 1; i >= 0; i--)
+            line[len++] = (char) ('0' + ((value >> i) & 0b1));
+        line[len++] = ' ';
+    }
+
+    line[len++] = signal->id;
+    line[len++] = '\n';
+
+    vcd_write(vcd, line, len);
+}
+
+static void vcd_write_timestamp(vcd_t* vcd, uint64_t timestamp)
+{
+    char line[32];
+    int len = snprintf(line, sizeof(line), "#%llu\n", (unsigned long long) timestamp);
+    vcd_write(vcd, line, len);
+}
+
+static void vcd_write_header(vcd_t* vcd, mcs51_t* p)
+{
+    char line[128];
+    int len;
+
+    len = snprintf(line, sizeof(line), "$version mcs51emu $end\n$timescale 1 ns $end\n$scope module mcs51 $end\n");
+    vcd_write(vcd, line, len);
+
+    for (uint8_t i = 0; i < vcd->signal_count; i++)
+    {
+        vcd_signal_t* signal = &vcd->signals[i];
+        len = snprintf(line, sizeof(line), "$var wire %d %c %s $end\n", signal->width, signal->id, signal->name);
+        vcd_write(vcd, line, len);
+    }
+
+    len = snprintf(line, sizeof(line), "$upscope $end\n$enddefinitions $end\n");
+    vcd_write(vcd, line, len);
+
+    // Initial values
+    vcd->_timestamp = msc51_execution_time_ns(p);
+    vcd_write_timestamp(vcd, vcd->_timestamp);
+    vcd_write(vcd, "$dumpvars\n", 10);
+    for (uint8_t i = 0; i < vcd->signal_count; i++)
+    {
+        vcd_signal_t* signal = &vcd->signals[i];
+        signal->value = signal->sample(p, signal);
+        vcd_write_value(vcd, signal, signal->value);
+    }
+    vcd_write(vcd, "$end\n", 5);
+
+    vcd->_header_written = true;
+}
+
+void vcd_sample(vcd_t* vcd, mcs51_t* p)
+{
+    if (!vcd->_header_written)
+    {
+        vcd_write_header(vcd, p);
+        return;
+    }
+
+    // The timer counts and the PSW flags are evaluated lazily
+    mcs51_sync_timers(p);
+    mcs51_sync_psw(p);
+
+    bool timestamp_written = false;
+
+    for (uint8_t i = 0; i < vcd->signal_count; i++)
+    {
+        vcd_signal_t* signal = &vcd->signals[i];
+        uint32_t value = signal->sample(p, signal);
+
+        // Log actual changes only
+        if (value == signal->value)
+            continue;
+
+        if (!timestamp_written)
+        {
+            uint64_t timestamp = msc51_execution_time_ns(p);
+
+            // Several oscillator periods may round to the same nanosecond
+            if (timestamp != vcd->_timestamp)
+            {
+                vcd_write_timestamp(vcd, timestamp);
+                vcd->_timestamp = timestamp;
+            }
+            timestamp_written = true;
+        }
+
+        signal->value = value;
+        vcd_write_value(vcd, signal, value);
+    }
+}
+
+void vcd_close(vcd_t* vcd)
+{
+    vcd_flush(vcd);
+    fclose(vcd->file);
+    vcd->file = NULL;
+}
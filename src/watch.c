@@ -0,0 +1,42 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "watch.h"
+#include "mcs51.h"
+
+int watch_add(mcs51_t* p, uint8_t address, watch_kind_t kind, watch_fn_t fn, void* ctx)
+{
+    for (int i = 0; i < WATCH_MAX; i++)
+    {
+        watch_t* watch = &p->_watches[i];
+        if (watch->fn != 0)
+            continue;
+
+        *watch = (watch_t){.fn = fn, .ctx = ctx, .address = address, .kind = kind};
+        mcs51_update_sfr_hooks(p);
+        return i;
+    }
+
+    return -1;
+}
+
+void watch_remove(mcs51_t* p, int handle)
+{
+    if (handle < 0 || handle >= WATCH_MAX)
+        return;
+
+    p->_watches[handle] = (watch_t){};
+    mcs51_update_sfr_hooks(p);
+}
+
+void watch_notify(mcs51_t* p, uint8_t address, watch_kind_t kind, uint8_t old_value, uint8_t new_value)
+{
+    for (int i = 0; i < WATCH_MAX; i++)
+    {
+        watch_t* watch = &p->_watches[i];
+        if (watch->fn != 0 && watch->address == address && (watch->kind & kind))
+            watch->fn(p, address, kind, old_value, new_value, watch->ctx);
+    }
+}
@@ -0,0 +1,122 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "watchdog.h"
+#include "mcs51.h"
+#include "mcs51_internal.h"
+#include "scheduler.h"
+#include "sfr_definitions_gen.h"
+#include <assert.h>
+
+/// State phases per watchdog cycle, 24 in X2 mode with CKCON0.WDX2 (standard peripheral clock)
+static uint64_t watchdog_period(mcs51_t* p)
+{
+    const bool x2 = p->_timebase.periods_per_osc == 2;
+    return x2 && (p->D[SFR_CKCON0] & SFR_CKCON0_WDX2_Msk) ? 24 : 12;
+}
+
+/// Arm the expiry at the end of the watchdog cycle that is cycles ahead (counting the current one)
+static void watchdog_arm(mcs51_t* p, uint64_t cycles)
+{
+    const uint64_t period = p->_watchdog._period;
+    scheduler_arm(p, p->_watchdog._event, period * (p->_osc_periods / period + cycles) - 1);
+}
+
+static void watchdog_expired(mcs51_t* p, uint64_t due, void* ctx)
+{
+    watchdog_t* w = &p->_watchdog;
+
+    w->expiries++;
+    w->last_expiry = due;
+
+    if (w->on_expiry)
+        w->on_expiry(p);
+
+    // The instruction in progress completes, the next one is fetched from the reset vector
+    if (w->reset_on_expiry)
+    {
+        p->PC = 0x0000;
+        mcs51_reset(p);
+    } else
+    {
+        // Keep counting, every further timeout without a service is an expiry
+        scheduler_arm(p, w->_event, due + w->_period * watchdog_timeout_cycles(p));
+    }
+}
+
+uint64_t watchdog_timeout_cycles(const mcs51_t* p)
+{
+    if (p->_watchdog.timeout_cycles != 0)
+        return p->_watchdog.timeout_cycles;
+
+    const uint8_t wto = p->D[SFR_WDTPRG] & (SFR_WDTPRG_WTO2_Msk | SFR_WDTPRG_WTO1_Msk | SFR_WDTPRG_WTO0_Msk);
+    return (1ULL << (14 + wto)) - 1;
+}
+
+uint64_t watchdog_remaining_cycles(const mcs51_t* p)
+{
+    const watchdog_t* w = &p->_watchdog;
+
+    if (!w->_running)
+        return UINT64_MAX;
+
+    if (w->_frozen_cycles != 0)
+        return w->_frozen_cycles;
+
+    return scheduler_due(p, w->_event) / w->_period - p->_osc_periods / w->_period + 1;
+}
+
+void mcs51_watchdog_init(mcs51_t* p)
+{
+    p->_watchdog = (watchdog_t){.reset_on_expiry = true, ._event = scheduler_add(p, &watchdog_expired, 0)};
+    assert(p->_watchdog._event >= 0);
+}
+
+void mcs51_watchdog_reset(mcs51_t* p)
+{
+    watchdog_t* w = &p->_watchdog;
+
+    w->_running = false;
+    w->_sequence = false;
+    w->_frozen_cycles = 0;
+    scheduler_cancel(p, w->_event);
+}
+
+void mcs51_watchdog_write(mcs51_t* p, uint8_t value)
+{
+    watchdog_t* w = &p->_watchdog;
+
+    if (value == 0xE1 && w->_sequence)
+    {
+        w->_running = true;
+        w->_period = watchdog_period(p);
+
+        if (p->D[SFR_PCON] & SFR_PCON_PD_Msk)
+            w->_frozen_cycles = watchdog_timeout_cycles(p);
+        else
+            watchdog_arm(p, watchdog_timeout_cycles(p));
+    }
+
+    w->_sequence = value == 0x1E;
+}
+
+void mcs51_watchdog_update(mcs51_t* p)
+{
+    watchdog_t* w = &p->_watchdog;
+    if (!w->_running)
+        return;
+
+    const bool power_down = p->D[SFR_PCON] & SFR_PCON_PD_Msk;
+
+    if (power_down && w->_frozen_cycles == 0)
+    {
+        w->_frozen_cycles = watchdog_remaining_cycles(p);
+        scheduler_cancel(p, w->_event);
+    } else if (!power_down && w->_frozen_cycles != 0)
+    {
+        watchdog_arm(p, w->_frozen_cycles);
+        w->_frozen_cycles = 0;
+    }
+}
@@ -0,0 +1,800 @@
+/**
+ * SPDX-FileCopyrightText: 2022 Julian Merkle <info@jvmerkle.de>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "wcet.h"
+#include "cfg.h"
+#include "mcs51.h"
+#include "sfr_definitions_gen.h"
+#include "sfr_map_gen.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define WCET_NONE (UINT32_MAX)
+#define WCET_MAX_STACK_OFFSET (0x100)
+
+typedef enum wcet_state_t
+{
+    WCET_STATE_NEW,
+    WCET_STATE_ACTIVE, /// Being analyzed, a call to it is recursive
+    WCET_STATE_DONE,
+} wcet_state_t;
+
+typedef struct wcet_context_t {
+    wcet_t* wcet;
+    const cfg_t* cfg;
+    const mcs51_t* p;
+    const wcet_loop_bound_t* bounds;
+    size_t bound_count;
+
+    uint8_t* state;    /// wcet_state_t of every function
+    int32_t* local;    /// Index of every block in the function being analyzed, -1 if not a member
+    uint8_t* missing;  /// Bitmap of the loop headers without a bound
+    bool ok;
+} wcet_context_t;
+
+/**
+ * Blocks of a function and the edges between them (calls excluded) by local index, the entry is 0.
+ * Collapsed loops are nodes: rep is the header of the outermost collapsed loop of a block, and the
+ * blocks of a node are linked from the header through next.
+ */
+typedef struct wcet_graph_t {
+    uint32_t count;
+    uint32_t* blocks;
+    uint32_t* succ_start;
+    uint32_t* succ;
+    uint32_t* pred_start;
+    uint32_t* pred;
+
+    uint32_t* rep;
+    uint32_t* next;
+    uint32_t* tail;
+    uint64_t* cost; /// Cycles of a node, a collapsed loop included
+
+    uint64_t* memo;
+    uint8_t* mark;
+} wcet_graph_t;
+
+typedef enum wcet_goal_t
+{
+    WCET_GOAL_BACK_EDGE, /// End of a loop iteration
+    WCET_GOAL_EXIT,      /// Leave the loop (or return)
+    WCET_GOAL_RETURN,    /// Return from the function
+} wcet_goal_t;
+
+typedef struct wcet_search_t {
+    wcet_graph_t* graph;
+    const uint8_t* region; /// Loop body, NULL for the whole function
+    uint32_t header;       /// Loop header or WCET_NONE
+    wcet_goal_t goal;
+} wcet_search_t;
+
+typedef struct wcet_loop_t {
+    uint32_t header;
+    uint32_t size;
+    uint8_t* body;
+} wcet_loop_t;
+
+static uint64_t wcet_add(uint64_t a, uint64_t b)
+{
+    return a > WCET_UNBOUNDED - b ? WCET_UNBOUNDED : a + b;
+}
+
+static uint64_t wcet_mul(uint64_t a, uint64_t b)
+{
+    return a != 0 && b > WCET_UNBOUNDED / a ? WCET_UNBOUNDED : a * b;
+}
+
+static uint8_t wcet_instruction_bytes(const mcs51_t* p, uint16_t address)
+{
+    const uint8_t bytes = p->opcode_map[p->C[address]].bytes;
+    return bytes ? bytes : 1;
+}
+
+static const wcet_loop_bound_t* wcet_find_bound(const wcet_context_t* ctx, uint16_t header)
+{
+    for (size_t i = 0; i < ctx->bound_count; i++)
+    {
+        if (ctx->bounds[i].header == header)
+            return &ctx->bounds[i];
+    }
+
+    return 0;
+}
+
+/// Callee of a call block, -1 if unknown or not analyzed completely (recursion)
+static int32_t wcet_callee(const wcet_context_t* ctx, const cfg_block_t* block)
+{
+    const int32_t callee = cfg_function_at(ctx->cfg, block->target);
+    return callee >= 0 && ctx->state[callee] == WCET_STATE_DONE ? callee : -1;
+}
+
+/// Blocks reachable from the entry of a function without following calls, the entry first
+static uint32_t* wcet_members(wcet_context_t* ctx, uint32_t f, uint32_t* count)
+{
+    const cfg_t* cfg = ctx->cfg;
+    uint32_t* blocks = malloc(cfg->block_count * sizeof(uint32_t));
+    uint32_t* stack = malloc((cfg->edge_count + 1) * sizeof(uint32_t));
+    size_t depth = 0;
+
+    *count = 0;
+    if (!blocks || !stack)
+    {
+        free(blocks);
+        free(stack);
+        return 0;
+    }
+
+    stack[depth++] = cfg->functions[f].entry_block;
+    while (depth > 0)
+    {
+        const uint32_t b = stack[--depth];
+        if (ctx->local[b] >= 0)
+            continue;
+
+        ctx->local[b] = (int32_t) *count;
+        blocks[(*count)++] = b;
+
+        const cfg_block_t* block = &cfg->blocks[b];
+        for (uint32_t e = block->first_edge; e < block->first_edge + block->edge_count; e++)
+        {
+            if (cfg->edges[e].kind != CFG_EDGE_CALL && ctx->local[cfg->edges[e].to] < 0)
+                stack[depth++] = cfg->edges[e].to;
+        }
+    }
+
+    for (uint32_t i = 0; i < *count; i++)
+        ctx->local[blocks[i]] = -1;
+
+    free(stack);
+    return blocks;
+}
+
+static void wcet_graph_free(wcet_graph_t* g)
+{
+    free(g->succ_start);
+    free(g->succ);
+    free(g->pred_start);
+    free(g->pred);
+    free(g->rep);
+    free(g->next);
+    free(g->tail);
+    free(g->cost);
+    free(g->memo);
+    free(g->mark);
+}
+
+/// Build the local graph, the blocks have to be marked in ctx->local
+static bool wcet_graph_init(wcet_graph_t* g, const wcet_context_t* ctx, uint32_t* blocks, uint32_t count)
+{
+    const cfg_t* cfg = ctx->cfg;
+    const uint32_t n = count;
+
+    *g = (wcet_graph_t){.count = n, .blocks = blocks};
+    g->succ_start = calloc(n + 1, sizeof(uint32_t));
+    g->pred_start = calloc(n + 1, sizeof(uint32_t));
+    g->rep = malloc(n * sizeof(uint32_t));
+    g->next = malloc(n * sizeof(uint32_t));
+    g->tail = malloc(n * sizeof(uint32_t));
+    g->cost = malloc(n * sizeof(uint64_t));
+    g->memo = malloc(n * sizeof(uint64_t));
+    g->mark = malloc(n);
+    if (!g->succ_start || !g->pred_start || !g->rep || !g->next || !g->tail || !g->cost || !g->memo || !g->mark)
+        return false;
+
+    uint32_t edges = 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        const cfg_block_t* block = &cfg->blocks[blocks[i]];
+        for (uint32_t e = block->first_edge; e < block->first_edge + block->edge_count; e++)
+        {
+            if (cfg->edges[e].kind == CFG_EDGE_CALL)
+                continue;
+
+            g->succ_start[i + 1]++;
+            g->pred_start[ctx->local[cfg->edges[e].to] + 1]++;
+            edges++;
+        }
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        g->succ_start[i + 1] += g->succ_start[i];
+        g->pred_start[i + 1] += g->pred_start[i];
+    }
+
+    g->succ = malloc((edges + 1) * sizeof(uint32_t));
+    g->pred = malloc((edges + 1) * sizeof(uint32_t));
+    uint32_t* pred_fill = calloc(n, sizeof(uint32_t));
+    if (!g->succ || !g->pred || !pred_fill)
+    {
+        free(pred_fill);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        const cfg_block_t* block = &cfg->blocks[blocks[i]];
+        uint32_t s = g->succ_start[i];
+
+        for (uint32_t e = block->first_edge; e < block->first_edge + block->edge_count; e++)
+        {
+            if (cfg->edges[e].kind == CFG_EDGE_CALL)
+                continue;
+
+            const uint32_t to = (uint32_t) ctx->local[cfg->edges[e].to];
+            g->succ[s++] = to;
+            g->pred[g->pred_start[to] + pred_fill[to]++] = i;
+        }
+    }
+
+    free(pred_fill);
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        const cfg_block_t* block = &cfg->blocks[blocks[i]];
+
+        g->rep[i] = i;
+        g->next[i] = WCET_NONE;
+        g->tail[i] = i;
+        g->cost[i] = block->cycles;
+
+        if (block->exit == CFG_EXIT_INDIRECT)
+        {
+            g->cost[i] = WCET_UNBOUNDED;
+        } else if (block->exit == CFG_EXIT_CALL)
+        {
+            const int32_t callee = wcet_callee(ctx, block);
+            g->cost[i] = callee < 0 ? WCET_UNBOUNDED : wcet_add(g->cost[i], ctx->wcet->functions[callee].cycles);
+        }
+    }
+
+    return true;
+}
+
+/// Longest path from a node to the goal of the search, false if the goal is not reachable
+static bool wcet_longest(const wcet_search_t* s, uint32_t node, uint64_t* cycles)
+{
+    wcet_graph_t* g = s->graph;
+
+    switch (g->mark[node])
+    {
+        case 1: // A cycle that is not a collapsed loop (irreducible)
+            *cycles = WCET_UNBOUNDED;
+            return true;
+        case 2:
+            *cycles = g->memo[node];
+            return true;
+        case 3:
+            return false;
+        default:
+            break;
+    }
+
+    g->mark[node] = 1;
+
+    bool found = false;
+    uint64_t longest = 0;
+
+    for (uint32_t x = node; x != WCET_NONE; x = g->next[x])
+    {
+        if (g->succ_start[x] == g->succ_start[x + 1] && s->goal != WCET_GOAL_BACK_EDGE)
+            found = true; // Return, or no known successor
+
+        for (uint32_t e = g->succ_start[x]; e < g->succ_start[x + 1]; e++)
+        {
+            const uint32_t y = g->succ[e];
+
+            if (s->region && !s->region[y])
+            {
+                found |= s->goal == WCET_GOAL_EXIT;
+                continue;
+            }
+
+            if (y == s->header)
+            {
+                found |= s->goal == WCET_GOAL_BACK_EDGE;
+                continue;
+            }
+
+            uint64_t c;
+            if (g->rep[y] != node && wcet_longest(s, g->rep[y], &c))
+            {
+                found = true;
+                longest = c > longest ? c : longest;
+            }
+        }
+    }
+
+    g->mark[node] = found ? 2 : 3;
+    g->memo[node] = wcet_add(g->cost[node], longest);
+    *cycles = g->memo[node];
+    return found;
+}
+
+static bool wcet_search(const wcet_search_t* s, uint32_t node, uint64_t* cycles)
+{
+    memset(s->graph->mark, 0, s->graph->count);
+    return wcet_longest(s, node, cycles);
+}
+
+static int wcet_compare_loops(const void* a, const void* b)
+{
+    const wcet_loop_t* x = a;
+    const wcet_loop_t* y = b;
+
+    if (x->size != y->size)
+        return x->size < y->size ? -1 : 1;
+
+    return x->header < y->header ? -1 : x->header > y->header;
+}
+
+/// Natural loops of the back edges found by a depth-first search from the entry, innermost first
+static wcet_loop_t* wcet_find_loops(const wcet_graph_t* g, uint32_t* loop_count)
+{
+    const uint32_t n = g->count;
+    uint8_t* color = calloc(n, 1);
+    uint32_t* cursor = calloc(n, sizeof(uint32_t));
+    uint32_t* stack = malloc((n + g->succ_start[n] + 1) * sizeof(uint32_t)); // Blocks, or edges of the body search
+    uint8_t* back_edge = calloc(g->succ_start[n] + 1, 1);
+    wcet_loop_t* loops = calloc(n, sizeof(wcet_loop_t));
+    uint32_t depth = 0;
+
+    *loop_count = 0;
+    if (!color || !cursor || !stack || !back_edge || !loops)
+        goto error;
+
+    color[0] = 1;
+    stack[depth++] = 0;
+    while (depth > 0)
+    {
+        const uint32_t u = stack[depth - 1];
+        const uint32_t e = g->succ_start[u] + cursor[u];
+
+        if (e == g->succ_start[u + 1])
+        {
+            color[u] = 2;
+            depth--;
+            continue;
+        }
+
+        cursor[u]++;
+
+        const uint32_t v = g->succ[e];
+        if (color[v] == 0)
+        {
+            color[v] = 1;
+            stack[depth++] = v;
+        } else if (color[v] == 1)
+        {
+            back_edge[e] = 1;
+        }
+    }
+
+    for (uint32_t h = 0; h < n; h++)
+    {
+        wcet_loop_t* loop = &loops[*loop_count];
+
+        // Body: The header and every block that reaches a back edge source without the header
+        depth = 0;
+        for (uint32_t p = g->pred_start[h]; p < g->pred_start[h + 1]; p++)
+        {
+            const uint32_t u = g->pred[p];
+            for (uint32_t e = g->succ_start[u]; e < g->succ_start[u + 1]; e++)
+            {
+                if (back_edge[e] && g->succ[e] == h)
+                {
+                    if (!loop->body && !(loop->body = calloc(n, 1)))
+                        goto error;
+                    stack[depth++] = u;
+                }
+            }
+        }
+
+        if (!loop->body)
+            continue;
+
+        loop->header = h;
+        loop->body[h] = 1;
+        loop->size = 1;
+
+        while (depth > 0)
+        {
+            const uint32_t u = stack[--depth];
+            if (loop->body[u])
+                continue;
+
+            loop->body[u] = 1;
+            loop->size++;
+
+            for (uint32_t e = g->pred_start[u]; e < g->pred_start[u + 1]; e++)
+            {
+                if (!loop->body[g->pred[e]])
+                    stack[depth++] = g->pred[e];
+            }
+        }
+
+        (*loop_count)++;
+    }
+
+    qsort(loops, *loop_count, sizeof(wcet_loop_t), &wcet_compare_loops);
+
+    free(color);
+    free(cursor);
+    free(stack);
+    free(back_edge);
+    return loops;
+
+error:
+    if (loops)
+    {
+        for (uint32_t i = 0; i <= *loop_count && i < n; i++)
+            free(loops[i].body);
+    }
+    free(color);
+    free(cursor);
+    free(stack);
+    free(back_edge);
+    free(loops);
+    return 0;
+}
+
+static uint64_t wcet_function_cycles(wcet_context_t* ctx, wcet_graph_t* g)
+{
+    uint32_t loop_count;
+    wcet_loop_t* loops = wcet_find_loops(g, &loop_count);
+    if (!loops)
+    {
+        ctx->ok = false;
+        return WCET_UNBOUNDED;
+    }
+
+    for (uint32_t l = 0; l < loop_count; l++)
+    {
+        const uint32_t h = loops[l].header;
+        const uint16_t address = ctx->cfg->blocks[g->blocks[h]].start;
+        const wcet_loop_bound_t* bound = wcet_find_bound(ctx, address);
+
+        uint64_t iteration = 0;
+        uint64_t exit = 0;
+        const wcet_search_t to_back_edge = {.graph = g, .region = loops[l].body, .header = h, .goal = WCET_GOAL_BACK_EDGE};
+        const wcet_search_t to_exit = {.graph = g, .region = loops[l].body, .header = h, .goal = WCET_GOAL_EXIT};
+
+        wcet_search(&to_back_edge, h, &iteration);
+        const bool exits = wcet_search(&to_exit, h, &exit);
+
+        if (!bound)
+            ctx->missing[address >> 3] |= 1 << (address & 0b111);
+
+        // Collapse the body into the header
+        for (uint32_t x = 0; x < g->count; x++)
+        {
+            if (!loops[l].body[x] || x == h || g->rep[x] != x)
+                continue;
+
+            g->next[g->tail[h]] = x;
+            g->tail[h] = g->tail[x];
+        }
+        for (uint32_t x = 0; x < g->count; x++)
+        {
+            if (loops[l].body[x])
+                g->rep[x] = h;
+        }
+
+        g->cost[h] = bound && exits ? wcet_add(wcet_mul(bound->iterations, iteration), exit) : WCET_UNBOUNDED;
+    }
+
+    for (uint32_t l = 0; l < loop_count; l++)
+        free(loops[l].body);
+    free(loops);
+
+    uint64_t cycles;
+    const wcet_search_t to_return = {.graph = g, .header = WCET_NONE, .goal = WCET_GOAL_RETURN};
+    return wcet_search(&to_return, g->rep[0], &cycles) ? cycles : WCET_UNBOUNDED;
+}
+
+/// Deepest stack along the paths of a function, relative to SP at the entry
+static uint32_t wcet_function_stack(wcet_context_t* ctx, const wcet_graph_t* g)
+{
+    const uint32_t n = g->count;
+    int32_t* offset = malloc(n * sizeof(int32_t));
+    uint32_t* worklist = malloc(n * sizeof(uint32_t));
+    uint8_t* queued = calloc(n, 1);
+    uint32_t count = 0;
+
+    if (!offset || !worklist || !queued)
+    {
+        free(offset);
+        free(worklist);
+        free(queued);
+        ctx->ok = false;
+        return WCET_STACK_UNBOUNDED;
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+        offset[i] = INT32_MIN;
+
+    int32_t peak = 0;
+    bool unbounded = false;
+
+    offset[0] = 0;
+    worklist[count++] = 0;
+    queued[0] = 1;
+
+    while (count > 0 && !unbounded)
+    {
+        const uint32_t i = worklist[--count];
+        const cfg_block_t* block = &ctx->cfg->blocks[g->blocks[i]];
+        int32_t sp = offset[i];
+
+        queued[i] = 0;
+
+        uint16_t address = block->start;
+        for (uint16_t k = 0; k < block->instructions; k++)
+        {
+            const uint8_t op = ctx->p->C[address];
+            sp += op == 0xC0 ? 1 : op == 0xD0 ? -1 : 0; // PUSH direct, POP direct
+            peak = sp > peak ? sp : peak;
+            address += wcet_instruction_bytes(ctx->p, address);
+        }
+
+        if (block->exit == CFG_EXIT_CALL)
+        {
+            const int32_t callee = wcet_callee(ctx, block);
+            if (callee < 0 || ctx->wcet->functions[callee].stack == WCET_STACK_UNBOUNDED)
+            {
+                unbounded = true;
+                break;
+            }
+
+            // Return address and the stack of the callee
+            const int32_t depth = sp + 2 + (int32_t) ctx->wcet->functions[callee].stack;
+            peak = depth > peak ? depth : peak;
+        }
+
+        for (uint32_t e = g->succ_start[i]; e < g->succ_start[i + 1]; e++)
+        {
+            const uint32_t j = g->succ[e];
+            if (offset[j] != INT32_MIN && offset[j] >= sp)
+                continue;
+
+            // A loop that pushes more than it pops
+            if (sp > WCET_MAX_STACK_OFFSET)
+            {
+                unbounded = true;
+                break;
+            }
+
+            offset[j] = sp;
+            if (!queued[j])
+            {
+                queued[j] = 1;
+                worklist[count++] = j;
+            }
+        }
+    }
+
+    free(offset);
+    free(worklist);
+    free(queued);
+
+    return unbounded || peak > WCET_MAX_STACK_OFFSET ? WCET_STACK_UNBOUNDED : (uint32_t) peak;
+}
+
+static void wcet_visit(wcet_context_t* ctx, uint32_t f)
+{
+    const cfg_t* cfg = ctx->cfg;
+    wcet_function_t* result = &ctx->wcet->functions[f];
+
+    ctx->state[f] = WCET_STATE_ACTIVE;
+    *result = (wcet_function_t){.cycles = WCET_UNBOUNDED, .stack = WCET_STACK_UNBOUNDED};
+
+    uint32_t count;
+    uint32_t* blocks = wcet_members(ctx, f, &count);
+    if (!blocks)
+    {
+        ctx->ok = false;
+        ctx->state[f] = WCET_STATE_DONE;
+        return;
+    }
+
+    // Callees first
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const cfg_block_t* block = &cfg->blocks[blocks[i]];
+        if (block->exit != CFG_EXIT_CALL)
+            continue;
+
+        const int32_t callee = cfg_function_at(cfg, block->target);
+        if (callee >= 0 && ctx->state[callee] == WCET_STATE_NEW)
+            wcet_visit(ctx, (uint32_t) callee);
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+        ctx->local[blocks[i]] = (int32_t) i;
+
+    wcet_graph_t g;
+    if (wcet_graph_init(&g, ctx, blocks, count))
+    {
+        result->cycles = wcet_function_cycles(ctx, &g);
+        result->stack = wcet_function_stack(ctx, &g);
+
+        if (cfg->functions[f].kind == CFG_FUNCTION_INTERRUPT)
+            result->cycles = wcet_add(result->cycles, 2); // The call inserted by the interrupt controller
+    } else
+    {
+        ctx->ok = false;
+    }
+
+    wcet_graph_free(&g);
+
+    for (uint32_t i = 0; i < count; i++)
+        ctx->local[blocks[i]] = -1;
+    free(blocks);
+
+    ctx->state[f] = WCET_STATE_DONE;
+}
+
+bool wcet_analyze(wcet_t* wcet, const cfg_t* cfg, const mcs51_t* p, const wcet_loop_bound_t* bounds, size_t bound_count)
+{
+    *wcet = (wcet_t){
+            .function_count = cfg->function_count,
+            .levels = p->_nvic._iph_mask ? 4 : 2,
+            .initial_sp = 0x07,
+            .idata_size = mcs51_variant_profiles[p->_variant].idata_size,
+    };
+
+    wcet_context_t ctx = {.wcet = wcet, .cfg = cfg, .p = p, .bounds = bounds, .bound_count = bound_count, .ok = true};
+    wcet->functions = calloc(cfg->function_count ? cfg->function_count : 1, sizeof(wcet_function_t));
+    ctx.state = calloc(cfg->function_count ? cfg->function_count : 1, 1);
+    ctx.local = malloc((cfg->block_count ? cfg->block_count : 1) * sizeof(int32_t));
+    ctx.missing = calloc(0x10000 / 8, 1);
+
+    if (!wcet->functions || !ctx.state || !ctx.local || !ctx.missing)
+        ctx.ok = false;
+
+    if (ctx.ok)
+    {
+        for (size_t b = 0; b < cfg->block_count; b++)
+            ctx.local[b] = -1;
+
+        for (uint32_t f = 0; f < cfg->function_count; f++)
+        {
+            if (ctx.state[f] == WCET_STATE_NEW)
+                wcet_visit(&ctx, f);
+        }
+    }
+
+    if (ctx.ok)
+    {
+        for (uint32_t address = 0; address < 0x10000; address++)
+        {
+            if (!(ctx.missing[address >> 3] & (1 << (address & 0b111))))
+                continue;
+
+            uint16_t* missing = realloc(wcet->missing_bounds, (wcet->missing_bound_count + 1) * sizeof(uint16_t));
+            if (!missing)
+            {
+                ctx.ok = false;
+                break;
+            }
+            wcet->missing_bounds = missing;
+            wcet->missing_bounds[wcet->missing_bound_count++] = (uint16_t) address;
+        }
+    }
+
+    if (ctx.ok)
+    {
+        // An interrupt is preempted by higher levels only: One interrupt per level on the stack
+        const uint8_t ip = p->D[SFR_IP];
+        const uint8_t iph = p->D[SFR_IPH] & p->_nvic._iph_mask;
+
+        for (uint32_t f = 0; f < cfg->function_count; f++)
+        {
+            const cfg_function_t* function = &cfg->functions[f];
+            wcet_function_t* result = &wcet->functions[f];
+
+            if (function->kind == CFG_FUNCTION_RESET)
+                wcet->max_stack = result->stack;
+
+            if (function->kind != CFG_FUNCTION_INTERRUPT)
+                continue;
+
+            const uint8_t mask = p->_nvic.map[function->interrupt].bit_mask;
+            result->level = (iph & mask ? 2 : 0) + (ip & mask ? 1 : 0);
+
+            const uint32_t depth = result->stack == WCET_STACK_UNBOUNDED ? WCET_STACK_UNBOUNDED : result->stack + 2;
+            if (depth > wcet->level_stack[result->level])
+                wcet->level_stack[result->level] = depth;
+        }
+
+        for (uint8_t level = 0; level < wcet->levels; level++)
+        {
+            if (wcet->max_stack == WCET_STACK_UNBOUNDED || wcet->level_stack[level] == WCET_STACK_UNBOUNDED)
+                wcet->max_stack = WCET_STACK_UNBOUNDED;
+            else
+                wcet->max_stack += wcet->level_stack[level];
+        }
+    }
+
+    free(ctx.state);
+    free(ctx.local);
+    free(ctx.missing);
+
+    if (!ctx.ok)
+        wcet_free(wcet);
+
+    return ctx.ok;
+}
+
+void wcet_free(wcet_t* wcet)
+{
+    free(wcet->functions);
+    free(wcet->missing_bounds);
+    memset(wcet, 0, sizeof(*wcet));
+}
+
+static void wcet_write_cycles(FILE* file, uint64_t cycles)
+{
+    if (cycles == WCET_UNBOUNDED)
+        fprintf(file, "null");
+    else
+        fprintf(file, "%llu", (unsigned long long) cycles);
+}
+
+static void wcet_write_stack(FILE* file, uint32_t stack)
+{
+    if (stack == WCET_STACK_UNBOUNDED)
+        fprintf(file, "null");
+    else
+        fprintf(file, "%u", stack);
+}
+
+void wcet_write_json(const wcet_t* wcet, const cfg_t* cfg, const mcs51_t* p, FILE* file)
+{
+    static const char* const kinds[] = {
+            [CFG_FUNCTION_RESET] = "reset",
+            [CFG_FUNCTION_INTERRUPT] = "interrupt",
+            [CFG_FUNCTION_ROOT] = "root",
+            [CFG_FUNCTION_CALL] = "function",
+    };
+
+    fprintf(file, "{\n  \"functions\": [");
+    for (size_t f = 0; f < wcet->function_count; f++)
+    {
+        const cfg_function_t* function = &cfg->functions[f];
+        const wcet_function_t* result = &wcet->functions[f];
+
+        fprintf(file, "%s\n    {\"entry\": \"0x%04X\", \"kind\": \"%s\", ", f ? "," : "", function->entry, kinds[function->kind]);
+        if (function->kind == CFG_FUNCTION_INTERRUPT)
+            fprintf(file, "\"name\": \"%s\", \"level\": %u, ", p->_nvic.map[function->interrupt].name, result->level);
+        fprintf(file, "\"blocks\": %u, \"cycles\": ", function->block_count);
+        wcet_write_cycles(file, result->cycles);
+        fprintf(file, ", \"stack\": ");
+        wcet_write_stack(file, result->stack);
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n  ],\n");
+
+    fprintf(file, "  \"missing_loop_bounds\": [");
+    for (size_t i = 0; i < wcet->missing_bound_count; i++)
+        fprintf(file, "%s\"0x%04X\"", i ? ", " : "", wcet->missing_bounds[i]);
+    fprintf(file, "],\n");
+
+    fprintf(file, "  \"stack\": {\"levels\": [");
+    for (uint8_t level = 0; level < wcet->levels; level++)
+    {
+        fprintf(file, "%s", level ? ", " : "");
+        wcet_write_stack(file, wcet->level_stack[level]);
+    }
+    fprintf(file, "], \"max_depth\": ");
+    wcet_write_stack(file, wcet->max_stack);
+    fprintf(file, ", \"initial_sp\": %u, \"max_sp\": ", wcet->initial_sp);
+    if (wcet->max_stack == WCET_STACK_UNBOUNDED)
+        fprintf(file, "null, \"overflow\": null");
+    else
+        fprintf(file, "%u, \"overflow\": %s", wcet->initial_sp + wcet->max_stack,
+                wcet->initial_sp + wcet->max_stack >= wcet->idata_size ? "true" : "false");
+    fprintf(file, ", \"idata_size\": %u}\n}\n", wcet->idata_size);
+}
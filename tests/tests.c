@@ -1,9 +1,19 @@
+#include <cfg.h>
+#include <conformance.h>
+#include <forkserver.h>
+#include <fuzz.h>
+#include <lockstep.h>
 #include <mcs51.h>
+#include <network.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <wcet.h>
 
 #include "sfr_definitions_gen.h"
 #include <assert.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 /// Test helper macro
 typedef struct test_cfg_t {
@@ -180,6 +190,34 @@ TEST(test_indirect_addressing)
     return proc.D[0x80] == 0xFF && proc.D[0x80 + 0x80] == 0xAB;
 }
 
+/**
+ *     MOV SP, #0x7F
+ *     LCALL sub        ; Return address in I:80, I:81
+ *     NOP
+ *
+ * .ORG 0010h
+ * sub:
+ *     SETB F0
+ *     CPL ACC.7
+ *     RET
+ */
+TEST(test_idata_stack)
+{
+    mcs51_t proc = {.C = {0x75, 0x81, 0x7f, 0x12, 0x00, 0x10, [0x10] = 0xd2, 0xd5, 0xb2, 0xe7, 0x22}};
+    mcs51_init(&proc);
+
+    uint8_t p0 = proc.D[SFR_P0];
+
+    RUN_UNTIL_NOP();
+    mcs51_sync_psw(&proc);
+
+    return proc.D[SFR_SP] == 0x7f
+           && proc.D[0x100] == 0x06 && proc.D[0x101] == 0x00
+           && proc.D[SFR_P0] == p0
+           && (proc.D[SFR_PSW] & SFR_PSW_F0_Msk)
+           && proc.D[SFR_ACC] == 0x80;
+}
+
 /**
  * MOV TMOD, #0x01 ; Set ET0 to 16-bit mode
  * SETB TR0
@@ -402,6 +440,1773 @@ TEST(test_max_interrupt_latency)
     return success;
 }
 
+/**
+ * MOV A, #0x7F
+ * ADD A, #0x01     ; A = 0x80, AC, OV, P
+ * MOV 0x30, A
+ * MOV 0x31, PSW
+ * MOV A, #0x19
+ * ADD A, #0x28     ; A = 0x41, AC
+ * DA A             ; A = 0x47 (BCD 19 + 28)
+ * MOV 0x32, A
+ */
+TEST(test_alu_flags)
+{
+    mcs51_t proc = {.C = {0x74, 0x7f, 0x24, 0x01, 0xf5, 0x30, 0x85, 0xd0, 0x31, 0x74, 0x19, 0x24, 0x28, 0xd4, 0xf5, 0x32}};
+    mcs51_init(&proc);
+
+    RUN_UNTIL_NOP();
+
+    return proc.D[0x30] == 0x80
+           && proc.D[0x31] == (SFR_PSW_AC_Msk | SFR_PSW_OV_Msk | SFR_PSW_P_Msk)
+           && proc.D[0x32] == 0x47;
+}
+
+/**
+ * MOV A, #0x7F
+ * ADD A, #0x01     ; A = 0x80, AC, OV (lazy)
+ * CLR OV           ; Bit write on the lazily evaluated PSW
+ * MOV B, #0x03     ; P is derived from A only
+ */
+TEST(test_lazy_psw)
+{
+    mcs51_t proc = {.C = {0x74, 0x7f, 0x24, 0x01, 0xc2, 0xd2, 0x75, 0xf0, 0x03}};
+    mcs51_init(&proc);
+
+    RUN_UNTIL_NOP();
+
+    mcs51_sync_psw(&proc);
+
+    return proc.D[SFR_PSW] == (SFR_PSW_AC_Msk | SFR_PSW_P_Msk);
+}
+
+/**
+ * SETB RS0         ; Bank 1
+ * MOV R0, #0xAA
+ * MOV PSW, #0x10   ; Bank 2
+ * MOV R7, #0xBB
+ * CLR RS1          ; Bank 0
+ * MOV R1, #0xCC
+ */
+TEST(test_register_banks)
+{
+    mcs51_t proc = {.C = {0xd2, 0xd3, 0x78, 0xaa, 0x75, 0xd0, 0x10, 0x7f, 0xbb, 0xc2, 0xd4, 0x79, 0xcc}};
+    mcs51_init(&proc);
+
+    RUN_UNTIL_NOP();
+
+    return proc.D[0x08] == 0xAA && proc.D[0x17] == 0xBB && proc.D[0x01] == 0xCC;
+}
+
+typedef struct watch_log_t {
+    int reads;
+    int writes;
+    uint8_t old_values[4];
+    uint8_t new_values[4];
+} watch_log_t;
+
+static void on_watch(mcs51_t* p, uint8_t address, watch_kind_t kind, uint8_t old_value, uint8_t new_value, void* ctx)
+{
+    watch_log_t* log = ctx;
+    if (kind == WATCH_READ)
+    {
+        log->reads++;
+    } else if (log->writes < 4)
+    {
+        log->old_values[log->writes] = old_value;
+        log->new_values[log->writes] = new_value;
+        log->writes++;
+    }
+}
+
+/**
+ * MOV 0x30, #0x12
+ * INC 0x30
+ * MOV A, 0x30
+ * MOV 0x31, A
+ * MOV R0, #0x30
+ * INC @R0
+ * MOV SP, #0x2F
+ * PUSH ACC
+ * POP 0x31
+ */
+TEST(test_watch)
+{
+    mcs51_t proc = {.C = {0x75, 0x30, 0x12, 0x05, 0x30, 0xe5, 0x30, 0xf5, 0x31, 0x78, 0x30, 0x06, 0x75, 0x81, 0x2f, 0xc0, 0xe0, 0xd0, 0x31}};
+    mcs51_init(&proc);
+
+    watch_log_t log = {};
+    watch_log_t log2 = {};
+    int handle = watch_add(&proc, 0x30, WATCH_READ_WRITE, &on_watch, &log);
+    watch_add(&proc, 0x30, WATCH_WRITE, &on_watch, &log2);
+
+    RUN_UNTIL_NOP();
+
+    watch_remove(&proc, handle);
+
+    return log.reads == 4 // INC is read-modify-write
+           && log.writes == 4
+           && log.old_values[0] == 0x00 && log.new_values[0] == 0x12
+           && log.old_values[1] == 0x12 && log.new_values[1] == 0x13
+           && log.old_values[2] == 0x13 && log.new_values[2] == 0x14 // INC @R0
+           && log.old_values[3] == 0x14 && log.new_values[3] == 0x13 // PUSH
+           && log2.reads == 0 && log2.writes == 4
+           && proc.D[0x31] == 0x13 && proc.D[SFR_SP] == 0x2F
+           && proc._watches[handle].fn == NULL;
+}
+
+/**
+ * .ORG 0000h
+ *     ACALL fn
+ *     NOP
+ *
+ * .ORG 0110h
+ * fn:
+ *     MOV A, #0xAB
+ *     RET
+ */
+TEST(test_acall)
+{
+    mcs51_t proc = {.C = {0x31, 0x10, 0x00, [0x110] = 0x74, 0xab, 0x22}};
+    mcs51_init(&proc);
+
+    RUN_UNTIL_NOP();
+
+    return proc.D[SFR_ACC] == 0xAB && proc.D[SFR_SP] == 0x07 && proc.PC == 0x03;
+}
+
+/**
+ * SETB P1.0
+ * CLR P1.0
+ * MOV A, #0x7F
+ * ADD A, #0x01
+ */
+TEST(test_vcd)
+{
+    bool success = true;
+
+    mcs51_t proc = {.C = {0xd2, 0x90, 0xc2, 0x90, 0x74, 0x7f, 0x24, 0x01}};
+    mcs51_init(&proc);
+
+    static vcd_t vcd;
+    FILE* file = tmpfile();
+    vcd_init(&vcd, file);
+    success &= vcd_add_sfr_bit(&vcd, "P1_0", SFR_P1, 0);
+    success &= vcd_add_ale(&vcd);
+    success &= vcd_add_isr_active(&vcd);
+    success &= vcd_add_sfr(&vcd, "PSW", SFR_PSW);
+    proc._vcd = &vcd;
+
+    RUN_UNTIL_NOP();
+
+    vcd_flush(&vcd);
+    rewind(file);
+
+    char dump[4096] = {};
+    size_t n = fread(dump, 1, sizeof(dump) - 1, file);
+    fclose(file);
+
+    success &= n > 0;
+    success &= strstr(dump, "$var wire 1 ! P1_0 $end") != NULL;
+    success &= strstr(dump, "$var wire 1 \" ALE $end") != NULL;
+    success &= strstr(dump, "$var wire 6 # ISR_ACTIVE $end") != NULL;
+
+    // P1.0: Initial value, set by SETB and cleared by CLR
+    const char* set = strstr(dump, "1!\n");
+    success &= set != NULL && strstr(set, "0!\n") != NULL;
+
+    // PSW: The lazily evaluated AC, OV and P of the ADD
+    success &= strstr(dump, "b01000101 $\n") != NULL;
+
+    // ALE is pulsed twice per machine cycle
+    int ale_rising = 0;
+    for (const char* s = dump; (s = strstr(s, "\n1\"")) != NULL; s++)
+        ale_rising++;
+    success &= ale_rising >= 2 * 3;
+
+    return success;
+}
+
+/**
+ * .ORG 0000h
+ *     LJMP main
+ *
+ * .ORG 000Bh
+ *     INC 0x40
+ *     MOV TH0, #0xFF
+ *     RETI
+ *
+ * .ORG 0020h
+ * main:
+ *     MOV TMOD, #0x01 ; Set ET0 to 16-bit mode
+ *     MOV TH0, #0xFF
+ *     SETB ET0
+ *     SETB EA
+ *     SETB TR0
+ * loop:
+ *     MOV A, 0x30
+ *     ADD A, #0x07
+ *     MOV 0x30, A
+ *     MOV 0x31, PSW
+ *     MUL AB
+ *     SJMP loop
+ */
+static const uint8_t s_engine_program[] = {
+        0x02, 0x00, 0x20, [0x0b] = 0x05, 0x40, 0x75, 0x8c, 0xff, 0x32,
+        [0x20] = 0x75, 0x89, 0x01, 0x75, 0x8c, 0xff, 0xd2, 0xa9, 0xd2, 0xaf, 0xd2, 0x8c,
+        0xe5, 0x30, 0x24, 0x07, 0xf5, 0x30, 0x85, 0xd0, 0x31, 0xa4, 0x80, 0xf4};
+
+/**
+ * The interpreter cores have to match the phase-accurate engine at every instruction boundary.
+ */
+TEST(test_engine_plain)
+{
+    static mcs51_t phase;
+    static mcs51_t fast;
+
+    memset(&phase, 0, sizeof(phase));
+    memcpy(phase.C, s_engine_program, sizeof(s_engine_program));
+    mcs51_init(&phase);
+    fast = phase;
+
+    // Complete the last instruction
+    while (phase._osc_periods < 12 * 5000 || phase._instruction_register.opcode.cycles != 0)
+        msc51_do_machine_cycle(&phase);
+
+    msc51_run(&fast, phase._osc_periods);
+
+    mcs51_sync_psw(&phase);
+    mcs51_sync_psw(&fast);
+
+    return fast._osc_periods == phase._osc_periods
+           && fast.PC == phase.PC
+           && fast.D[0x40] > 10 // Some timer interrupts
+           && memcmp(fast.D, phase.D, sizeof(fast.D)) == 0;
+}
+
+TEST(test_engine_profile_coverage)
+{
+    static mcs51_t proc;
+    static profile_t profile;
+    static coverage_t coverage;
+
+    memset(&proc, 0, sizeof(proc));
+    memcpy(proc.C, s_engine_program, sizeof(s_engine_program));
+    mcs51_init(&proc);
+    profile_reset(&profile);
+    coverage_reset(&coverage);
+
+    proc._profile = &profile;
+    proc._engine = MCS51_ENGINE_PROFILE;
+    msc51_run(&proc, 12 * 1000);
+
+    proc._coverage = &coverage;
+    proc._engine = MCS51_ENGINE_COVERAGE;
+    msc51_run(&proc, 12 * 1000);
+
+    // 3 ISR and 6 loop instructions, the initialization ran with the profiler
+    return coverage_count_executed(&coverage) == 9
+           && (coverage.executed[0x0b / 8] & (1 << (0x0b % 8)))
+           && !(coverage.executed[0x20 / 8] & (1 << (0x20 % 8)))
+           && profile.opcode_count[0x02] == 1 // Inserted LJMPs are not counted
+           && profile.pc_count[0x20] == 1
+           && profile.pc_count[0x2c] >= profile.opcode_count[0xa4]
+           && profile.instructions > 100;
+}
+
+TEST(test_profile_superinstructions)
+{
+    static mcs51_t proc;
+    static profile_t profile;
+
+    memset(&proc, 0, sizeof(proc));
+    memcpy(proc.C, s_engine_program, sizeof(s_engine_program));
+    mcs51_init(&proc);
+    profile_reset(&profile);
+
+    proc._profile = &profile;
+    proc._engine = MCS51_ENGINE_PROFILE;
+    msc51_run(&proc, 12 * 1000);
+
+    FILE* file = tmpfile();
+    profile_write_superinstructions(&profile, &proc, file, 3);
+    rewind(file);
+
+    char list[4096] = {};
+    fread(list, 1, sizeof(list) - 1, file);
+    fclose(file);
+
+    // MOV A, direct; ADD A, #immed; MOV direct, A
+    return profile.pair_count[0xe524] == profile.pc_count[0x2e]
+           && profile.pair_count[0xa480] > 0
+           && strstr(list, "\nE5 24 F5 ") != NULL;
+}
+
+/// R6/R7 = R6/R7 * R4/R5 (16-bit, high byte in R6 and R4)
+static void hle_mul16(mcs51_t* p, void* ctx)
+{
+    uint8_t* R = &p->D[p->_register_bank];
+    uint16_t product = (uint16_t) (((R[6] << 8) | R[7]) * ((R[4] << 8) | R[5]));
+
+    R[6] = product >> 8;
+    R[7] = product & 0xFF;
+    (*(int*) ctx)++;
+}
+
+/**
+ *     MOV R6, #0x12
+ *     MOV R7, #0x34
+ *     MOV R4, #0x00
+ *     MOV R5, #0x03
+ *     LCALL mul16
+ *     MOV 0x30, R6
+ *     MOV 0x31, R7
+ *     NOP
+ *
+ * .ORG 0100h
+ * mul16: ; Stand-in for a runtime library routine
+ *     MOV A, R7
+ *     MOV B, R5
+ *     MUL AB
+ *     RET
+ */
+TEST(test_hle)
+{
+    bool success = true;
+    const uint8_t signature[] = {0xef, 0x8d, 0xf0, 0xa4};
+
+    mcs51_t proc = {.C = {0x7e, 0x12, 0x7f, 0x34, 0x7c, 0x00, 0x7d, 0x03, 0x12, 0x01, 0x00, 0x8e, 0x30, 0x8f, 0x31, 0x00,
+                          [0x100] = 0xef, 0x8d, 0xf0, 0xa4, 0x22}};
+    mcs51_init(&proc);
+
+    int calls = 0;
+    success &= hle_add_signature(&proc, signature, NULL, sizeof(signature), 20, &hle_mul16, &calls) >= 0;
+
+    RUN_UNTIL_NOP();
+
+    success &= proc.D[0x30] == 0x36 && proc.D[0x31] == 0x9c;
+    success &= proc.D[SFR_SP] == 0x07 && calls == 1;
+    success &= proc._osc_periods == 12 * (11 + 20);
+
+    // Interpreter core
+    memset(proc.D, 0, sizeof(proc.D));
+    mcs51_init(&proc);
+    proc.PC = 0;
+    msc51_run(&proc, 12 * (11 + 20));
+
+    success &= proc.D[0x30] == 0x36 && proc.D[0x31] == 0x9c && calls == 2;
+
+    /**
+     *     LJMP main
+     * .ORG 000Bh
+     *     INC 0x31
+     *     RETI
+     * .ORG 0020h
+     * main:
+     *     MOV TMOD, #0x01
+     *     MOV TH0, #0xFF
+     *     MOV TL0, #0xC0   ; Overflow during the emulated routine
+     *     SETB ET0
+     *     SETB EA
+     *     SETB TR0
+     *     LCALL 0x0100     ; 100 cycles
+     *     SJMP $
+     */
+    static mcs51_t phase;
+    static mcs51_t fast;
+    memset(&phase, 0, sizeof(phase));
+    const uint8_t main[] = {0x75, 0x89, 0x01, 0x75, 0x8c, 0xff, 0x75, 0x8a, 0xc0, 0xd2, 0xa9, 0xd2, 0xaf, 0xd2, 0x8c, 0x12, 0x01, 0x00, 0x80, 0xfe};
+    phase.C[0x00] = 0x02;
+    phase.C[0x02] = 0x20;
+    phase.C[0x0B] = 0x05;
+    phase.C[0x0C] = 0x31;
+    phase.C[0x0D] = 0x32;
+    phase.C[0x100] = 0x22;
+    memcpy(&phase.C[0x20], main, sizeof(main));
+    mcs51_init(&phase);
+    success &= hle_add(&phase, 0x100, 100, &hle_mul16, &calls) >= 0;
+    fast = phase;
+
+    // The timer counts the charged cycles, its interrupt is taken after the return
+    while (phase._osc_periods < 12 * 125 || phase._instruction_register.opcode.cycles != 0)
+        msc51_do_machine_cycle(&phase);
+    msc51_run(&fast, phase._osc_periods);
+    mcs51_sync_timers(&phase);
+    mcs51_sync_timers(&fast);
+
+    success &= phase.D[0x31] == 1 && fast.D[0x31] == 1 && calls == 4;
+    success &= fast._osc_periods == phase._osc_periods && fast.PC == phase.PC;
+    success &= memcmp(fast.D, phase.D, sizeof(fast.D)) == 0;
+
+    return success;
+}
+
+/**
+ *     MOV DPTR, #0x0100
+ *     MOV R7, #3          ; File 3
+ *     MOV R4, #0
+ *     MOV R5, #5          ; 5 bytes
+ *     MOV A, #1           ; SEMIHOST_WRITE
+ *     SEMIHOST
+ *     MOV 0x30, A
+ *     MOV R7, #4          ; File 4
+ *     MOV A, #2           ; SEMIHOST_READ
+ *     SEMIHOST
+ *     MOV 0x31, R5
+ *     MOV R7, #0x2A
+ *     MOV A, #3           ; SEMIHOST_EXIT
+ *     SEMIHOST
+ */
+TEST(test_semihost)
+{
+    bool success = true;
+
+    static mcs51_t proc;
+    memset(&proc, 0, sizeof(proc));
+    const uint8_t program[] = {0x90, 0x01, 0x00, 0x7f, 0x03, 0x7c, 0x00, 0x7d, 0x05, 0x74, 0x01, 0xa5, 0xf5, 0x30,
+                               0x7f, 0x04, 0x74, 0x02, 0xa5, 0x8d, 0x31, 0x7f, 0x2a, 0x74, 0x03, 0xa5};
+    memcpy(proc.C, program, sizeof(program));
+    memcpy(&proc.X[0x100], "hello", 5);
+    mcs51_init(&proc);
+
+    semihost_t semihost;
+    semihost_init(&semihost);
+    semihost.files[3] = tmpfile();
+    semihost.files[4] = tmpfile();
+    fputs("abc", semihost.files[4]);
+    rewind(semihost.files[4]);
+    semihost_enable(&proc, &semihost);
+
+    for (int i = 0; i < 100 && !semihost.exited; i++)
+        MACHINE_CYCLE();
+
+    char output[8] = {};
+    rewind(semihost.files[3]);
+    fread(output, 1, sizeof(output) - 1, semihost.files[3]);
+    fclose(semihost.files[3]);
+    fclose(semihost.files[4]);
+
+    success &= strcmp(output, "hello") == 0 && proc.D[0x30] == 0x00;
+    success &= memcmp(&proc.X[0x100], "abclo", 5) == 0 && proc.D[0x31] == 3;
+    success &= semihost.exited && semihost.exit_code == 0x2A;
+
+    // Halted at the SEMIHOST instruction
+    msc51_run(&proc, 12 * 10);
+    success &= proc.PC == sizeof(program) - 1;
+
+    return success;
+}
+
+/**
+ *     MOV R2, #3
+ *     DJNZ R2, $
+ *     JZ skip
+ *     MOV A, #1
+ * skip:
+ *     JNZ end
+ * end:
+ *     SJMP $
+ */
+TEST(test_branch_coverage)
+{
+    bool success = true;
+
+    static mcs51_t proc;
+    static coverage_t coverage;
+    static coverage_t merged;
+
+    memset(&proc, 0, sizeof(proc));
+    const uint8_t program[] = {0x7a, 0x03, 0xda, 0xfe, 0x60, 0x02, 0x74, 0x01, 0x70, 0x00, 0x80, 0xfe};
+    memcpy(proc.C, program, sizeof(program));
+    mcs51_init(&proc);
+    coverage_reset(&coverage);
+
+    proc._coverage = &coverage;
+    proc._engine = MCS51_ENGINE_COVERAGE;
+    msc51_run(&proc, 12 * 50);
+
+    success &= coverage_count_executed(&coverage) == 5;
+    success &= coverage_count_branch_outcomes(&coverage) == 4;
+    success &= coverage_test(coverage.branch_taken, 0x02) && coverage_test(coverage.branch_not_taken, 0x02);
+    success &= coverage_test(coverage.branch_taken, 0x04) && !coverage_test(coverage.branch_not_taken, 0x04);
+    success &= !coverage_test(coverage.branch_taken, 0x08) && coverage_test(coverage.branch_not_taken, 0x08);
+
+    // Merge through a file
+    FILE* file = tmpfile();
+    coverage_reset(&merged);
+    success &= coverage_save(&coverage, file);
+    rewind(file);
+    success &= coverage_merge_file(&merged, file);
+    fclose(file);
+    success &= memcmp(&merged, &coverage, sizeof(coverage)) == 0;
+
+    // lcov export
+    const char* lines = "# Test map\n"
+                        "L 0000 main.a51 1\nL 0002 main.a51 2\nL 0004 main.a51 3\n"
+                        "L 0006 main.a51 4\nL 0008 main.a51 5\nL 000A main.a51 6\n"
+                        "F 0000 main\n";
+    file = tmpfile();
+    fputs(lines, file);
+    rewind(file);
+
+    coverage_map_t map;
+    success &= coverage_map_load(&map, file);
+    fclose(file);
+
+    file = tmpfile();
+    coverage_write_lcov(&coverage, &map, proc.C, file);
+    coverage_map_free(&map);
+    rewind(file);
+
+    char lcov[4096] = {};
+    fread(lcov, 1, sizeof(lcov) - 1, file);
+    fclose(file);
+
+    success &= strstr(lcov, "SF:main.a51\n") != NULL;
+    success &= strstr(lcov, "FNDA:1,main\n") != NULL;
+    success &= strstr(lcov, "DA:3,1\n") != NULL && strstr(lcov, "DA:4,0\n") != NULL;
+    success &= strstr(lcov, "BRDA:3,0,0,1\nBRDA:3,0,1,0\n") != NULL;
+    success &= strstr(lcov, "BRF:6\nBRH:4\nLF:6\nLH:5\n") != NULL;
+
+    // MOV A, #1; JNZ $+2; CJNE A, #1, $+3; SJMP $: Branches to the next instruction
+    memset(&proc, 0, sizeof(proc));
+    const uint8_t next[] = {0x74, 0x01, 0x70, 0x00, 0xb4, 0x01, 0x00, 0x80, 0xfe};
+    memcpy(proc.C, next, sizeof(next));
+    mcs51_init(&proc);
+    coverage_reset(&coverage);
+
+    proc._coverage = &coverage;
+    proc._engine = MCS51_ENGINE_COVERAGE;
+    msc51_run(&proc, 12 * 10);
+
+    success &= coverage_test(coverage.branch_taken, 0x02) && !coverage_test(coverage.branch_not_taken, 0x02);
+    success &= !coverage_test(coverage.branch_taken, 0x04) && coverage_test(coverage.branch_not_taken, 0x04);
+
+    return success;
+}
+
+/**
+ *     MOV SP, #0x30
+ * entry:
+ *     MOV DPTR, #0x0100
+ *     MOVX A, @DPTR
+ *     CJNE A, #'F', done
+ *     INC DPTR
+ *     MOVX A, @DPTR
+ *     CJNE A, #'U', done
+ *     LJMP 0xFFF0         ; Beyond the image
+ * done:
+ *     SJMP $
+ */
+TEST(test_fuzz)
+{
+    bool success = true;
+
+    const uint8_t program[] = {0x75, 0x81, 0x30, 0x90, 0x01, 0x00, 0xe0, 0xb4, 0x46, 0x08, 0xa3, 0xe0, 0xb4, 0x55, 0x03,
+                               0x02, 0xff, 0xf0, 0x80, 0xfe};
+    const fuzz_config_t config = {
+            .entry = 0x03,
+            .stop = 0x12,
+            .init_cycles = 100,
+            .budget_cycles = 1000,
+            .input = FUZZ_INPUT_XDATA,
+            .xdata_address = 0x0100,
+            .xdata_length_address = 0x00FE,
+            .max_input = 16,
+    };
+
+    fuzz_t* fuzz = malloc(sizeof(fuzz_t));
+    success &= fuzz_init(fuzz, &config, program, sizeof(program));
+    success &= fuzz->config.sp_max == 0xFF;
+
+    success &= fuzz_run(fuzz, (const uint8_t*) "A", 1) == FUZZ_OK;
+    success &= fuzz_run(fuzz, (const uint8_t*) "FU", 2) == FUZZ_CRASH_PC_OUT_OF_ROM;
+
+    char corpus_dir[] = "/tmp/8051emu-fuzz-XXXXXX";
+    success &= mkdtemp(corpus_dir) != NULL;
+    char crash_dir[64];
+    snprintf(crash_dir, sizeof(crash_dir), "%s/crashes", corpus_dir);
+
+    success &= fuzz_loop(fuzz, corpus_dir, crash_dir, 100000, 1) >= 1;
+    success &= fuzz->corpus_count >= 2; // Initial input and 'F'
+
+    fuzz_free(fuzz);
+
+    // Imported inputs of other workers run once, also the ones without new coverage
+    char sync_dir[] = "/tmp/8051emu-fuzz-sync-XXXXXX";
+    success &= mkdtemp(sync_dir) != NULL;
+    snprintf(crash_dir, sizeof(crash_dir), "%s/crashes", sync_dir);
+    for (char c = 'A'; c <= 'C'; c++)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "%s/id-%c", sync_dir, c);
+        FILE* file = fopen(path, "wb");
+        success &= file != NULL && fputc(c, file) == c && fclose(file) == 0;
+    }
+
+    success &= fuzz_init(fuzz, &config, program, sizeof(program));
+    const uint64_t executions = fuzz->executions;
+    fuzz_loop(fuzz, sync_dir, crash_dir, 0, 1);
+    success &= fuzz->corpus_count == 1 && fuzz->executions == executions + 3;
+    fuzz_loop(fuzz, sync_dir, crash_dir, 0, 1);
+    success &= fuzz->executions == executions + 3;
+
+    fuzz_free(fuzz);
+
+    // ACALL $
+    const uint8_t recursion[] = {0x11, 0x00};
+    const fuzz_config_t recursion_config = {.stop = 0x01, .init_cycles = 100, .budget_cycles = 1000, .input = FUZZ_INPUT_XDATA};
+    success &= fuzz_init(fuzz, &recursion_config, recursion, sizeof(recursion));
+    success &= fuzz_run(fuzz, (const uint8_t*) "A", 1) == FUZZ_CRASH_STACK_OVERFLOW;
+
+    fuzz_free(fuzz);
+    free(fuzz);
+
+    return success;
+}
+
+static int forkserver_test(mcs51_t* p, const uint8_t* request, size_t length, void* ctx)
+{
+    p->X[0x0000] = request[0];
+    msc51_run(p, 12 * 10);
+
+    return p->D[0x30];
+}
+
+/**
+ *     MOV R0, #0x7F
+ * clear:                  ; Reset code, run once by the fork server
+ *     MOV @R0, #0
+ *     DJNZ R0, clear
+ * test:
+ *     MOV DPTR, #0x0000
+ *     MOVX A, @DPTR
+ *     ADD A, #1
+ *     MOV 0x30, A
+ *     SJMP $
+ */
+TEST(test_forkserver)
+{
+    bool success = true;
+
+    static mcs51_t proc;
+    memset(&proc, 0, sizeof(proc));
+    const uint8_t program[] = {0x78, 0x7f, 0x76, 0x00, 0xd8, 0xfc, 0x90, 0x00, 0x00, 0xe0, 0x24, 0x01, 0xf5, 0x30, 0x80, 0xfe};
+    memcpy(proc.C, program, sizeof(program));
+    mcs51_init(&proc);
+
+    int requests[2];
+    int responses[2];
+    success &= pipe(requests) == 0 && pipe(responses) == 0;
+
+    pid_t server = fork();
+    if (server == 0)
+    {
+        close(requests[1]);
+        close(responses[0]);
+        long served = forkserver_run(&proc, 0x06, 1000, requests[0], responses[1], &forkserver_test, NULL);
+        _exit(served == 2 ? 0 : 1);
+    }
+
+    close(requests[0]);
+    close(responses[1]);
+
+    int status = -1;
+    const uint8_t first[] = {5};
+    const uint8_t second[] = {41};
+    success &= forkserver_request(requests[1], responses[0], first, sizeof(first), &status) && status == 6;
+    success &= forkserver_request(requests[1], responses[0], second, sizeof(second), &status) && status == 42;
+
+    close(requests[1]);
+    close(responses[0]);
+
+    int server_status;
+    success &= waitpid(server, &server_status, 0) == server;
+    success &= WIFEXITED(server_status) && WEXITSTATUS(server_status) == 0;
+
+    return success;
+}
+
+static void hle_skip(mcs51_t* p, void* ctx)
+{
+    (void) p;
+    (void) ctx;
+}
+
+TEST(test_lockstep)
+{
+    bool success = true;
+
+    static mcs51_t reference;
+    static mcs51_t candidate;
+    lockstep_t lockstep;
+
+    memset(&reference, 0, sizeof(reference));
+    memcpy(reference.C, s_engine_program, sizeof(s_engine_program));
+    mcs51_init(&reference);
+    candidate = reference;
+
+    success &= lockstep_init(&lockstep, &reference, &candidate, 100);
+    success &= lockstep_run(&lockstep, 20000) && !lockstep.diverged;
+    success &= lockstep.instructions == 20000 && reference.D[0x40] > 10;
+    lockstep_free(&lockstep);
+
+    // Misbehaving candidate: ADD A, #0x07 is replaced by a RET
+    memset(&reference, 0, sizeof(reference));
+    memcpy(reference.C, s_engine_program, sizeof(s_engine_program));
+    mcs51_init(&reference);
+    candidate = reference;
+    success &= hle_add(&candidate, 0x2e, 0, &hle_skip, NULL) >= 0;
+
+    success &= lockstep_init(&lockstep, &reference, &candidate, 100);
+    success &= !lockstep_run(&lockstep, 1000) && lockstep.diverged;
+    success &= lockstep.divergence_instruction == 7 && lockstep.divergence_pc == 0x2e;
+    success &= reference.PC == 0x30 && candidate.PC != 0x30;
+    lockstep_free(&lockstep);
+
+    /**
+     *     MOV TMOD, #0x01  ; Timer 0 mode 1
+     *     SETB TR0
+     *     SJMP $
+     */
+    const uint8_t timer_program[] = {0x75, 0x89, 0x01, 0xd2, 0x8c, 0x80, 0xfe};
+    memset(&reference, 0, sizeof(reference));
+    memcpy(reference.C, timer_program, sizeof(timer_program));
+    mcs51_init(&reference);
+    candidate = reference;
+
+    // A diverging timer count is detected although the firmware never reads it
+    success &= lockstep_init(&lockstep, &reference, &candidate, 100);
+    success &= lockstep_run(&lockstep, 2);
+    candidate._timers[0].start_count++;
+    success &= !lockstep_run(&lockstep, 1000) && lockstep.diverged;
+    success &= lockstep.divergence_instruction == 2 && lockstep.divergence_pc == 0x05;
+    lockstep_free(&lockstep);
+
+    return success;
+}
+
+TEST(test_conformance)
+{
+    conformance_case_t a;
+    conformance_case_t b;
+
+    // Cases are reproducible from their index
+    conformance_generate(42, 1234, 16, &a);
+    conformance_generate(42, 1234, 16, &b);
+
+    conformance_config_t config = {
+            .seed = 42,
+            .cases = 20000,
+            .max_instructions = 16,
+            .engines = CONFORMANCE_ENGINES_ALL,
+            .workers = 2,
+            .report = stdout,
+    };
+    conformance_result_t result = conformance_run(&config);
+
+    return memcmp(&a, &b, sizeof(a)) == 0
+           && result.cases == 20000
+           && result.instructions > 100000
+           && result.failures == 0
+           && !result.error;
+}
+
+/**
+ *     LJMP main
+ * .ORG 000Bh
+ *     INC 0x30
+ *     RETI
+ * .ORG 0020h
+ * main:
+ *     MOV TMOD, #0x01
+ *     SETB ET0
+ *     SETB EA
+ *     SETB TR0
+ * loop:
+ *     ORL PCON, #0x01  ; IDLE until the timer 0 interrupt
+ *     INC 0x31
+ *     SJMP loop
+ */
+TEST(test_power_modes)
+{
+    bool success = true;
+
+    static mcs51_t phase;
+    static mcs51_t fast;
+
+    memset(&phase, 0, sizeof(phase));
+    const uint8_t idle[] = {0x02, 0x00, 0x20, [0x0b] = 0x05, 0x30, 0x32,
+                            [0x20] = 0x75, 0x89, 0x01, 0xd2, 0xa9, 0xd2, 0xaf, 0xd2, 0x8c,
+                            0x43, 0x87, 0x01, 0x05, 0x31, 0x80, 0xf9};
+    memcpy(phase.C, idle, sizeof(idle));
+    mcs51_init(&phase);
+    fast = phase;
+
+    // The sleeping cycles are skipped by the interpreter cores
+    while (phase._osc_periods < 12 * 300000 || phase._instruction_register.opcode.cycles != 0)
+        msc51_do_machine_cycle(&phase);
+
+    msc51_run(&fast, phase._osc_periods);
+
+    success &= fast._osc_periods == phase._osc_periods && fast.PC == phase.PC;
+    success &= memcmp(fast.D, phase.D, sizeof(fast.D)) == 0;
+    success &= fast.D[0x30] == 4 && fast.D[0x31] == 4;
+
+    /**
+     *     LJMP main
+     * .ORG 0003h
+     *     INC 0x32
+     *     RETI
+     * .ORG 0020h
+     * main:
+     *     SETB EX0
+     *     SETB EA
+     *     ORL PCON, #0x02  ; Power-down until INT0
+     *     MOV 0x33, #0x01
+     *     SJMP $
+     */
+    memset(&fast, 0, sizeof(fast));
+    const uint8_t power_down[] = {0x02, 0x00, 0x20, 0x05, 0x32, 0x32,
+                                  [0x20] = 0xd2, 0xa8, 0xd2, 0xaf, 0x43, 0x87, 0x02, 0x75, 0x33, 0x01, 0x80, 0xfe};
+    memcpy(fast.C, power_down, sizeof(power_down));
+    mcs51_init(&fast);
+
+    msc51_run(&fast, 12 * 10000000);
+    success &= fast.PC == 0x27 && fast.D[0x33] == 0 && (fast.D[SFR_PCON] & SFR_PCON_PD_Msk);
+
+    // A timer interrupt does not end power-down (the oscillator is stopped), it stays pending
+    mcs51_write_direct(&fast, SFR_IE, fast.D[SFR_IE] | SFR_IE_ET0_Msk);
+    mcs51_write_direct(&fast, SFR_TCON, fast.D[SFR_TCON] | SFR_TCON_TF0_Msk);
+    msc51_run(&fast, 12 * 100);
+    success &= fast.PC == 0x27 && (fast.D[SFR_TCON] & SFR_TCON_TF0_Msk) && (fast.D[SFR_PCON] & SFR_PCON_PD_Msk);
+    mcs51_write_direct(&fast, SFR_IE, fast.D[SFR_IE] & ~SFR_IE_ET0_Msk);
+
+    // Host-injected wake-up
+    mcs51_write_direct(&fast, SFR_TCON, fast.D[SFR_TCON] | SFR_TCON_IE0_Msk);
+    msc51_run(&fast, 12 * 100);
+    success &= fast.D[0x32] == 1 && fast.D[0x33] == 1 && !(fast.D[SFR_PCON] & SFR_PCON_PD_Msk);
+
+    return success;
+}
+
+typedef struct test_scheduler_ctx_t {
+    int handle;
+    int events;
+    uint64_t last_due;
+} test_scheduler_ctx_t;
+
+/// Host-scheduled pin change: An INT0 edge every 777 machine cycles
+static void test_scheduler_int0(mcs51_t* p, uint64_t due, void* ctx)
+{
+    test_scheduler_ctx_t* c = ctx;
+    c->events++;
+    c->last_due = due;
+
+    p->D[SFR_TCON] |= SFR_TCON_IE0_Msk;
+    scheduler_arm(p, c->handle, due + 12 * 777);
+}
+
+static int s_scheduler_order;
+
+static void test_scheduler_order(mcs51_t* p, uint64_t due, void* ctx)
+{
+    test_scheduler_ctx_t* c = ctx;
+    s_scheduler_order = s_scheduler_order * 10 + c->handle;
+}
+
+TEST(test_scheduler)
+{
+    bool success = true;
+
+    static mcs51_t phase;
+    static mcs51_t fast;
+
+    /**
+     *     LJMP main
+     * .ORG 0003h
+     *     INC 0x32
+     *     MOV 0x34, TL0
+     *     RETI
+     * .ORG 0020h
+     * main:
+     *     MOV TMOD, #0x01
+     *     SETB TR0
+     *     SETB EX0
+     *     SETB EA
+     *     SJMP $
+     */
+    memset(&phase, 0, sizeof(phase));
+    const uint8_t program[] = {0x02, 0x00, 0x20, 0x05, 0x32, 0x85, 0x8a, 0x34, 0x32,
+                               [0x20] = 0x75, 0x89, 0x01, 0xd2, 0x8c, 0xd2, 0xa8, 0xd2, 0xaf, 0x80, 0xfe};
+    memcpy(phase.C, program, sizeof(program));
+    mcs51_init(&phase);
+    fast = phase;
+
+    test_scheduler_ctx_t phase_ctx = {};
+    test_scheduler_ctx_t fast_ctx = {};
+
+    phase_ctx.handle = scheduler_add(&phase, &test_scheduler_int0, &phase_ctx);
+    fast_ctx.handle = scheduler_add(&fast, &test_scheduler_int0, &fast_ctx);
+    scheduler_arm(&phase, phase_ctx.handle, 12 * 1000 + 11);
+    scheduler_arm(&fast, fast_ctx.handle, 12 * 1000 + 11);
+
+    while (phase._osc_periods < 12 * 5000 || phase._instruction_register.opcode.cycles != 0)
+        msc51_do_machine_cycle(&phase);
+
+    msc51_run(&fast, phase._osc_periods);
+
+    mcs51_sync_timers(&phase);
+    mcs51_sync_timers(&fast);
+
+    success &= fast._osc_periods == phase._osc_periods && fast.PC == phase.PC;
+    success &= memcmp(fast.D, phase.D, sizeof(fast.D)) == 0;
+    success &= fast_ctx.events == 6 && phase_ctx.events == 6 && fast_ctx.last_due == 12 * 4885 + 11;
+    success &= fast.D[0x32] == 6 && (fast.D[SFR_TH0] << 8 | fast.D[SFR_TL0]) == phase._osc_periods / 12 - 4;
+
+    // Events run in the order of their due, ties in the order of their handles
+    memset(&fast, 0, sizeof(fast));
+    fast.C[0] = 0x80;
+    fast.C[1] = 0xfe;
+    mcs51_init(&fast);
+
+    test_scheduler_ctx_t order[3] = {};
+    for (int i = 0; i < 3; i++)
+        order[i].handle = scheduler_add(&fast, &test_scheduler_order, &order[i]);
+
+    scheduler_arm(&fast, order[2].handle, 12 * 10);
+    scheduler_arm(&fast, order[1].handle, 12 * 20);
+    scheduler_arm(&fast, order[0].handle, 12 * 5);
+    scheduler_arm(&fast, order[1].handle, 12 * 10);
+    scheduler_cancel(&fast, order[0].handle);
+    success &= fast._scheduler.next_due == 12 * 10;
+
+    s_scheduler_order = 0;
+    msc51_run(&fast, 12 * 30);
+    success &= s_scheduler_order == (order[1].handle * 10 + order[2].handle) && fast._scheduler.next_due == UINT64_MAX;
+
+    return success;
+}
+
+TEST(test_watchdog)
+{
+    bool success = true;
+
+    static mcs51_t phase;
+    static mcs51_t fast;
+
+    /**
+     *     INC 0x30           ; Boot counter
+     *     MOV WDTPRG, #0x00  ; 2^14 - 1 machine cycles
+     *     MOV WDTRST, #0x1E
+     *     MOV WDTRST, #0xE1
+     *     MOV R7, #0x08
+     * service:
+     *     DJNZ R6, $
+     *     MOV WDTRST, #0x1E
+     *     MOV WDTRST, #0xE1
+     *     DJNZ R7, service
+     *     SJMP $             ; Starve the watchdog
+     */
+    memset(&phase, 0, sizeof(phase));
+    const uint8_t program[] = {0x05, 0x30, 0x75, 0xa7, 0x00, 0x75, 0xa6, 0x1e, 0x75, 0xa6, 0xe1, 0x7f, 0x08,
+                               0xde, 0xfe, 0x75, 0xa6, 0x1e, 0x75, 0xa6, 0xe1, 0xdf, 0xf6, 0x80, 0xfe};
+    memcpy(phase.C, program, sizeof(program));
+    mcs51_init(&phase);
+    fast = phase;
+
+    while (phase._osc_periods < 12 * 50000 || phase._instruction_register.opcode.cycles != 0)
+        msc51_do_machine_cycle(&phase);
+
+    msc51_run(&fast, phase._osc_periods);
+
+    success &= fast._osc_periods == phase._osc_periods && fast.PC == phase.PC;
+    success &= memcmp(fast.D, phase.D, sizeof(fast.D)) == 0;
+    success &= fast._watchdog.expiries == 2 && phase._watchdog.expiries == 2 && fast._watchdog.last_expiry == phase._watchdog.last_expiry;
+    success &= fast.D[0x30] == 3;
+
+    /**
+     *     MOV WDTRST, #0x1E
+     *     MOV WDTRST, #0xE1
+     *     ORL PCON, #0x02  ; Power-down
+     *     SJMP $
+     */
+    memset(&fast, 0, sizeof(fast));
+    const uint8_t power_down[] = {0x75, 0xa6, 0x1e, 0x75, 0xa6, 0xe1, 0x43, 0x87, 0x02, 0x80, 0xfe};
+    memcpy(fast.C, power_down, sizeof(power_down));
+    mcs51_init(&fast);
+    fast._watchdog.reset_on_expiry = false;
+
+    // The watchdog stops with the oscillator
+    msc51_run(&fast, 12 * 1000000);
+    uint64_t remaining = watchdog_remaining_cycles(&fast);
+    success &= fast._watchdog.expiries == 0 && remaining == watchdog_timeout_cycles(&fast) - 2;
+
+    // Without a reset on expiry, it expires once per time-out
+    mcs51_write_direct(&fast, SFR_PCON, fast.D[SFR_PCON] & ~SFR_PCON_PD_Msk);
+    uint64_t resumed = fast._osc_periods;
+    msc51_run(&fast, 12 * (remaining + 2 * watchdog_timeout_cycles(&fast)));
+    success &= fast._watchdog.expiries == 3 && fast._watchdog.last_expiry == resumed + 12 * (remaining - 1 + 2 * watchdog_timeout_cycles(&fast)) + 11;
+    success &= fast.PC == 0x09;
+
+    /**
+     *     INC 0x30           ; Boot counter
+     *     MOV A, 0x30
+     *     CJNE A, #1, halt
+     *     MOV IE, #0x82      ; EA, ET0
+     *     MOV PSW, #0x18     ; Register bank 3
+     *     MOV P1, #0x00
+     *     MOV WDTRST, #0x1E
+     *     MOV WDTRST, #0xE1
+     *     SJMP $             ; Starve the watchdog
+     * halt:
+     *     SJMP $
+     */
+    memset(&fast, 0, sizeof(fast));
+    const uint8_t reinit[] = {0x05, 0x30, 0xe5, 0x30, 0xb4, 0x01, 0x11, 0x75, 0xa8, 0x82, 0x75, 0xd0, 0x18, 0x75,
+                              0x90, 0x00, 0x75, 0xa6, 0x1e, 0x75, 0xa6, 0xe1, 0x80, 0xfe, 0x80, 0xfe};
+    memcpy(fast.C, reinit, sizeof(reinit));
+    mcs51_init(&fast);
+
+    // The reset restores IE, PSW and the ports, the second boot does not initialize them
+    msc51_run(&fast, 12 * 20000);
+    mcs51_sync_psw(&fast);
+    success &= fast._watchdog.expiries == 1 && fast.D[0x30] == 2 && fast.PC == 0x18;
+    success &= fast.D[SFR_IE] == 0x00 && fast.D[SFR_P1] == 0xFF;
+    success &= (fast.D[SFR_PSW] & (SFR_PSW_RS1_Msk | SFR_PSW_RS0_Msk)) == 0 && fast._register_bank == 0x00;
+
+    /**
+     *     INC 0x30           ; Boot counter
+     *     MOV WDTPRG, #0x00
+     *     MOV WDTRST, #0x1E
+     *     MOV WDTRST, #0xE1
+     *     JNB TI, $          ; Fused busy wait, the reset hits between two JNB
+     */
+    memset(&phase, 0, sizeof(phase));
+    const uint8_t busy_wait[] = {0x05, 0x30, 0x75, 0xa7, 0x00, 0x75, 0xa6, 0x1e, 0x75, 0xa6, 0xe1, 0x30, 0x99, 0xfd};
+    memcpy(phase.C, busy_wait, sizeof(busy_wait));
+    mcs51_init(&phase);
+    fast = phase;
+
+    while (phase._osc_periods < 12 * 40000 || phase._instruction_register.opcode.cycles != 0)
+        msc51_do_machine_cycle(&phase);
+
+    msc51_run(&fast, phase._osc_periods);
+
+    success &= fast._osc_periods == phase._osc_periods && fast.PC == phase.PC;
+    success &= memcmp(fast.D, phase.D, sizeof(fast.D)) == 0;
+    success &= fast._watchdog.expiries == 2 && fast.D[0x30] == 3;
+
+    return success;
+}
+
+TEST(test_clock_modes)
+{
+    bool success = true;
+
+    static mcs51_t proc;
+
+    // SJMP $
+    memset(&proc, 0, sizeof(proc));
+    proc.C[0] = 0x80;
+    proc.C[1] = 0xfe;
+    mcs51_init(&proc);
+    mcs51_set_osc_frequency(&proc, 12000000);
+
+    // 12-clock mode: One machine cycle per microsecond
+    for (int i = 0; i < 12 * 100; i++)
+        msc51_do_osc_period(&proc);
+    success &= msc51_execution_time_ns(&proc) == 100000;
+
+    // X2 mode: Two machine cycles per microsecond
+    mcs51_write_direct(&proc, SFR_CKCON0, SFR_CKCON0_X2_Msk);
+    for (int i = 0; i < 12 * 100; i++)
+        msc51_do_osc_period(&proc);
+    success &= msc51_execution_time_ns(&proc) == 150000 && proc._timebase.start_periods == 12 * 100;
+
+    // Frequency change at runtime
+    mcs51_set_osc_frequency(&proc, 24000000);
+    for (int i = 0; i < 12 * 100; i++)
+        msc51_do_osc_period(&proc);
+    success &= msc51_execution_time_ns(&proc) == 175000;
+
+    // Timers keep counting machine cycles in X2 mode, T0X2 selects the standard peripheral clock
+    mcs51_write_direct(&proc, SFR_TMOD, 0x01);
+    mcs51_write_direct(&proc, SFR_TCON, SFR_TCON_TR0_Msk);
+    for (int i = 0; i < 12 * 100; i++)
+        msc51_do_osc_period(&proc);
+    mcs51_write_direct(&proc, SFR_CKCON0, SFR_CKCON0_X2_Msk | SFR_CKCON0_T0X2_Msk);
+    for (int i = 0; i < 12 * 100; i++)
+        msc51_do_osc_period(&proc);
+    mcs51_sync_timers(&proc);
+    success &= proc.D[SFR_TH0] == 0 && proc.D[SFR_TL0] == 150;
+
+    // Back to the 12-clock mode
+    mcs51_write_direct(&proc, SFR_CKCON0, 0x00);
+    for (int i = 0; i < 12 * 100; i++)
+        msc51_do_osc_period(&proc);
+    success &= msc51_execution_time_ns(&proc) == 175000 + 2 * 25000 + 50000;
+
+    // Pacing against emulated time, following the clock changes of the firmware
+    msc51_run_until_ns(&proc, 1000000);
+    uint64_t ns = msc51_execution_time_ns(&proc);
+    success &= ns >= 1000000 && ns < 1000000 + 2000;
+
+    // No drift over many segments: 11.0592 MHz does not divide 10^9
+    memset(&proc, 0, sizeof(proc));
+    proc.C[0] = 0x80;
+    proc.C[1] = 0xfe;
+    mcs51_init(&proc);
+    for (int i = 0; i < 10000; i++)
+    {
+        msc51_run(&proc, 12 * 7);
+        mcs51_set_osc_frequency(&proc, 11059200);
+    }
+    timebase_t reference;
+    timebase_init(&reference, 11059200);
+    success &= msc51_execution_time_ns(&proc) == timebase_ns(&reference, proc._osc_periods);
+    success &= timebase_ns(&reference, timebase_periods(&reference, 123456789)) >= 123456789;
+    success &= timebase_ns(&reference, timebase_periods(&reference, 123456789) - 1) < 123456789;
+
+    return success;
+}
+
+static char s_variant_tx[8];
+static unsigned int s_variant_tx_count;
+
+static void test_variant_on_serial_tx(char c)
+{
+    if (s_variant_tx_count < sizeof(s_variant_tx))
+        s_variant_tx[s_variant_tx_count] = c;
+    s_variant_tx_count++;
+}
+
+/// Run a program on the phase engine and on the fast cores, true if both end in the same state
+static bool test_variant_run(mcs51_t* phase, mcs51_t* fast, mcs51_variant_t variant, const uint8_t* program, size_t size, uint64_t cycles)
+{
+    memset(phase, 0, sizeof(*phase));
+    memcpy(phase->C, program, size);
+    mcs51_init_variant(phase, variant);
+    phase->_on_serial_tx = &test_variant_on_serial_tx;
+    *fast = *phase;
+
+    while (phase->_osc_periods < 12 * cycles || phase->_instruction_register.opcode.cycles != 0)
+        msc51_do_machine_cycle(phase);
+
+    msc51_run(fast, phase->_osc_periods);
+    mcs51_sync_timers(phase);
+    mcs51_sync_timers(fast);
+
+    return fast->_osc_periods == phase->_osc_periods && fast->PC == phase->PC && memcmp(fast->D, phase->D, sizeof(fast->D)) == 0;
+}
+
+TEST(test_variants)
+{
+    bool success = true;
+
+    static mcs51_t phase;
+    static mcs51_t fast;
+
+    /**
+     *     MOV R0, #0x90
+     *     MOV @R0, #0x5A  ; Upper IDATA, 8052 and later
+     *     MOV 0x90, #0xA5 ; P1
+     *     SJMP $
+     */
+    const uint8_t idata[] = {0x78, 0x90, 0x76, 0x5a, 0x75, 0x90, 0xa5, 0x80, 0xfe};
+    success &= test_variant_run(&phase, &fast, MCS51_VARIANT_8051, idata, sizeof(idata), 10);
+    success &= fast.D[0x110] == 0x00 && fast.D[SFR_P1] == 0xA5;
+    success &= fast.sfr_map[SFR_T2CON].name == 0 && fast.sfr_map[SFR_WDTRST].name == 0;
+    success &= test_variant_run(&phase, &fast, MCS51_VARIANT_8052, idata, sizeof(idata), 10);
+    success &= fast.D[0x110] == 0x5A && fast.D[SFR_P1] == 0xA5;
+    success &= strcmp(fast.sfr_map[SFR_T2CON].name, "T2CON") == 0 && fast.sfr_map[SFR_WDTRST].name == 0;
+
+    /**
+     *     LJMP main
+     * .org 0x2B            ; Timer 2
+     *     INC 0x30
+     *     CLR TF2
+     *     RETI
+     * .org 0x40
+     * main:
+     *     MOV RCAP2H, #0xFF
+     *     MOV RCAP2L, #0x00 ; Overflow every 256 machine cycles
+     *     MOV TH2, #0xFF
+     *     MOV TL2, #0x00
+     *     MOV IE, #0xA0     ; EA, ET2
+     *     SETB TR2
+     *     SJMP $
+     */
+    uint8_t timer_2[0x60] = {0x02, 0x00, 0x40};
+    const uint8_t timer_2_isr[] = {0x05, 0x30, 0xc2, 0xcf, 0x32};
+    const uint8_t timer_2_main[] = {0x75, 0xcb, 0xff, 0x75, 0xca, 0x00, 0x75, 0xcd, 0xff, 0x75, 0xcc, 0x00, 0x75, 0xa8, 0xa0, 0xd2, 0xca, 0x80, 0xfe};
+    memcpy(&timer_2[0x2B], timer_2_isr, sizeof(timer_2_isr));
+    memcpy(&timer_2[0x40], timer_2_main, sizeof(timer_2_main));
+    success &= test_variant_run(&phase, &fast, MCS51_VARIANT_8052, timer_2, sizeof(timer_2), 256 * 10 + 100);
+    success &= fast.D[0x30] == 10;
+    success &= test_variant_run(&phase, &fast, MCS51_VARIANT_8051, timer_2, sizeof(timer_2), 256 * 10 + 100);
+    success &= fast.D[0x30] == 0;
+
+    /**
+     *     MOV DPTR, #0x1234
+     *     INC AUXR1         ; DPS = 1
+     *     MOV DPTR, #0x5678
+     *     INC AUXR1         ; DPS = 0
+     *     MOV 0x30, DPL
+     *     INC AUXR1         ; DPS = 1
+     *     MOV 0x31, DPL
+     *     INC AUXR1         ; Bit 2 is stuck at 0, DPS = 0
+     *     INC AUXR1         ; DPS = 1
+     *     MOV 0x32, DPL
+     *     SJMP $
+     */
+    const uint8_t dual_dptr[] = {0x90, 0x12, 0x34, 0x05, 0xa2, 0x90, 0x56, 0x78, 0x05, 0xa2, 0x85, 0x82, 0x30, 0x05, 0xa2,
+                                 0x85, 0x82, 0x31, 0x05, 0xa2, 0x05, 0xa2, 0x85, 0x82, 0x32, 0x80, 0xfe};
+    success &= test_variant_run(&phase, &fast, MCS51_VARIANT_AT89C51RD2, dual_dptr, sizeof(dual_dptr), 30);
+    success &= fast.D[0x30] == 0x34 && fast.D[0x31] == 0x78 && fast.D[0x32] == 0x78 && fast.D[SFR_AUXR1] == 0x01;
+    success &= fast._dptr_inactive[0] == 0x34 && fast._dptr_inactive[1] == 0x12;
+
+    /**
+     *     LJMP main
+     * .org 0x03            ; INT0
+     *     LJMP isr_int0
+     * .org 0x0B            ; Timer 0
+     *     LJMP isr_timer_0
+     * .org 0x40
+     * main:
+     *     MOV IPH, #0x02    ; Timer 0: Level 2
+     *     MOV IP, #0x01     ; INT0: Level 1
+     *     MOV R0, #0x30
+     *     MOV IE, #0x83     ; EA, ET0, EX0
+     *     MOV TCON, #0x22   ; TF0, IE0
+     *     SJMP $
+     * isr_int0:
+     *     MOV @R0, #0x01
+     *     INC R0
+     *     RETI
+     * isr_timer_0:
+     *     MOV @R0, #0x02
+     *     INC R0
+     *     RETI
+     */
+    uint8_t priorities[0x60] = {0x02, 0x00, 0x40, 0x02, 0x00, 0x50};
+    const uint8_t priorities_timer_0[] = {0x02, 0x00, 0x54};
+    const uint8_t priorities_main[] = {0x75, 0xb7, 0x02, 0x75, 0xb8, 0x01, 0x78, 0x30, 0x75, 0xa8, 0x83, 0x75, 0x88, 0x22, 0x80, 0xfe,
+                                       0x76, 0x01, 0x08, 0x32, 0x76, 0x02, 0x08, 0x32};
+    memcpy(&priorities[0x0B], priorities_timer_0, sizeof(priorities_timer_0));
+    memcpy(&priorities[0x40], priorities_main, sizeof(priorities_main));
+    success &= test_variant_run(&phase, &fast, MCS51_VARIANT_AT89C51RD2, priorities, sizeof(priorities), 50);
+    success &= fast.D[0x30] == 0x02 && fast.D[0x31] == 0x01;
+    success &= test_variant_run(&phase, &fast, MCS51_VARIANT_8052, priorities, sizeof(priorities), 50);
+    success &= fast.D[0x30] == 0x01 && fast.D[0x31] == 0x02;
+
+    /**
+     *     MOV SCON, #0x40    ; Mode 1
+     *     MOV BRL, #0xFD
+     *     MOV BDRCON, #0x1E  ; BRR, TBCK, RBCK, SPD
+     *     MOV SBUF, #'A'
+     *     JNB TI, $
+     *     SJMP $
+     */
+    const uint8_t brg[] = {0x75, 0x98, 0x40, 0x75, 0x9a, 0xfd, 0x75, 0x9b, 0x1e, 0x75, 0x99, 0x41, 0x30, 0x99, 0xfd, 0x80, 0xfe};
+    s_variant_tx_count = 0;
+    success &= test_variant_run(&phase, &fast, MCS51_VARIANT_AT89C51RD2, brg, sizeof(brg), 20);
+    success &= s_variant_tx_count == 2 && s_variant_tx[0] == 'A' && s_variant_tx[1] == 'A';
+    success &= fast.PC == 0x0F && fast._serial_tx_clock == MCS51_SERIAL_CLOCK_BRG;
+
+    /**
+     *     MOV SCON, #0x40    ; Mode 1
+     *     MOV RCAP2H, #0xFF
+     *     MOV RCAP2L, #0xFD
+     *     MOV TH2, #0xFF
+     *     MOV TL2, #0xFD
+     *     MOV T2CON, #0x34   ; RCLK, TCLK, TR2
+     *     MOV SBUF, #'B'
+     *     JNB TI, $
+     *     SJMP $
+     */
+    const uint8_t timer_2_baud[] = {0x75, 0x98, 0x40, 0x75, 0xcb, 0xff, 0x75, 0xca, 0xfd, 0x75, 0xcd, 0xff, 0x75, 0xcc, 0xfd, 0x75, 0xc8, 0x34, 0x75, 0x99, 0x42, 0x30, 0x99, 0xfd, 0x80, 0xfe};
+    s_variant_tx_count = 0;
+    success &= test_variant_run(&phase, &fast, MCS51_VARIANT_8052, timer_2_baud, sizeof(timer_2_baud), 20);
+    success &= s_variant_tx_count == 2 && s_variant_tx[0] == 'B' && s_variant_tx[1] == 'B';
+    success &= fast.PC == 0x18 && (fast.D[SFR_T2CON] & SFR_T2CON_TF2_Msk) == 0;
+
+    return success;
+}
+
+typedef struct test_network_log_t {
+    uint8_t bytes[8];
+    uint64_t ns[8];
+    unsigned int count;
+} test_network_log_t;
+
+static void test_network_on_serial_tx(network_t* network, unsigned int node, uint8_t byte, uint64_t ns)
+{
+    test_network_log_t* log = network->ctx;
+    if (log->count < 8)
+    {
+        log->bytes[log->count] = byte;
+        log->ns[log->count] = ns;
+    }
+    log->count++;
+}
+
+TEST(test_network)
+{
+    bool success = true;
+
+    static mcs51_t mcus[3][3];
+    test_network_log_t logs[3] = {};
+
+    /**
+     *     MOV P1, #0x5A
+     *     MOV SCON, #0x40  ; Mode 1
+     *     MOV TMOD, #0x20  ; Timer 1 mode 2
+     *     MOV TH1, #0xFD
+     *     MOV TL1, #0xFD
+     *     SETB TR1
+     *     MOV SBUF, #'H'
+     *     JNB TI, $
+     *     CLR TI
+     *     MOV SBUF, #'I'
+     *     JNB TI, $
+     *     SJMP $
+     */
+    const uint8_t sender[] = {0x75, 0x90, 0x5a, 0x75, 0x98, 0x40, 0x75, 0x89, 0x20, 0x75, 0x8d, 0xfd, 0x75, 0x8b, 0xfd, 0xd2, 0x8e,
+                              0x75, 0x99, 0x48, 0x30, 0x99, 0xfd, 0xc2, 0x99, 0x75, 0x99, 0x49, 0x30, 0x99, 0xfd, 0x80, 0xfe};
+
+    /**
+     *     MOV SCON, #0x50  ; Mode 1, REN
+     *     MOV R0, #0x30
+     * loop:
+     *     JNB RI, $
+     *     CLR RI
+     *     MOV @R0, SBUF
+     *     INC R0
+     *     SJMP loop
+     */
+    const uint8_t receiver[] = {0x75, 0x98, 0x50, 0x78, 0x30, 0x30, 0x98, 0xfd, 0xc2, 0x98, 0xa6, 0x99, 0x08, 0x80, 0xf6};
+
+    // The same network on 0, 1 and 3 worker threads
+    const unsigned int workers[3] = {0, 1, 3};
+    for (unsigned int run = 0; run < 3; run++)
+    {
+        mcs51_t* a = &mcus[run][0];
+        mcs51_t* b = &mcus[run][1];
+        mcs51_t* c = &mcus[run][2];
+
+        memset(a, 0, sizeof(mcs51_t));
+        memcpy(a->C, sender, sizeof(sender));
+        mcs51_init(a);
+
+        memset(b, 0, sizeof(mcs51_t));
+        memcpy(b->C, receiver, sizeof(receiver));
+        mcs51_init(b);
+
+        // 8052 at a different frequency
+        memset(c, 0, sizeof(mcs51_t));
+        memcpy(c->C, receiver, sizeof(receiver));
+        mcs51_init_variant(c, MCS51_VARIANT_8052);
+        mcs51_set_osc_frequency(c, 24000000);
+        c->_engine = MCS51_ENGINE_TRACE;
+
+        network_t network;
+        network_init(&network);
+        network.on_serial_tx = &test_network_on_serial_tx;
+        network.ctx = &logs[run];
+
+        success &= network_add_mcu(&network, a) == 0 && network_add_mcu(&network, b) == 1 && network_add_mcu(&network, c) == 2;
+        success &= network_connect_serial(&network, 0, 1, 1000000000 / 960) >= 0; // One character at 9600 baud
+        success &= network_connect_serial(&network, 0, 2, 2 * 1000000000 / 960) >= 0;
+        success &= network_connect_pins(&network, 0, SFR_P1, 2, SFR_P2, 0x0F, 2000000) >= 0;
+
+        network_run(&network, 5000000, workers[run]);
+
+        success &= network.time_ns == 5000000 && network.windows == 5;
+        success &= b->D[0x30] == 'H' && b->D[0x31] == 'I' && b->D[0x32] == 0x00 && network.nodes[1].rx_bytes == 2;
+        success &= c->D[0x30] == 'H' && c->D[0x31] == 'I' && network.nodes[2].rx_bytes == 2;
+        success &= c->D[SFR_P2] == 0xFA; // The upper pins keep their reset level
+        network_free(&network);
+    }
+
+    // Deterministic regardless of the thread count
+    for (unsigned int run = 1; run < 3; run++)
+    {
+        for (unsigned int i = 0; i < 3; i++)
+            success &= lockstep_hash(&mcus[run][i]) == lockstep_hash(&mcus[0][i]);
+
+        success &= logs[run].count == 2 && memcmp(&logs[run], &logs[0], sizeof(test_network_log_t)) == 0;
+    }
+
+    success &= logs[0].bytes[0] == 'H' && logs[0].bytes[1] == 'I' && logs[0].ns[0] < logs[0].ns[1];
+
+    // A byte is lost while RI is set
+    success &= mcs51_serial_rx(&mcus[0][1], 'X') && !mcs51_serial_rx(&mcus[0][1], 'Y');
+    success &= mcus[0][1].D[SFR_SBUF] == 'X';
+
+    return success;
+}
+
+TEST(test_control_flow_graph)
+{
+    bool success = true;
+
+    static mcs51_t proc;
+    static cfg_t cfg;
+
+    /**
+     *     LJMP main
+     * .org 0x03 ... 0x2B   ; RETI at every interrupt vector
+     * .org 0x40
+     * main:
+     *     LCALL check
+     *     MOV R7, #3
+     *     DJNZ R7, $
+     *     MOV DPTR, #table
+     *     CLR A
+     *     JMP @A+DPTR
+     * .org 0x60
+     * check:
+     *     JZ invalid
+     *     RET
+     * invalid:
+     *     .db 0xA5          ; Reserved opcode
+     * .org 0x70
+     * table:
+     *     AJMP first
+     *     AJMP second
+     * .org 0x80
+     * first:
+     *     SJMP $
+     * .org 0x90
+     * second:
+     *     SJMP $
+     */
+    uint8_t program[0xA0] = {0x02, 0x00, 0x40};
+    const uint8_t main[] = {0x12, 0x00, 0x60, 0x7f, 0x03, 0xdf, 0xfe, 0x90, 0x00, 0x70, 0xe4, 0x73};
+    const uint8_t check[] = {0x60, 0x01, 0x22, 0xa5};
+    const uint8_t table[] = {0x01, 0x80, 0x01, 0x90};
+    for (uint8_t vector = 0x03; vector <= 0x2B; vector += 8)
+        program[vector] = 0x32;
+    memcpy(&program[0x40], main, sizeof(main));
+    memcpy(&program[0x60], check, sizeof(check));
+    memcpy(&program[0x70], table, sizeof(table));
+    program[0x80] = program[0x90] = 0x80;
+    program[0x81] = program[0x91] = 0xfe;
+
+    memset(&proc, 0, sizeof(proc));
+    memcpy(proc.C, program, sizeof(program));
+    mcs51_init(&proc);
+
+    success &= cfg_build(&cfg, &proc, NULL, 0);
+    success &= cfg.block_count == 18 && cfg.function_count == 8;
+    success &= cfg.unimplemented_count == 1 && cfg.unimplemented[0] == 0x63 && cfg.unresolved_count == 0;
+    success &= cfg.functions[0].kind == CFG_FUNCTION_RESET && cfg.functions[0].block_count == 9;
+    success &= cfg.functions[6].kind == CFG_FUNCTION_INTERRUPT && cfg.functions[6].entry == 0x2B;
+    success &= cfg.functions[7].kind == CFG_FUNCTION_CALL && cfg.functions[7].entry == 0x60 && cfg.functions[7].block_count == 3;
+
+    const int32_t dispatch = cfg_block_at(&cfg, 0x4A);
+    success &= dispatch >= 0 && cfg.blocks[dispatch].start == 0x47 && cfg.blocks[dispatch].exit == CFG_EXIT_TABLE;
+    success &= dispatch >= 0 && cfg.blocks[dispatch].cycles == 5 && cfg.blocks[dispatch].edge_count == 2;
+    success &= dispatch >= 0 && cfg.blocks[cfg.edges[cfg.blocks[dispatch].first_edge + 1].to].start == 0x72;
+    success &= cfg.blocks[cfg_block_at(&cfg, 0x62)].function == 7 && cfg.blocks[cfg_block_at(&cfg, 0x72)].function == 0;
+    success &= cfg_block_at(&cfg, 0x50) == -1;
+
+    char text[32];
+    cfg_format_instruction(&proc, 0x47, text, sizeof(text));
+    success &= strcmp(text, "MOV DPTR, #0x0070") == 0;
+    cfg_format_instruction(&proc, 0x45, text, sizeof(text));
+    success &= strcmp(text, "DJNZ R7, 0x0045") == 0;
+    cfg_format_instruction(&proc, 0x70, text, sizeof(text));
+    success &= strcmp(text, "AJMP 0x0080") == 0;
+    cfg_free(&cfg);
+
+    // Without Timer 2, its vector is unreachable data
+    memset(&proc, 0, sizeof(proc));
+    memcpy(proc.C, program, sizeof(program));
+    mcs51_init_variant(&proc, MCS51_VARIANT_8051);
+
+    success &= cfg_build(&cfg, &proc, NULL, 0);
+    success &= cfg.block_count == 17 && cfg.function_count == 7 && cfg_block_at(&cfg, 0x2B) == -1;
+    cfg_free(&cfg);
+
+    /**
+     *     MOV DPTR, #table
+     *     MOV DPL, #0x20   ; DPTR is no longer the immediate
+     *     JMP @A+DPTR
+     * .org 0x10
+     * table:
+     *     LJMP 0x0030
+     *     LJMP 0x0030
+     */
+    memset(&proc, 0, sizeof(proc));
+    const uint8_t overwritten[] = {0x90, 0x00, 0x10, 0x75, 0x82, 0x20, 0x73};
+    memcpy(proc.C, overwritten, sizeof(overwritten));
+    proc.C[0x10] = proc.C[0x13] = 0x02;
+    proc.C[0x12] = proc.C[0x15] = 0x30;
+    mcs51_init(&proc);
+
+    success &= cfg_build(&cfg, &proc, NULL, 0);
+    success &= cfg.unresolved_count == 1 && cfg.unresolved[0] == 0x06;
+    cfg_free(&cfg);
+
+    return success;
+}
+
+TEST(test_wcet)
+{
+    bool success = true;
+
+    static mcs51_t proc;
+    static cfg_t cfg;
+    static wcet_t wcet;
+
+    /**
+     *     LJMP main
+     * .org 0x0B            ; Timer 0
+     *     PUSH ACC
+     *     LCALL delay
+     *     POP ACC
+     *     RETI
+     * .org 0x40
+     * main:
+     *     LCALL delay
+     *     SJMP $
+     * .org 0x60
+     * delay:
+     *     MOV R7, #10
+     *     DJNZ R7, $
+     *     RET
+     */
+    uint8_t program[0x70] = {0x02, 0x00, 0x40};
+    const uint8_t timer_0[] = {0xc0, 0xe0, 0x12, 0x00, 0x60, 0xd0, 0xe0, 0x32};
+    const uint8_t main[] = {0x12, 0x00, 0x60, 0x80, 0xfe};
+    const uint8_t delay[] = {0x7f, 0x0a, 0xdf, 0xfe, 0x22};
+    for (uint8_t vector = 0x03; vector <= 0x2B; vector += 8)
+        program[vector] = 0x32;
+    memcpy(&program[0x0B], timer_0, sizeof(timer_0));
+    memcpy(&program[0x40], main, sizeof(main));
+    memcpy(&program[0x60], delay, sizeof(delay));
+
+    memset(&proc, 0, sizeof(proc));
+    memcpy(proc.C, program, sizeof(program));
+    mcs51_init(&proc);
+    success &= cfg_build(&cfg, &proc, NULL, 0);
+
+    const int32_t reset = cfg_function_at(&cfg, 0x0000);
+    const int32_t isr = cfg_function_at(&cfg, 0x000B);
+    const int32_t function = cfg_function_at(&cfg, 0x0060);
+    success &= reset >= 0 && isr >= 0 && function >= 0;
+
+    // Without loop bounds
+    success &= wcet_analyze(&wcet, &cfg, &proc, NULL, 0);
+    success &= wcet.missing_bound_count == 2 && wcet.missing_bounds[0] == 0x43 && wcet.missing_bounds[1] == 0x62;
+    success &= wcet.functions[function].cycles == WCET_UNBOUNDED && wcet.functions[function].stack == 0;
+    wcet_free(&wcet);
+
+    // DJNZ R7, $ jumps back 9 times: MOV (1), 10 * DJNZ (2), RET (2)
+    const wcet_loop_bound_t bounds[] = {{.header = 0x62, .iterations = 9}};
+    success &= wcet_analyze(&wcet, &cfg, &proc, bounds, 1);
+    success &= wcet.missing_bound_count == 1 && wcet.missing_bounds[0] == 0x43;
+    success &= wcet.functions[function].cycles == 23 && wcet.functions[function].stack == 0;
+    success &= wcet.functions[reset].cycles == WCET_UNBOUNDED && wcet.functions[reset].stack == 2;
+
+    // Inserted call (2), PUSH (2), LCALL (2), delay, POP (2), RETI (2)
+    success &= wcet.functions[isr].cycles == 33 && wcet.functions[isr].stack == 3 && wcet.functions[isr].level == 0;
+
+    // All interrupts on level 0: Reset and the deepest interrupt (return address, PUSH, return address)
+    success &= wcet.levels == 4 && wcet.level_stack[0] == 5 && wcet.max_stack == 7;
+    wcet_free(&wcet);
+
+    // Timer 0 on level 1 preempts the other interrupts
+    proc.D[SFR_IP] = SFR_IP_T0_Msk;
+    success &= wcet_analyze(&wcet, &cfg, &proc, bounds, 1);
+    success &= wcet.functions[isr].level == 1 && wcet.level_stack[0] == 2 && wcet.level_stack[1] == 5 && wcet.max_stack == 9;
+
+    FILE* file = tmpfile();
+    wcet_write_json(&wcet, &cfg, &proc, file);
+    rewind(file);
+
+    char json[4096] = {};
+    size_t n = fread(json, 1, sizeof(json) - 1, file);
+    fclose(file);
+
+    success &= n > 0;
+    success &= strstr(json, "{\"entry\": \"0x0060\", \"kind\": \"function\", \"blocks\": 3, \"cycles\": 23, \"stack\": 0}") != NULL;
+    success &= strstr(json, "\"missing_loop_bounds\": [\"0x0043\"]") != NULL;
+    success &= strstr(json, "\"max_depth\": 9, \"initial_sp\": 7, \"max_sp\": 16, \"overflow\": false") != NULL;
+    wcet_free(&wcet);
+
+    cfg_free(&cfg);
+
+    return success;
+}
+
+static stack_overflow_t s_first_overflow;
+
+static void test_stack_on_overflow(mcs51_t* p, const stack_overflow_t* overflow)
+{
+    if (p->_stack.overflows == 1)
+        s_first_overflow = *overflow;
+}
+
+TEST(test_stack_guard)
+{
+    bool success = true;
+
+    static mcs51_t proc;
+
+    /**
+     *     MOV SP, #0xF0
+     *     LCALL recurse
+     * .org 0x10
+     * recurse:
+     *     PUSH ACC
+     *     ACALL recurse     ; 3 bytes per call, wraps past 0xFF
+     */
+    memset(&proc, 0, sizeof(proc));
+    const uint8_t recursion[] = {0x75, 0x81, 0xf0, 0x12, 0x00, 0x10};
+    const uint8_t recurse[] = {0xc0, 0xe0, 0x11, 0x10};
+    memcpy(proc.C, recursion, sizeof(recursion));
+    memcpy(&proc.C[0x10], recurse, sizeof(recurse));
+    mcs51_init(&proc);
+    proc._stack.on_overflow = &test_stack_on_overflow;
+    success &= proc._stack.floor == 0x08 && proc._stack.ceiling == 0xFF && proc._stack.high_water == 0x07;
+
+    msc51_run(&proc, 12 * 20);
+    success &= proc._stack.overflows == 0 && proc._stack.high_water == 0xFE;
+
+    // The low byte of the return address of the 5th ACALL wraps to 0x00
+    msc51_run(&proc, 12 * 8);
+    success &= proc._stack.overflows >= 1 && proc._stack.high_water == 0xFF;
+    success &= s_first_overflow.sp == 0x00 && s_first_overflow.chain_length == 6;
+    success &= s_first_overflow.chain[0] == 0x14 && s_first_overflow.chain[1] == 0x14 && s_first_overflow.chain[4] == 0x14;
+    success &= s_first_overflow.chain[5] == 0x06;
+
+    /**
+     *     PUSH ACC          ; SP 0x07 after reset, into register bank 1
+     *     SJMP $
+     */
+    memset(&proc, 0, sizeof(proc));
+    const uint8_t bank[] = {0xc0, 0xe0, 0x80, 0xfe};
+    memcpy(proc.C, bank, sizeof(bank));
+    mcs51_init_variant(&proc, MCS51_VARIANT_8051);
+    stack_set_guard(&proc, 0x30, 0x7F);
+
+    for (int i = 0; i < 4; i++)
+        msc51_do_machine_cycle(&proc);
+    success &= proc._stack.overflows == 1 && proc._stack.last_overflow.sp == 0x08 && proc._stack.last_overflow.chain[0] == 0x0002;
+    success &= proc._stack.high_water == 0x07;
+
+    // The 8051 has 128 bytes IDATA
+    memset(&proc, 0, sizeof(proc));
+    memcpy(proc.C, bank, sizeof(bank));
+    mcs51_init_variant(&proc, MCS51_VARIANT_8051);
+    proc.D[SFR_SP] = 0x7F;
+    success &= proc._stack.ceiling == 0x7F;
+
+    msc51_run(&proc, 12 * 4);
+    success &= proc._stack.overflows == 1 && proc._stack.last_overflow.sp == 0x80;
+
+    return success;
+}
+
+TEST(test_memory_profile)
+{
+    bool success = true;
+
+    static mcs51_t proc;
+    static memprofile_t memprofile;
+
+    /**
+     *     MOV DPTR, #0x1000
+     *     MOV R0, #0x40
+     * loop:
+     *     MOVX A, @DPTR
+     *     INC A
+     *     MOVX @DPTR, A
+     *     MOV @R0, A
+     *     INC 0x30
+     *     JNB TI, loop      ; 9 cycles per iteration
+     *     SJMP $
+     */
+    const uint8_t program[] = {0x90, 0x10, 0x00, 0x78, 0x40, 0xe0, 0x04, 0xf0, 0xf6, 0x05, 0x30, 0x30, 0x99, 0xf7, 0x80, 0xfe};
+    memset(&proc, 0, sizeof(proc));
+    memcpy(proc.C, program, sizeof(program));
+    mcs51_init(&proc);
+    memprofile_reset(&memprofile);
+
+    proc._memprofile = &memprofile;
+    proc._engine = MCS51_ENGINE_MEMORY;
+    msc51_run(&proc, 12 * (3 + 9 * 100));
+
+    success &= proc.X[0x1000] == 100 && proc.D[0x30] == 100;
+    success &= memprofile.xdata[0x1000].reads == 100 && memprofile.xdata[0x1000].writes == 100;
+    success &= memprofile.data[0x30].reads == 100 && memprofile.data[0x30].writes == 100;
+    success &= memprofile.data[0x30].pc == 0x09 && memprofile.data[0x30].pc_weight == 200;
+    success &= memprofile.data[0x40].reads == 0 && memprofile.data[0x40].writes == 100 && memprofile.data[0x40].pc == 0x08;
+    success &= memprofile.data[SFR_SCON].reads == 100 && memprofile.data[SFR_SCON].pc == 0x0B;
+    success &= memprofile.pc_accesses[0x09] == 200 && memprofile.pc_accesses[0x0B] == 100 && memprofile.pc_accesses[0x06] == 0;
+
+    // The other cores do not count
+    proc._engine = MCS51_ENGINE_PLAIN;
+    msc51_run(&proc, 12 * 9 * 10);
+    success &= proc.D[0x30] == 110 && memprofile.data[0x30].writes == 100;
+
+    FILE* file = tmpfile();
+    memprofile_print(&memprofile, &proc, file, 3);
+    memprofile_print_heatmap(&memprofile, file);
+    rewind(file);
+
+    char report[8192] = {};
+    size_t n = fread(report, 1, sizeof(report) - 1, file);
+    fclose(file);
+
+    success &= n > 0;
+    success &= strstr(report, "         100         100  D:0x30     0x0009 INC 0x30") != NULL;
+    success &= strstr(report, "         100           0  SCON       0x000B JNB 0x99, 0x0005") != NULL;
+    success &= strstr(report, "         100         100  X:0x1000 ") != NULL;
+    success &= strstr(report, "X:0x1000 |@               |") != NULL;
+
+    /**
+     *     LJMP main
+     * .ORG 000Bh
+     *     INC 0x31
+     *     RETI
+     * .ORG 0020h
+     * main:
+     *     MOV TMOD, #0x01
+     *     MOV TH0, #0xFF
+     *     SETB ET0
+     *     SETB EA
+     *     SETB TR0
+     *     SJMP $
+     */
+    memset(&proc, 0, sizeof(proc));
+    const uint8_t isr[] = {0x75, 0x89, 0x01, 0x75, 0x8c, 0xff, 0xd2, 0xa9, 0xd2, 0xaf, 0xd2, 0x8c, 0x80, 0xfe};
+    proc.C[0x00] = 0x02;
+    proc.C[0x01] = 0x00;
+    proc.C[0x02] = 0x20;
+    proc.C[0x0B] = 0x05;
+    proc.C[0x0C] = 0x31;
+    proc.C[0x0D] = 0x32;
+    memcpy(&proc.C[0x20], isr, sizeof(isr));
+    mcs51_init(&proc);
+    memprofile_reset(&memprofile);
+
+    proc._memprofile = &memprofile;
+    proc._engine = MCS51_ENGINE_MEMORY;
+    msc51_run(&proc, 12 * 1000);
+
+    // The return address pushed by the interrupt controller is attributed to the vector, RETI pops it
+    success &= proc.D[0x31] == 1;
+    success &= memprofile.data[0x08].writes == 1 && memprofile.data[0x08].reads == 1 && memprofile.data[0x08].pc == 0x0B;
+    success &= memprofile.data[0x09].writes == 1 && memprofile.data[0x09].reads == 1 && memprofile.data[0x09].pc == 0x0B;
+    success &= memprofile.pc_accesses[0x0B] == 4 && memprofile.pc_accesses[0x0D] == 2;
+
+    return success;
+}
+
 int main(int argc, char* argv[])
 {
     int code = 0;
@@ -417,12 +2222,39 @@ int main(int argc, char* argv[])
     RUN_TEST(test_accumulator);
     RUN_TEST(test_sfr_sbuf);
     RUN_TEST(test_indirect_addressing);
+    RUN_TEST(test_idata_stack);
     RUN_TEST(test_timer_0);
     RUN_TEST(test_timer_0_isr);
     RUN_TEST(test_sfr_addresses);
     RUN_TEST(test_sfr_names);
     RUN_TEST(test_isr_nesting);
     RUN_TEST(test_max_interrupt_latency);
+    RUN_TEST(test_vcd);
+    RUN_TEST(test_alu_flags);
+    RUN_TEST(test_lazy_psw);
+    RUN_TEST(test_acall);
+    RUN_TEST(test_register_banks);
+    RUN_TEST(test_watch);
+    RUN_TEST(test_engine_plain);
+    RUN_TEST(test_engine_profile_coverage);
+    RUN_TEST(test_profile_superinstructions);
+    RUN_TEST(test_hle);
+    RUN_TEST(test_semihost);
+    RUN_TEST(test_branch_coverage);
+    RUN_TEST(test_fuzz);
+    RUN_TEST(test_forkserver);
+    RUN_TEST(test_lockstep);
+    RUN_TEST(test_conformance);
+    RUN_TEST(test_power_modes);
+    RUN_TEST(test_scheduler);
+    RUN_TEST(test_watchdog);
+    RUN_TEST(test_variants);
+    RUN_TEST(test_clock_modes);
+    RUN_TEST(test_network);
+    RUN_TEST(test_control_flow_graph);
+    RUN_TEST(test_wcet);
+    RUN_TEST(test_stack_guard);
+    RUN_TEST(test_memory_profile);
 
     return code;
 }